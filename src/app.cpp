@@ -1,16 +1,23 @@
 #include <format>
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <expected>
 #include <filesystem>
 #include <iterator>
+#include <memory>
 #include <string>
 #include <string_view>
 #include <unordered_map>
 #include <utility>
 
 #include <nlohmann/json.hpp>
+#include <openssl/crypto.h>
 #include <spdlog/spdlog.h>
 #include <inja.hpp>
 #include <mw/http_server.hpp>
@@ -23,48 +30,63 @@
 #include "app.hpp"
 #include "config.hpp"
 #include "data.hpp"
+#include "link_io.hpp"
+#include "metrics.hpp"
+#include "worker_pool.hpp"
 #include "mw/error.hpp"
 
 namespace
 {
 
-std::unordered_map<std::string, std::string> parseCookies(std::string_view value)
-{
-    std::unordered_map<std::string, std::string> cookies;
-    size_t begin = 0;
-    while(true)
-    {
-        if(begin >= value.size())
-        {
-            break;
-        }
-
-        size_t semicolon = value.find(';', begin);
-        if(semicolon == std::string::npos)
-        {
-            semicolon = value.size();
-        }
+// The pages rendered from templates. Templates they include are
+// parsed along with them.
+constexpr const char* TEMPLATE_PAGES[] = {
+    "links.html", "links-head.html", "links-rows.html", "links-tail.html",
+    "new-link.html", "delete-link.html"};
 
-        std::string_view section = value.substr(begin, semicolon - begin);
+struct RouteSpec
+{
+    App::Route route;
+    // Name of the route in templates and in metrics.
+    std::string_view name;
+    // Path relative to the base URL.
+    std::string_view path;
+    bool takes_arg;
+};
 
-        begin = semicolon + 1;
-        // Skip spaces
-        while(begin < value.size() && value[begin] == ' ')
-        {
-            begin++;
-        }
+// Indexed by App::Route.
+constexpr std::array<RouteSpec, App::ROUTE_COUNT> ROUTES = {{
+    {App::STATICS, "statics", "_/statics", true},
+    {App::INDEX, "index", "", false},
+    {App::SHORTCUT, "shortcut", "", true},
+    {App::LINKS, "links", "_/links", false},
+    {App::METRICS, "metrics", "_/metrics", false},
+    {App::LOGIN, "login", "_/login", false},
+    {App::OPENID_REDIRECT, "openid-redirect", "_/openid-redirect", false},
+    {App::NEW_LINK, "new-link", "_/new-link", false},
+    {App::CREATE_LINK, "create-link", "_/create-link", false},
+    {App::DELETE_LINK_DIALOG, "delete-link-dialog", "_/delete-link", true},
+    {App::DELETE_LINK, "delete-link", "_/delete-link", false},
+    {App::EXPORT_LINKS, "export-links", "_/export", false},
+    {App::IMPORT_LINKS, "import-links", "_/import", false},
+    {App::API_LINKS, "api-links", "_/api/links", false},
+    {App::REPLICATION_CHANGES, "replication-changes", "_/replication/changes",
+     false},
+    {App::ADMIN_HOT_LINKS, "admin-hot-links", "_/admin/hot-links", false},
+}};
 
-        size_t equal = section.find('=');
-        if(equal == std::string::npos) continue;
-        cookies.emplace(section.substr(0, equal),
-                        section.substr(equal+1, semicolon - equal - 1));
-        if(semicolon >= value.size())
+constexpr bool routesAreInOrder()
+{
+    for(size_t i = 0; i < ROUTES.size(); i++)
+    {
+        if(ROUTES[i].route != static_cast<App::Route>(i))
         {
-            continue;
+            return false;
         }
     }
-    return cookies;
+    return true;
 }
+static_assert(routesAreInOrder());
 
 void setTokenCookies(const mw::Tokens& tokens, App::Response& res)
 {
@@ -95,31 +117,94 @@ void setTokenCookies(const mw::Tokens& tokens, App::Response& res)
     }
 }
 
-nlohmann::json link2JSON(const ShortLink& link)
+// A page of links larger than this is rendered and sent in batches of
+// this size, so that the whole page is never in memory at once.
+constexpr int64_t LINKS_STREAM_BATCH = 500;
+constexpr int64_t LINKS_PAGE_SIZE_MAX = 100000;
+// Links are exported in pages of this size.
+constexpr int64_t LINKS_EXPORT_BATCH = 1000;
+
+// Maximum number of links created or deleted by one API request.
+constexpr size_t API_BATCH_MAX = 10000;
+// Maximum number of changes sent to a follower at a time.
+constexpr int64_t REPLICATION_BATCH_MAX = 10000;
+
+// Read the “format” parameter of import and export. The default is
+// NDJSON.
+mw::E<LinkFormat::Type> linkFormatFromRequest(
+    const mw::HTTPServer::Request& req)
 {
-    std::string type_is_regexp;
-    switch(link.type)
+    if(!req.has_param("format"))
     {
-    case ShortLink::NORMAL:
-        type_is_regexp = "-";
-        break;
-    case ShortLink::REGEXP:
-        type_is_regexp = "✅";
-        break;
+        return LinkFormat::NDJSON;
+    }
+    std::optional<LinkFormat::Type> format =
+        LinkFormat::fromStr(req.get_param_value("format"));
+    if(!format.has_value())
+    {
+        return std::unexpected(mw::httpError(400, "Invalid format"));
     }
+    return *format;
+}
 
-    return {{"shortcut", link.shortcut},
-            {"original_url", link.original_url},
-            {"id", link.id},
-            {"id_str", std::to_string(link.id)},
-            {"type", link.type},
-            {"type_is_regexp_str", type_is_regexp},
-            {"visits", link.visits},
-            {"time", mw::timeToSeconds(link.time_creation)},
-            {"time_str", mw::timeToStr(link.time_creation)},
-            {"time_iso8601", mw::timeToISO8601(link.time_creation)}};
+// Read the “after”, “limit” and “order” parameters of the link list.
+mw::E<LinkPageQuery> linkPageQueryFromRequest(
+    const mw::HTTPServer::Request& req, int64_t default_limit)
+{
+    LinkPageQuery query;
+    query.limit = std::clamp<int64_t>(default_limit, 1, LINKS_PAGE_SIZE_MAX);
+    if(req.has_param("after"))
+    {
+        mw::E<int64_t> after =
+            mw::strToNumber<int64_t>(req.get_param_value("after"));
+        if(!after.has_value())
+        {
+            return std::unexpected(mw::httpError(400, "Invalid page start"));
+        }
+        query.after_id = *after;
+    }
+    if(req.has_param("limit"))
+    {
+        mw::E<int64_t> limit =
+            mw::strToNumber<int64_t>(req.get_param_value("limit"));
+        if(!limit.has_value() || *limit < 1 || *limit > LINKS_PAGE_SIZE_MAX)
+        {
+            return std::unexpected(mw::httpError(400, "Invalid page size"));
+        }
+        query.limit = *limit;
+    }
+    if(req.has_param("order"))
+    {
+        std::string order = req.get_param_value("order");
+        if(order == "asc")
+        {
+            query.order = LinkPageQuery::ASCENDING;
+        }
+        else if(order == "desc")
+        {
+            query.order = LinkPageQuery::DESCENDING;
+        }
+        else
+        {
+            return std::unexpected(mw::httpError(400, "Invalid order"));
+        }
+    }
+    return query;
 }
 
+// State of a link list that is sent in batches.
+struct LinkStream
+{
+    enum { HEAD, ROWS, TAIL } stage = HEAD;
+    std::string user_id;
+    // The page being sent. Its “after_id” moves forward with every
+    // batch.
+    LinkPageQuery query;
+    // Number of links left to send in this page.
+    int64_t remaining;
+    nlohmann::json render_data;
+};
+
 bool validateShortcut([[maybe_unused]] std::string_view shortcut)
 {
     // This needs a unicode library to really work. For now I’ll just
@@ -144,26 +229,276 @@ mw::HTTPServer::ListenAddress listenAddrFromConfig(const Configuration& config)
     return sock;
 }
 
+std::string cacheControlFor(int64_t max_age_sec)
+{
+    if(max_age_sec <= 0)
+    {
+        return "no-cache";
+    }
+    return std::format("public, max-age={}", max_age_sec);
+}
+
+// The entity tag of a redirect to “url”. A link never changes where
+// it points to, so this is the same on all nodes and replicas, and
+// only depends on the URL. This is the 64-bit FNV-1a hash of it.
+void appendRedirectETag(std::string& out, std::string_view url)
+{
+    uint64_t h = 14695981039346656037ull;
+    for(char c: url)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    std::format_to(std::back_inserter(out), "\"{:016x}\"", h);
+}
+
+// Whether the If-None-Match header “value” matches “etag”. This is a
+// weak comparison, as required for If-None-Match.
+bool etagMatches(std::string_view value, std::string_view etag)
+{
+    while(!value.empty())
+    {
+        size_t comma = value.find(',');
+        std::string_view tag = value.substr(0, comma);
+        value = comma == std::string_view::npos ?
+            std::string_view() : value.substr(comma + 1);
+        while(!tag.empty() && (tag.front() == ' ' || tag.front() == '\t'))
+        {
+            tag.remove_prefix(1);
+        }
+        while(!tag.empty() && (tag.back() == ' ' || tag.back() == '\t'))
+        {
+            tag.remove_suffix(1);
+        }
+        if(tag.starts_with("W/"))
+        {
+            tag.remove_prefix(2);
+        }
+        if(tag == "*" || tag == etag)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether the Authorization header “value” carries the bearer token
+// “token”. This takes the same time wherever the two differ, so that
+// the token cannot be guessed byte by byte from the response times.
+// An empty “token” is never matched.
+bool bearerTokenMatches(std::string_view value, std::string_view token)
+{
+    constexpr std::string_view prefix = "Bearer ";
+    if(token.empty() || !value.starts_with(prefix))
+    {
+        return false;
+    }
+    value.remove_prefix(prefix.size());
+    return value.size() == token.size() &&
+        CRYPTO_memcmp(value.data(), token.data(), token.size()) == 0;
+}
+
 } // namespace
 
+std::unordered_map<std::string, std::string> parseCookies(std::string_view value)
+{
+    std::unordered_map<std::string, std::string> cookies;
+    size_t begin = 0;
+    while(true)
+    {
+        if(begin >= value.size())
+        {
+            break;
+        }
+
+        size_t semicolon = value.find(';', begin);
+        if(semicolon == std::string::npos)
+        {
+            semicolon = value.size();
+        }
+
+        std::string_view section = value.substr(begin, semicolon - begin);
+
+        begin = semicolon + 1;
+        // Skip spaces
+        while(begin < value.size() && value[begin] == ' ')
+        {
+            begin++;
+        }
+
+        size_t equal = section.find('=');
+        if(equal == std::string::npos) continue;
+        cookies.emplace(section.substr(0, equal),
+                        section.substr(equal+1, semicolon - equal - 1));
+        if(semicolon >= value.size())
+        {
+            continue;
+        }
+    }
+    return cookies;
+}
+
+nlohmann::json link2JSON(const ShortLink& link)
+{
+    std::string type_is_regexp;
+    switch(link.type)
+    {
+    case ShortLink::NORMAL:
+        type_is_regexp = "-";
+        break;
+    case ShortLink::REGEXP:
+        type_is_regexp = "✅";
+        break;
+    }
+
+    return {{"shortcut", link.shortcut},
+            {"original_url", link.original_url},
+            {"id", link.id},
+            {"id_str", std::to_string(link.id)},
+            {"type", link.type},
+            {"type_is_regexp_str", type_is_regexp},
+            {"visits", link.visits},
+            {"time", mw::timeToSeconds(link.time_creation)},
+            {"time_str", mw::timeToStr(link.time_creation)},
+            {"time_iso8601", mw::timeToISO8601(link.time_creation)}};
+}
+
+mw::E<std::string> shortcutFromURL(const std::string& url)
+{
+    ASSIGN_OR_RETURN(auto hash, mw::SHA256Hasher().hashToBytes(url));
+    hash.resize(8);
+    return mw::base64Encode(hash);
+}
+
 App::App(const Configuration& conf,
          std::unique_ptr<DataSourceInterface> data_source,
-         std::unique_ptr<mw::AuthInterface> openid_auth)
+         std::unique_ptr<mw::AuthInterface> openid_auth,
+         std::unique_ptr<JWTVerifierInterface> jwt,
+         Metrics* metrics_registry,
+         std::unique_ptr<Cluster> cluster_nodes)
         : mw::HTTPServer(listenAddrFromConfig(conf)),
           config(conf),
-          templates((std::filesystem::path(config.data_dir) / "templates" / "")
-                    .string()),
+          metrics(metrics_registry),
           data(std::move(data_source)),
-          auth(std::move(openid_auth))
+          auth(std::move(openid_auth)),
+          sessions(std::make_unique<SessionCache>(
+              conf.session_cache_size,
+              std::chrono::seconds(conf.session_cache_ttl_sec))),
+          jwt_verifier(std::move(jwt)),
+          visits(std::make_unique<VisitCounter>(
+              *data, std::chrono::milliseconds(conf.visit_flush_interval_ms),
+              conf.visit_flush_threshold)),
+          cluster(std::move(cluster_nodes))
 {
+    redirect_cache_control = cacheControlFor(config.redirect_max_age_sec);
+    if(metrics == nullptr)
+    {
+        own_metrics = std::make_unique<Metrics>();
+        metrics = own_metrics.get();
+    }
+    jwt_verify_time = metrics->histogram(
+        "shrt_auth_seconds", "Duration of authentication steps",
+        "step=\"jwt_verify\"");
+    get_user_time = metrics->histogram(
+        "shrt_auth_seconds", "Duration of authentication steps",
+        "step=\"get_user\"");
+    refresh_tokens_time = metrics->histogram(
+        "shrt_auth_seconds", "Duration of authentication steps",
+        "step=\"refresh_tokens\"");
+    cluster_redirects = metrics->counter(
+        "shrt_cluster_lookups_total",
+        "Lookups of shortcuts owned by other nodes", "result=\"redirect\"");
+    cluster_forwards = metrics->counter(
+        "shrt_cluster_lookups_total",
+        "Lookups of shortcuts owned by other nodes", "result=\"forward\"");
+    cluster_forward_errors = metrics->counter(
+        "shrt_cluster_lookups_total",
+        "Lookups of shortcuts owned by other nodes", "result=\"error\"");
+    for(const char* page: TEMPLATE_PAGES)
+    {
+        render_times.emplace(page, metrics->histogram(
+            "shrt_render_seconds", "Duration of rendering templates",
+            std::format("page=\"{}\"", page)));
+    }
+    const std::string labels = "cache=\"sessions\"";
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::COUNTER, "shrt_cache_hits_total", "Hits of in-memory caches",
+        labels, [this] { return static_cast<double>(sessions->stats().hits); }));
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::COUNTER, "shrt_cache_misses_total",
+        "Misses of in-memory caches", labels,
+        [this] { return static_cast<double>(sessions->stats().misses); }));
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::GAUGE, "shrt_cache_hit_ratio",
+        "Ratio of hits over all lookups of in-memory caches", labels, [this]
+        {
+            SessionCache::Stats stats = sessions->stats();
+            uint64_t total = stats.hits + stats.misses;
+            return total == 0 ? 0.0 : static_cast<double>(stats.hits) /
+                static_cast<double>(total);
+        }));
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::GAUGE, "shrt_cache_entries",
+        "Number of entries in in-memory caches", labels,
+        [this] { return static_cast<double>(sessions->stats().size); }));
+
     auto u = mw::URL::fromStr(conf.base_url);
     if(u.has_value())
     {
         base_url = *std::move(u);
     }
+    for(const RouteSpec& spec: ROUTES)
+    {
+        std::string& prefix = route_prefixes[spec.route];
+        prefix = spec.path.empty() ? base_url.str() :
+            mw::URL(base_url).appendPath(spec.path).str();
+        if(spec.takes_arg && !prefix.ends_with('/'))
+        {
+            prefix += '/';
+        }
+    }
+
+    if(mw::E<void> result = reloadTemplates(); !result.has_value())
+    {
+        spdlog::error("Failed to load templates: {}",
+                      mw::errorMsg(result.error()));
+    }
+
+    if(config.hot_links_size > 0)
+    {
+        DataSourceHotLinks::Options options;
+        options.capacity = config.hot_links_size;
+        options.threshold = config.hot_links_threshold;
+        options.interval =
+            std::chrono::milliseconds(config.hot_links_interval_ms);
+        options.metrics = metrics;
+        auto pinned = std::make_unique<DataSourceHotLinks>(std::move(data),
+                                                           options);
+        hot_links = pinned.get();
+        data = std::move(pinned);
+    }
+
+    if(!config.replication_primary.empty())
+    {
+        ReplicationFollower::Options options;
+        options.primary_url = config.replication_primary;
+        options.token = config.replication_token;
+        options.poll_interval =
+            std::chrono::milliseconds(config.replication_poll_interval_ms);
+        options.batch_size = config.replication_batch_size;
+        options.state_file = config.replication_state_file;
+        options.metrics = metrics;
+        follower = std::make_unique<ReplicationFollower>(
+            *data, options, std::make_unique<mw::HTTPSession>());
+    }
+}
 
-    templates.add_callback("url_for", [&](const inja::Arguments& args) ->
-                           std::string
+mw::E<std::shared_ptr<App::Templates>> App::loadTemplates() const
+{
+    auto result = std::make_shared<Templates>(
+        (std::filesystem::path(config.data_dir) / "templates" / "").string());
+    result->env.add_callback("url_for", [this](const inja::Arguments& args) ->
+                             std::string
     {
         switch(args.size())
         {
@@ -176,58 +511,125 @@ App::App(const Configuration& conf,
             return "Invalid number of url_for() arguments";
         }
     });
-}
 
-std::string App::urlFor(const std::string& name, const std::string& arg) const
-{
-    if(name == "statics")
+    for(const char* page: TEMPLATE_PAGES)
     {
-        return mw::URL(base_url).appendPath("_/statics").appendPath(arg).str();
+        try
+        {
+            result->pages.emplace(page, result->env.parse_template(page));
+        }
+        catch(const inja::InjaError& e)
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Failed to parse template {}: {}", page, e.what())));
+        }
     }
-    if(name == "index")
+    return result;
+}
+
+mw::E<void> App::reloadTemplates()
+{
+    ASSIGN_OR_RETURN(std::shared_ptr<Templates> loaded, loadTemplates());
+    std::lock_guard<std::mutex> guard(templates_lock);
+    templates = std::move(loaded);
+    return {};
+}
+
+mw::E<std::string> App::renderPage(const std::string& name,
+                                   const nlohmann::json& data) const
+{
+    std::shared_ptr<Templates> current;
     {
-        return base_url.str();
+        std::lock_guard<std::mutex> guard(templates_lock);
+        current = templates;
     }
-    if(name == "shortcut")
+    if(current == nullptr)
     {
-        return mw::URL(base_url).appendPath(arg).str();
+        return std::unexpected(mw::runtimeError("Templates are not loaded"));
     }
-    if(name == "links")
+    auto page = current->pages.find(name);
+    if(page == current->pages.end())
     {
-        return mw::URL(base_url).appendPath("_/links").str();
+        return std::unexpected(mw::runtimeError(
+            std::format("Unknown template {}", name)));
     }
-    if(name == "login")
+
+    auto begin = std::chrono::steady_clock::now();
+    std::string result;
+    try
     {
-        return mw::URL(base_url).appendPath("_/login").str();
+        result = current->env.render(page->second, data);
     }
-    if(name == "openid-redirect")
+    catch(const inja::InjaError& e)
     {
-        return mw::URL(base_url).appendPath("_/openid-redirect").str();
+        spdlog::error("Failed to render page: {}", e.what());
+        return std::unexpected(mw::runtimeError("Failed to render page"));
     }
-    if(name == "new-link")
+    auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin);
+    if(auto h = render_times.find(name); h != render_times.end())
     {
-        return mw::URL(base_url).appendPath("_/new-link").str();
+        metrics->observe(h->second, duration);
     }
-    if(name == "create-link")
+    uint64_t ns = duration.count();
+    render_count++;
+    render_total_ns += ns;
+    uint64_t max = render_max_ns;
+    while(ns > max && !render_max_ns.compare_exchange_weak(max, ns));
+    return result;
+}
+
+App::RenderStats App::renderStats() const
+{
+    return {render_count, std::chrono::nanoseconds(render_total_ns),
+            std::chrono::nanoseconds(render_max_ns)};
+}
+
+std::string App::urlFor(Route route, std::string_view arg) const
+{
+    std::string url;
+    appendURL(url, route, arg);
+    return url;
+}
+
+void App::appendURL(std::string& out, Route route, std::string_view arg) const
+{
+    const std::string& prefix = route_prefixes[route];
+    if(!ROUTES[route].takes_arg)
     {
-        return mw::URL(base_url).appendPath("_/create-link").str();
+        out += prefix;
+        return;
     }
-    if(name == "delete-link-dialog")
+    out.reserve(out.size() + prefix.size() + arg.size());
+    out += prefix;
+    out += arg;
+}
+
+std::string App::urlFor(std::string_view name, std::string_view arg) const
+{
+    std::optional<Route> route = routeFromName(name);
+    if(!route.has_value())
     {
-        return mw::URL(base_url).appendPath("_/delete-link").appendPath(arg)
-            .str();
+        return "";
     }
-    if(name == "delete-link")
+    return urlFor(*route, arg);
+}
+
+std::optional<App::Route> App::routeFromName(std::string_view name)
+{
+    for(const RouteSpec& spec: ROUTES)
     {
-        return mw::URL(base_url).appendPath("_/delete-link").str();
+        if(spec.name == name)
+        {
+            return spec.route;
+        }
     }
-
-    return "";
+    return std::nullopt;
 }
 
 void App::handleIndex(Response& res) const
 {
-    res.set_redirect(urlFor("links"), 301);
+    res.set_redirect(urlFor(LINKS), 301);
 }
 
 void App::handleLinks(const Request& req, Response& res)
@@ -235,51 +637,141 @@ void App::handleLinks(const Request& req, Response& res)
     auto session = prepareSession(req, res, true);
     if(session->status == SessionValidation::INVALID)
     {
-        res.set_redirect(urlFor("login"));
+        res.set_redirect(urlFor(LOGIN));
         return;
     }
 
-    nlohmann::json render_data = {{"session_user", ""},
+    ASSIGN_OR_RESPOND_ERROR(
+        LinkPageQuery query,
+        linkPageQueryFromRequest(req, config.links_page_size), res);
+    nlohmann::json render_data = {{"session_user", session->user.name},
                                   {"title", "Links"},
-                                  {"links", nlohmann::json::array_t()}};
-    ASSIGN_OR_RESPOND_ERROR(std::vector<ShortLink> links,
-                            data->getAllLinks(session->user.id), res);
-    render_data["session_user"] = session->user.name;
-    for(const ShortLink& link: links)
+                                  {"links", nlohmann::json::array_t()},
+                                  {"has_next", false},
+                                  {"next_url", ""}};
+    if(query.limit > LINKS_STREAM_BATCH)
     {
-        render_data["links"].push_back(link2JSON(link));
+        streamLinks(session->user.id, query, std::move(render_data), res);
+        return;
     }
 
-    try
+    ASSIGN_OR_RESPOND_ERROR(std::vector<ShortLink> links,
+                            data->getLinks(session->user.id, query), res);
+    for(const ShortLink& link: links)
     {
-        std::string result = templates.render_file(
-            "links.html", std::move(render_data));
-        res.status = 200;
-        res.set_content(result, "text/html");
+        render_data["links"].push_back(link2JSON(link));
     }
-    catch(const inja::InjaError& e)
+    if(std::ssize(links) == query.limit)
     {
-        spdlog::error("Failed to render page: {}", e.what());
-        res.status = 500;
+        query.after_id = links.back().id;
+        render_data["has_next"] = true;
+        render_data["next_url"] = nextLinksPageURL(query);
     }
-}
 
-void App::handleLogin(Response& res) const
-{
-    res.set_redirect(auth->initialURL(), 301);
+    ASSIGN_OR_RESPOND_ERROR(std::string result,
+                            renderPage("links.html", render_data), res);
+    res.status = 200;
+    res.set_content(result, "text/html");
 }
 
-void App::handleOpenIDRedirect(const Request& req, Response& res) const
+void App::streamLinks(const std::string& user_id, const LinkPageQuery& query,
+                      nlohmann::json&& render_data, Response& res) const
 {
-    if(req.has_param("error"))
+    auto stream = std::make_shared<LinkStream>();
+    stream->user_id = user_id;
+    stream->query = query;
+    stream->remaining = query.limit;
+    stream->render_data = std::move(render_data);
+
+    auto write = [this](httplib::DataSink& sink, const std::string& page,
+                        const nlohmann::json& page_data)
     {
-        res.status = 500;
-        if(req.has_param("error_description"))
+        mw::E<std::string> result = renderPage(page, page_data);
+        return result.has_value() && sink.write(result->data(),
+                                                result->size());
+    };
+
+    res.status = 200;
+    res.set_chunked_content_provider(
+        "text/html", [this, stream, write](size_t, httplib::DataSink& sink)
+    {
+        switch(stream->stage)
         {
-            res.set_content(
-                std::format("{}: {}.", req.get_param_value("error"),
-                            req.get_param_value("error_description")),
-                "text/plain");
+        case LinkStream::HEAD:
+            stream->stage = LinkStream::ROWS;
+            return write(sink, "links-head.html", stream->render_data);
+        case LinkStream::ROWS:
+        {
+            LinkPageQuery batch = stream->query;
+            batch.limit = std::min(stream->remaining, LINKS_STREAM_BATCH);
+            mw::E<std::vector<ShortLink>> links =
+                data->getLinks(stream->user_id, batch);
+            if(!links.has_value())
+            {
+                spdlog::error("Failed to get links: {}",
+                              mw::errorMsg(links.error()));
+                return false;
+            }
+            nlohmann::json rows = {{"links", nlohmann::json::array_t()}};
+            for(const ShortLink& link: *links)
+            {
+                rows["links"].push_back(link2JSON(link));
+            }
+            stream->remaining -= std::ssize(*links);
+            if(!links->empty())
+            {
+                stream->query.after_id = links->back().id;
+            }
+            if(std::ssize(*links) < batch.limit || stream->remaining == 0)
+            {
+                stream->stage = LinkStream::TAIL;
+                if(stream->remaining == 0)
+                {
+                    stream->render_data["has_next"] = true;
+                    stream->render_data["next_url"] =
+                        nextLinksPageURL(stream->query);
+                }
+            }
+            return write(sink, "links-rows.html", rows);
+        }
+        case LinkStream::TAIL:
+            if(!write(sink, "links-tail.html", stream->render_data))
+            {
+                return false;
+            }
+            sink.done();
+            return true;
+        }
+        return false;
+    });
+}
+
+std::string App::nextLinksPageURL(const LinkPageQuery& query) const
+{
+    std::string url;
+    appendURL(url, LINKS);
+    std::format_to(std::back_inserter(url), "?after={}&limit={}&order={}",
+                   query.after_id.value_or(0), query.limit,
+                   query.order == LinkPageQuery::ASCENDING ? "asc" : "desc");
+    return url;
+}
+
+void App::handleLogin(Response& res) const
+{
+    res.set_redirect(auth->initialURL(), 301);
+}
+
+void App::handleOpenIDRedirect(const Request& req, Response& res) const
+{
+    if(req.has_param("error"))
+    {
+        res.status = 500;
+        if(req.has_param("error_description"))
+        {
+            res.set_content(
+                std::format("{}: {}.", req.get_param_value("error"),
+                            req.get_param_value("error_description")),
+                "text/plain");
         }
         return;
     }
@@ -296,7 +788,7 @@ void App::handleOpenIDRedirect(const Request& req, Response& res) const
     ASSIGN_OR_RESPOND_ERROR(mw::UserInfo user, auth->getUser(tokens), res);
 
     setTokenCookies(tokens, res);
-    res.set_redirect(urlFor("index"), 301);
+    res.set_redirect(urlFor(INDEX), 301);
 }
 
 void App::handleNewLink(const Request& req, Response& res)
@@ -309,22 +801,15 @@ void App::handleNewLink(const Request& req, Response& res)
 
     nlohmann::json render_data = {{"session_user", session->user.name},
                                   {"title", "Create New Link"}};
-    try
-    {
-        std::string result = templates.render_file(
-            "new-link.html", std::move(render_data));
-        res.status = 200;
-        res.set_content(result, "text/html");
-    }
-    catch(const inja::InjaError& e)
-    {
-        spdlog::error("Failed to render page: {}", e.what());
-        res.status = 500;
-    }
+    ASSIGN_OR_RESPOND_ERROR(std::string result, renderPage("new-link.html", render_data),
+                            res);
+    res.status = 200;
+    res.set_content(result, "text/html");
 }
 
 void App::handleCreateLink(const Request& req, Response& res) const
 {
+    if(refuseWriteOnReplica(res)) return;
     auto session = prepareSession(req, res);
     if(!session.has_value()) return;
 
@@ -370,13 +855,14 @@ void App::handleCreateLink(const Request& req, Response& res) const
                             "text/plain");
             return;
         }
-        // Generate a shortcut by taking the first 8 bytes of the
-        // SHA256 hash of the original URL, and base64-encode.
         ASSIGN_OR_RESPOND_ERROR(
-            auto hash, mw::SHA256Hasher().hashToBytes(link.original_url), res);
-
-        hash.resize(8);
-        link.shortcut = mw::base64Encode(hash);
+            link.shortcut, shortcutFromURL(link.original_url), res);
+    }
+    if(mw::E<void> owned = checkLinkOwner(link); !owned.has_value())
+    {
+        res.status = 421;
+        res.set_content(mw::errorMsg(owned.error()), "text/plain");
+        return;
     }
     link.user_id = session->user.id;
     mw::E<void> result = data->addLink(std::move(link));
@@ -386,7 +872,7 @@ void App::handleCreateLink(const Request& req, Response& res) const
         res.set_content(mw::errorMsg(result.error()), "text/plain");
         return;
     }
-    res.set_redirect(urlFor("index"));
+    res.set_redirect(urlFor(INDEX));
 }
 
 void App::handleDeleteLinkDialog(const Request& req, Response& res)
@@ -413,22 +899,15 @@ void App::handleDeleteLinkDialog(const Request& req, Response& res)
                            {"link", {{"shortcut", link->shortcut},
                                      {"original_url", link->original_url},
                                      {"id_str", std::to_string(link->id)}}}};
-    try
-    {
-        std::string result = templates.render_file(
-            "delete-link.html", std::move(data));
-        res.status = 200;
-        res.set_content(result, "text/html");
-    }
-    catch(const inja::InjaError& e)
-    {
-        spdlog::error("Failed to render page: {}", e.what());
-        res.status = 500;
-    }
+    ASSIGN_OR_RESPOND_ERROR(std::string result, renderPage("delete-link.html", data),
+                            res);
+    res.status = 200;
+    res.set_content(result, "text/html");
 }
 
 void App::handleDeleteLink(const Request& req, Response& res) const
 {
+    if(refuseWriteOnReplica(res)) return;
     auto session = prepareSession(req, res);
     if(!session.has_value()) return;
 
@@ -461,38 +940,650 @@ void App::handleDeleteLink(const Request& req, Response& res) const
         res.set_content(mw::errorMsg(result.error()), "text/plain");
         return;
     }
-    res.set_redirect(urlFor("index"));
+    res.set_redirect(urlFor(INDEX));
 }
 
 void App::handleShortcut(const Request& req, Response& res) const
 {
-    std::string shortcut = req.path_params.at("shortcut");
+    const std::string& shortcut = req.path_params.at("shortcut");
     if(shortcut.empty())
     {
         res.status = 500;
         res.set_content("This shouldn't happen!", "text/plain");
         return;
     }
+    // A request forwarded by another node is always resolved here,
+    // even if this node does not think it owns the shortcut.
+    if(cluster != nullptr && !req.has_header(Cluster::FORWARDED_HEADER))
+    {
+        if(std::optional<size_t> peer = cluster->peerOf(shortcut);
+           peer.has_value())
+        {
+            handlePeerShortcut(req, *peer, shortcut, res);
+            return;
+        }
+    }
+
+    // Reused by all redirects on this thread, so that looking up the
+    // URL does not allocate once the buffer is large enough.
+    thread_local std::string url;
+    ASSIGN_OR_RESPOND_ERROR(std::optional<ResolvedLink> resolved,
+                            data->resolveShortcut(shortcut, url), res);
+    if(resolved.has_value())
+    {
+        visits->record(resolved->id);
+        respondRedirect(req, url, resolved->cache_max_age, res);
+        return;
+    }
 
+    // Fall back to regexp links. The data source has the capture
+    // groups already substituted into the URL.
     ASSIGN_OR_RESPOND_ERROR(std::optional<ShortLink> link,
-                            data->findLinkByShortcut(shortcut), res);
+                            data->findLinkFromRegexpLinks(shortcut), res);
     if(!link.has_value())
     {
         res.status = 404;
         return;
     }
-    res.set_redirect(link->original_url, 308);
+    visits->record(link->id);
+    respondRedirect(req, link->original_url, link->cache_max_age, res);
+}
+
+void App::respondRedirect(const Request& req, const std::string& url,
+                          std::optional<int64_t> cache_max_age,
+                          Response& res) const
+{
+    thread_local std::string etag;
+    etag.clear();
+    appendRedirectETag(etag, url);
+    res.set_header("ETag", etag);
+    if(cache_max_age.has_value())
+    {
+        res.set_header("Cache-Control", cacheControlFor(*cache_max_age));
+    }
+    else
+    {
+        res.set_header("Cache-Control", redirect_cache_control);
+    }
+    if(req.has_header("If-None-Match") &&
+       etagMatches(req.get_header_value("If-None-Match"), etag))
+    {
+        res.status = 304;
+        return;
+    }
+    res.set_redirect(url, 308);
+}
+
+void App::handlePeerShortcut(const Request& req, size_t peer,
+                             std::string_view shortcut, Response& res) const
+{
+    if(cluster->mode() == Cluster::REDIRECT)
+    {
+        // Temporary, because the owner changes when nodes are added
+        // or removed.
+        metrics->increment(cluster_redirects);
+        res.set_redirect(cluster->urlOn(peer, shortcut), 307);
+        return;
+    }
+
+    mw::E<Cluster::Answer> answer = cluster->forward(peer, shortcut);
+    if(!answer.has_value())
+    {
+        metrics->increment(cluster_forward_errors);
+        spdlog::warn("Failed to forward shortcut {}: {}", shortcut,
+                     mw::errorMsg(answer.error()));
+        res.status = 502;
+        res.set_content(mw::errorMsg(answer.error()), "text/plain");
+        return;
+    }
+    metrics->increment(cluster_forwards);
+    if(!answer->location.empty())
+    {
+        // The owner is not asked conditionally, so that its answer
+        // can be checked against whatever the client has.
+        if(!answer->cache_control.empty())
+        {
+            res.set_header("Cache-Control", answer->cache_control);
+        }
+        if(!answer->etag.empty())
+        {
+            res.set_header("ETag", answer->etag);
+            if(req.has_header("If-None-Match") &&
+               etagMatches(req.get_header_value("If-None-Match"),
+                           answer->etag))
+            {
+                res.status = 304;
+                return;
+            }
+        }
+        res.set_redirect(answer->location, answer->status);
+        return;
+    }
+    res.status = answer->status;
+}
+
+bool App::refuseWriteOnReplica(Response& res) const
+{
+    if(follower == nullptr)
+    {
+        return false;
+    }
+    res.status = 403;
+    res.set_content(std::format("This is a read-only replica. Links are "
+                                "changed at {}.", config.replication_primary),
+                    "text/plain");
+    return true;
 }
 
-std::string App::getPath(const std::string& name,
-                         const std::string& arg_name) const
+mw::E<void> App::checkLinkOwner(const ShortLink& link) const
 {
-    return mw::URL::fromStr(urlFor(name, std::string(":") + arg_name)).value()
+    // Regexp links may match shortcuts of any node, so they are kept
+    // where they are created.
+    if(cluster == nullptr || link.type == ShortLink::REGEXP)
+    {
+        return {};
+    }
+    if(std::optional<size_t> peer = cluster->peerOf(link.shortcut);
+       peer.has_value())
+    {
+        return std::unexpected(mw::httpError(421, std::format(
+            "Shortcut {} belongs to {}", link.shortcut,
+            cluster->urlOn(*peer, ""))));
+    }
+    return {};
+}
+
+namespace
+{
+
+// Make a link from an element of the “links” array of the API. This
+// fills in what the user gives, like the form of handleCreateLink().
+mw::E<ShortLink> linkFromAPIJSON(const nlohmann::json& item)
+{
+    if(!item.is_object())
+    {
+        return std::unexpected(mw::httpError(400, "Link is not an object"));
+    }
+    ShortLink link;
+    link.type = ShortLink::NORMAL;
+    link.visits = 0;
+    auto url = item.find("original_url");
+    if(url == item.end() || !url->is_string())
+    {
+        return std::unexpected(mw::httpError(
+            400, "Link should have an original URL."));
+    }
+    link.original_url = mw::strip(url->get<std::string>());
+    if(link.original_url.empty())
+    {
+        return std::unexpected(mw::httpError(
+            400, "Link should have an original URL that is not empty."));
+    }
+    if(auto shortcut = item.find("shortcut"); shortcut != item.end())
+    {
+        if(!shortcut->is_string())
+        {
+            return std::unexpected(mw::httpError(
+                400, "Shortcut should be a string."));
+        }
+        link.shortcut = mw::strip(shortcut->get<std::string>());
+    }
+    if(!validateShortcut(link.shortcut))
+    {
+        return std::unexpected(mw::httpError(400, "Invalid shortcut"));
+    }
+    if(auto type = item.find("type"); type != item.end())
+    {
+        std::optional<ShortLink::Type> t;
+        if(type->is_number_integer())
+        {
+            t = ShortLink::typeFromInt(type->get<int>());
+        }
+        if(!t.has_value())
+        {
+            return std::unexpected(mw::httpError(400, "Invalid link type"));
+        }
+        link.type = *t;
+    }
+    if(auto max_age = item.find("cache_max_age");
+       max_age != item.end() && !max_age->is_null())
+    {
+        if(!max_age->is_number_integer() || max_age->get<int64_t>() < 0)
+        {
+            return std::unexpected(mw::httpError(
+                400, "Cache max age should be a non-negative integer."));
+        }
+        link.cache_max_age = max_age->get<int64_t>();
+    }
+    if(link.shortcut.empty())
+    {
+        if(link.type == ShortLink::REGEXP)
+        {
+            return std::unexpected(mw::httpError(
+                400, "Regexp link should have a non-empty shortcut"));
+        }
+        ASSIGN_OR_RETURN(link.shortcut, shortcutFromURL(link.original_url));
+    }
+    return link;
+}
+
+} // namespace
+
+void App::handleAPIListLinks(const Request& req, Response& res) const
+{
+    auto session = prepareSession(req, res);
+    if(!session.has_value()) return;
+    ASSIGN_OR_RESPOND_ERROR(
+        LinkPageQuery query,
+        linkPageQueryFromRequest(req, config.links_page_size), res);
+    ASSIGN_OR_RESPOND_ERROR(std::vector<ShortLink> links,
+                            data->getLinks(session->user.id, query), res);
+
+    // The links are written straight into the body, which is sized
+    // for a typical link up front.
+    std::string body;
+    body.reserve(64 + links.size() * 192);
+    body += "{\"links\":[";
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        if(i > 0)
+        {
+            body += ',';
+        }
+        LinkFormat::appendJSON(body, links[i]);
+    }
+    body += "],\"next_after\":";
+    if(std::ssize(links) == query.limit)
+    {
+        std::format_to(std::back_inserter(body), "{}", links.back().id);
+    }
+    else
+    {
+        body += "null";
+    }
+    body += '}';
+    res.status = 200;
+    res.set_content(std::move(body), "application/json");
+}
+
+void App::handleAPICreateLinks(const Request& req, Response& res) const
+{
+    if(refuseWriteOnReplica(res)) return;
+    auto session = prepareSession(req, res);
+    if(!session.has_value()) return;
+
+    nlohmann::json body = nlohmann::json::parse(req.body, nullptr, false);
+    if(body.is_discarded() || !body.is_object() || !body.contains("links") ||
+       !body["links"].is_array())
+    {
+        res.status = 400;
+        res.set_content("Body should be an object with a “links” array.",
+                        "text/plain");
+        return;
+    }
+    const nlohmann::json& items = body["links"];
+    if(items.size() > API_BATCH_MAX)
+    {
+        res.status = 400;
+        res.set_content(std::format("At most {} links at a time.",
+                                    API_BATCH_MAX), "text/plain");
+        return;
+    }
+
+    nlohmann::json rejected = nlohmann::json::array_t();
+    std::vector<ShortLink> links;
+    // Index in “items” of each link in “links”.
+    std::vector<size_t> indices;
+    links.reserve(items.size());
+    indices.reserve(items.size());
+    const mw::Time now = mw::Clock::now();
+    for(size_t i = 0; i < items.size(); i++)
+    {
+        mw::E<ShortLink> link = linkFromAPIJSON(items[i]);
+        if(!link.has_value())
+        {
+            rejected.push_back({{"index", i},
+                                {"reason", mw::errorMsg(link.error())}});
+            continue;
+        }
+        if(mw::E<void> owned = checkLinkOwner(*link); !owned.has_value())
+        {
+            rejected.push_back({{"index", i},
+                                {"shortcut", link->shortcut},
+                                {"reason", mw::errorMsg(owned.error())}});
+            continue;
+        }
+        link->user_id = session->user.id;
+        link->time_creation = now;
+        links.push_back(*std::move(link));
+        indices.push_back(i);
+    }
+
+    ASSIGN_OR_RESPOND_ERROR(std::vector<size_t> skipped,
+                            data->addLinks(links), res);
+    nlohmann::json created = nlohmann::json::array_t();
+    auto next_skipped = skipped.begin();
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        if(next_skipped != skipped.end() && *next_skipped == i)
+        {
+            rejected.push_back({{"index", indices[i]},
+                                {"shortcut", links[i].shortcut},
+                                {"reason", "Shortcut already exists"}});
+            next_skipped++;
+            continue;
+        }
+        created.push_back({{"index", indices[i]},
+                           {"shortcut", links[i].shortcut}});
+    }
+    res.status = 200;
+    res.set_content(nlohmann::json{{"created", std::move(created)},
+                                   {"rejected", std::move(rejected)}}.dump(),
+                    "application/json");
+}
+
+void App::handleAPIDeleteLinks(const Request& req, Response& res) const
+{
+    if(refuseWriteOnReplica(res)) return;
+    auto session = prepareSession(req, res);
+    if(!session.has_value()) return;
+
+    nlohmann::json body = nlohmann::json::parse(req.body, nullptr, false);
+    if(body.is_discarded() || !body.is_object() || !body.contains("ids") ||
+       !body["ids"].is_array())
+    {
+        res.status = 400;
+        res.set_content("Body should be an object with an “ids” array.",
+                        "text/plain");
+        return;
+    }
+    const nlohmann::json& ids = body["ids"];
+    if(ids.size() > API_BATCH_MAX)
+    {
+        res.status = 400;
+        res.set_content(std::format("At most {} links at a time.",
+                                    API_BATCH_MAX), "text/plain");
+        return;
+    }
+
+    nlohmann::json deleted = nlohmann::json::array_t();
+    nlohmann::json rejected = nlohmann::json::array_t();
+    // The links are removed one by one, so those before a failure stay
+    // removed. Report them, so that the client knows what is left.
+    auto fail = [&](size_t index, const mw::Error& error)
+    {
+        std::string message = mw::errorMsg(error);
+        rejected.push_back({{"id", ids[index]}, {"reason", message}});
+        for(size_t i = index + 1; i < ids.size(); i++)
+        {
+            rejected.push_back({{"id", ids[i]}, {"reason", "Not attempted"}});
+        }
+        res.status = 500;
+        res.set_content(nlohmann::json{{"error", std::move(message)},
+                                       {"deleted", std::move(deleted)},
+                                       {"rejected", std::move(rejected)}}
+                        .dump(), "application/json");
+    };
+    for(size_t i = 0; i < ids.size(); i++)
+    {
+        const nlohmann::json& item = ids[i];
+        if(!item.is_number_integer())
+        {
+            rejected.push_back({{"id", item}, {"reason", "Invalid link ID"}});
+            continue;
+        }
+        const int64_t id = item.get<int64_t>();
+        mw::E<std::optional<ShortLink>> link = data->getLink(id);
+        if(!link.has_value())
+        {
+            fail(i, link.error());
+            return;
+        }
+        if(!link->has_value())
+        {
+            rejected.push_back({{"id", id}, {"reason", "Not found"}});
+            continue;
+        }
+        if((*link)->user_id != session->user.id)
+        {
+            rejected.push_back({{"id", id}, {"reason", "Permission denied"}});
+            continue;
+        }
+        mw::E<void> result = data->removeLink(id);
+        if(!result.has_value())
+        {
+            fail(i, result.error());
+            return;
+        }
+        deleted.push_back(id);
+    }
+    res.status = 200;
+    res.set_content(nlohmann::json{{"deleted", std::move(deleted)},
+                                   {"rejected", std::move(rejected)}}.dump(),
+                    "application/json");
+}
+
+void App::handleReplicationChanges(const Request& req, Response& res) const
+{
+    if(!bearerTokenMatches(req.get_header_value("Authorization"),
+                           config.replication_token))
+    {
+        res.status = 401;
+        res.set_content("Invalid replication token.", "text/plain");
+        return;
+    }
+    // The log is paged like the link list, by sequence number.
+    ASSIGN_OR_RESPOND_ERROR(LinkPageQuery query,
+                            linkPageQueryFromRequest(req, 1000), res);
+    ASSIGN_OR_RESPOND_ERROR(
+        std::vector<LinkChange> changes,
+        data->getChanges(query.after_id.value_or(0),
+                         std::min(query.limit, REPLICATION_BATCH_MAX)), res);
+    // Read after the changes, so that neither is behind them. A
+    // compaction in between then shows as a follower falling behind.
+    ReplicationFormat::LogState state;
+    ASSIGN_OR_RESPOND_ERROR(state.latest, data->latestChangeSeq(), res);
+    ASSIGN_OR_RESPOND_ERROR(state.compacted, data->compactedChangeSeq(),
+                            res);
+    res.status = 200;
+    res.set_content(ReplicationFormat::changesToJSON(changes, state),
+                    "application/json");
+}
+
+void App::handleAdminHotLinks(const Request& req, Response& res) const
+{
+    if(!bearerTokenMatches(req.get_header_value("Authorization"),
+                           config.admin_token))
+    {
+        res.status = 401;
+        res.set_content("Invalid admin token.", "text/plain");
+        return;
+    }
+    DataSourceHotLinks::Stats stats = hot_links->stats();
+    nlohmann::json links = nlohmann::json::array();
+    for(const DataSourceHotLinks::HotLink& link: hot_links->topLinks())
+    {
+        links.push_back({{"shortcut", link.shortcut},
+                         {"estimate", link.estimate},
+                         {"pinned", link.pinned}});
+    }
+    res.status = 200;
+    res.set_content(nlohmann::json{
+            {"pinned", stats.pinned}, {"hits", stats.hits},
+            {"promotions", stats.promotions},
+            {"demotions", stats.demotions}, {"links", std::move(links)}}
+        .dump(), "application/json");
+}
+
+void App::handleExportLinks(const Request& req, Response& res) const
+{
+    auto session = prepareSession(req, res);
+    if(!session.has_value()) return;
+    ASSIGN_OR_RESPOND_ERROR(LinkFormat::Type format,
+                            linkFormatFromRequest(req), res);
+
+    struct Export
+    {
+        std::string user_id;
+        std::optional<int64_t> after_id;
+        bool header_sent = false;
+        // Reused for every page.
+        std::string buffer;
+    };
+    auto state = std::make_shared<Export>();
+    state->user_id = session->user.id;
+
+    res.status = 200;
+    res.set_header("Content-Disposition", std::format(
+        "attachment; filename=\"links.{}\"",
+        format == LinkFormat::CSV ? "csv" : "ndjson"));
+    res.set_chunked_content_provider(
+        std::string(LinkFormat::contentType(format)),
+        [this, state, format](size_t, httplib::DataSink& sink)
+    {
+        state->buffer.clear();
+        if(!state->header_sent)
+        {
+            state->buffer += LinkFormat::header(format);
+            state->header_sent = true;
+        }
+        LinkPageQuery query;
+        query.after_id = state->after_id;
+        query.limit = LINKS_EXPORT_BATCH;
+        mw::E<std::vector<ShortLink>> links =
+            data->getLinks(state->user_id, query);
+        if(!links.has_value())
+        {
+            spdlog::error("Failed to export links: {}",
+                          mw::errorMsg(links.error()));
+            return false;
+        }
+        for(const ShortLink& link: *links)
+        {
+            LinkFormat::appendLink(state->buffer, link, format);
+        }
+        if(!links->empty())
+        {
+            state->after_id = links->back().id;
+        }
+        if(!state->buffer.empty() &&
+           !sink.write(state->buffer.data(), state->buffer.size()))
+        {
+            return false;
+        }
+        if(std::ssize(*links) < LINKS_EXPORT_BATCH)
+        {
+            sink.done();
+        }
+        return true;
+    });
+}
+
+void App::handleImportLinks(const Request& req, Response& res,
+                            const httplib::ContentReader& content_reader) const
+{
+    if(refuseWriteOnReplica(res)) return;
+    auto session = prepareSession(req, res);
+    if(!session.has_value()) return;
+    ASSIGN_OR_RESPOND_ERROR(LinkFormat::Type format,
+                            linkFormatFromRequest(req), res);
+
+    LinkImporter importer(*data, format);
+    importer.setOwner(session->user.id);
+    auto read_all = [&]() -> mw::E<LinkImporter::Report>
+    {
+        mw::E<void> fed;
+        content_reader([&](const char* chunk, size_t size)
+        {
+            fed = importer.feed(std::string_view(chunk, size));
+            return fed.has_value();
+        });
+        DO_OR_RETURN(fed);
+        return importer.finish();
+    };
+    ASSIGN_OR_RESPOND_ERROR(LinkImporter::Report report, read_all(), res);
+    spdlog::info("Imported {} links for user {}, rejected {}.", report.added,
+                 session->user.id, report.rejected);
+    res.status = 200;
+    res.set_content(report.toJSON().dump(), "application/json");
+}
+
+std::string App::getPath(Route route, const std::string& arg_name) const
+{
+    return mw::URL::fromStr(urlFor(route, ":" + arg_name)).value()
         .path();
 }
 
+mw::E<void> App::start()
+{
+    DO_OR_RETURN(mw::HTTPServer::start());
+    if(config.listen_backlog <= 0)
+    {
+        return {};
+    }
+    // httplib listens with a backlog fixed at compile time. Listening
+    // again on the same socket only changes the backlog.
+    server.wait_until_ready();
+    if(int sock = listen_socket; sock >= 0 &&
+       ::listen(sock, config.listen_backlog) != 0)
+    {
+        spdlog::warn("Failed to set the listen backlog to {}: {}",
+                     config.listen_backlog, std::strerror(errno));
+    }
+    return {};
+}
+
+void App::configureServer()
+{
+    if(config.server_threads > 0 || config.server_max_queued > 0 ||
+       config.server_pin_threads)
+    {
+        WorkerPool::Options options;
+        options.threads = config.server_threads;
+        options.max_queued = config.server_max_queued;
+        options.pin_cpus = config.server_pin_threads;
+        server.new_task_queue = [options]
+        {
+            return new WorkerPool(options);
+        };
+    }
+    if(config.listen_backlog > 0)
+    {
+        server.set_socket_options([this](socket_t sock)
+        {
+            httplib::default_socket_options(sock);
+            listen_socket = sock;
+        });
+    }
+    if(config.keep_alive_max_count > 0)
+    {
+        server.set_keep_alive_max_count(config.keep_alive_max_count);
+    }
+    if(config.keep_alive_timeout_sec > 0)
+    {
+        server.set_keep_alive_timeout(config.keep_alive_timeout_sec);
+    }
+    if(config.read_timeout_sec > 0)
+    {
+        server.set_read_timeout(config.read_timeout_sec);
+    }
+    if(config.write_timeout_sec > 0)
+    {
+        server.set_write_timeout(config.write_timeout_sec);
+    }
+    if(config.max_payload_bytes > 0)
+    {
+        server.set_payload_max_length(config.max_payload_bytes);
+    }
+    if(config.tcp_nodelay)
+    {
+        server.set_tcp_nodelay(true);
+    }
+}
+
 void App::setup()
 {
+    configureServer();
     {
         std::string statics_dir = (std::filesystem::path(config.data_dir) /
                                    "statics").string();
@@ -504,48 +1595,196 @@ void App::setup()
         }
     }
 
-    server.Get(getPath("index"), [&]([[maybe_unused]] const Request& req, Response& res)
+    server.Get(getPath(INDEX), instrumented(INDEX, [&](
+        [[maybe_unused]] const Request& req, Response& res)
     {
         handleIndex(res);
-    });
-    server.Get(getPath("login"), [&]([[maybe_unused]] const Request& req, Response& res)
+    }));
+    server.Get(getPath(LOGIN), instrumented(LOGIN, [&](
+        [[maybe_unused]] const Request& req, Response& res)
     {
         handleLogin(res);
-    });
-    server.Get(getPath("openid-redirect"), [&](const Request& req, Response& res)
+    }));
+    server.Get(getPath(OPENID_REDIRECT), instrumented(OPENID_REDIRECT, [&](
+        const Request& req, Response& res)
     {
         handleOpenIDRedirect(req, res);
-    });
-    server.Get(getPath("links"), [&](const Request& req, Response& res)
+    }));
+    server.Get(getPath(LINKS), instrumented(LINKS, [&](
+        const Request& req, Response& res)
     {
         handleLinks(req, res);
-    });
-    server.Get(getPath("new-link"), [&](const Request& req, Response& res)
+    }));
+    server.Get(getPath(NEW_LINK), instrumented(NEW_LINK, [&](
+        const Request& req, Response& res)
     {
         handleNewLink(req, res);
-    });
-    server.Post(getPath("create-link"), [&](const Request& req, Response& res)
+    }));
+    server.Post(getPath(CREATE_LINK), instrumented(CREATE_LINK, [&](
+        const Request& req, Response& res)
     {
         handleCreateLink(req, res);
-    });
-    server.Get(getPath("delete-link-dialog", "id"), [&](const Request& req, Response& res)
+    }));
+    server.Get(getPath(DELETE_LINK_DIALOG, "id"), instrumented(
+        DELETE_LINK_DIALOG, [&](const Request& req, Response& res)
     {
         handleDeleteLinkDialog(req, res);
-    });
-    server.Post(getPath("delete-link"), [&](const Request& req, Response& res)
+    }));
+    server.Post(getPath(DELETE_LINK), instrumented(DELETE_LINK, [&](
+        const Request& req, Response& res)
     {
         handleDeleteLink(req, res);
-    });
-    server.Get(getPath("shortcut", "shortcut"),
-                [&](const Request& req, Response& res)
+    }));
+    server.Get(getPath(EXPORT_LINKS), instrumented(EXPORT_LINKS, [&](
+        const Request& req, Response& res)
+    {
+        handleExportLinks(req, res);
+    }));
+    server.Post(getPath(IMPORT_LINKS), instrumented(IMPORT_LINKS, [&](
+        const Request& req, Response& res,
+        const httplib::ContentReader& content_reader)
+    {
+        handleImportLinks(req, res, content_reader);
+    }));
+    server.Get(getPath(API_LINKS), instrumented(API_LINKS, withJSONErrors([&](
+        const Request& req, Response& res)
+    {
+        handleAPIListLinks(req, res);
+    })));
+    server.Post(getPath(API_LINKS), instrumented(API_LINKS, withJSONErrors([&](
+        const Request& req, Response& res)
+    {
+        handleAPICreateLinks(req, res);
+    })));
+    server.Delete(getPath(API_LINKS), instrumented(API_LINKS, withJSONErrors(
+        [&](const Request& req, Response& res)
+    {
+        handleAPIDeleteLinks(req, res);
+    })));
+    if(!config.replication_token.empty())
+    {
+        server.Get(getPath(REPLICATION_CHANGES), instrumented(
+            REPLICATION_CHANGES, [&](const Request& req, Response& res)
+        {
+            handleReplicationChanges(req, res);
+        }));
+    }
+    if(!config.admin_token.empty() && hot_links != nullptr)
+    {
+        server.Get(getPath(ADMIN_HOT_LINKS), instrumented(
+            ADMIN_HOT_LINKS, [&](const Request& req, Response& res)
+        {
+            handleAdminHotLinks(req, res);
+        }));
+    }
+    if(config.metrics_endpoint)
+    {
+        server.Get(getPath(METRICS), [&](
+            [[maybe_unused]] const Request& req, Response& res)
+        {
+            handleMetrics(res);
+        });
+    }
+    server.Get(getPath(SHORTCUT, "shortcut"), instrumented(SHORTCUT, [&](
+        const Request& req, Response& res)
     {
         handleShortcut(req, res);
-    });
+    }));
+}
 
+App::Handler App::instrumented(Route route, Handler handler)
+{
+    return [this, handler = std::move(handler), m = routeMetrics(route)](
+        const Request& req, Response& res)
+    {
+        {
+            Metrics::Timer timer(metrics, m.duration);
+            handler(req, res);
+        }
+        countResponse(m, res);
+    };
+}
+
+App::ContentReaderHandler App::instrumented(Route route,
+                                            ContentReaderHandler handler)
+{
+    return [this, handler = std::move(handler), m = routeMetrics(route)](
+        const Request& req, Response& res,
+        const httplib::ContentReader& content_reader)
+    {
+        {
+            Metrics::Timer timer(metrics, m.duration);
+            handler(req, res, content_reader);
+        }
+        countResponse(m, res);
+    };
+}
+
+App::Handler App::withJSONErrors(Handler handler)
+{
+    return [handler = std::move(handler)](const Request& req,
+                                          Response& res)
+    {
+        handler(req, res);
+        if(res.status < 400 ||
+           res.get_header_value("Content-Type") == "application/json")
+        {
+            return;
+        }
+        std::string message = res.body.empty() ?
+            httplib::status_message(res.status) : res.body;
+        res.set_content(nlohmann::json{{"error", message}}.dump(),
+                        "application/json");
+    };
+}
+
+App::RouteMetrics App::routeMetrics(Route route)
+{
+    const std::string labels = std::format("route=\"{}\"",
+                                           ROUTES[route].name);
+    RouteMetrics m;
+    m.duration = metrics->histogram(
+        "shrt_http_request_seconds", "Duration of HTTP request handlers",
+        labels);
+    for(size_t i = 0; i < m.responses.size(); i++)
+    {
+        m.responses[i] = metrics->counter(
+            "shrt_http_responses_total", "Number of HTTP responses",
+            std::format("{},code=\"{}xx\"", labels, i + 1));
+    }
+    return m;
+}
+
+void App::countResponse(const RouteMetrics& route_metrics,
+                        const Response& res) const
+{
+    // The server sets a status of 200 if the handler does not.
+    int status_class = res.status < 0 ? 2 : res.status / 100;
+    metrics->increment(
+        route_metrics.responses[std::clamp(status_class, 1, 5) - 1]);
+}
+
+void App::handleMetrics(Response& res) const
+{
+    res.set_content(metrics->render(), "text/plain; version=0.0.4");
 }
 
 mw::E<App::SessionValidation> App::validateSession(const Request& req) const
 {
+    // API clients may send the access token in a header instead.
+    if(std::string authorization = req.get_header_value("Authorization");
+       authorization.starts_with("Bearer "))
+    {
+        spdlog::debug("Request has bearer token.");
+        mw::E<mw::UserInfo> user = userFromAccessToken(
+            authorization.substr(std::string_view("Bearer ").size()));
+        if(user.has_value())
+        {
+            return SessionValidation::valid(*std::move(user));
+        }
+        return SessionValidation::invalid();
+    }
+
     if(!req.has_header("Cookie"))
     {
         spdlog::debug("Request has no cookie.");
@@ -557,9 +1796,7 @@ mw::E<App::SessionValidation> App::validateSession(const Request& req) const
        it != std::end(cookies))
     {
         spdlog::debug("Cookie has access token.");
-        mw::Tokens tokens;
-        tokens.access_token = it->second;
-        mw::E<mw::UserInfo> user = auth->getUser(tokens);
+        mw::E<mw::UserInfo> user = userFromAccessToken(it->second);
         if(user.has_value())
         {
             return SessionValidation::valid(*std::move(user));
@@ -571,13 +1808,52 @@ mw::E<App::SessionValidation> App::validateSession(const Request& req) const
     {
         spdlog::debug("Cookie has refresh token.");
         // Try to refresh the tokens.
-        ASSIGN_OR_RETURN(mw::Tokens tokens, auth->refreshTokens(it->second));
-        ASSIGN_OR_RETURN(mw::UserInfo user, auth->getUser(tokens));
+        mw::Tokens tokens;
+        {
+            Metrics::Timer timer(metrics, refresh_tokens_time);
+            ASSIGN_OR_RETURN(tokens, auth->refreshTokens(it->second));
+        }
+        mw::UserInfo user;
+        {
+            Metrics::Timer timer(metrics, get_user_time);
+            ASSIGN_OR_RETURN(user, auth->getUser(tokens));
+        }
+        sessions->insert(tokens.access_token, user, tokens.expiration);
         return SessionValidation::refreshed(std::move(user), std::move(tokens));
     }
     return SessionValidation::invalid();
 }
 
+mw::E<mw::UserInfo> App::userFromAccessToken(const std::string& token) const
+{
+    if(jwt_verifier != nullptr)
+    {
+        std::optional<mw::UserInfo> user;
+        {
+            Metrics::Timer timer(metrics, jwt_verify_time);
+            ASSIGN_OR_RETURN(user, jwt_verifier->verify(token));
+        }
+        if(user.has_value())
+        {
+            return *std::move(user);
+        }
+    }
+    if(std::optional<mw::UserInfo> user = sessions->find(token);
+       user.has_value())
+    {
+        return *std::move(user);
+    }
+    mw::Tokens tokens;
+    tokens.access_token = token;
+    mw::UserInfo user;
+    {
+        Metrics::Timer timer(metrics, get_user_time);
+        ASSIGN_OR_RETURN(user, auth->getUser(tokens));
+    }
+    sessions->insert(token, user);
+    return user;
+}
+
 std::optional<App::SessionValidation> App::prepareSession(
     const Request& req, Response& res, bool allow_error_and_invalid) const
 {
@@ -1,17 +1,42 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <inja.hpp>
+#include <nlohmann/json.hpp>
 #include <mw/url.hpp>
 #include <mw/http_server.hpp>
 #include <mw/error.hpp>
 #include <mw/auth.hpp>
 
+#include "cluster.hpp"
 #include "data.hpp"
+#include "data_hot_links.hpp"
 #include "config.hpp"
+#include "jwt.hpp"
+#include "metrics.hpp"
+#include "replication.hpp"
+#include "session_cache.hpp"
+#include "visit_counter.hpp"
+
+// Parse the value of a “Cookie” header into a map from cookie names
+// to values.
+std::unordered_map<std::string, std::string> parseCookies(std::string_view value);
+// The data of a link given to the templates.
+nlohmann::json link2JSON(const ShortLink& link);
+// Generate a shortcut for “url” by taking the first 8 bytes of its
+// SHA256 hash, and base64-encode.
+mw::E<std::string> shortcutFromURL(const std::string& url);
 
 class App : public mw::HTTPServer
 {
@@ -22,9 +47,49 @@ public:
     App() = delete;
     App(const Configuration& conf,
         std::unique_ptr<DataSourceInterface> data_source,
-        std::unique_ptr<mw::AuthInterface> openid_auth);
+        std::unique_ptr<mw::AuthInterface> openid_auth,
+        std::unique_ptr<JWTVerifierInterface> jwt = nullptr,
+        Metrics* metrics = nullptr,
+        std::unique_ptr<Cluster> cluster = nullptr);
 
-    std::string urlFor(const std::string& name, const std::string& arg="") const;
+    // Timing of template rendering since the start.
+    struct RenderStats
+    {
+        uint64_t count;
+        std::chrono::nanoseconds total;
+        std::chrono::nanoseconds max;
+    };
+
+    // Named URLs of the app. The names used in templates are in
+    // “ROUTES” in app.cpp.
+    enum Route
+    {
+        STATICS, INDEX, SHORTCUT, LINKS, METRICS, LOGIN, OPENID_REDIRECT,
+        NEW_LINK, CREATE_LINK, DELETE_LINK_DIALOG, DELETE_LINK, EXPORT_LINKS,
+        IMPORT_LINKS, API_LINKS, REPLICATION_CHANGES, ADMIN_HOT_LINKS,
+        ROUTE_COUNT,
+    };
+
+    // The URL of “route”. For the routes that take an argument, “arg”
+    // is appended as is, so it should already be URL-safe. Otherwise
+    // it is ignored.
+    std::string urlFor(Route route, std::string_view arg = {}) const;
+    // Same as above, but append the URL to “out”.
+    void appendURL(std::string& out, Route route, std::string_view arg = {})
+        const;
+    // Look up the route by its name in templates. This returns an
+    // empty string for an unknown name.
+    std::string urlFor(std::string_view name, std::string_view arg = {}) const;
+    static std::optional<Route> routeFromName(std::string_view name);
+
+    // Start serving. This also applies the listen backlog of the
+    // configuration, which httplib only takes after binding.
+    mw::E<void> start();
+
+    // Parse the templates from the data directory again. The old
+    // templates stay in use if this fails.
+    mw::E<void> reloadTemplates();
+    RenderStats renderStats() const;
 
     void handleIndex(Response& res) const;
     void handleLogin(Response& res) const;
@@ -35,10 +100,69 @@ public:
     void handleCreateLink(const Request& req, Response& res) const;
     void handleDeleteLinkDialog(const Request& req, Response& res);
     void handleDeleteLink(const Request& req, Response& res) const;
+    // Redirect to the URL of a shortcut. In a cluster, shortcuts
+    // owned by other nodes are sent to their owners.
     void handleShortcut(const Request& req, Response& res) const;
+    // Send all links of the current user as NDJSON or CSV, as given
+    // by the “format” parameter.
+    void handleExportLinks(const Request& req, Response& res) const;
+    // Add links from the body of the request, in the format given by
+    // the “format” parameter, for the current user. The body is
+    // parsed as it arrives. Respond with a JSON report.
+    void handleImportLinks(const Request& req, Response& res,
+                           const httplib::ContentReader& content_reader)
+        const;
+    // Metrics in the text format of Prometheus.
+    void handleMetrics(Response& res) const;
+
+    // The JSON API. Besides the session cookies, these accept the
+    // access token in an “Authorization: Bearer” header, and respond
+    // to errors with an object of one “error” message.
+    //
+    // One page of the links of the current user, with the same
+    // parameters as the link list.
+    void handleAPIListLinks(const Request& req, Response& res) const;
+    // Create the links in the “links” array of the JSON body, in one
+    // transaction. Respond with the links created and the ones
+    // rejected, by their indices in the array.
+    void handleAPICreateLinks(const Request& req, Response& res) const;
+    // Delete the links in the “ids” array of the JSON body.
+    void handleAPIDeleteLinks(const Request& req, Response& res) const;
+    // The replication log after the “after” parameter, for followers.
+    // This requires the replication token as a bearer token.
+    void handleReplicationChanges(const Request& req, Response& res) const;
+    // The hottest links and whether they are pinned, as JSON. This
+    // requires the admin token as a bearer token.
+    void handleAdminHotLinks(const Request& req, Response& res) const;
 
 private:
+    using Handler = std::function<void(const Request&, Response&)>;
+    using ContentReaderHandler = std::function<
+        void(const Request&, Response&, const httplib::ContentReader&)>;
+
     void setup() override;
+    // Apply the worker and socket settings of the configuration to
+    // the server.
+    void configureServer();
+    // Wrap “handler” so that its duration and the status of its
+    // responses are recorded under “route”.
+    Handler instrumented(Route route, Handler handler);
+    ContentReaderHandler instrumented(Route route,
+                                      ContentReaderHandler handler);
+    // Wrap an API handler so that its error responses, which the
+    // shared helpers make in plain text, are sent as JSON objects
+    // instead.
+    static Handler withJSONErrors(Handler handler);
+
+    struct RouteMetrics
+    {
+        Metrics::Histogram duration;
+        // Responses by the first digit of the status.
+        std::array<Metrics::Counter, 5> responses;
+    };
+    RouteMetrics routeMetrics(Route route);
+    void countResponse(const RouteMetrics& route_metrics,
+                       const Response& res) const;
 
     struct SessionValidation
     {
@@ -62,6 +186,10 @@ private:
         }
     };
     mw::E<SessionValidation> validateSession(const Request& req) const;
+    // Find the user of an access token: verify it locally if it is a
+    // JWT we can check, then try the session cache, and ask the auth
+    // module at last.
+    mw::E<mw::UserInfo> userFromAccessToken(const std::string& token) const;
 
     // Query the auth module for the status of the session. If there
     // is no session or it fails to query the auth module, set the
@@ -77,18 +205,98 @@ private:
         const Request& req, Response& res,
         bool allow_error_and_invalid=false) const;
 
+    // Redirect to “url”, or respond with a 304 if the client has it
+    // cached already. “cache_max_age” is that of the link.
+    void respondRedirect(const Request& req, const std::string& url,
+                         std::optional<int64_t> cache_max_age,
+                         Response& res) const;
+    // Send “shortcut” to node “peer” of the cluster, which owns it.
+    void handlePeerShortcut(const Request& req, size_t peer,
+                            std::string_view shortcut, Response& res) const;
+    // On a read-only replica, respond with a 403 and return true.
+    bool refuseWriteOnReplica(Response& res) const;
+    // In a cluster, fail with a 421 if “link” should be created on
+    // another node.
+    mw::E<void> checkLinkOwner(const ShortLink& link) const;
+
+    // Send a page of links in batches with chunked transfer encoding.
+    void streamLinks(const std::string& user_id, const LinkPageQuery& query,
+                     nlohmann::json&& render_data, Response& res) const;
+    // URL of the page of links after the one in “query”.
+    std::string nextLinksPageURL(const LinkPageQuery& query) const;
+
     // This gives a path, optionally with the name of an argument,
     // that is suitable to bind to a URL handler. For example,
     // supposed the URL of the blog post with ID 1 is
-    // “http://some.domain/blog/p/1”. Calling “getPath("post", "id")”
+    // “http://some.domain/blog/p/1”. Calling “getPath(POST, "id")”
     // would give “/blog/p/:id”. This uses urlFor(), and therefore
-    // requires that the URL is mapped correctly in that function.
-    std::string getPath(const std::string& name, const std::string& arg_name="")
-        const;
+    // requires that the URL is mapped correctly in “ROUTES”.
+    std::string getPath(Route route, const std::string& arg_name="") const;
+
+    // Parsed templates, including the ones they include. This is
+    // replaced as a whole when the templates are reloaded, so that a
+    // reload does not affect renders in progress.
+    struct Templates
+    {
+        explicit Templates(const std::string& dir) : env(dir) {}
+
+        inja::Environment env;
+        std::unordered_map<std::string, inja::Template> pages;
+    };
+    mw::E<std::shared_ptr<Templates>> loadTemplates() const;
+    // Render one of the pages in “templates”.
+    mw::E<std::string> renderPage(const std::string& name,
+                                  const nlohmann::json& data) const;
 
     Configuration config;
     mw::URL base_url;
-    inja::Environment templates;
+    // The listening socket, once the server has made it, if the
+    // configuration has a listen backlog. Otherwise -1.
+    std::atomic<int> listen_socket = -1;
+    // The Cache-Control header of redirects of links without their
+    // own max age.
+    std::string redirect_cache_control;
+    // The URL of each route, up to the argument. These are built from
+    // “base_url” once, so that urlFor() only needs to concatenate.
+    std::array<std::string, ROUTE_COUNT> route_prefixes;
+    mutable std::mutex templates_lock;
+    std::shared_ptr<Templates> templates;
+    mutable std::atomic<uint64_t> render_count = 0;
+    mutable std::atomic<uint64_t> render_total_ns = 0;
+    mutable std::atomic<uint64_t> render_max_ns = 0;
+    // Only used if no registry is given to the constructor. The
+    // layers of “data” and “follower” register metric callbacks that
+    // they remove when destroyed, so this is declared before them.
+    std::unique_ptr<Metrics> own_metrics;
+    // Never null.
+    Metrics* metrics;
     std::unique_ptr<DataSourceInterface> data;
+    // The outermost layer of “data”, or null if hot links are
+    // disabled.
+    const DataSourceHotLinks* hot_links = nullptr;
     std::unique_ptr<mw::AuthInterface> auth;
+    std::unique_ptr<SessionCache> sessions;
+    // Null if access tokens are not verified locally.
+    std::unique_ptr<JWTVerifierInterface> jwt_verifier;
+    // This refers to “data”, and therefore has to be destroyed
+    // before it. Its destructor flushes the remaining visits.
+    std::unique_ptr<VisitCounter> visits;
+    // Null if this is not part of a cluster.
+    std::unique_ptr<Cluster> cluster;
+    // Null unless this is a read-only replica of another instance.
+    // This refers to “data”, and has to be destroyed before it. It
+    // also registers metric callbacks, so it has to be destroyed
+    // before “own_metrics” as well.
+    std::unique_ptr<ReplicationFollower> follower;
+
+    Metrics::Histogram jwt_verify_time;
+    Metrics::Histogram get_user_time;
+    Metrics::Histogram refresh_tokens_time;
+    Metrics::Counter cluster_redirects;
+    Metrics::Counter cluster_forwards;
+    Metrics::Counter cluster_forward_errors;
+    // Keyed by the names in “TEMPLATE_PAGES”.
+    std::unordered_map<std::string, Metrics::Histogram> render_times;
+    // These refer to “sessions”, and have to be destroyed before it.
+    std::vector<Metrics::Registration> metric_callbacks;
 };
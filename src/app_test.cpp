@@ -1,23 +1,36 @@
 #include <httplib.h>
+#include <chrono>
+#include <format>
 #include <memory>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <mw/test_utils.hpp>
 #include <mw/http_client.hpp>
 #include <mw/auth_mock.hpp>
+#include <nlohmann/json.hpp>
 
 #include "app.hpp"
+#include "cluster.hpp"
 #include "config.hpp"
 #include "data.hpp"
 #include "data_mock.hpp"
+#include "jwt.hpp"
+#include "jwt_test_utils.hpp"
 
 using ::testing::_;
 using ::testing::Return;
+using ::testing::DoAll;
+using ::testing::SetArgReferee;
 using ::testing::HasSubstr;
 using ::testing::FieldsAre;
 using ::testing::ContainsRegex;
+using ::testing::ElementsAre;
+using ::testing::Optional;
 
 void PrintTo(const ShortLink& link, std::ostream* os)
 {
@@ -42,6 +55,7 @@ protected:
         config.data_dir = ".";
 
         auto auth = std::make_unique<mw::AuthMock>();
+        auth_mock = auth.get();
 
         mw::UserInfo expected_user;
         expected_user.name = "mw";
@@ -60,6 +74,7 @@ protected:
     Configuration config;
     std::unique_ptr<App> app;
     const DataSourceMock* data_source;
+    const mw::AuthMock* auth_mock;
 };
 
 TEST_F(UserAppTest, CanDenyAccessToLinkList)
@@ -95,7 +110,7 @@ TEST_F(UserAppTest, CanHandleLinkList)
     links.push_back(std::move(link0));
     links.push_back(std::move(link1));
 
-    EXPECT_CALL(*data_source, getAllLinks("mw"))
+    EXPECT_CALL(*data_source, getLinks("mw", _))
         .WillOnce(Return(std::move(links)));
 
     EXPECT_TRUE(mw::isExpected(app->start()));
@@ -112,6 +127,46 @@ TEST_F(UserAppTest, CanHandleLinkList)
     app->wait();
 }
 
+TEST_F(UserAppTest, CanStreamLargeLinkPage)
+{
+    std::vector<ShortLink> batch;
+    for(int64_t i = 1; i <= 500; i++)
+    {
+        ShortLink link;
+        link.shortcut = std::format("link{}", i);
+        link.original_url = std::format("url{}", i);
+        link.id = i;
+        link.user_id = "mw";
+        link.type = ShortLink::NORMAL;
+        batch.push_back(std::move(link));
+    }
+    std::vector<ShortLink> last_batch(batch.begin(), batch.begin() + 1);
+    last_batch[0].id = 501;
+    last_batch[0].original_url = "url501";
+
+    EXPECT_CALL(*data_source, getLinks("mw", FieldsAre(
+        std::nullopt, 500, LinkPageQuery::DESCENDING)))
+        .WillOnce(Return(batch));
+    EXPECT_CALL(*data_source, getLinks("mw", FieldsAre(
+        500, 1, LinkPageQuery::DESCENDING)))
+        .WillOnce(Return(last_batch));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+            mw::HTTPRequest("http://localhost:8080/_/links?limit=501&order=desc")
+            .addHeader("Cookie", "shrt-access-token=aaa")));
+        EXPECT_EQ(res->status, 200);
+        EXPECT_THAT(res->payloadAsStr(), HasSubstr("<td>url1</td>"));
+        EXPECT_THAT(res->payloadAsStr(), HasSubstr("<td>url501</td>"));
+        EXPECT_THAT(res->payloadAsStr(),
+                    HasSubstr("links?after=501&limit=501&order=desc"));
+    }
+    app->stop();
+    app->wait();
+}
+
 TEST_F(UserAppTest, CanDenyAccessToNewLink)
 {
     EXPECT_TRUE(mw::isExpected(app->start()));
@@ -164,7 +219,8 @@ TEST_F(UserAppTest, CanDenyHandleCreateLink)
             "mw",                  // user_id
             "",                  // user_name
             _,                     // visits
-            _)))                   // time_creation
+            _,                     // time_creation
+            _)))                   // cache_max_age
         .WillOnce(Return(mw::E<void>()));
 
     EXPECT_CALL(*data_source, addLink(
@@ -176,7 +232,8 @@ TEST_F(UserAppTest, CanDenyHandleCreateLink)
             "mw",                  // user_id
             "",                  // user_name
             _,                     // visits
-            _)))                   // time_creation
+            _,                     // time_creation
+            _)))                   // cache_max_age
         .WillOnce(Return(mw::E<void>()));
 
     EXPECT_TRUE(mw::isExpected(app->start()));
@@ -203,3 +260,629 @@ TEST_F(UserAppTest, CanDenyHandleCreateLink)
     app->stop();
     app->wait();
 }
+
+TEST_F(UserAppTest, CanImportLinks)
+{
+    // The links belong to the session user, whoever is in the input.
+    EXPECT_CALL(*data_source, addLinks(ElementsAre(
+        FieldsAre(_, "abc", "http://darksair.org", ShortLink::NORMAL, "mw",
+                  _, 3, _, _),
+        FieldsAre(_, "xyz", "http://mws.rocks", ShortLink::REGEXP, "mw",
+                  _, 0, _, _))))
+        .WillOnce(Return(std::vector<size_t>{1}));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.post(
+            mw::HTTPRequest("http://localhost:8080/_/import?format=csv")
+            .setPayload("shortcut,original_url,type,user_id,visits\r\n"
+                        "abc,http://darksair.org,1,someone,3\r\n"
+                        "xyz,http://mws.rocks,2,,\r\n"
+                        ",http://empty.shortcut,1,,\r\n")
+            .addHeader("Cookie", "shrt-access-token=aaa")
+            .setContentType("text/csv")));
+        EXPECT_EQ(res->status, 200);
+        nlohmann::json report = nlohmann::json::parse(res->payloadAsStr());
+        EXPECT_EQ(report["added"], 1);
+        EXPECT_EQ(report["rejected"], 2);
+        ASSERT_EQ(report["rejections"].size(), 2);
+        EXPECT_EQ(report["rejections"][0]["line"], 4);
+        EXPECT_EQ(report["rejections"][1]["shortcut"], "xyz");
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanListLinksWithAPI)
+{
+    ShortLink link;
+    link.id = 1;
+    link.shortcut = "abc";
+    link.original_url = "http://darksair.org/\"quoted\"";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "mw";
+    link.visits = 2;
+    link.time_creation = mw::secondsToTime(1000);
+    EXPECT_CALL(*data_source, getLinks("mw", FieldsAre(
+        std::nullopt, 1, LinkPageQuery::ASCENDING)))
+        .WillOnce(Return(std::vector<ShortLink>{link}));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+            mw::HTTPRequest("http://localhost:8080/_/api/links?limit=1")
+            .addHeader("Authorization", "Bearer aaa")));
+        EXPECT_EQ(res->status, 200);
+        nlohmann::json body = nlohmann::json::parse(res->payloadAsStr());
+        ASSERT_EQ(body["links"].size(), 1);
+        EXPECT_EQ(body["links"][0]["original_url"], link.original_url);
+        EXPECT_EQ(body["links"][0]["visits"], 2);
+        EXPECT_EQ(body["next_after"], 1);
+
+        ASSIGN_OR_FAIL(res, client.get(
+            mw::HTTPRequest("http://localhost:8080/_/api/links")));
+        EXPECT_EQ(res->status, 401);
+        EXPECT_EQ(nlohmann::json::parse(res->payloadAsStr())["error"],
+                  "Invalid session.");
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanCreateLinksWithAPI)
+{
+    EXPECT_CALL(*data_source, addLinks(ElementsAre(
+        FieldsAre(_, "abc", "http://darksair.org", ShortLink::NORMAL, "mw",
+                  _, 0, _, Optional(60)),
+        FieldsAre(_, "x(.*)", "http://mws.rocks/$1", ShortLink::REGEXP,
+                  "mw", _, 0, _, std::nullopt))))
+        .WillOnce(Return(std::vector<size_t>{0}));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.post(
+            mw::HTTPRequest("http://localhost:8080/_/api/links")
+            .setPayload(R"json({"links": [
+                {"shortcut": "abc", "original_url": " http://darksair.org ",
+                 "cache_max_age": 60},
+                {"shortcut": "", "original_url": "http://x", "type": 2},
+                {"shortcut": "x(.*)", "original_url": "http://mws.rocks/$1",
+                 "type": 2}]})json")
+            .addHeader("Authorization", "Bearer aaa")
+            .setContentType("application/json")));
+        EXPECT_EQ(res->status, 200);
+        nlohmann::json body = nlohmann::json::parse(res->payloadAsStr());
+        ASSERT_EQ(body["created"].size(), 1);
+        EXPECT_EQ(body["created"][0]["index"], 2);
+        ASSERT_EQ(body["rejected"].size(), 2);
+        EXPECT_EQ(body["rejected"][0]["index"], 1);
+        EXPECT_EQ(body["rejected"][1]["index"], 0);
+        EXPECT_EQ(body["rejected"][1]["reason"], "Shortcut already exists");
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanReportLinksDeletedBeforeFailure)
+{
+    ShortLink link;
+    link.shortcut = "abc";
+    link.original_url = "http://darksair.org";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "mw";
+    EXPECT_CALL(*data_source, getLink(_)).WillRepeatedly(Return(link));
+    EXPECT_CALL(*data_source, removeLink(1)).WillOnce(Return(mw::E<void>()));
+    EXPECT_CALL(*data_source, removeLink(2)).WillOnce(Return(
+        std::unexpected(mw::runtimeError("Disk full"))));
+    EXPECT_CALL(*data_source, removeLink(3)).Times(0);
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        httplib::Client client("localhost", 8080);
+        httplib::Result res = client.Delete(
+            "/_/api/links", {{"Authorization", "Bearer aaa"}},
+            R"({"ids": [1, 2, 3]})", "application/json");
+        ASSERT_TRUE(res);
+        EXPECT_EQ(res->status, 500);
+        nlohmann::json body = nlohmann::json::parse(res->body);
+        EXPECT_EQ(body["error"], "Disk full");
+        EXPECT_EQ(body["deleted"], nlohmann::json::array({1}));
+        ASSERT_EQ(body["rejected"].size(), 2);
+        EXPECT_EQ(body["rejected"][0]["id"], 2);
+        EXPECT_EQ(body["rejected"][0]["reason"], "Disk full");
+        EXPECT_EQ(body["rejected"][1]["id"], 3);
+        EXPECT_EQ(body["rejected"][1]["reason"], "Not attempted");
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanRedirectShortcut)
+{
+    EXPECT_CALL(*data_source, resolveShortcut("abc", _))
+        .WillOnce(DoAll(SetArgReferee<1>("http://darksair.org"),
+                        Return(ResolvedLink{1, std::nullopt})));
+    // The visit is written when the app is destroyed.
+    EXPECT_CALL(*data_source, addVisits(::testing::SizeIs(1)))
+        .WillOnce(Return(mw::E<void>()));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+            mw::HTTPRequest("http://localhost:8080/abc")));
+        EXPECT_EQ(res->status, 308);
+        EXPECT_EQ(res->header.at("Location"), "http://darksair.org");
+        EXPECT_EQ(res->header.at("Cache-Control"), "no-cache");
+        EXPECT_FALSE(res->header.at("ETag").empty());
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanFallBackToRegexpLinks)
+{
+    ShortLink link;
+    link.id = 1;
+    link.shortcut = "gh-(.+)";
+    link.original_url = "https://github.com/MetroWind/shrt";
+    link.type = ShortLink::REGEXP;
+    EXPECT_CALL(*data_source, addVisits(::testing::SizeIs(1)))
+        .WillOnce(Return(mw::E<void>()));
+    EXPECT_CALL(*data_source, resolveShortcut(_, _))
+        .Times(2).WillRepeatedly(Return(std::nullopt));
+    EXPECT_CALL(*data_source, findLinkFromRegexpLinks("gh-shrt"))
+        .WillOnce(Return(std::move(link)));
+    EXPECT_CALL(*data_source, findLinkFromRegexpLinks("nothing"))
+        .WillOnce(Return(std::nullopt));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res1, client.get(
+            mw::HTTPRequest("http://localhost:8080/gh-shrt")));
+        EXPECT_EQ(res1->status, 308);
+        EXPECT_EQ(res1->header.at("Location"),
+                  "https://github.com/MetroWind/shrt");
+
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res2, client.get(
+            mw::HTTPRequest("http://localhost:8080/nothing")));
+        EXPECT_EQ(res2->status, 404);
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanCacheValidatedSession)
+{
+    mw::UserInfo expected_user;
+    expected_user.name = "mw";
+    expected_user.id = "mw";
+    EXPECT_CALL(*auth_mock, getUser(_)).WillOnce(Return(expected_user));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        for(int i = 0; i < 3; i++)
+        {
+            ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+                mw::HTTPRequest("http://localhost:8080/_/new-link")
+                .addHeader("Cookie", "shrt-access-token=aaa")));
+            EXPECT_EQ(res->status, 200);
+        }
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanVerifyJWTLocally)
+{
+    TestJWTSigner signer;
+    ASSIGN_OR_FAIL(auto verifier, JWTVerifier::fromJWKS(
+        signer.jwks(), "", "shrt"));
+    auto auth = std::make_unique<mw::AuthMock>();
+    EXPECT_CALL(*auth, getUser(_)).Times(0);
+    App jwt_app(config, std::make_unique<DataSourceMock>(), std::move(auth),
+                std::move(verifier));
+
+    nlohmann::json claims = {
+        {"aud", "shrt"},
+        {"sub", "mw"},
+        {"preferred_username", "mw"},
+        {"exp", mw::timeToSeconds(mw::Clock::now() + std::chrono::minutes(5))},
+    };
+    EXPECT_TRUE(mw::isExpected(jwt_app.start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+            mw::HTTPRequest("http://localhost:8080/_/new-link")
+            .addHeader("Cookie", "shrt-access-token=" + signer.sign(claims))));
+        EXPECT_EQ(res->status, 200);
+    }
+    jwt_app.stop();
+    jwt_app.wait();
+}
+
+TEST_F(UserAppTest, CanReloadTemplates)
+{
+    EXPECT_TRUE(mw::isExpected(app->reloadTemplates()));
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+            mw::HTTPRequest("http://localhost:8080/_/new-link")
+            .addHeader("Cookie", "shrt-access-token=aaa")));
+        EXPECT_EQ(res->status, 200);
+    }
+    app->stop();
+    app->wait();
+    EXPECT_EQ(app->renderStats().count, 1);
+}
+
+TEST_F(UserAppTest, CanServeMetrics)
+{
+    EXPECT_CALL(*data_source, resolveShortcut("abc", _))
+        .WillOnce(DoAll(SetArgReferee<1>("http://darksair.org"),
+                        Return(ResolvedLink{1, std::nullopt})));
+    EXPECT_CALL(*data_source, addVisits(::testing::SizeIs(1)))
+        .WillOnce(Return(mw::E<void>()));
+
+    EXPECT_TRUE(mw::isExpected(app->start()));
+    {
+        mw::HTTPSession client;
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res1, client.get(
+            mw::HTTPRequest("http://localhost:8080/abc")));
+        EXPECT_EQ(res1->status, 308);
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res2, client.get(
+            mw::HTTPRequest("http://localhost:8080/_/metrics")));
+        EXPECT_EQ(res2->status, 200);
+        std::string body(res2->payloadAsStr());
+        EXPECT_THAT(body, HasSubstr(
+            "shrt_http_responses_total{route=\"shortcut\",code=\"3xx\"} 1\n"));
+        EXPECT_THAT(body, HasSubstr(
+            "shrt_http_request_seconds_count{route=\"shortcut\"} 1\n"));
+        EXPECT_THAT(body, HasSubstr(
+            "shrt_cache_hit_ratio{cache=\"sessions\"}"));
+    }
+    app->stop();
+    app->wait();
+}
+
+TEST_F(UserAppTest, CanBuildURLs)
+{
+    EXPECT_EQ(app->urlFor(App::INDEX), "http://localhost:8080/");
+    EXPECT_EQ(app->urlFor(App::LINKS), "http://localhost:8080/_/links");
+    EXPECT_EQ(app->urlFor(App::SHORTCUT, "abc"), "http://localhost:8080/abc");
+    EXPECT_EQ(app->urlFor("delete-link-dialog", "3"),
+              "http://localhost:8080/_/delete-link/3");
+    EXPECT_EQ(app->urlFor("statics", "styles.css"),
+              "http://localhost:8080/_/statics/styles.css");
+    // Routes without argument ignore it.
+    EXPECT_EQ(app->urlFor("delete-link", "3"),
+              "http://localhost:8080/_/delete-link");
+    EXPECT_EQ(app->urlFor("no-such-route"), "");
+}
+
+TEST(ClusterAppTest, CanRouteShortcutsToOwner)
+{
+    const std::vector<std::string> nodes = {
+        "http://localhost:8091/", "http://localhost:8092/",
+        "http://localhost:8093/"};
+    HashRing ring(nodes, 128);
+    std::vector<std::unique_ptr<App>> apps;
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        Configuration config;
+        config.base_url = nodes[i];
+        config.listen_address = "localhost";
+        config.listen_port = 8091 + static_cast<int>(i);
+        config.data_dir = ".";
+
+        // Each node only has the links it owns.
+        ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                       DataSourceSQLite::newFromMemory());
+        for(int j = 0; j < 20; j++)
+        {
+            ShortLink link;
+            link.shortcut = std::format("link{}", j);
+            link.original_url = std::format("https://example.com/{}", j);
+            link.type = ShortLink::NORMAL;
+            link.user_id = "mw";
+            if(ring.ownerOf(link.shortcut) == i)
+            {
+                ASSERT_TRUE(mw::isExpected(data->addLink(std::move(link))));
+            }
+        }
+
+        Cluster::Options options;
+        options.nodes = nodes;
+        options.self = nodes[i];
+        // The first node asks the owners, and the others redirect.
+        options.mode = i == 0 ? Cluster::FORWARD : Cluster::REDIRECT;
+        ASSIGN_OR_FAIL(std::unique_ptr<Cluster> cluster,
+                       Cluster::create(options));
+        apps.push_back(std::make_unique<App>(
+            config, std::move(data), std::make_unique<mw::AuthMock>(),
+            nullptr, nullptr, std::move(cluster)));
+        EXPECT_TRUE(mw::isExpected(apps.back()->start()));
+    }
+
+    {
+        mw::HTTPSession client;
+        for(int j = 0; j < 20; j++)
+        {
+            std::string shortcut = std::format("link{}", j);
+            ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+                mw::HTTPRequest(nodes[0] + shortcut)));
+            EXPECT_EQ(res->status, 308);
+            EXPECT_EQ(res->header.at("Location"),
+                      std::format("https://example.com/{}", j));
+
+            size_t owner = ring.ownerOf(shortcut);
+            ASSIGN_OR_FAIL(res, client.get(
+                mw::HTTPRequest(nodes[owner == 1 ? 2 : 1] + shortcut)));
+            EXPECT_EQ(res->status, 307);
+            EXPECT_EQ(res->header.at("Location"), nodes[owner] + shortcut);
+        }
+
+        // A forwarded request is answered by the node that gets it.
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+            mw::HTTPRequest(nodes[0] + "nothing")));
+        EXPECT_EQ(res->status, 404);
+        ASSIGN_OR_FAIL(res, client.get(
+            mw::HTTPRequest(nodes[1] + "link0")
+            .addHeader(Cluster::FORWARDED_HEADER, "1")));
+        EXPECT_EQ(res->status, ring.ownerOf("link0") == 1 ? 308 : 404);
+    }
+    for(std::unique_ptr<App>& app: apps)
+    {
+        app->stop();
+        app->wait();
+    }
+}
+
+// Runs Apps on in-memory databases, and stops them after each test.
+class ServingAppTest : public testing::Test
+{
+protected:
+    ~ServingAppTest() override
+    {
+        // Followers stop before their primaries.
+        for(auto it = apps.rbegin(); it != apps.rend(); it++)
+        {
+            (*it)->stop();
+            (*it)->wait();
+        }
+    }
+
+    static Configuration configOnPort(int port)
+    {
+        Configuration config;
+        config.base_url = std::format("http://localhost:{}/", port);
+        config.listen_address = "localhost";
+        config.listen_port = port;
+        config.data_dir = ".";
+        return config;
+    }
+
+    // A database with “link0”, which points to https://example.com/.
+    static mw::E<std::unique_ptr<DataSourceSQLite>> dataWithLink()
+    {
+        ASSIGN_OR_RETURN(std::unique_ptr<DataSourceSQLite> data,
+                         DataSourceSQLite::newFromMemory());
+        ShortLink link;
+        link.shortcut = "link0";
+        link.original_url = "https://example.com/";
+        link.type = ShortLink::NORMAL;
+        link.user_id = "mw";
+        DO_OR_RETURN(data->addLink(std::move(link)));
+        return data;
+    }
+
+    void start(const Configuration& config,
+               std::unique_ptr<DataSourceInterface> data)
+    {
+        apps.push_back(std::make_unique<App>(
+            config, std::move(data), std::make_unique<mw::AuthMock>()));
+        EXPECT_TRUE(mw::isExpected(apps.back()->start()));
+    }
+
+    std::vector<std::unique_ptr<App>> apps;
+};
+
+class ReplicationAppTest : public ServingAppTest {};
+class HotLinksAppTest : public ServingAppTest {};
+class CachingAppTest : public ServingAppTest {};
+class ServerAppTest : public ServingAppTest {};
+
+TEST_F(ReplicationAppTest, CanFollowPrimary)
+{
+    Configuration primary_config = configOnPort(8094);
+    primary_config.replication_token = "secret";
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> primary_data,
+                   dataWithLink());
+    const DataSourceSQLite* links = primary_data.get();
+    start(primary_config, std::move(primary_data));
+
+    Configuration follower_config = primary_config;
+    follower_config.base_url = "http://localhost:8095/";
+    follower_config.listen_port = 8095;
+    follower_config.replication_primary = "http://localhost:8094/";
+    follower_config.replication_poll_interval_ms = 10;
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> follower_data,
+                   DataSourceSQLite::newFromMemory());
+    start(follower_config, std::move(follower_data));
+
+    mw::HTTPSession client;
+    // Wait for the follower to catch up with “expected_status”.
+    auto wait_for = [&](int expected_status)
+    {
+        int status = 0;
+        for(int i = 0; i < 500 && status != expected_status; i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            mw::E<const mw::HTTPResponse*> res = client.get(
+                mw::HTTPRequest("http://localhost:8095/link0"));
+            status = res.has_value() ? (*res)->status : 0;
+        }
+        return status;
+    };
+    EXPECT_EQ(wait_for(308), 308);
+    ASSERT_TRUE(mw::isExpected(links->removeLink(1)));
+    EXPECT_EQ(wait_for(404), 404);
+
+    ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.post(
+        mw::HTTPRequest("http://localhost:8095/_/api/links")
+        .setPayload(R"({"links": []})")
+        .setContentType("application/json")
+        .addHeader("Authorization", "Bearer aaa")));
+    EXPECT_EQ(res->status, 403);
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8094/_/replication/changes")
+        .addHeader("Authorization", "Bearer wrong")));
+    EXPECT_EQ(res->status, 401);
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8094/_/replication/changes")
+        .addHeader("Authorization", "Bearer secret0")));
+    EXPECT_EQ(res->status, 401);
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8094/_/replication/changes")
+        .addHeader("Authorization", "secret")));
+    EXPECT_EQ(res->status, 401);
+}
+
+TEST_F(HotLinksAppTest, CanPinHotLinks)
+{
+    Configuration config = configOnPort(8096);
+    config.hot_links_threshold = 1;
+    config.hot_links_interval_ms = 10;
+    config.admin_token = "secret";
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data, dataWithLink());
+    start(config, std::move(data));
+
+    mw::HTTPSession client;
+    ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+        mw::HTTPRequest("http://localhost:8096/_/admin/hot-links")));
+    EXPECT_EQ(res->status, 401);
+
+    // Only some lookups are counted, so keep looking up until the
+    // link is pinned.
+    nlohmann::json hot;
+    for(int i = 0; i < 500 && hot.value("pinned", 0) == 0; i++)
+    {
+        ASSIGN_OR_FAIL(res, client.get(
+            mw::HTTPRequest("http://localhost:8096/link0")));
+        ASSERT_EQ(res->status, 308);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        ASSIGN_OR_FAIL(res, client.get(
+            mw::HTTPRequest("http://localhost:8096/_/admin/hot-links")
+            .addHeader("Authorization", "Bearer secret")));
+        ASSERT_EQ(res->status, 200);
+        hot = nlohmann::json::parse(res->payloadAsStr());
+    }
+    EXPECT_EQ(hot["pinned"], 1);
+    ASSERT_FALSE(hot["links"].empty());
+    EXPECT_EQ(hot["links"][0]["shortcut"], "link0");
+    EXPECT_EQ(hot["links"][0]["pinned"], true);
+
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8096/link0")));
+    EXPECT_EQ(res->status, 308);
+    EXPECT_EQ(res->header.at("Location"), "https://example.com/");
+}
+
+TEST_F(CachingAppTest, CanCacheRedirects)
+{
+    Configuration config = configOnPort(8097);
+    config.redirect_max_age_sec = 600;
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data, dataWithLink());
+    for(int i = 1; i < 3; i++)
+    {
+        ShortLink link;
+        link.shortcut = std::format("link{}", i);
+        link.original_url = std::format("https://example.com/{}", i);
+        link.type = ShortLink::NORMAL;
+        link.user_id = "mw";
+        link.cache_max_age = i == 1 ? 60 : 0;
+        ASSERT_TRUE(mw::isExpected(data->addLink(std::move(link))));
+    }
+    start(config, std::move(data));
+
+    mw::HTTPSession client;
+    ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+        mw::HTTPRequest("http://localhost:8097/link0")));
+    EXPECT_EQ(res->status, 308);
+    EXPECT_EQ(res->header.at("Cache-Control"), "public, max-age=600");
+    std::string etag = res->header.at("ETag");
+    EXPECT_EQ(etag.size(), 18);
+
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8097/link0")
+        .addHeader("If-None-Match", std::format("\"x\", W/{}", etag))));
+    EXPECT_EQ(res->status, 304);
+    EXPECT_EQ(res->header.at("ETag"), etag);
+    EXPECT_FALSE(res->header.contains("Location"));
+
+    // The tag of another link does not match.
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8097/link1")
+        .addHeader("If-None-Match", etag)));
+    EXPECT_EQ(res->status, 308);
+    EXPECT_EQ(res->header.at("Cache-Control"), "public, max-age=60");
+    EXPECT_NE(res->header.at("ETag"), etag);
+
+    ASSIGN_OR_FAIL(res, client.get(
+        mw::HTTPRequest("http://localhost:8097/link2")));
+    EXPECT_EQ(res->status, 308);
+    EXPECT_EQ(res->header.at("Cache-Control"), "no-cache");
+}
+
+TEST_F(ServerAppTest, CanTuneServer)
+{
+    Configuration config = configOnPort(8098);
+    config.server_threads = 2;
+    config.server_max_queued = 16;
+    config.server_pin_threads = true;
+    config.listen_backlog = 128;
+    config.keep_alive_max_count = 2;
+    config.keep_alive_timeout_sec = 1;
+    config.read_timeout_sec = 1;
+    config.write_timeout_sec = 1;
+    config.max_payload_bytes = 1024;
+    config.tcp_nodelay = true;
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data, dataWithLink());
+    start(config, std::move(data));
+
+    {
+        // More requests than a connection may make.
+        mw::HTTPSession client;
+        for(int i = 0; i < 5; i++)
+        {
+            ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.get(
+                mw::HTTPRequest("http://localhost:8098/link0")));
+            EXPECT_EQ(res->status, 308);
+        }
+        ASSIGN_OR_FAIL(const mw::HTTPResponse* res, client.post(
+            mw::HTTPRequest("http://localhost:8098/_/api/links")
+            .setPayload(std::string(2048, ' '))
+            .setContentType("application/json")));
+        EXPECT_EQ(res->status, 413);
+    }
+    {
+        // The server closes a connection after keep-alive-max-count
+        // requests, and says so in the last response.
+        httplib::Client client("localhost", 8098);
+        client.set_keep_alive(true);
+        httplib::Result res = client.Get("/link0");
+        ASSERT_TRUE(res);
+        EXPECT_EQ(res->status, 308);
+        EXPECT_NE(res->get_header_value("Connection"), "close");
+        res = client.Get("/link0");
+        ASSERT_TRUE(res);
+        EXPECT_EQ(res->status, 308);
+        EXPECT_EQ(res->get_header_value("Connection"), "close");
+    }
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+
+#include "bloom_filter.hpp"
+
+BloomFilter::BloomFilter(size_t capacity, size_t slots_per_item)
+        : item_capacity(std::max<size_t>(capacity, 1)),
+          hash_count(std::max<size_t>(
+              std::lround(static_cast<double>(slots_per_item) * std::log(2.0)),
+              1)),
+          counters(item_capacity * std::max<size_t>(slots_per_item, 1), 0)
+{
+}
+
+void BloomFilter::add(std::string_view s)
+{
+    Hashes h = hashes(s);
+    for(size_t i = 0; i < hash_count; i++)
+    {
+        uint8_t& c = counters[slot(h, i)];
+        if(c == 0)
+        {
+            nonzero_count++;
+        }
+        if(c < COUNTER_MAX)
+        {
+            c++;
+        }
+    }
+    item_count++;
+}
+
+void BloomFilter::remove(std::string_view s)
+{
+    Hashes h = hashes(s);
+    for(size_t i = 0; i < hash_count; i++)
+    {
+        uint8_t& c = counters[slot(h, i)];
+        // A saturated counter may stand for more strings than it can
+        // count, so it is left alone.
+        if(c == 0 || c == COUNTER_MAX)
+        {
+            continue;
+        }
+        c--;
+        if(c == 0)
+        {
+            nonzero_count--;
+        }
+    }
+    if(item_count > 0)
+    {
+        item_count--;
+    }
+}
+
+bool BloomFilter::mayContain(std::string_view s) const
+{
+    Hashes h = hashes(s);
+    for(size_t i = 0; i < hash_count; i++)
+    {
+        if(counters[slot(h, i)] == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+double BloomFilter::falsePositiveRate() const
+{
+    double filled = static_cast<double>(nonzero_count) /
+        static_cast<double>(counters.size());
+    return std::pow(filled, static_cast<double>(hash_count));
+}
+
+BloomFilter::Hashes BloomFilter::hashes(std::string_view s)
+{
+    uint64_t h = std::hash<std::string_view>()(s);
+    // The second hash must not be 0, or all slots of a string would
+    // be the same one.
+    return {h, std::rotl(h, 32) | 1};
+}
+
+size_t BloomFilter::slot(const Hashes& h, size_t i) const
+{
+    return (h.h1 + i * h.h2) % counters.size();
+}
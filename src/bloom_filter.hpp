@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// A counting Bloom filter of strings. Each slot is an 8-bit counter
+// instead of a bit, so that strings can be removed as well as added.
+// A counter that reaches its maximum stays there and is never
+// decreased again, which only makes false positives a little more
+// likely.
+//
+// Removing a string that was never added breaks the filter, so the
+// caller has to keep track of what is in it. This class is not
+// thread-safe.
+class BloomFilter
+{
+public:
+    // Size the filter for “capacity” strings, with “slots_per_item”
+    // counters for each. With the default of 10, the false positive
+    // rate is about 1% when the filter is at its capacity. The number
+    // of hashes is chosen to minimize it.
+    explicit BloomFilter(size_t capacity, size_t slots_per_item = 10);
+
+    void add(std::string_view s);
+    void remove(std::string_view s);
+    // False means “s” is definitely not in the filter.
+    bool mayContain(std::string_view s) const;
+
+    // Number of strings added and not removed.
+    size_t size() const { return item_count; }
+    size_t capacity() const { return item_capacity; }
+    // Probability that mayContain() is true for a string that is not
+    // in the filter, from the fraction of counters that are not 0.
+    double falsePositiveRate() const;
+
+private:
+    static constexpr uint8_t COUNTER_MAX = 255;
+
+    // The slots of a string are h1 + i × h2, for i from 0 to
+    // “hash_count” - 1.
+    struct Hashes
+    {
+        uint64_t h1;
+        uint64_t h2;
+    };
+    static Hashes hashes(std::string_view s);
+    size_t slot(const Hashes& h, size_t i) const;
+
+    size_t item_capacity;
+    size_t hash_count;
+    std::vector<uint8_t> counters;
+    size_t item_count = 0;
+    size_t nonzero_count = 0;
+};
@@ -0,0 +1,49 @@
+#include <format>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "bloom_filter.hpp"
+
+TEST(BloomFilter, HasNoFalseNegatives)
+{
+    BloomFilter filter(1000);
+    for(int i = 0; i < 1000; i++)
+    {
+        filter.add(std::format("link{}", i));
+    }
+    for(int i = 0; i < 1000; i++)
+    {
+        EXPECT_TRUE(filter.mayContain(std::format("link{}", i)));
+    }
+    EXPECT_EQ(filter.size(), 1000);
+
+    // Close to the designed rate of about 1%, both estimated and
+    // measured.
+    EXPECT_LT(filter.falsePositiveRate(), 0.02);
+    int false_positives = 0;
+    for(int i = 0; i < 10000; i++)
+    {
+        if(filter.mayContain(std::format("missing{}", i)))
+        {
+            false_positives++;
+        }
+    }
+    EXPECT_LT(false_positives, 200);
+}
+
+TEST(BloomFilter, CanRemove)
+{
+    BloomFilter filter(100);
+    filter.add("a");
+    filter.add("b");
+    filter.add("b");
+    filter.remove("a");
+    filter.remove("b");
+    EXPECT_FALSE(filter.mayContain("a"));
+    EXPECT_TRUE(filter.mayContain("b"));
+    EXPECT_EQ(filter.size(), 1);
+    filter.remove("b");
+    EXPECT_FALSE(filter.mayContain("b"));
+    EXPECT_DOUBLE_EQ(filter.falsePositiveRate(), 0.0);
+}
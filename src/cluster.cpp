@@ -0,0 +1,212 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <httplib.h>
+#include <mw/error.hpp>
+#include <mw/url.hpp>
+
+#include "cluster.hpp"
+
+namespace
+{
+
+// Base URLs are compared with a trailing slash, so that
+// “http://a:8080” and “http://a:8080/” are the same node.
+std::string normalizeNode(std::string_view url)
+{
+    std::string result(url);
+    if(!result.ends_with('/'))
+    {
+        result += '/';
+    }
+    return result;
+}
+
+// Split “url” into “scheme://host:port” and the path.
+mw::E<std::pair<std::string, std::string>> splitURL(std::string_view url)
+{
+    if(!url.starts_with("http://") && !url.starts_with("https://"))
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Cluster node {} is not an HTTP URL", url)));
+    }
+    size_t path_start = url.find('/', url.find("://") + 3);
+    return std::pair<std::string, std::string>(
+        url.substr(0, path_start), url.substr(path_start));
+}
+
+} // namespace
+
+HashRing::HashRing(const std::vector<std::string>& nodes,
+                   size_t virtual_nodes)
+{
+    points.reserve(nodes.size() * virtual_nodes);
+    for(size_t i = 0; i < nodes.size(); i++)
+    {
+        for(size_t v = 0; v < virtual_nodes; v++)
+        {
+            points.emplace_back(hash(std::format("{}#{}", nodes[i], v)), i);
+        }
+    }
+    std::sort(points.begin(), points.end());
+}
+
+size_t HashRing::ownerOf(std::string_view shortcut) const
+{
+    auto it = std::lower_bound(
+        points.begin(), points.end(), hash(shortcut),
+        [](const std::pair<uint64_t, size_t>& point, uint64_t h)
+        {
+            return point.first < h;
+        });
+    if(it == points.end())
+    {
+        // Wrap around the ring.
+        it = points.begin();
+    }
+    return it->second;
+}
+
+uint64_t HashRing::hash(std::string_view s)
+{
+    // FNV-1a, followed by the finalizer of MurmurHash3, because
+    // FNV-1a alone does not spread similar short strings well.
+    uint64_t h = 0xcbf29ce484222325ull;
+    for(char c: s)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 0x100000001b3ull;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+std::optional<Cluster::Mode> Cluster::modeFromStr(std::string_view s)
+{
+    if(s == "redirect")
+    {
+        return REDIRECT;
+    }
+    if(s == "forward")
+    {
+        return FORWARD;
+    }
+    return std::nullopt;
+}
+
+mw::E<std::unique_ptr<Cluster>> Cluster::create(const Options& options)
+{
+    Options normalized = options;
+    std::transform(normalized.nodes.begin(), normalized.nodes.end(),
+                   normalized.nodes.begin(), normalizeNode);
+    normalized.self = normalizeNode(normalized.self);
+    normalized.virtual_nodes = std::max<size_t>(normalized.virtual_nodes, 1);
+
+    std::unique_ptr<Cluster> cluster(new Cluster(normalized));
+    const std::vector<std::string>& nodes = cluster->options.nodes;
+    auto self = std::find(nodes.begin(), nodes.end(),
+                          cluster->options.self);
+    if(self == nodes.end())
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "This node {} is not one of the cluster nodes",
+            cluster->options.self)));
+    }
+    cluster->self_index = self - nodes.begin();
+    for(const std::string& node: nodes)
+    {
+        if(std::count(nodes.begin(), nodes.end(), node) > 1)
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Cluster node {} is listed more than once", node)));
+        }
+        ASSIGN_OR_RETURN(auto parts, splitURL(node));
+        cluster->origins.push_back(std::move(parts.first));
+        cluster->paths.push_back(std::move(parts.second));
+    }
+    return cluster;
+}
+
+Cluster::Cluster(const Options& opts)
+        : options(opts), ring(opts.nodes, opts.virtual_nodes),
+          idle_clients(opts.nodes.size())
+{
+}
+
+// Defined here, where httplib::Client is complete.
+Cluster::~Cluster() = default;
+
+std::optional<size_t> Cluster::peerOf(std::string_view shortcut) const
+{
+    size_t owner = ring.ownerOf(shortcut);
+    if(owner == self_index)
+    {
+        return std::nullopt;
+    }
+    return owner;
+}
+
+std::string Cluster::urlOn(size_t peer, std::string_view shortcut) const
+{
+    return options.nodes[peer] + mw::urlEncode(shortcut);
+}
+
+mw::E<Cluster::Answer> Cluster::forward(size_t peer,
+                                        std::string_view shortcut) const
+{
+    std::unique_ptr<httplib::Client> client = takeClient(peer);
+    httplib::Result res = client->Get(
+        paths[peer] + mw::urlEncode(shortcut),
+        {{FORWARDED_HEADER, "1"}});
+    if(!res)
+    {
+        // The connection may be broken, so it is not reused.
+        return std::unexpected(mw::httpError(502, std::format(
+            "Failed to reach {}", options.nodes[peer])));
+    }
+    Answer answer{res->status, res->get_header_value("Location"),
+                  res->get_header_value("Cache-Control"),
+                  res->get_header_value("ETag")};
+    returnClient(peer, std::move(client));
+    return answer;
+}
+
+std::unique_ptr<httplib::Client> Cluster::takeClient(size_t peer) const
+{
+    {
+        std::lock_guard<std::mutex> guard(clients_lock);
+        std::vector<std::unique_ptr<httplib::Client>>& idle =
+            idle_clients[peer];
+        if(!idle.empty())
+        {
+            std::unique_ptr<httplib::Client> client = std::move(idle.back());
+            idle.pop_back();
+            return client;
+        }
+    }
+    auto client = std::make_unique<httplib::Client>(origins[peer]);
+    client->set_keep_alive(true);
+    client->set_connection_timeout(options.forward_timeout);
+    client->set_read_timeout(options.forward_timeout);
+    return client;
+}
+
+void Cluster::returnClient(size_t peer,
+                           std::unique_ptr<httplib::Client> client) const
+{
+    std::lock_guard<std::mutex> guard(clients_lock);
+    idle_clients[peer].push_back(std::move(client));
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <mw/error.hpp>
+
+namespace httplib
+{
+class Client;
+} // namespace httplib
+
+// Assigns shortcuts to the nodes of a cluster by consistent hashing.
+// Each node is put on a ring of 64-bit hashes at “virtual_nodes”
+// points, and a shortcut belongs to the first node after its own
+// hash. Adding or removing a node only moves the shortcuts next to
+// its points.
+//
+// The hash is computed by this class instead of std::hash, so that
+// all nodes agree on it regardless of how they are built.
+class HashRing
+{
+public:
+    HashRing(const std::vector<std::string>& nodes, size_t virtual_nodes);
+
+    // Index in the node list of the owner of “shortcut”. The ring
+    // must not be empty.
+    size_t ownerOf(std::string_view shortcut) const;
+    bool empty() const { return points.empty(); }
+
+    static uint64_t hash(std::string_view s);
+
+private:
+    // Sorted by the hash. The second element is the node index.
+    std::vector<std::pair<uint64_t, size_t>> points;
+};
+
+// The nodes of a cluster, each of which has its own database, and
+// owns the links whose shortcuts hash to it. A node resolves its own
+// shortcuts, and sends the others to their owners, either by
+// redirecting the client or by asking the owner itself.
+class Cluster
+{
+public:
+    enum Mode
+    {
+        // Redirect the client to the owner with a 307.
+        REDIRECT,
+        // Ask the owner, and send its answer to the client.
+        FORWARD,
+    };
+
+    static std::optional<Mode> modeFromStr(std::string_view s);
+
+    struct Options
+    {
+        // Base URLs of all nodes, including this one, in the same
+        // order on all nodes.
+        std::vector<std::string> nodes;
+        // Base URL of this node, which has to be one of “nodes”.
+        std::string self;
+        Mode mode = REDIRECT;
+        size_t virtual_nodes = 128;
+        // Timeout of connecting to a peer and of waiting for its
+        // answer, in forward mode.
+        std::chrono::milliseconds forward_timeout{1000};
+    };
+
+    // The answer of the owner to a forwarded lookup.
+    struct Answer
+    {
+        int status;
+        // The “Location” header, if the owner redirects.
+        std::string location;
+        // The caching headers of the redirect, if any.
+        std::string cache_control;
+        std::string etag;
+    };
+
+    // Requests forwarded by a node carry this header, and are always
+    // resolved locally by the node that receives them. This keeps a
+    // node with a different list of nodes from forwarding them in a
+    // loop.
+    static constexpr char FORWARDED_HEADER[] = "X-Shrt-Forwarded";
+
+    static mw::E<std::unique_ptr<Cluster>> create(const Options& options);
+    ~Cluster();
+
+    Mode mode() const { return options.mode; }
+    // The index of the node that owns “shortcut”, or nullopt if it is
+    // this node.
+    std::optional<size_t> peerOf(std::string_view shortcut) const;
+    // The URL of “shortcut” on node “peer”.
+    std::string urlOn(size_t peer, std::string_view shortcut) const;
+    // Look up “shortcut” on node “peer”. This is thread-safe.
+    mw::E<Answer> forward(size_t peer, std::string_view shortcut) const;
+
+private:
+    explicit Cluster(const Options& options);
+
+    // An idle connection to “peer”, or a new one if there is none.
+    std::unique_ptr<httplib::Client> takeClient(size_t peer) const;
+    void returnClient(size_t peer, std::unique_ptr<httplib::Client> client)
+        const;
+
+    const Options options;
+    HashRing ring;
+    size_t self_index = 0;
+    // “scheme://host:port” and the path of each node.
+    std::vector<std::string> origins;
+    std::vector<std::string> paths;
+
+    // Keep-alive connections to each peer that are not in use.
+    mutable std::mutex clients_lock;
+    mutable std::vector<std::vector<std::unique_ptr<httplib::Client>>>
+    idle_clients;
+};
@@ -0,0 +1,92 @@
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+
+#include "cluster.hpp"
+
+TEST(HashRing, CanSpreadShortcuts)
+{
+    std::vector<std::string> nodes = {"http://a/", "http://b/", "http://c/"};
+    HashRing ring(nodes, 128);
+    std::vector<int> counts(nodes.size(), 0);
+    for(int i = 0; i < 30000; i++)
+    {
+        counts[ring.ownerOf(std::format("link{}", i))]++;
+    }
+    for(int count: counts)
+    {
+        EXPECT_GT(count, 7000);
+        EXPECT_LT(count, 13000);
+    }
+}
+
+TEST(HashRing, CanMoveFewShortcutsWhenAddingNode)
+{
+    HashRing ring({"http://a/", "http://b/", "http://c/"}, 128);
+    HashRing larger({"http://a/", "http://b/", "http://c/", "http://d/"},
+                    128);
+    int moved = 0;
+    for(int i = 0; i < 10000; i++)
+    {
+        std::string shortcut = std::format("link{}", i);
+        size_t owner = larger.ownerOf(shortcut);
+        if(owner != ring.ownerOf(shortcut))
+        {
+            // Shortcuts only move to the new node.
+            EXPECT_EQ(owner, 3);
+            moved++;
+        }
+    }
+    EXPECT_GT(moved, 1500);
+    EXPECT_LT(moved, 3500);
+}
+
+TEST(HashRing, HashIsStable)
+{
+    // All nodes have to agree on this, whatever they are built with.
+    EXPECT_EQ(HashRing::hash("abc"), 0x33ebaf9927cbc5bdull);
+}
+
+TEST(Cluster, CanFindOwner)
+{
+    Cluster::Options options;
+    options.nodes = {"http://localhost:8081", "http://localhost:8082/x/"};
+    options.self = "http://localhost:8081/";
+    ASSIGN_OR_FAIL(std::unique_ptr<Cluster> cluster,
+                   Cluster::create(options));
+    HashRing ring(std::vector<std::string>{"http://localhost:8081/",
+                                           "http://localhost:8082/x/"},
+                  options.virtual_nodes);
+    for(int i = 0; i < 100; i++)
+    {
+        std::string shortcut = std::format("link{}", i);
+        std::optional<size_t> peer = cluster->peerOf(shortcut);
+        if(ring.ownerOf(shortcut) == 0)
+        {
+            EXPECT_FALSE(peer.has_value());
+        }
+        else
+        {
+            ASSERT_TRUE(peer.has_value());
+            EXPECT_EQ(cluster->urlOn(*peer, shortcut),
+                      "http://localhost:8082/x/" + shortcut);
+        }
+    }
+}
+
+TEST(Cluster, CanNotCreateWithoutSelf)
+{
+    Cluster::Options options;
+    options.nodes = {"http://localhost:8081/", "http://localhost:8082/"};
+    options.self = "http://localhost:8083/";
+    EXPECT_FALSE(Cluster::create(options).has_value());
+    options.self = "http://localhost:8081/";
+    options.nodes.push_back("localhost:8084");
+    EXPECT_FALSE(Cluster::create(options).has_value());
+}
@@ -60,6 +60,46 @@ mw::E<Configuration> Configuration::fromYaml(const std::filesystem::path& path)
     {
         tree["socket-permission"] >> config.socket_permission;
     }
+    if(tree["server-threads"].readable())
+    {
+        tree["server-threads"] >> config.server_threads;
+    }
+    if(tree["server-max-queued"].readable())
+    {
+        tree["server-max-queued"] >> config.server_max_queued;
+    }
+    if(tree["server-pin-threads"].readable())
+    {
+        tree["server-pin-threads"] >> config.server_pin_threads;
+    }
+    if(tree["listen-backlog"].readable())
+    {
+        tree["listen-backlog"] >> config.listen_backlog;
+    }
+    if(tree["keep-alive-max-count"].readable())
+    {
+        tree["keep-alive-max-count"] >> config.keep_alive_max_count;
+    }
+    if(tree["keep-alive-timeout-sec"].readable())
+    {
+        tree["keep-alive-timeout-sec"] >> config.keep_alive_timeout_sec;
+    }
+    if(tree["read-timeout-sec"].readable())
+    {
+        tree["read-timeout-sec"] >> config.read_timeout_sec;
+    }
+    if(tree["write-timeout-sec"].readable())
+    {
+        tree["write-timeout-sec"] >> config.write_timeout_sec;
+    }
+    if(tree["max-payload-bytes"].readable())
+    {
+        tree["max-payload-bytes"] >> config.max_payload_bytes;
+    }
+    if(tree["tcp-nodelay"].readable())
+    {
+        tree["tcp-nodelay"] >> config.tcp_nodelay;
+    }
     if(tree["base-url"].readable())
     {
         tree["base-url"] >> config.base_url;
@@ -80,6 +120,144 @@ mw::E<Configuration> Configuration::fromYaml(const std::filesystem::path& path)
     {
         tree["client-secret"] >> config.client_secret;
     }
+    if(tree["link-cache-size"].readable())
+    {
+        tree["link-cache-size"] >> config.link_cache_size;
+    }
+    if(tree["shortcut-filter"].readable())
+    {
+        tree["shortcut-filter"] >> config.shortcut_filter;
+    }
+    if(tree["negative-cache-size"].readable())
+    {
+        tree["negative-cache-size"] >> config.negative_cache_size;
+    }
+    if(tree["negative-cache-ttl-sec"].readable())
+    {
+        tree["negative-cache-ttl-sec"] >> config.negative_cache_ttl_sec;
+    }
+    if(tree["visit-flush-interval-ms"].readable())
+    {
+        tree["visit-flush-interval-ms"] >> config.visit_flush_interval_ms;
+    }
+    if(tree["visit-flush-threshold"].readable())
+    {
+        tree["visit-flush-threshold"] >> config.visit_flush_threshold;
+    }
+    if(tree["db-read-connections"].readable())
+    {
+        tree["db-read-connections"] >> config.db_read_connections;
+    }
+    if(tree["db-synchronous"].readable())
+    {
+        tree["db-synchronous"] >> config.db_synchronous;
+    }
+    if(tree["db-mmap-size"].readable())
+    {
+        tree["db-mmap-size"] >> config.db_mmap_size;
+    }
+    if(tree["db-cache-size-kib"].readable())
+    {
+        tree["db-cache-size-kib"] >> config.db_cache_size_kib;
+    }
+    if(tree["snapshot-file"].readable())
+    {
+        tree["snapshot-file"] >> config.snapshot_file;
+    }
+    if(tree["snapshot-interval-sec"].readable())
+    {
+        tree["snapshot-interval-sec"] >> config.snapshot_interval_sec;
+    }
+    if(tree["links-page-size"].readable())
+    {
+        tree["links-page-size"] >> config.links_page_size;
+    }
+    if(tree["session-cache-size"].readable())
+    {
+        tree["session-cache-size"] >> config.session_cache_size;
+    }
+    if(tree["session-cache-ttl-sec"].readable())
+    {
+        tree["session-cache-ttl-sec"] >> config.session_cache_ttl_sec;
+    }
+    if(tree["jwt-local-verification"].readable())
+    {
+        tree["jwt-local-verification"] >> config.jwt_local_verification;
+    }
+    if(tree["jwt-audience"].readable())
+    {
+        tree["jwt-audience"] >> config.jwt_audience;
+    }
+    if(tree["metrics-endpoint"].readable())
+    {
+        tree["metrics-endpoint"] >> config.metrics_endpoint;
+    }
+    if(tree["cluster-nodes"].readable())
+    {
+        tree["cluster-nodes"] >> config.cluster_nodes;
+    }
+    if(tree["cluster-self"].readable())
+    {
+        tree["cluster-self"] >> config.cluster_self;
+    }
+    if(tree["cluster-mode"].readable())
+    {
+        tree["cluster-mode"] >> config.cluster_mode;
+    }
+    if(tree["cluster-virtual-nodes"].readable())
+    {
+        tree["cluster-virtual-nodes"] >> config.cluster_virtual_nodes;
+    }
+    if(tree["cluster-forward-timeout-ms"].readable())
+    {
+        tree["cluster-forward-timeout-ms"] >>
+            config.cluster_forward_timeout_ms;
+    }
+    if(tree["replication-token"].readable())
+    {
+        tree["replication-token"] >> config.replication_token;
+    }
+    if(tree["replication-primary"].readable())
+    {
+        tree["replication-primary"] >> config.replication_primary;
+    }
+    if(tree["replication-state-file"].readable())
+    {
+        tree["replication-state-file"] >> config.replication_state_file;
+    }
+    if(tree["replication-poll-interval-ms"].readable())
+    {
+        tree["replication-poll-interval-ms"] >> config.replication_poll_interval_ms;
+    }
+    if(tree["replication-batch-size"].readable())
+    {
+        tree["replication-batch-size"] >> config.replication_batch_size;
+    }
+    if(tree["replication-log-retention"].readable())
+    {
+        tree["replication-log-retention"] >>
+            config.replication_log_retention;
+    }
+    if(tree["hot-links-size"].readable())
+    {
+        tree["hot-links-size"] >> config.hot_links_size;
+    }
+    if(tree["hot-links-threshold"].readable())
+    {
+        tree["hot-links-threshold"] >> config.hot_links_threshold;
+    }
+    if(tree["hot-links-interval-ms"].readable())
+    {
+        tree["hot-links-interval-ms"] >> config.hot_links_interval_ms;
+    }
+    if(tree["redirect-max-age-sec"].readable())
+    {
+        tree["redirect-max-age-sec"] >> config.redirect_max_age_sec;
+    }
+    if(tree["admin-token"].readable())
+    {
+        tree["admin-token"] >> config.admin_token;
+    }
 
     return mw::E<Configuration>{std::in_place, std::move(config)};
 }
@@ -2,6 +2,7 @@
 
 #include <filesystem>
 #include <string>
+#include <vector>
 
 #include <mw/error.hpp>
 
@@ -13,11 +14,113 @@ struct Configuration
     std::string socket_user = "";
     std::string socket_group = "";
     int socket_permission = 0;
+    // Tuning of the HTTP server. 0 keeps the default of httplib for
+    // each of these. A connection that finds “server_max_queued”
+    // others waiting for a worker is closed right away. With
+    // “server_pin_threads”, each worker is pinned to a CPU, and 0
+    // threads means one per CPU.
+    size_t server_threads = 0;
+    size_t server_max_queued = 0;
+    bool server_pin_threads = false;
+    int listen_backlog = 0;
+    size_t keep_alive_max_count = 0;
+    int keep_alive_timeout_sec = 0;
+    int read_timeout_sec = 0;
+    int write_timeout_sec = 0;
+    size_t max_payload_bytes = 0;
+    bool tcp_nodelay = false;
     std::string base_url = "http://localhost:8123/";
     std::string data_dir = ".";
     std::string openid_url_prefix;
     std::string client_id;
     std::string client_secret;
+    // Maximal number of links kept in the in-memory shortcut cache.
+    // Set this to 0 to disable the cache.
+    size_t link_cache_size = 10000;
+    // Keep a Bloom filter of all shortcuts, so that lookups of
+    // shortcuts that do not exist do not go to the database. Misses
+    // the filter cannot rule out are remembered for
+    // “negative_cache_ttl_sec” seconds. Set the size to 0 to disable
+    // that.
+    bool shortcut_filter = true;
+    size_t negative_cache_size = 100000;
+    int negative_cache_ttl_sec = 60;
+    // Visits are counted in memory, and written to the database
+    // every this many milliseconds, or when this many visits are
+    // pending, whichever comes first.
+    int visit_flush_interval_ms = 5000;
+    uint64_t visit_flush_threshold = 10000;
+    // Number of SQLite connections used for reading. Writes use
+    // another connection.
+    int db_read_connections = 4;
+    // Value of “PRAGMA synchronous”.
+    std::string db_synchronous = "NORMAL";
+    // Size of memory-mapped I/O and the page cache, per connection.
+    int64_t db_mmap_size = 256 * 1024 * 1024;
+    int64_t db_cache_size_kib = 16 * 1024;
+    // If not empty, redirects are served from a memory-mapped
+    // snapshot of all links at this path, which is rebuilt every
+    // “snapshot_interval_sec” seconds and after every change.
+    std::string snapshot_file;
+    int snapshot_interval_sec = 300;
+    // Number of links on a page of the link list.
+    int64_t links_page_size = 100;
+    // Validated access tokens are remembered for this many seconds,
+    // so that most requests do not ask the OpenID Connect provider.
+    // Set the size to 0 to disable this.
+    size_t session_cache_size = 10000;
+    int session_cache_ttl_sec = 60;
+    // Verify signed JWT access tokens with the public keys of the
+    // OpenID Connect provider, instead of asking the provider for
+    // every token. The “aud” claim of the tokens has to include
+    // “jwt_audience”, which defaults to the client ID.
+    bool jwt_local_verification = false;
+    std::string jwt_audience;
+    // Serve metrics for Prometheus at “/_/metrics”.
+    bool metrics_endpoint = true;
+    // Base URLs of all nodes of a cluster, including this one. If
+    // this is empty, this is a single node that owns all links.
+    // Otherwise each node owns the shortcuts that hash to it, and
+    // “cluster_self” is the base URL of this node.
+    std::vector<std::string> cluster_nodes;
+    std::string cluster_self;
+    // How shortcuts owned by another node are served: “redirect” or
+    // “forward”.
+    std::string cluster_mode = "redirect";
+    size_t cluster_virtual_nodes = 128;
+    int cluster_forward_timeout_ms = 1000;
+    // If not empty, the replication log is served to followers that
+    // send this as a bearer token.
+    std::string replication_token;
+    // If not empty, this is a read-only follower of the instance at
+    // this base URL, and “replication_token” is sent to it. The
+    // sequence number of the last applied change is kept in
+    // “replication_state_file”, which defaults to a file in the data
+    // directory.
+    std::string replication_primary;
+    std::string replication_state_file;
+    int replication_poll_interval_ms = 1000;
+    int64_t replication_batch_size = 1000;
+    // The latest this many changes of the replication log are kept
+    // as they are. Older removals are dropped with the additions of
+    // the links they removed. 0 keeps the whole log.
+    int64_t replication_log_retention = 100000;
+    // Up to this many of the most visited links are kept in a table
+    // that is checked before any other lookup. A link is added once
+    // it has about “hot_links_threshold” lookups in an interval of
+    // “hot_links_interval_ms”. Set the size to 0 to disable this.
+    size_t hot_links_size = 64;
+    uint32_t hot_links_threshold = 100;
+    int hot_links_interval_ms = 1000;
+    // Redirects may be kept by browsers and shared caches for this
+    // long, unless a link has its own “cache_max_age”. With 0 they
+    // are revalidated on every use. Caches are not told when a link
+    // is removed, so this is 0 unless set, and a deleted link stops
+    // redirecting right away.
+    int64_t redirect_max_age_sec = 0;
+    // If not empty, the admin endpoints are served to clients that
+    // send this as a bearer token.
+    std::string admin_token;
 
     static mw::E<Configuration> fromYaml(const std::filesystem::path& path);
 };
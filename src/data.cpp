@@ -1,22 +1,28 @@
+#include <array>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <optional>
 #include <expected>
+#include <functional>
 #include <regex>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <sqlite3.h>
 #include <mw/database.hpp>
 #include <mw/error.hpp>
 #include <mw/utils.hpp>
 
 #include "data.hpp"
+#include "regexp_matcher.hpp"
 
-namespace
-{
-
-mw::E<ShortLink> rowToLink(
-    std::tuple<int64_t, int64_t, std::string, std::string, std::string,
-    int, int64_t>& row)
+mw::E<ShortLink> rowToLink(LinkRow& row)
 {
     ShortLink link;
     link.id = std::get<0>(row);
@@ -31,9 +37,236 @@ mw::E<ShortLink> rowToLink(
     }
     link.type = *type;
     link.visits = std::get<6>(row);
+    link.cache_max_age = std::get<7>(row);
     return link;
 }
 
+namespace
+{
+
+mw::E<std::vector<ShortLink>> rowsToLinks(std::vector<LinkRow>&& rows)
+{
+    std::vector<ShortLink> links;
+    links.reserve(rows.size());
+    for(auto& row: rows)
+    {
+        ASSIGN_OR_RETURN(links.emplace_back(), rowToLink(row));
+    }
+    return links;
+}
+
+template<typename T>
+T column(sqlite3_stmt* statement, int i)
+{
+    if constexpr(std::is_same_v<T, std::string>)
+    {
+        const unsigned char* text = sqlite3_column_text(statement, i);
+        if(text == nullptr)
+        {
+            return {};
+        }
+        return std::string(reinterpret_cast<const char*>(text),
+                           sqlite3_column_bytes(statement, i));
+    }
+    else if constexpr(std::is_same_v<T, std::optional<int64_t>>)
+    {
+        if(sqlite3_column_type(statement, i) == SQLITE_NULL)
+        {
+            return std::nullopt;
+        }
+        return sqlite3_column_int64(statement, i);
+    }
+    else
+    {
+        return static_cast<T>(sqlite3_column_int64(statement, i));
+    }
+}
+
+template<typename... Types, size_t... I>
+std::tuple<Types...> columns(sqlite3_stmt* statement,
+                             std::index_sequence<I...>)
+{
+    return {column<Types>(statement, static_cast<int>(I))...};
+}
+
+// Bind “value” to parameter “i”, or NULL if there is none.
+bool bindOptional(sqlite3_stmt* statement, int i,
+                  const std::optional<int64_t>& value)
+{
+    int code = value.has_value() ?
+        sqlite3_bind_int64(statement, i, *value) :
+        sqlite3_bind_null(statement, i);
+    return code == SQLITE_OK;
+}
+
+mw::Error stepError(sqlite3_stmt* statement)
+{
+    mw::Error e = mw::runtimeError(std::format(
+        "Failed to run SQL: {}", sqlite3_errmsg(sqlite3_db_handle(statement))));
+    sqlite3_reset(statement);
+    return e;
+}
+
+// Run a prepared statement, and collect the resulting rows. Unlike
+// mw::SQLite::eval(), this leaves the statement alive, and resets it
+// so that it can be run again.
+template<typename... Types>
+mw::E<std::vector<std::tuple<Types...>>>
+evalPrepared(const mw::SQLiteStatement& statement)
+{
+    sqlite3_stmt* s = statement.data();
+    std::vector<std::tuple<Types...>> rows;
+    while(true)
+    {
+        int code = sqlite3_step(s);
+        if(code == SQLITE_DONE)
+        {
+            break;
+        }
+        if(code != SQLITE_ROW)
+        {
+            return std::unexpected(stepError(s));
+        }
+        rows.push_back(columns<Types...>(s, std::index_sequence_for<Types...>{}));
+    }
+    sqlite3_reset(s);
+    return rows;
+}
+
+// Like evalPrepared(), but for statements that do not return rows.
+mw::E<void> executePrepared(const mw::SQLiteStatement& statement)
+{
+    sqlite3_stmt* s = statement.data();
+    int code;
+    do
+    {
+        code = sqlite3_step(s);
+    } while(code == SQLITE_ROW);
+    if(code != SQLITE_DONE)
+    {
+        return std::unexpected(stepError(s));
+    }
+    sqlite3_reset(s);
+    return {};
+}
+
+mw::E<void> configureConnection(mw::SQLite& db,
+                                const DataSourceSQLite::Options& options)
+{
+    DO_OR_RETURN(db.execute(std::format("PRAGMA synchronous = {};",
+                                        options.synchronous)));
+    DO_OR_RETURN(db.execute(std::format("PRAGMA mmap_size = {};",
+                                        options.mmap_size)));
+    // A negative cache size is in KiB rather than in pages.
+    DO_OR_RETURN(db.execute(std::format("PRAGMA cache_size = -{};",
+                                        options.cache_size_kib)));
+    // Wait for the lock instead of failing right away, e.g. during a
+    // checkpoint.
+    return db.execute("PRAGMA busy_timeout = 5000;");
+}
+
+// Schema version 2 adds indexes for listing the links of a user, and
+// for loading the regexp links. Both queries filter on the first
+// column and sort on the second, so neither needs a table scan or a
+// temporary B-tree. The rest of the row is fetched by rowid.
+mw::E<void> upgradeSchema1To2(mw::SQLite& db)
+{
+    DO_OR_RETURN(db.execute(
+        "CREATE INDEX IF NOT EXISTS LinksByUser ON Links (user_id, id);"));
+    return db.execute(
+        "CREATE INDEX IF NOT EXISTS LinksByType ON Links (type, id);");
+}
+
+// Schema version 3 adds the replication log. Triggers append every
+// insert and delete of a link to it, so that nothing that writes the
+// database, including another process, can bypass it. The links
+// already there are logged as added, so that a follower can start
+// from an empty database. Sequence numbers are never reused, even
+// after the last change is gone.
+mw::E<void> upgradeSchema2To3(mw::SQLite& db)
+{
+    DO_OR_RETURN(db.execute(
+        "CREATE TABLE IF NOT EXISTS Changes "
+        "(seq INTEGER PRIMARY KEY AUTOINCREMENT, op INTEGER, link_id INTEGER,"
+        " time_creation INTEGER, user_id TEXT, shortcut TEXT,"
+        " original_url TEXT, type INTEGER, visits INTEGER);"));
+    DO_OR_RETURN(db.execute(
+        "INSERT INTO Changes (op, link_id, time_creation, user_id, shortcut,"
+        " original_url, type, visits) SELECT 1, id, time_creation, user_id,"
+        " shortcut, original_url, type, visits FROM Links ORDER BY id;"));
+    DO_OR_RETURN(db.execute(
+        "CREATE TRIGGER IF NOT EXISTS LogLinkInsert AFTER INSERT ON Links "
+        "BEGIN INSERT INTO Changes (op, link_id, time_creation, user_id,"
+        " shortcut, original_url, type, visits) VALUES (1, NEW.id,"
+        " NEW.time_creation, NEW.user_id, NEW.shortcut, NEW.original_url,"
+        " NEW.type, NEW.visits); END;"));
+    return db.execute(
+        "CREATE TRIGGER IF NOT EXISTS LogLinkDelete AFTER DELETE ON Links "
+        "BEGIN INSERT INTO Changes (op, link_id, time_creation, user_id,"
+        " shortcut, original_url, type, visits) VALUES (2, OLD.id,"
+        " OLD.time_creation, OLD.user_id, OLD.shortcut, OLD.original_url,"
+        " OLD.type, OLD.visits); END;");
+}
+
+// Schema version 4 adds how long a redirect of each link may be
+// cached, which is NULL for the default. The change log carries it
+// too, so the triggers are replaced.
+mw::E<void> upgradeSchema3To4(mw::SQLite& db)
+{
+    DO_OR_RETURN(db.execute(
+        "ALTER TABLE Links ADD COLUMN cache_max_age INTEGER;"));
+    DO_OR_RETURN(db.execute(
+        "ALTER TABLE Changes ADD COLUMN cache_max_age INTEGER;"));
+    DO_OR_RETURN(db.execute("DROP TRIGGER IF EXISTS LogLinkInsert;"));
+    DO_OR_RETURN(db.execute("DROP TRIGGER IF EXISTS LogLinkDelete;"));
+    DO_OR_RETURN(db.execute(
+        "CREATE TRIGGER LogLinkInsert AFTER INSERT ON Links "
+        "BEGIN INSERT INTO Changes (op, link_id, time_creation, user_id,"
+        " shortcut, original_url, type, visits, cache_max_age) VALUES (1,"
+        " NEW.id, NEW.time_creation, NEW.user_id, NEW.shortcut,"
+        " NEW.original_url, NEW.type, NEW.visits, NEW.cache_max_age); END;"));
+    return db.execute(
+        "CREATE TRIGGER LogLinkDelete AFTER DELETE ON Links "
+        "BEGIN INSERT INTO Changes (op, link_id, time_creation, user_id,"
+        " shortcut, original_url, type, visits, cache_max_age) VALUES (2,"
+        " OLD.id, OLD.time_creation, OLD.user_id, OLD.shortcut,"
+        " OLD.original_url, OLD.type, OLD.visits, OLD.cache_max_age); END;");
+}
+
+// Schema version 5 lets the replication log be compacted. It keeps
+// the sequence number up to which the log is compacted, and indexes
+// the changes by link, so that the addition of a removed link is
+// found quickly.
+mw::E<void> upgradeSchema4To5(mw::SQLite& db)
+{
+    DO_OR_RETURN(db.execute(
+        "CREATE TABLE IF NOT EXISTS ChangeLogState "
+        "(compacted_seq INTEGER NOT NULL);"));
+    DO_OR_RETURN(db.execute("INSERT INTO ChangeLogState VALUES (0);"));
+    return db.execute(
+        "CREATE INDEX IF NOT EXISTS ChangesByLink ON Changes (link_id, seq);");
+}
+
+// Schema upgrades. The i-th function upgrades the schema from version
+// i+1 to i+2. To change the schema, add a function to the end.
+using SchemaUpgrade = mw::E<void>(*)(mw::SQLite&);
+constexpr std::array<SchemaUpgrade, 4> SCHEMA_UPGRADES = {
+    upgradeSchema1To2,
+    upgradeSchema2To3,
+    upgradeSchema3To4,
+    upgradeSchema4To5,
+};
+constexpr int64_t LATEST_SCHEMA_VERSION = SCHEMA_UPGRADES.size() + 1;
+
+// Label values of the query durations, in the order of
+// DataSourceSQLite::Query.
+constexpr const char* QUERY_NAMES[] = {
+    "add_link", "add_links", "find_link_by_shortcut", "resolve_shortcut",
+    "find_link_from_regexp_links", "get_all_links", "get_links",
+    "for_each_link", "get_link", "remove_link", "add_visits", "get_changes",
+    "latest_change_seq", "compacted_change_seq",
+};
+
 } // namespace
 
 std::optional<ShortLink::Type> ShortLink::typeFromInt(int t)
@@ -45,30 +278,74 @@ std::optional<ShortLink::Type> ShortLink::typeFromInt(int t)
     case REGEXP:
         return REGEXP;
     default:
-        std::unreachable();
+        return std::nullopt;
     }
 }
 
+DataSourceSQLite::DataSourceSQLite(std::unique_ptr<mw::SQLite> conn)
+{
+    write_conn.db = std::move(conn);
+}
+
 mw::E<std::unique_ptr<DataSourceSQLite>>
-DataSourceSQLite::fromFile(const std::string& db_file)
+DataSourceSQLite::fromFile(const std::string& db_file, const Options& options)
 {
     auto data_source = std::make_unique<DataSourceSQLite>();
-    ASSIGN_OR_RETURN(data_source->db, mw::SQLite::connectFile(db_file));
-
-    // Perform schema upgrade here.
-    //
-    // data_source->upgradeSchema1To2();
+    const bool in_memory = db_file == ":memory:";
+    ASSIGN_OR_RETURN(data_source->write_conn.db,
+                     mw::SQLite::connectFile(db_file));
+    if(!in_memory)
+    {
+        // The journal mode is persistent in the database file, so it
+        // only needs to be set once, on the writer.
+        ASSIGN_OR_RETURN(std::string mode,
+                         data_source->write_conn.db->evalToValue<std::string>(
+                             "PRAGMA journal_mode = WAL;"));
+        if(mode != "wal")
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Failed to use WAL mode, journal mode is {}", mode)));
+        }
+    }
+    DO_OR_RETURN(configureConnection(*data_source->write_conn.db, options));
+    data_source->change_log_retention = options.change_log_retention;
 
-    // Update this line when schema updates.
-    DO_OR_RETURN(data_source->setSchemaVersion(1));
-    DO_OR_RETURN(data_source->db->execute(
+    // This is the schema of version 1. Newer versions are reached by
+    // upgrading, also for new databases, so that there is only one
+    // way to arrive at the latest schema.
+    DO_OR_RETURN(data_source->write_conn.db->execute(
         "CREATE TABLE IF NOT EXISTS Links "
         "(id INTEGER PRIMARY KEY, time_creation INTEGER, user_id TEXT,"
         " shortcut TEXT UNIQUE, original_url TEXT, type INTEGER,"
         " visits INTEGER);"));
+    DO_OR_RETURN(data_source->upgradeSchema());
+    if(options.metrics != nullptr)
+    {
+        data_source->registerMetrics(*options.metrics);
+    }
+
+    if(in_memory)
+    {
+        return data_source;
+    }
+    for(int i = 0; i < options.read_connections; i++)
+    {
+        auto conn = std::make_unique<Connection>();
+        ASSIGN_OR_RETURN(conn->db, mw::SQLite::connectFile(db_file));
+        DO_OR_RETURN(configureConnection(*conn->db, options));
+        DO_OR_RETURN(conn->db->execute("PRAGMA query_only = ON;"));
+        data_source->idle_read_conns.push_back(conn.get());
+        data_source->read_conns.push_back(std::move(conn));
+    }
     return data_source;
 }
 
+mw::E<std::unique_ptr<DataSourceSQLite>>
+DataSourceSQLite::fromFile(const std::string& db_file)
+{
+    return fromFile(db_file, Options());
+}
+
 mw::E<std::unique_ptr<DataSourceSQLite>> DataSourceSQLite::newFromMemory()
 {
     return fromFile(":memory:");
@@ -76,31 +353,109 @@ mw::E<std::unique_ptr<DataSourceSQLite>> DataSourceSQLite::newFromMemory()
 
 mw::E<int64_t> DataSourceSQLite::getSchemaVersion() const
 {
-    return db->evalToValue<int64_t>("PRAGMA user_version;");
+    ConnectionHandle conn = writer();
+    return conn->db->evalToValue<int64_t>("PRAGMA user_version;");
 }
 
 mw::E<void> DataSourceSQLite::addLink(ShortLink&& link) const
 {
-    ASSIGN_OR_RETURN(auto statement, db->statementFromStr(
+    Metrics::Timer timer = timeQuery(ADD_LINK);
+    ConnectionHandle conn = writer();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
         "INSERT INTO Links (time_creation, user_id, shortcut, original_url,"
-        " type, visits) VALUES (?, ?, ?, ?, ?, 0);"));
-    DO_OR_RETURN((statement.bind<int64_t, std::string, std::string,
+        " type, visits, cache_max_age) VALUES (?, ?, ?, ?, ?, 0, ?);"));
+    DO_OR_RETURN((statement->bind<int64_t, std::string, std::string,
                   std::string&, int>(
         mw::timeToSeconds(mw::Clock::now()), link.user_id, link.shortcut,
         link.original_url, link.type)));
-    return db->execute(std::move(statement));
+    if(!bindOptional(statement->data(), 6, link.cache_max_age))
+    {
+        return std::unexpected(stepError(statement->data()));
+    }
+    DO_OR_RETURN(executePrepared(*statement));
+    if(link.type == ShortLink::REGEXP)
+    {
+        invalidateRegexpLinks();
+    }
+    return {};
+}
+
+mw::E<std::vector<size_t>>
+DataSourceSQLite::addLinks(const std::vector<ShortLink>& links) const
+{
+    Metrics::Timer timer = timeQuery(ADD_LINKS);
+    ConnectionHandle conn = writer();
+    std::vector<size_t> skipped;
+    bool has_regexp = false;
+    DO_OR_RETURN(conn->db->execute("BEGIN TRANSACTION;"));
+    mw::E<void> result = [&]() -> mw::E<void>
+    {
+        ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+            "INSERT INTO Links (time_creation, user_id, shortcut,"
+            " original_url, type, visits, cache_max_age)"
+            " VALUES (?, ?, ?, ?, ?, ?, ?)"
+            " ON CONFLICT (shortcut) DO NOTHING;"));
+        sqlite3_stmt* s = statement->data();
+        // The strings are bound without copying. Each row is stepped
+        // and reset before the next one is bound, while “links” is
+        // alive.
+        auto bind_text = [s](int i, const std::string& text)
+        {
+            return sqlite3_bind_text(s, i, text.data(),
+                                     static_cast<int>(text.size()),
+                                     SQLITE_STATIC) == SQLITE_OK;
+        };
+        for(size_t i = 0; i < links.size(); i++)
+        {
+            const ShortLink& link = links[i];
+            if(sqlite3_bind_int64(s, 1, mw::timeToSeconds(link.time_creation))
+               != SQLITE_OK || !bind_text(2, link.user_id) ||
+               !bind_text(3, link.shortcut) ||
+               !bind_text(4, link.original_url) ||
+               sqlite3_bind_int(s, 5, link.type) != SQLITE_OK ||
+               sqlite3_bind_int64(s, 6, static_cast<int64_t>(link.visits))
+               != SQLITE_OK || !bindOptional(s, 7, link.cache_max_age))
+            {
+                return std::unexpected(stepError(s));
+            }
+            DO_OR_RETURN(executePrepared(*statement));
+            if(sqlite3_changes(conn->db->data()) == 0)
+            {
+                skipped.push_back(i);
+            }
+            else if(link.type == ShortLink::REGEXP)
+            {
+                has_regexp = true;
+            }
+        }
+        return {};
+    }();
+    if(!result.has_value())
+    {
+        std::ignore = conn->db->execute("ROLLBACK;");
+        return std::unexpected(result.error());
+    }
+    DO_OR_RETURN(conn->db->execute("COMMIT;"));
+    if(has_regexp)
+    {
+        invalidateRegexpLinks();
+    }
+    return skipped;
 }
 
 mw::E<std::optional<ShortLink>> DataSourceSQLite::findLinkByShortcut(
     const std::string& shortcut) const
 {
-    ASSIGN_OR_RETURN(auto statement, db->statementFromStr(
+    Metrics::Timer timer = timeQuery(FIND_LINK_BY_SHORTCUT);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
         "SELECT id, time_creation, user_id, shortcut, original_url, type,"
-        " visits FROM Links WHERE shortcut = ?;"));
-    DO_OR_RETURN(statement.bind<std::string>(shortcut));
+        " visits, cache_max_age FROM Links WHERE shortcut = ?;"));
+    DO_OR_RETURN(statement->bind<std::string>(shortcut));
     ASSIGN_OR_RETURN(
-        auto rows, (db->eval<int64_t, int64_t, std::string, std::string,
-                    std::string, int, int64_t>(std::move(statement))));
+        auto rows, (evalPrepared<int64_t, int64_t, std::string, std::string,
+                    std::string, int, int64_t, std::optional<int64_t>>(
+                        *statement)));
     if(rows.empty())
     {
         return std::nullopt;
@@ -108,55 +463,164 @@ mw::E<std::optional<ShortLink>> DataSourceSQLite::findLinkByShortcut(
     return rowToLink(rows[0]);
 }
 
+mw::E<std::optional<ResolvedLink>> DataSourceSQLite::resolveShortcut(
+    std::string_view shortcut, std::string& url) const
+{
+    Metrics::Timer timer = timeQuery(RESOLVE_SHORTCUT);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+        "SELECT id, original_url, cache_max_age FROM Links"
+        " WHERE shortcut = ?;"));
+    sqlite3_stmt* s = statement->data();
+    // Bind the shortcut without copying it. The statement is reset
+    // before returning, and the binding is cleared before the next
+    // use, so SQLite never reads it after “shortcut” is gone.
+    if(sqlite3_bind_text(s, 1, shortcut.data(),
+                         static_cast<int>(shortcut.size()), SQLITE_STATIC)
+       != SQLITE_OK)
+    {
+        return std::unexpected(stepError(s));
+    }
+    int code = sqlite3_step(s);
+    if(code == SQLITE_DONE)
+    {
+        sqlite3_reset(s);
+        return std::nullopt;
+    }
+    if(code != SQLITE_ROW)
+    {
+        return std::unexpected(stepError(s));
+    }
+    ResolvedLink link;
+    link.id = sqlite3_column_int64(s, 0);
+    link.cache_max_age = column<std::optional<int64_t>>(s, 2);
+    const unsigned char* text = sqlite3_column_text(s, 1);
+    if(text == nullptr)
+    {
+        url.clear();
+    }
+    else
+    {
+        url.assign(reinterpret_cast<const char*>(text),
+                   sqlite3_column_bytes(s, 1));
+    }
+    sqlite3_reset(s);
+    return link;
+}
+
 mw::E<std::optional<ShortLink>> DataSourceSQLite::findLinkFromRegexpLinks(
     const std::string& shortcut) const
 {
-    ASSIGN_OR_RETURN(auto statement, db->statementFromStr(
-        "SELECT id, time_creation, user_id, shortcut, original_url, type,"
-        " visits FROM Links WHERE type = ?;"));
-    DO_OR_RETURN(statement.bind<int>(ShortLink::REGEXP));
-    ASSIGN_OR_RETURN(
-        auto rows, (db->eval<int64_t, int64_t, std::string, std::string,
-                    std::string, int, int64_t>(std::move(statement))));
-    for(auto& row: std::move(rows))
+    Metrics::Timer timer = timeQuery(FIND_LINK_FROM_REGEXP_LINKS);
+    ASSIGN_OR_RETURN(std::shared_ptr<const RegexpLinkMatcher> matcher,
+                     regexpMatcher());
+    std::smatch captures;
+    const ShortLink* link = matcher->match(shortcut, captures);
+    if(link == nullptr)
     {
-        ASSIGN_OR_RETURN(ShortLink link, rowToLink(row));
-        // Ensure it’s a full match
-        if(std::regex_match(shortcut, std::regex(link.shortcut)))
-        {
-            return link;
-        }
+        return std::nullopt;
     }
-    return std::nullopt;
+    ShortLink result = *link;
+    result.original_url = RegexpLinkMatcher::expandCaptures(
+        link->original_url, captures);
+    return result;
 }
 
 mw::E<std::vector<ShortLink>> DataSourceSQLite::getAllLinks(
     const std::string& user_id) const
 {
-    ASSIGN_OR_RETURN(auto statement, db->statementFromStr(
+    Metrics::Timer timer = timeQuery(GET_ALL_LINKS);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
         "SELECT id, time_creation, user_id, shortcut, original_url, type,"
-        " visits FROM Links WHERE user_id = ?;"));
-    DO_OR_RETURN(statement.bind<std::string>(user_id));
-    ASSIGN_OR_RETURN(auto rows, (db->eval<int64_t, int64_t, std::string, std::string,
-                            std::string, int, int64_t>(std::move(statement))));
-    std::vector<ShortLink> links;
-    links.reserve(rows.size());
-    for(auto& row: std::move(rows))
+        " visits, cache_max_age FROM Links WHERE user_id = ? ORDER BY id;"));
+    DO_OR_RETURN(statement->bind<std::string>(user_id));
+    ASSIGN_OR_RETURN(auto rows, (evalPrepared<int64_t, int64_t, std::string,
+                                 std::string, std::string, int, int64_t,
+                                 std::optional<int64_t>>(*statement)));
+    return rowsToLinks(std::move(rows));
+}
+
+mw::E<std::vector<ShortLink>> DataSourceSQLite::getLinks(
+    const std::string& user_id, const LinkPageQuery& query) const
+{
+    Metrics::Timer timer = timeQuery(GET_LINKS);
+    ConnectionHandle conn = reader();
+    mw::SQLiteStatement* statement;
+    int64_t after;
+    // Both are range scans on the LinksByUser index.
+    if(query.order == LinkPageQuery::ASCENDING)
     {
-        ASSIGN_OR_RETURN(links.emplace_back(), rowToLink(row));
+        ASSIGN_OR_RETURN(statement, conn->prepared(
+            "SELECT id, time_creation, user_id, shortcut, original_url, type,"
+            " visits, cache_max_age FROM Links WHERE user_id = ? AND id > ?"
+            " ORDER BY id LIMIT ?;"));
+        after = query.after_id.value_or(std::numeric_limits<int64_t>::min());
     }
-    return links;
+    else
+    {
+        ASSIGN_OR_RETURN(statement, conn->prepared(
+            "SELECT id, time_creation, user_id, shortcut, original_url, type,"
+            " visits, cache_max_age FROM Links WHERE user_id = ? AND id < ?"
+            " ORDER BY id DESC LIMIT ?;"));
+        after = query.after_id.value_or(std::numeric_limits<int64_t>::max());
+    }
+    DO_OR_RETURN((statement->bind<std::string, int64_t, int64_t>(
+        user_id, after, query.limit)));
+    ASSIGN_OR_RETURN(auto rows, (evalPrepared<int64_t, int64_t, std::string,
+                                 std::string, std::string, int, int64_t,
+                                 std::optional<int64_t>>(*statement)));
+    return rowsToLinks(std::move(rows));
+}
+
+mw::E<void> DataSourceSQLite::forEachLink(
+    const std::function<mw::E<void>(ShortLink&&)>& f) const
+{
+    Metrics::Timer timer = timeQuery(FOR_EACH_LINK);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+        "SELECT id, time_creation, user_id, shortcut, original_url, type,"
+        " visits, cache_max_age FROM Links ORDER BY id;"));
+    sqlite3_stmt* s = statement->data();
+    while(true)
+    {
+        int code = sqlite3_step(s);
+        if(code == SQLITE_DONE)
+        {
+            break;
+        }
+        if(code != SQLITE_ROW)
+        {
+            return std::unexpected(stepError(s));
+        }
+        auto row = columns<int64_t, int64_t, std::string, std::string,
+                           std::string, int, int64_t, std::optional<int64_t>>(
+            s, std::make_index_sequence<8>{});
+        mw::E<ShortLink> link = rowToLink(row);
+        mw::E<void> result = link.has_value() ? f(*std::move(link)) :
+            std::unexpected(link.error());
+        if(!result.has_value())
+        {
+            sqlite3_reset(s);
+            return result;
+        }
+    }
+    sqlite3_reset(s);
+    return {};
 }
 
 mw::E<std::optional<ShortLink>> DataSourceSQLite::getLink(int64_t id) const
 {
-    ASSIGN_OR_RETURN(auto statement, db->statementFromStr(
+    Metrics::Timer timer = timeQuery(GET_LINK);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
         "SELECT id, time_creation, user_id, shortcut, original_url, type,"
-        " visits FROM Links WHERE id = ?;"));
-    DO_OR_RETURN(statement.bind<int64_t>(id));
+        " visits, cache_max_age FROM Links WHERE id = ?;"));
+    DO_OR_RETURN(statement->bind<int64_t>(id));
     ASSIGN_OR_RETURN(
-        auto rows, (db->eval<int64_t, int64_t, std::string, std::string,
-                    std::string, int, int64_t>(std::move(statement))));
+        auto rows, (evalPrepared<int64_t, int64_t, std::string, std::string,
+                    std::string, int, int64_t, std::optional<int64_t>>(
+                        *statement)));
     if(rows.empty())
     {
         return std::nullopt;
@@ -167,13 +631,317 @@ mw::E<std::optional<ShortLink>> DataSourceSQLite::getLink(int64_t id) const
 
 mw::E<void> DataSourceSQLite::removeLink(int64_t id) const
 {
-    ASSIGN_OR_RETURN(auto statement, db->statementFromStr(
-        "DELETE FROM Links WHERE id = ?;"));
-    DO_OR_RETURN(statement.bind<int>(id));
-    return db->execute(std::move(statement));
+    Metrics::Timer timer = timeQuery(REMOVE_LINK);
+    ConnectionHandle conn = writer();
+    DO_OR_RETURN(conn->db->execute("BEGIN TRANSACTION;"));
+    mw::E<void> result = [&]() -> mw::E<void>
+    {
+        ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+            "DELETE FROM Links WHERE id = ?;"));
+        DO_OR_RETURN(statement->bind<int64_t>(id));
+        DO_OR_RETURN(executePrepared(*statement));
+        // Only removals leave anything to compact.
+        if(change_log_retention > 0)
+        {
+            return compactChanges(*conn);
+        }
+        return {};
+    }();
+    if(!result.has_value())
+    {
+        std::ignore = conn->db->execute("ROLLBACK;");
+        return std::unexpected(result.error());
+    }
+    DO_OR_RETURN(conn->db->execute("COMMIT;"));
+    // The type of the removed link is unknown here. Rebuilding the
+    // regexps is cheap enough compared to how rare removal is.
+    invalidateRegexpLinks();
+    return {};
+}
+
+mw::E<void> DataSourceSQLite::addVisits(
+    const std::unordered_map<int64_t, uint64_t>& visits) const
+{
+    Metrics::Timer timer = timeQuery(ADD_VISITS);
+    ConnectionHandle conn = writer();
+    DO_OR_RETURN(conn->db->execute("BEGIN TRANSACTION;"));
+    for(const auto& [id, count]: visits)
+    {
+        mw::E<void> result = [&]() -> mw::E<void>
+        {
+            ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+                "UPDATE Links SET visits = visits + ? WHERE id = ?;"));
+            DO_OR_RETURN((statement->bind<int64_t, int64_t>(
+                static_cast<int64_t>(count), id)));
+            return executePrepared(*statement);
+        }();
+        if(!result.has_value())
+        {
+            // Ignore the error of rollback, the original one is more
+            // important.
+            std::ignore = conn->db->execute("ROLLBACK;");
+            return result;
+        }
+    }
+    return conn->db->execute("COMMIT;");
+}
+
+mw::E<std::vector<LinkChange>>
+DataSourceSQLite::getChanges(int64_t after_seq, int64_t limit) const
+{
+    Metrics::Timer timer = timeQuery(GET_CHANGES);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+        "SELECT seq, op, link_id, time_creation, user_id, shortcut,"
+        " original_url, type, visits, cache_max_age FROM Changes"
+        " WHERE seq > ? ORDER BY seq LIMIT ?;"));
+    DO_OR_RETURN((statement->bind<int64_t, int64_t>(after_seq, limit)));
+    ASSIGN_OR_RETURN(
+        auto rows, (evalPrepared<int64_t, int, int64_t, int64_t, std::string,
+                    std::string, std::string, int, int64_t,
+                    std::optional<int64_t>>(*statement)));
+    std::vector<LinkChange> changes;
+    changes.reserve(rows.size());
+    for(auto& row: rows)
+    {
+        LinkChange& change = changes.emplace_back();
+        change.seq = std::get<0>(row);
+        if(std::get<1>(row) != LinkChange::ADD &&
+           std::get<1>(row) != LinkChange::REMOVE)
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Invalid operation in change {}", change.seq)));
+        }
+        change.op = static_cast<LinkChange::Op>(std::get<1>(row));
+        LinkRow link_row(std::get<2>(row), std::get<3>(row),
+                         std::move(std::get<4>(row)),
+                         std::move(std::get<5>(row)),
+                         std::move(std::get<6>(row)), std::get<7>(row),
+                         std::get<8>(row), std::get<9>(row));
+        ASSIGN_OR_RETURN(change.link, rowToLink(link_row));
+    }
+    return changes;
+}
+
+mw::E<int64_t> DataSourceSQLite::latestChangeSeq() const
+{
+    Metrics::Timer timer = timeQuery(LATEST_CHANGE_SEQ);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+        "SELECT coalesce(max(seq), 0) FROM Changes;"));
+    ASSIGN_OR_RETURN(auto rows, evalPrepared<int64_t>(*statement));
+    return rows.empty() ? 0 : std::get<0>(rows[0]);
+}
+
+mw::E<int64_t> DataSourceSQLite::compactedChangeSeq() const
+{
+    Metrics::Timer timer = timeQuery(COMPACTED_CHANGE_SEQ);
+    ConnectionHandle conn = reader();
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+        "SELECT compacted_seq FROM ChangeLogState;"));
+    ASSIGN_OR_RETURN(auto rows, evalPrepared<int64_t>(*statement));
+    return rows.empty() ? 0 : std::get<0>(rows[0]);
+}
+
+mw::E<void> DataSourceSQLite::compactChanges(Connection& conn) const
+{
+    ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn.prepared(
+        "SELECT coalesce(max(seq), 0),"
+        " (SELECT compacted_seq FROM ChangeLogState) FROM Changes;"));
+    ASSIGN_OR_RETURN(auto rows, (evalPrepared<int64_t, int64_t>(*statement)));
+    if(rows.empty())
+    {
+        return {};
+    }
+    const int64_t compacted = std::get<1>(rows[0]);
+    const int64_t cutoff = std::get<0>(rows[0]) - change_log_retention;
+    if(cutoff <= compacted)
+    {
+        return {};
+    }
+    // Drop the removals up to “cutoff” that are not compacted yet,
+    // and the additions of the links they removed, which may be
+    // older. IDs of links may be reused, so only additions before a
+    // removal are dropped with it.
+    ASSIGN_OR_RETURN(statement, conn.prepared(
+        "DELETE FROM Changes WHERE seq IN (SELECT added.seq"
+        " FROM Changes AS removed JOIN Changes AS added"
+        " ON added.link_id = removed.link_id AND added.op = 1"
+        " AND added.seq < removed.seq"
+        " WHERE removed.op = 2 AND removed.seq > ? AND removed.seq <= ?);"));
+    DO_OR_RETURN((statement->bind<int64_t, int64_t>(compacted, cutoff)));
+    DO_OR_RETURN(executePrepared(*statement));
+    ASSIGN_OR_RETURN(statement, conn.prepared(
+        "DELETE FROM Changes WHERE op = 2 AND seq > ? AND seq <= ?;"));
+    DO_OR_RETURN((statement->bind<int64_t, int64_t>(compacted, cutoff)));
+    DO_OR_RETURN(executePrepared(*statement));
+    ASSIGN_OR_RETURN(statement, conn.prepared(
+        "UPDATE ChangeLogState SET compacted_seq = ?;"));
+    DO_OR_RETURN(statement->bind<int64_t>(cutoff));
+    return executePrepared(*statement);
+}
+
+mw::E<void> DataSourceSQLite::upgradeSchema() const
+{
+    ConnectionHandle conn = writer();
+    ASSIGN_OR_RETURN(int64_t version, conn->db->evalToValue<int64_t>(
+        "PRAGMA user_version;"));
+    // A new database has version 0, but its table is already of
+    // version 1.
+    if(version == 0)
+    {
+        version = 1;
+        DO_OR_RETURN(conn->db->execute("PRAGMA user_version = 1;"));
+    }
+    if(version > LATEST_SCHEMA_VERSION)
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Database schema version {} is newer than the supported {}",
+            version, LATEST_SCHEMA_VERSION)));
+    }
+
+    for(; version < LATEST_SCHEMA_VERSION; version++)
+    {
+        DO_OR_RETURN(conn->db->execute("BEGIN TRANSACTION;"));
+        mw::E<void> result = [&]() -> mw::E<void>
+        {
+            DO_OR_RETURN(SCHEMA_UPGRADES[version - 1](*conn->db));
+            return conn->db->execute(
+                std::format("PRAGMA user_version = {};", version + 1));
+        }();
+        if(!result.has_value())
+        {
+            std::ignore = conn->db->execute("ROLLBACK;");
+            return std::unexpected(mw::runtimeError(std::format(
+                "Failed to upgrade schema from version {}: {}", version,
+                mw::errorMsg(result.error()))));
+        }
+        DO_OR_RETURN(conn->db->execute("COMMIT;"));
+    }
+    return {};
+}
+
+void DataSourceSQLite::registerMetrics(Metrics& m)
+{
+    static_assert(std::size(QUERY_NAMES) == QUERY_COUNT);
+    metrics = &m;
+    for(size_t i = 0; i < QUERY_COUNT; i++)
+    {
+        query_histograms[i] = m.histogram(
+            "shrt_db_query_seconds", "Duration of database queries",
+            std::format("query=\"{}\"", QUERY_NAMES[i]));
+    }
+}
+
+Metrics::Timer DataSourceSQLite::timeQuery(Query query) const
+{
+    return Metrics::Timer(metrics, query_histograms[query]);
 }
 
 mw::E<void> DataSourceSQLite::setSchemaVersion(int64_t v) const
 {
-    return db->execute(std::format("PRAGMA user_version = {};", v));
+    ConnectionHandle conn = writer();
+    return conn->db->execute(std::format("PRAGMA user_version = {};", v));
+}
+
+mw::E<std::shared_ptr<const RegexpLinkMatcher>>
+DataSourceSQLite::regexpMatcher() const
+{
+    uint64_t generation;
+    {
+        std::lock_guard<std::mutex> guard(regexp_lock);
+        if(regexp_matcher != nullptr)
+        {
+            return regexp_matcher;
+        }
+        generation = regexp_generation;
+    }
+
+    std::vector<LinkRow> rows;
+    {
+        ConnectionHandle conn = reader();
+        ASSIGN_OR_RETURN(mw::SQLiteStatement* statement, conn->prepared(
+            "SELECT id, time_creation, user_id, shortcut, original_url, type,"
+            " visits, cache_max_age FROM Links WHERE type = ? ORDER BY id;"));
+        DO_OR_RETURN(statement->bind<int>(ShortLink::REGEXP));
+        ASSIGN_OR_RETURN(
+            rows, (evalPrepared<int64_t, int64_t, std::string, std::string,
+                   std::string, int, int64_t, std::optional<int64_t>>(
+                       *statement)));
+    }
+    ASSIGN_OR_RETURN(std::vector<ShortLink> links,
+                     rowsToLinks(std::move(rows)));
+    auto matcher = std::make_shared<const RegexpLinkMatcher>(std::move(links));
+
+    std::lock_guard<std::mutex> guard(regexp_lock);
+    // Don’t keep it if the links changed while we were reading them.
+    if(generation == regexp_generation)
+    {
+        regexp_matcher = matcher;
+    }
+    return matcher;
+}
+
+void DataSourceSQLite::invalidateRegexpLinks() const
+{
+    std::lock_guard<std::mutex> guard(regexp_lock);
+    regexp_generation++;
+    regexp_matcher.reset();
+}
+
+mw::E<mw::SQLiteStatement*>
+DataSourceSQLite::Connection::prepared(std::string_view sql)
+{
+    auto it = statements.find(sql);
+    if(it == statements.end())
+    {
+        ASSIGN_OR_RETURN(mw::SQLiteStatement statement,
+                         db->statementFromStr(std::string(sql)));
+        it = statements.emplace(sql, std::move(statement)).first;
+        return &it->second;
+    }
+    // The statement is reset after every successful run, but not if
+    // binding failed half way.
+    sqlite3_reset(it->second.data());
+    sqlite3_clear_bindings(it->second.data());
+    return &it->second;
+}
+
+DataSourceSQLite::ConnectionHandle::ConnectionHandle(
+    const DataSourceSQLite& source, Connection& c,
+    std::unique_lock<std::mutex>&& guard)
+        : data_source(source), conn(&c), write_guard(std::move(guard))
+{
+}
+
+DataSourceSQLite::ConnectionHandle::~ConnectionHandle()
+{
+    if(write_guard.owns_lock())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(data_source.read_lock);
+        data_source.idle_read_conns.push_back(conn);
+    }
+    data_source.read_available.notify_one();
+}
+
+DataSourceSQLite::ConnectionHandle DataSourceSQLite::reader() const
+{
+    if(read_conns.empty())
+    {
+        return writer();
+    }
+    std::unique_lock<std::mutex> guard(read_lock);
+    read_available.wait(guard, [this] { return !idle_read_conns.empty(); });
+    Connection* conn = idle_read_conns.back();
+    idle_read_conns.pop_back();
+    return ConnectionHandle(*this, *conn, {});
+}
+
+DataSourceSQLite::ConnectionHandle DataSourceSQLite::writer() const
+{
+    return ConnectionHandle(*this, write_conn,
+                            std::unique_lock<std::mutex>(write_lock));
 }
@@ -1,13 +1,22 @@
 #pragma once
 
+#include <array>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 
 #include <mw/database.hpp>
 #include <mw/error.hpp>
 
+#include "metrics.hpp"
+
 struct ShortLink
 {
     enum Type { NORMAL = 1, REGEXP };
@@ -22,10 +31,58 @@ struct ShortLink
     std::string user_name;
     uint64_t visits;
     mw::Time time_creation;
+    // How many seconds clients may cache a redirect of this link, or
+    // nullopt for the configured default.
+    std::optional<int64_t> cache_max_age;
 
     static std::optional<Type> typeFromInt(int t);
 };
 
+// What resolveShortcut() finds besides the URL.
+struct ResolvedLink
+{
+    int64_t id;
+    // As in ShortLink.
+    std::optional<int64_t> cache_max_age;
+};
+
+// A row of the Links table, in the order of “SELECT id,
+// time_creation, user_id, shortcut, original_url, type, visits,
+// cache_max_age”.
+using LinkRow = std::tuple<int64_t, int64_t, std::string, std::string,
+                           std::string, int, int64_t, std::optional<int64_t>>;
+
+// Make a link out of “row”. The strings are moved out of the row.
+mw::E<ShortLink> rowToLink(LinkRow& row);
+
+// Which links of a user to return from getLinks(). Links are ordered
+// by ID. A page starts after the last ID of the previous one instead
+// of at an offset, so that a page deep into the list is as cheap to
+// get as the first one.
+struct LinkPageQuery
+{
+    enum Order { ASCENDING, DESCENDING };
+    // Only return links that come after this ID in “order”. If this
+    // is nullopt, start from the first link.
+    std::optional<int64_t> after_id;
+    int64_t limit = 100;
+    Order order = ASCENDING;
+};
+
+// One entry of the replication log. Every link that is added or
+// removed is appended to the log with the next sequence number,
+// whoever writes it. Changing the visits of a link is not logged.
+struct LinkChange
+{
+    enum Op { ADD = 1, REMOVE };
+    int64_t seq;
+    Op op;
+    // The link as it was added or removed.
+    ShortLink link;
+};
+
+class RegexpLinkMatcher;
+
 class DataSourceInterface
 {
 public:
@@ -40,14 +97,58 @@ public:
     // Add a link to the database. This requires the user_id,
     // shortcut, original_url and type to be filled in “link”.
     virtual mw::E<void> addLink(ShortLink&& link) const = 0;
+    // Add many links in one transaction. Unlike addLink(), the user,
+    // creation time and visits of the links are kept as they are, so
+    // that links can be moved between databases. A link whose
+    // shortcut already exists, in the database or earlier in “links”,
+    // is skipped. Return the indices of the skipped links in “links”.
+    virtual mw::E<std::vector<size_t>>
+    addLinks(const std::vector<ShortLink>& links) const = 0;
     virtual mw::E<std::optional<ShortLink>>
     findLinkByShortcut(const std::string& shortcut) const = 0;
+    // Find a link by its exact shortcut like findLinkByShortcut(),
+    // but only for redirecting: on a hit, “url” is set to the
+    // original URL, and the ID and cache lifetime of the link are
+    // returned. “url” is assigned to, so a caller can reuse its
+    // buffer, and nothing else is fetched.
+    virtual mw::E<std::optional<ResolvedLink>>
+    resolveShortcut(std::string_view shortcut, std::string& url) const = 0;
+    // Find the first regexp link whose shortcut fully matches
+    // “shortcut”. In the returned link, “$n” in the original_url is
+    // replaced by the n-th capture group of the match.
     virtual mw::E<std::optional<ShortLink>>
     findLinkFromRegexpLinks(const std::string& shortcut) const = 0;
     virtual mw::E<std::vector<ShortLink>>
     getAllLinks(const std::string& user_id) const = 0;
+    // Get one page of the links of a user.
+    virtual mw::E<std::vector<ShortLink>>
+    getLinks(const std::string& user_id, const LinkPageQuery& query) const
+        = 0;
+    // Call “f” with every link of every user, in the order of ID,
+    // without loading them all into memory. Stop at the first error
+    // from “f”. “f” should not call into the data source.
+    virtual mw::E<void>
+    forEachLink(const std::function<mw::E<void>(ShortLink&&)>& f) const = 0;
     virtual mw::E<std::optional<ShortLink>> getLink(int64_t id) const = 0;
     virtual mw::E<void> removeLink(int64_t id) const = 0;
+    // Increase the visit counts of links. “visits” maps link IDs to
+    // the number of new visits. This should be done in one
+    // transaction. IDs of links that do not exist are ignored.
+    virtual mw::E<void>
+    addVisits(const std::unordered_map<int64_t, uint64_t>& visits) const = 0;
+    // Get at most “limit” changes with sequence numbers after
+    // “after_seq”, in order.
+    virtual mw::E<std::vector<LinkChange>>
+    getChanges(int64_t after_seq, int64_t limit) const = 0;
+    // The sequence number of the latest change, or 0 if there is
+    // none.
+    virtual mw::E<int64_t> latestChangeSeq() const = 0;
+    // Changes up to this sequence number are compacted: removals are
+    // dropped along with the additions of the links they removed, so
+    // only the additions of the links that still exist are left. A
+    // follower that has not seen all changes up to here has missed
+    // some removals. This is 0 if nothing has been compacted.
+    virtual mw::E<int64_t> compactedChangeSeq() const = 0;
 
 protected:
     virtual mw::E<void> setSchemaVersion(int64_t v) const = 0;
@@ -56,10 +157,36 @@ protected:
 class DataSourceSQLite : public DataSourceInterface
 {
 public:
-    explicit DataSourceSQLite(std::unique_ptr<mw::SQLite> conn)
-            : db(std::move(conn)) {}
+    struct Options
+    {
+        // Number of connections used for reading. Writes always go
+        // through one separate connection. If this is 0, reads use
+        // the write connection as well. In-memory databases always
+        // behave as if this is 0, since each connection to “:memory:”
+        // would be a different database.
+        int read_connections = 4;
+        // Value of “PRAGMA synchronous”. NORMAL is safe with WAL.
+        std::string synchronous = "NORMAL";
+        // Values of “PRAGMA mmap_size” in bytes and “PRAGMA
+        // cache_size” in KiB, for each connection.
+        int64_t mmap_size = 256 * 1024 * 1024;
+        int64_t cache_size_kib = 16 * 1024;
+        // Keep at least this many of the latest changes in the
+        // replication log as they are, and compact the older ones
+        // when links are removed. 0 keeps all changes.
+        int64_t change_log_retention = 0;
+        // If not null, the duration of every query is recorded here.
+        // This has to outlive the data source.
+        Metrics* metrics = nullptr;
+    };
+
+    explicit DataSourceSQLite(std::unique_ptr<mw::SQLite> conn);
     ~DataSourceSQLite() override = default;
 
+    // Open a database file in WAL mode, so that readers do not block
+    // the writer, nor each other.
+    static mw::E<std::unique_ptr<DataSourceSQLite>>
+    fromFile(const std::string& db_file, const Options& options);
     static mw::E<std::unique_ptr<DataSourceSQLite>>
     fromFile(const std::string& db_file);
     static mw::E<std::unique_ptr<DataSourceSQLite>> newFromMemory();
@@ -67,14 +194,29 @@ public:
     mw::E<int64_t> getSchemaVersion() const override;
 
     mw::E<void> addLink(ShortLink&& link) const override;
+    mw::E<std::vector<size_t>> addLinks(const std::vector<ShortLink>& links)
+        const override;
     mw::E<std::optional<ShortLink>>
     findLinkByShortcut(const std::string& shortcut) const override;
+    mw::E<std::optional<ResolvedLink>>
+    resolveShortcut(std::string_view shortcut, std::string& url) const
+        override;
     mw::E<std::optional<ShortLink>>
     findLinkFromRegexpLinks(const std::string& shortcut) const override;
     mw::E<std::vector<ShortLink>> getAllLinks(const std::string& user_id) const
         override;
+    mw::E<std::vector<ShortLink>> getLinks(
+        const std::string& user_id, const LinkPageQuery& query) const override;
+    mw::E<void> forEachLink(
+        const std::function<mw::E<void>(ShortLink&&)>& f) const override;
     mw::E<std::optional<ShortLink>> getLink(int64_t id) const override;
     mw::E<void> removeLink(int64_t id) const override;
+    mw::E<void> addVisits(const std::unordered_map<int64_t, uint64_t>& visits)
+        const override;
+    mw::E<std::vector<LinkChange>> getChanges(int64_t after_seq,
+                                              int64_t limit) const override;
+    mw::E<int64_t> latestChangeSeq() const override;
+    mw::E<int64_t> compactedChangeSeq() const override;
 
     // Do not use.
     DataSourceSQLite() = default;
@@ -83,5 +225,91 @@ protected:
     mw::E<void> setSchemaVersion(int64_t v) const override;
 
 private:
-    std::unique_ptr<mw::SQLite> db;
+    enum Query
+    {
+        ADD_LINK, ADD_LINKS, FIND_LINK_BY_SHORTCUT, RESOLVE_SHORTCUT,
+        FIND_LINK_FROM_REGEXP_LINKS, GET_ALL_LINKS, GET_LINKS, FOR_EACH_LINK,
+        GET_LINK, REMOVE_LINK, ADD_VISITS, GET_CHANGES, LATEST_CHANGE_SEQ,
+        COMPACTED_CHANGE_SEQ, QUERY_COUNT,
+    };
+
+    // A connection and its prepared statements. It is only used by
+    // one thread at a time.
+    struct Connection
+    {
+        std::unique_ptr<mw::SQLite> db;
+        // Prepared statements, keyed by their SQL. These are
+        // finalized before the connection is closed, since they are
+        // declared after it.
+        std::unordered_map<std::string_view, mw::SQLiteStatement> statements;
+
+        // Return the prepared statement for “sql”, preparing it the
+        // first time. The statement is reset and its bindings are
+        // cleared. “sql” is used as the key of the cache without
+        // being copied, so it should be a string literal.
+        mw::E<mw::SQLiteStatement*> prepared(std::string_view sql);
+    };
+
+    // A connection borrowed for one operation. It goes back to the
+    // pool (or releases the write lock) when this is destroyed.
+    class ConnectionHandle
+    {
+    public:
+        ~ConnectionHandle();
+        Connection* operator->() const { return conn; }
+        Connection& operator*() const { return *conn; }
+
+    private:
+        friend class DataSourceSQLite;
+        ConnectionHandle(const DataSourceSQLite& source, Connection& c,
+                         std::unique_lock<std::mutex>&& guard);
+
+        const DataSourceSQLite& data_source;
+        Connection* conn;
+        // Only locked for the write connection.
+        std::unique_lock<std::mutex> write_guard;
+    };
+
+    ConnectionHandle reader() const;
+    ConnectionHandle writer() const;
+
+    // Bring the schema of the database up to the latest version, one
+    // version at a time, each in its own transaction.
+    mw::E<void> upgradeSchema() const;
+    // Compact the changes older than the latest
+    // “change_log_retention” ones. This requires the write
+    // connection “conn”, in a transaction.
+    mw::E<void> compactChanges(Connection& conn) const;
+
+    // Return the compiled regexp links, building them from the
+    // database if the links have changed since the last time.
+    mw::E<std::shared_ptr<const RegexpLinkMatcher>> regexpMatcher() const;
+    void invalidateRegexpLinks() const;
+
+    void registerMetrics(Metrics& m);
+    // Record the duration of “query” until the returned timer is
+    // destroyed.
+    Metrics::Timer timeQuery(Query query) const;
+
+    // Everything that writes goes through this connection, holding
+    // “write_lock”. This also keeps a statement from one thread from
+    // ending up in the transaction of another.
+    mutable Connection write_conn;
+    mutable std::mutex write_lock;
+
+    std::vector<std::unique_ptr<Connection>> read_conns;
+    mutable std::vector<Connection*> idle_read_conns;
+    mutable std::mutex read_lock;
+    mutable std::condition_variable read_available;
+
+    mutable std::mutex regexp_lock;
+    // Null if it needs to be rebuilt.
+    mutable std::shared_ptr<const RegexpLinkMatcher> regexp_matcher;
+    // Increased every time the links change.
+    mutable uint64_t regexp_generation = 0;
+
+    int64_t change_log_retention = 0;
+    // Null if queries are not timed.
+    Metrics* metrics = nullptr;
+    std::array<Metrics::Histogram, QUERY_COUNT> query_histograms;
 };
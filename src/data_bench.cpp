@@ -0,0 +1,441 @@
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mw/database.hpp>
+#include <mw/error.hpp>
+
+#include "data.hpp"
+
+namespace
+{
+
+// Create an in-memory data source with “count” regexp links. Half of
+// them have a literal prefix, the other half do not.
+std::unique_ptr<DataSourceSQLite> regexpLinks(int64_t count)
+{
+    auto data = DataSourceSQLite::newFromMemory();
+    if(!data.has_value())
+    {
+        return nullptr;
+    }
+    for(int64_t i = 0; i < count; i++)
+    {
+        ShortLink link;
+        link.shortcut = i % 2 == 0 ? std::format("p{}-(.+)", i) :
+            std::format("[a-z]+{}", i);
+        link.original_url = std::format("https://example.com/{}/$1", i);
+        link.type = ShortLink::REGEXP;
+        link.user_id = "bench";
+        if(!(*data)->addLink(std::move(link)).has_value())
+        {
+            return nullptr;
+        }
+    }
+    return *std::move(data);
+}
+
+// The full miss path of App::handleShortcut(): an exact lookup,
+// followed by the regexp fallback, neither of which matches.
+void BM_ShortcutMiss(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = regexpLinks(state.range(0));
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    const std::string path = "wp-login.php";
+    // Build the compiled regexps outside of the timed loop.
+    benchmark::DoNotOptimize(data->findLinkFromRegexpLinks(path));
+
+    for(auto _: state)
+    {
+        auto exact = data->findLinkByShortcut(path);
+        benchmark::DoNotOptimize(exact);
+        auto regexp = data->findLinkFromRegexpLinks(path);
+        benchmark::DoNotOptimize(regexp);
+    }
+}
+BENCHMARK(BM_ShortcutMiss)->RangeMultiplier(10)->Range(10, 1000);
+
+// A regexp hit on a pattern with a literal prefix, with capture
+// substitution.
+void BM_RegexpHit(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = regexpLinks(state.range(0));
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    const std::string path = "p0-abc";
+    benchmark::DoNotOptimize(data->findLinkFromRegexpLinks(path));
+
+    for(auto _: state)
+    {
+        auto regexp = data->findLinkFromRegexpLinks(path);
+        benchmark::DoNotOptimize(regexp);
+    }
+}
+BENCHMARK(BM_RegexpHit)->RangeMultiplier(10)->Range(10, 1000);
+
+// What findLinkFromRegexpLinks() used to do on a miss: construct a
+// std::regex for every pattern, on every lookup. This is here for
+// comparison.
+void BM_NaiveRegexpMiss(benchmark::State& state)
+{
+    std::vector<std::string> patterns;
+    for(int64_t i = 0; i < state.range(0); i++)
+    {
+        patterns.push_back(i % 2 == 0 ? std::format("p{}-(.+)", i) :
+                           std::format("[a-z]+{}", i));
+    }
+    const std::string path = "wp-login.php";
+
+    for(auto _: state)
+    {
+        bool found = false;
+        for(const std::string& pattern: patterns)
+        {
+            if(std::regex_match(path, std::regex(pattern)))
+            {
+                found = true;
+                break;
+            }
+        }
+        benchmark::DoNotOptimize(found);
+    }
+}
+BENCHMARK(BM_NaiveRegexpMiss)->RangeMultiplier(10)->Range(10, 1000);
+
+constexpr char LINKS_TABLE[] =
+    "CREATE TABLE IF NOT EXISTS Links "
+    "(id INTEGER PRIMARY KEY, time_creation INTEGER, user_id TEXT,"
+    " shortcut TEXT UNIQUE, original_url TEXT, type INTEGER,"
+    " visits INTEGER);";
+
+// Create an in-memory data source with “count” normal links, with
+// shortcuts “link0”, “link1”, etc.
+std::unique_ptr<DataSourceSQLite> normalLinks(int64_t count)
+{
+    auto data = DataSourceSQLite::newFromMemory();
+    if(!data.has_value())
+    {
+        return nullptr;
+    }
+    for(int64_t i = 0; i < count; i++)
+    {
+        ShortLink link;
+        link.shortcut = std::format("link{}", i);
+        link.original_url = std::format("https://example.com/{}", i);
+        link.type = ShortLink::NORMAL;
+        link.user_id = "bench";
+        if(!(*data)->addLink(std::move(link)).has_value())
+        {
+            return nullptr;
+        }
+    }
+    return *std::move(data);
+}
+
+// An exact shortcut lookup through the prepared statement cache.
+void BM_FindLinkByShortcut(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = normalLinks(state.range(0));
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    const std::string shortcut = std::format("link{}", state.range(0) / 2);
+
+    for(auto _: state)
+    {
+        auto link = data->findLinkByShortcut(shortcut);
+        benchmark::DoNotOptimize(link);
+    }
+}
+BENCHMARK(BM_FindLinkByShortcut)->RangeMultiplier(10)->Range(1000, 100000);
+
+// The same lookup, but preparing the statement every time, which is
+// what findLinkByShortcut() used to do. This is here for comparison.
+void BM_FindLinkByShortcutUnprepared(benchmark::State& state)
+{
+    auto db = mw::SQLite::connectMemory();
+    if(!db.has_value() || !(*db)->execute(LINKS_TABLE).has_value())
+    {
+        state.SkipWithError("Failed to create database");
+        return;
+    }
+    for(int64_t i = 0; i < state.range(0); i++)
+    {
+        auto statement = (*db)->statementFromStr(
+            "INSERT INTO Links (time_creation, user_id, shortcut,"
+            " original_url, type, visits) VALUES (0, 'bench', ?, ?, 1, 0);");
+        if(!statement.has_value() ||
+           !(statement->bind<std::string, std::string>(
+               std::format("link{}", i),
+               std::format("https://example.com/{}", i))).has_value() ||
+           !(*db)->execute(*std::move(statement)).has_value())
+        {
+            state.SkipWithError("Failed to populate database");
+            return;
+        }
+    }
+    const std::string shortcut = std::format("link{}", state.range(0) / 2);
+
+    for(auto _: state)
+    {
+        auto statement = (*db)->statementFromStr(
+            "SELECT id, time_creation, user_id, shortcut, original_url, type,"
+            " visits FROM Links WHERE shortcut = ?;");
+        if(!statement.has_value() ||
+           !statement->bind<std::string>(shortcut).has_value())
+        {
+            state.SkipWithError("Failed to prepare statement");
+            return;
+        }
+        auto rows = (*db)->eval<int64_t, int64_t, std::string, std::string,
+                                std::string, int, int64_t>(
+            *std::move(statement));
+        benchmark::DoNotOptimize(rows);
+    }
+}
+BENCHMARK(BM_FindLinkByShortcutUnprepared)->RangeMultiplier(10)
+    ->Range(1000, 100000);
+
+// Number of users the links of a seeded database belong to.
+constexpr int64_t SEEDED_USERS = 1000;
+
+void tableSizes(benchmark::internal::Benchmark* b)
+{
+    b->Arg(1000)->Arg(100000)->Arg(10000000)
+        ->Unit(benchmark::kMicrosecond);
+}
+
+// Return the path of a database file with “count” normal links. Link
+// i has shortcut “link<i>”, ID i+1, and belongs to user “user<i %
+// SEEDED_USERS>”. Filling the larger ones takes a while, so the file
+// is kept in the temporary directory, and reused by later runs.
+mw::E<std::string> seededDatabase(int64_t count)
+{
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string path =
+        (dir / std::format("shrt-bench-{}.db", count)).string();
+    if(std::filesystem::exists(path))
+    {
+        return path;
+    }
+
+    // Let the data source create the latest schema, and then insert
+    // all the rows in one statement, which is much faster than
+    // addLink().
+    const std::string tmp_path = path + ".tmp";
+    std::filesystem::remove(tmp_path);
+    {
+        ASSIGN_OR_RETURN(auto data, DataSourceSQLite::fromFile(tmp_path));
+    }
+    {
+        ASSIGN_OR_RETURN(auto db, mw::SQLite::connectFile(tmp_path));
+        ASSIGN_OR_RETURN(mw::SQLiteStatement statement, db->statementFromStr(
+            "INSERT INTO Links (time_creation, user_id, shortcut,"
+            " original_url, type, visits)"
+            " WITH RECURSIVE n(i) AS"
+            " (SELECT 0 UNION ALL SELECT i + 1 FROM n WHERE i + 1 < ?)"
+            " SELECT 0, 'user' || (i % ?), 'link' || i,"
+            " 'https://example.com/' || i, 1, 0 FROM n;"));
+        DO_OR_RETURN((statement.bind<int64_t, int64_t>(count, SEEDED_USERS)));
+        DO_OR_RETURN(db->execute("BEGIN TRANSACTION;"));
+        DO_OR_RETURN(db->execute(std::move(statement)));
+        DO_OR_RETURN(db->execute("COMMIT;"));
+    }
+    std::filesystem::rename(tmp_path, path);
+    return path;
+}
+
+// Open the seeded database with “state.range(0)” links.
+std::unique_ptr<DataSourceSQLite> openSeeded(benchmark::State& state)
+{
+    auto path = seededDatabase(state.range(0));
+    if(!path.has_value())
+    {
+        state.SkipWithError(mw::errorMsg(path.error()).c_str());
+        return nullptr;
+    }
+    auto data = DataSourceSQLite::fromFile(*path);
+    if(!data.has_value())
+    {
+        state.SkipWithError(mw::errorMsg(data.error()).c_str());
+        return nullptr;
+    }
+    return *std::move(data);
+}
+
+void BM_QueryFindLinkByShortcut(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    const std::string shortcut = std::format("link{}", state.range(0) / 2);
+    for(auto _: state)
+    {
+        auto link = data->findLinkByShortcut(shortcut);
+        benchmark::DoNotOptimize(link);
+    }
+}
+BENCHMARK(BM_QueryFindLinkByShortcut)->Apply(tableSizes);
+
+void BM_QueryResolveShortcut(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    const std::string shortcut = std::format("link{}", state.range(0) / 2);
+    std::string url;
+    for(auto _: state)
+    {
+        auto id = data->resolveShortcut(shortcut, url);
+        benchmark::DoNotOptimize(id);
+    }
+}
+BENCHMARK(BM_QueryResolveShortcut)->Apply(tableSizes);
+
+// An exact miss followed by the regexp fallback, which finds no
+// regexp link at all.
+void BM_QueryShortcutMiss(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    const std::string shortcut = "wp-login.php";
+    for(auto _: state)
+    {
+        auto exact = data->findLinkByShortcut(shortcut);
+        benchmark::DoNotOptimize(exact);
+        auto regexp = data->findLinkFromRegexpLinks(shortcut);
+        benchmark::DoNotOptimize(regexp);
+    }
+}
+BENCHMARK(BM_QueryShortcutMiss)->Apply(tableSizes);
+
+void BM_QueryGetLink(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    const int64_t id = state.range(0) / 2 + 1;
+    for(auto _: state)
+    {
+        auto link = data->getLink(id);
+        benchmark::DoNotOptimize(link);
+    }
+}
+BENCHMARK(BM_QueryGetLink)->Apply(tableSizes);
+
+// A page of 100 links from the middle of the list of a user.
+void BM_QueryGetLinks(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    LinkPageQuery query;
+    query.after_id = state.range(0) / 2;
+    query.limit = 100;
+    for(auto _: state)
+    {
+        auto links = data->getLinks("user0", query);
+        benchmark::DoNotOptimize(links);
+    }
+}
+BENCHMARK(BM_QueryGetLinks)->Apply(tableSizes);
+
+// All links of a user, which is 1/SEEDED_USERS of the table.
+void BM_QueryGetAllLinks(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    for(auto _: state)
+    {
+        auto links = data->getAllLinks("user0");
+        benchmark::DoNotOptimize(links);
+    }
+    state.counters["links"] = static_cast<double>(
+        state.range(0) / SEEDED_USERS);
+}
+BENCHMARK(BM_QueryGetAllLinks)->Apply(tableSizes);
+
+// Create a link and remove it again, so that the table keeps its
+// size.
+void BM_QueryAddRemoveLink(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    for(auto _: state)
+    {
+        ShortLink link;
+        link.shortcut = "bench-new-link";
+        link.original_url = "https://example.com/new";
+        link.type = ShortLink::NORMAL;
+        link.user_id = "bench";
+        if(!data->addLink(std::move(link)).has_value())
+        {
+            state.SkipWithError("Failed to add link");
+            return;
+        }
+        std::string url;
+        auto id = data->resolveShortcut("bench-new-link", url);
+        if(!id.has_value() || !id->has_value() ||
+           !data->removeLink((*id)->id).has_value())
+        {
+            state.SkipWithError("Failed to remove link");
+            return;
+        }
+    }
+}
+BENCHMARK(BM_QueryAddRemoveLink)->Apply(tableSizes);
+
+// One flush of the visit counter, with visits to 100 links.
+void BM_QueryAddVisits(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = openSeeded(state);
+    if(data == nullptr)
+    {
+        return;
+    }
+    std::unordered_map<int64_t, uint64_t> visits;
+    for(int64_t i = 0; i < 100; i++)
+    {
+        visits[i * (state.range(0) / 100) + 1] = 1;
+    }
+    for(auto _: state)
+    {
+        auto result = data->addVisits(visits);
+        benchmark::DoNotOptimize(result);
+    }
+}
+BENCHMARK(BM_QueryAddVisits)->Apply(tableSizes);
+
+} // namespace
@@ -0,0 +1,276 @@
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mw/error.hpp>
+
+#include "data.hpp"
+#include "data_cache.hpp"
+
+double DataSourceCache::Stats::hitRatio() const
+{
+    uint64_t total = hits + misses;
+    if(total == 0)
+    {
+        return 0.0;
+    }
+    return static_cast<double>(hits) / static_cast<double>(total);
+}
+
+DataSourceCache::DataSourceCache(std::unique_ptr<DataSourceInterface> source,
+                                 size_t max_size, Metrics* metrics)
+        : backend(std::move(source)), capacity(max_size)
+{
+    by_shortcut.reserve(capacity);
+    by_id.reserve(capacity);
+    if(metrics == nullptr)
+    {
+        return;
+    }
+    const std::string labels = "cache=\"links\"";
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::COUNTER, "shrt_cache_hits_total", "Hits of in-memory caches",
+        labels, [this] { return static_cast<double>(hits); }));
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::COUNTER, "shrt_cache_misses_total",
+        "Misses of in-memory caches", labels,
+        [this] { return static_cast<double>(misses); }));
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::GAUGE, "shrt_cache_hit_ratio",
+        "Ratio of hits over all lookups of in-memory caches", labels,
+        [this] { return stats().hitRatio(); }));
+    metric_callbacks.push_back(metrics->callback(
+        Metrics::GAUGE, "shrt_cache_entries",
+        "Number of entries in in-memory caches", labels,
+        [this] { return static_cast<double>(stats().size); }));
+}
+
+mw::E<int64_t> DataSourceCache::getSchemaVersion() const
+{
+    return backend->getSchemaVersion();
+}
+
+mw::E<void> DataSourceCache::addLink(ShortLink&& link) const
+{
+    // Nothing should be cached under this shortcut, since negative
+    // results are not cached. But invalidate anyway, in case the
+    // backend replaces existing rows.
+    eraseShortcut(link.shortcut);
+    return backend->addLink(std::move(link));
+}
+
+mw::E<std::vector<size_t>>
+DataSourceCache::addLinks(const std::vector<ShortLink>& links) const
+{
+    for(const ShortLink& link: links)
+    {
+        eraseShortcut(link.shortcut);
+    }
+    return backend->addLinks(links);
+}
+
+mw::E<std::optional<ShortLink>> DataSourceCache::findLinkByShortcut(
+    const std::string& shortcut) const
+{
+    if(std::optional<ShortLink> link = lookup(shortcut); link.has_value())
+    {
+        hits++;
+        return link;
+    }
+    misses++;
+
+    uint64_t gen;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        gen = generation;
+    }
+    ASSIGN_OR_RETURN(std::optional<ShortLink> link,
+                     backend->findLinkByShortcut(shortcut));
+    if(link.has_value())
+    {
+        insert(*link, gen);
+    }
+    return link;
+}
+
+mw::E<std::optional<ResolvedLink>> DataSourceCache::resolveShortcut(
+    std::string_view shortcut, std::string& url) const
+{
+    uint64_t gen;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(auto it = by_shortcut.find(shortcut); it != by_shortcut.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            url.assign(it->second->original_url);
+            hits++;
+            return ResolvedLink{it->second->id, it->second->cache_max_age};
+        }
+        gen = generation;
+    }
+    misses++;
+
+    ASSIGN_OR_RETURN(std::optional<ShortLink> link,
+                     backend->findLinkByShortcut(std::string(shortcut)));
+    if(!link.has_value())
+    {
+        return std::nullopt;
+    }
+    insert(*link, gen);
+    url.assign(link->original_url);
+    return ResolvedLink{link->id, link->cache_max_age};
+}
+
+mw::E<std::optional<ShortLink>> DataSourceCache::findLinkFromRegexpLinks(
+    const std::string& shortcut) const
+{
+    return backend->findLinkFromRegexpLinks(shortcut);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceCache::getAllLinks(
+    const std::string& user_id) const
+{
+    return backend->getAllLinks(user_id);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceCache::getLinks(
+    const std::string& user_id, const LinkPageQuery& query) const
+{
+    return backend->getLinks(user_id, query);
+}
+
+mw::E<void> DataSourceCache::forEachLink(
+    const std::function<mw::E<void>(ShortLink&&)>& f) const
+{
+    return backend->forEachLink(f);
+}
+
+mw::E<std::optional<ShortLink>> DataSourceCache::getLink(int64_t id) const
+{
+    return backend->getLink(id);
+}
+
+mw::E<void> DataSourceCache::removeLink(int64_t id) const
+{
+    // Invalidate both before and after. The former makes sure no
+    // reader sees the link once it is removed from the backend, and
+    // the latter bumps the generation so that a lookup that started
+    // in between does not put it back.
+    eraseID(id);
+    DO_OR_RETURN(backend->removeLink(id));
+    eraseID(id);
+    return {};
+}
+
+mw::E<void> DataSourceCache::addVisits(
+    const std::unordered_map<int64_t, uint64_t>& visits) const
+{
+    // The visit counts of cached links go stale. Nothing on the
+    // redirect path uses them.
+    return backend->addVisits(visits);
+}
+
+mw::E<std::vector<LinkChange>>
+DataSourceCache::getChanges(int64_t after_seq, int64_t limit) const
+{
+    return backend->getChanges(after_seq, limit);
+}
+
+mw::E<int64_t> DataSourceCache::latestChangeSeq() const
+{
+    return backend->latestChangeSeq();
+}
+
+mw::E<int64_t> DataSourceCache::compactedChangeSeq() const
+{
+    return backend->compactedChangeSeq();
+}
+
+DataSourceCache::Stats DataSourceCache::stats() const
+{
+    Stats s;
+    s.hits = hits;
+    s.misses = misses;
+    s.capacity = capacity;
+    std::lock_guard<std::mutex> guard(lock);
+    s.size = lru.size();
+    return s;
+}
+
+mw::E<void> DataSourceCache::setSchemaVersion([[maybe_unused]] int64_t v) const
+{
+    return std::unexpected(mw::runtimeError(
+        "Cannot set schema version through the cache"));
+}
+
+std::optional<ShortLink> DataSourceCache::lookup(
+    const std::string& shortcut) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = by_shortcut.find(shortcut);
+    if(it == by_shortcut.end())
+    {
+        return std::nullopt;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    return *it->second;
+}
+
+void DataSourceCache::insert(const ShortLink& link, uint64_t gen) const
+{
+    if(capacity == 0)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(gen != generation || by_shortcut.contains(link.shortcut))
+    {
+        return;
+    }
+    if(lru.size() >= capacity)
+    {
+        const ShortLink& victim = lru.back();
+        by_shortcut.erase(victim.shortcut);
+        by_id.erase(victim.id);
+        lru.pop_back();
+    }
+    lru.push_front(link);
+    by_shortcut.emplace(link.shortcut, lru.begin());
+    by_id.emplace(link.id, lru.begin());
+}
+
+void DataSourceCache::eraseShortcut(const std::string& shortcut) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    generation++;
+    auto it = by_shortcut.find(shortcut);
+    if(it == by_shortcut.end())
+    {
+        return;
+    }
+    by_id.erase(it->second->id);
+    lru.erase(it->second);
+    by_shortcut.erase(it);
+}
+
+void DataSourceCache::eraseID(int64_t id) const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    generation++;
+    auto it = by_id.find(id);
+    if(it == by_id.end())
+    {
+        return;
+    }
+    by_shortcut.erase(it->second->shortcut);
+    lru.erase(it->second);
+    by_id.erase(it);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mw/error.hpp>
+
+#include "data.hpp"
+#include "metrics.hpp"
+
+// A read-through cache in front of another data source. Links looked
+// up by shortcut are kept in memory, so that a repeated redirect does
+// not touch the backend at all. Everything other than
+// findLinkByShortcut() is forwarded to the backend. addLink(),
+// addLinks() and removeLink() invalidate the affected entries.
+//
+// The cache holds at most “capacity” links, and evicts the least
+// recently used one when it is full. Negative results are not
+// cached. This class is thread-safe as long as the backend is.
+class DataSourceCache : public DataSourceInterface
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+
+        // Ratio of hits over all lookups. This is 0 if there has been
+        // no lookup yet.
+        double hitRatio() const;
+    };
+
+    // If “metrics” is not null, the statistics of the cache are
+    // exported there.
+    DataSourceCache(std::unique_ptr<DataSourceInterface> source,
+                    size_t max_size, Metrics* metrics = nullptr);
+    ~DataSourceCache() override = default;
+
+    mw::E<int64_t> getSchemaVersion() const override;
+
+    mw::E<void> addLink(ShortLink&& link) const override;
+    mw::E<std::vector<size_t>> addLinks(const std::vector<ShortLink>& links)
+        const override;
+    mw::E<std::optional<ShortLink>>
+    findLinkByShortcut(const std::string& shortcut) const override;
+    mw::E<std::optional<ResolvedLink>>
+    resolveShortcut(std::string_view shortcut, std::string& url) const
+        override;
+    mw::E<std::optional<ShortLink>>
+    findLinkFromRegexpLinks(const std::string& shortcut) const override;
+    mw::E<std::vector<ShortLink>> getAllLinks(const std::string& user_id) const
+        override;
+    mw::E<std::vector<ShortLink>> getLinks(
+        const std::string& user_id, const LinkPageQuery& query) const override;
+    mw::E<void> forEachLink(
+        const std::function<mw::E<void>(ShortLink&&)>& f) const override;
+    mw::E<std::optional<ShortLink>> getLink(int64_t id) const override;
+    mw::E<void> removeLink(int64_t id) const override;
+    mw::E<void> addVisits(const std::unordered_map<int64_t, uint64_t>& visits)
+        const override;
+    mw::E<std::vector<LinkChange>> getChanges(int64_t after_seq,
+                                              int64_t limit) const override;
+    mw::E<int64_t> latestChangeSeq() const override;
+    mw::E<int64_t> compactedChangeSeq() const override;
+
+    Stats stats() const;
+
+protected:
+    // The schema belongs to the backend. This always fails.
+    mw::E<void> setSchemaVersion(int64_t v) const override;
+
+private:
+    using LRUList = std::list<ShortLink>;
+
+    // Allows looking up “by_shortcut” with a string_view, without
+    // making a string first.
+    struct ShortcutHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const
+        {
+            return std::hash<std::string_view>()(s);
+        }
+    };
+
+    // Look up “shortcut” in the cache, and move it to the front of
+    // the LRU list if it is there.
+    std::optional<ShortLink> lookup(const std::string& shortcut) const;
+    // Put “link” into the cache, unless the cache has been
+    // invalidated since “generation” was read.
+    void insert(const ShortLink& link, uint64_t generation) const;
+    void eraseShortcut(const std::string& shortcut) const;
+    void eraseID(int64_t id) const;
+
+    std::unique_ptr<DataSourceInterface> backend;
+    size_t capacity;
+
+    mutable std::mutex lock;
+    // Most recently used link is at the front.
+    mutable LRUList lru;
+    mutable std::unordered_map<std::string, LRUList::iterator, ShortcutHash,
+                               std::equal_to<>> by_shortcut;
+    mutable std::unordered_map<int64_t, LRUList::iterator> by_id;
+    // Increased on every invalidation. A lookup that went to the
+    // backend only populates the cache if this has not changed in
+    // the mean time, so that a concurrent removeLink() cannot be
+    // undone by a stale insert.
+    mutable uint64_t generation = 0;
+
+    mutable std::atomic<uint64_t> hits = 0;
+    mutable std::atomic<uint64_t> misses = 0;
+
+    std::vector<Metrics::Registration> metric_callbacks;
+};
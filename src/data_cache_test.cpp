@@ -0,0 +1,107 @@
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+
+#include "data.hpp"
+#include "data_cache.hpp"
+#include "data_mock.hpp"
+
+using ::testing::Return;
+
+namespace
+{
+
+ShortLink makeLink(int64_t id, const std::string& shortcut)
+{
+    ShortLink link;
+    link.id = id;
+    link.shortcut = shortcut;
+    link.original_url = "https://darksair.org/" + shortcut;
+    link.type = ShortLink::NORMAL;
+    link.user_id = "mw";
+    link.visits = 0;
+    return link;
+}
+
+} // namespace
+
+TEST(DataSourceCache, CanServeRepeatedLookupFromMemory)
+{
+    auto backend = std::make_unique<DataSourceMock>();
+    EXPECT_CALL(*backend, findLinkByShortcut("a"))
+        .WillOnce(Return(makeLink(1, "a")));
+    DataSourceCache cache(std::move(backend), 10);
+
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link0,
+                   cache.findLinkByShortcut("a"));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link1,
+                   cache.findLinkByShortcut("a"));
+    ASSERT_TRUE(link0.has_value());
+    ASSERT_TRUE(link1.has_value());
+    EXPECT_EQ(link1->original_url, "https://darksair.org/a");
+
+    DataSourceCache::Stats stats = cache.stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_DOUBLE_EQ(stats.hitRatio(), 0.5);
+}
+
+TEST(DataSourceCache, CanResolveShortcutFromMemory)
+{
+    auto backend = std::make_unique<DataSourceMock>();
+    EXPECT_CALL(*backend, findLinkByShortcut("a"))
+        .WillOnce(Return(makeLink(1, "a")));
+    DataSourceCache cache(std::move(backend), 10);
+
+    std::string url;
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> link0,
+                   cache.resolveShortcut("a", url));
+    ASSERT_TRUE(link0.has_value());
+    EXPECT_EQ(link0->id, 1);
+    url.clear();
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> link1,
+                   cache.resolveShortcut("a", url));
+    ASSERT_TRUE(link1.has_value());
+    EXPECT_EQ(link1->id, 1);
+    EXPECT_EQ(url, "https://darksair.org/a");
+    EXPECT_EQ(cache.stats().hits, 1);
+}
+
+TEST(DataSourceCache, CanInvalidateOnRemove)
+{
+    auto backend = std::make_unique<DataSourceMock>();
+    EXPECT_CALL(*backend, findLinkByShortcut("a"))
+        .WillOnce(Return(makeLink(1, "a")))
+        .WillOnce(Return(std::nullopt));
+    EXPECT_CALL(*backend, removeLink(1)).WillOnce(Return(mw::E<void>()));
+    DataSourceCache cache(std::move(backend), 10);
+
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link0,
+                   cache.findLinkByShortcut("a"));
+    EXPECT_TRUE(link0.has_value());
+    EXPECT_TRUE(mw::isExpected(cache.removeLink(1)));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link1,
+                   cache.findLinkByShortcut("a"));
+    EXPECT_FALSE(link1.has_value());
+}
+
+TEST(DataSourceCache, CanEvictLeastRecentlyUsed)
+{
+    auto backend = std::make_unique<DataSourceMock>();
+    EXPECT_CALL(*backend, findLinkByShortcut("a"))
+        .Times(2).WillRepeatedly(Return(makeLink(1, "a")));
+    EXPECT_CALL(*backend, findLinkByShortcut("b"))
+        .WillOnce(Return(makeLink(2, "b")));
+    DataSourceCache cache(std::move(backend), 1);
+
+    EXPECT_TRUE(mw::isExpected(cache.findLinkByShortcut("a")));
+    EXPECT_TRUE(mw::isExpected(cache.findLinkByShortcut("b")));
+    // “a” was evicted by “b”.
+    EXPECT_TRUE(mw::isExpected(cache.findLinkByShortcut("a")));
+    EXPECT_EQ(cache.stats().size, 1);
+}
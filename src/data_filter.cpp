@@ -0,0 +1,464 @@
+#include <algorithm>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <mw/error.hpp>
+#include <mw/utils.hpp>
+#include <spdlog/spdlog.h>
+
+#include "bloom_filter.hpp"
+#include "data.hpp"
+#include "data_filter.hpp"
+
+namespace
+{
+
+// The filter is never sized for fewer links than this, so that a new
+// database does not rebuild it for every few links added.
+constexpr size_t FILTER_MIN_CAPACITY = 1024;
+
+} // namespace
+
+double DataSourceFilter::Stats::observedFalsePositiveRate() const
+{
+    uint64_t total = filter_rejects + false_positives;
+    if(total == 0)
+    {
+        return 0.0;
+    }
+    return static_cast<double>(false_positives) / static_cast<double>(total);
+}
+
+DataSourceFilter::DataSourceFilter(std::unique_ptr<DataSourceInterface> source,
+                                   const Options& opts)
+        : backend(std::move(source)), options(opts),
+          negative_shard_size((opts.negative_cache_size + NEGATIVE_SHARDS - 1)
+                              / NEGATIVE_SHARDS)
+{
+    if(options.metrics == nullptr)
+    {
+        return;
+    }
+    Metrics& m = *options.metrics;
+    metric_callbacks.push_back(m.callback(
+        Metrics::COUNTER, "shrt_shortcut_filter_rejects_total",
+        "Exact lookups of shortcuts answered by the Bloom filter alone", "",
+        [this] { return static_cast<double>(filter_rejects); }));
+    metric_callbacks.push_back(m.callback(
+        Metrics::COUNTER, "shrt_shortcut_filter_false_positives_total",
+        "Exact lookups of shortcuts that passed the Bloom filter but missed",
+        "", [this] { return static_cast<double>(false_positives); }));
+    metric_callbacks.push_back(m.callback(
+        Metrics::GAUGE, "shrt_shortcut_filter_false_positive_rate",
+        "False positive rate of the Bloom filter of shortcuts, estimated "
+        "from its fill", "",
+        [this] { return stats().estimated_false_positive_rate; }));
+    metric_callbacks.push_back(m.callback(
+        Metrics::GAUGE, "shrt_shortcut_filter_observed_false_positive_rate",
+        "Ratio of false positives over exact lookups of missing shortcuts",
+        "", [this] { return stats().observedFalsePositiveRate(); }));
+    metric_callbacks.push_back(m.callback(
+        Metrics::GAUGE, "shrt_shortcut_filter_links",
+        "Number of shortcuts in the Bloom filter", "",
+        [this] { return static_cast<double>(stats().links); }));
+
+    const std::string labels = "cache=\"negative\"";
+    metric_callbacks.push_back(m.callback(
+        Metrics::COUNTER, "shrt_cache_hits_total", "Hits of in-memory caches",
+        labels, [this] { return static_cast<double>(negative_hits); }));
+    metric_callbacks.push_back(m.callback(
+        Metrics::GAUGE, "shrt_cache_entries",
+        "Number of entries in in-memory caches", labels,
+        [this] { return static_cast<double>(stats().negative_entries); }));
+}
+
+mw::E<std::unique_ptr<DataSourceFilter>> DataSourceFilter::create(
+    std::unique_ptr<DataSourceInterface> source, const Options& options)
+{
+    // The constructor is private.
+    std::unique_ptr<DataSourceFilter> data(
+        new DataSourceFilter(std::move(source), options));
+    ASSIGN_OR_RETURN(data->filter, data->buildFilter());
+    spdlog::info("Shortcut filter has {} links.", data->filter->size());
+    return data;
+}
+
+mw::E<int64_t> DataSourceFilter::getSchemaVersion() const
+{
+    return backend->getSchemaVersion();
+}
+
+mw::E<void> DataSourceFilter::addLink(ShortLink&& link) const
+{
+    std::lock_guard<std::mutex> guard(write_lock);
+    const std::string shortcut = link.shortcut;
+    const ShortLink::Type type = link.type;
+    DO_OR_RETURN(backend->addLink(std::move(link)));
+    addToFilter({shortcut});
+    // A new regexp link may match any of the shortcuts that missed.
+    if(type == ShortLink::REGEXP)
+    {
+        forgetMissing(std::nullopt);
+    }
+    else
+    {
+        forgetMissing(shortcut);
+    }
+    return {};
+}
+
+mw::E<std::vector<size_t>>
+DataSourceFilter::addLinks(const std::vector<ShortLink>& links) const
+{
+    std::lock_guard<std::mutex> guard(write_lock);
+    ASSIGN_OR_RETURN(std::vector<size_t> skipped, backend->addLinks(links));
+    std::vector<std::string_view> added;
+    added.reserve(links.size() - skipped.size());
+    bool has_regexp = false;
+    auto next_skipped = skipped.begin();
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        if(next_skipped != skipped.end() && *next_skipped == i)
+        {
+            next_skipped++;
+            continue;
+        }
+        added.push_back(links[i].shortcut);
+        has_regexp = has_regexp || links[i].type == ShortLink::REGEXP;
+    }
+    addToFilter(added);
+    if(has_regexp)
+    {
+        forgetMissing(std::nullopt);
+    }
+    else
+    {
+        for(std::string_view shortcut: added)
+        {
+            forgetMissing(shortcut);
+        }
+    }
+    return skipped;
+}
+
+mw::E<std::optional<ShortLink>> DataSourceFilter::findLinkByShortcut(
+    const std::string& shortcut) const
+{
+    if(!filterMayContain(shortcut))
+    {
+        filter_rejects++;
+        return std::nullopt;
+    }
+    uint64_t generation;
+    if(isKnownMissing(shortcut, true, generation))
+    {
+        negative_hits++;
+        return std::nullopt;
+    }
+    ASSIGN_OR_RETURN(std::optional<ShortLink> link,
+                     backend->findLinkByShortcut(shortcut));
+    if(!link.has_value())
+    {
+        false_positives++;
+        rememberMissing(shortcut, true, generation);
+    }
+    return link;
+}
+
+mw::E<std::optional<ResolvedLink>> DataSourceFilter::resolveShortcut(
+    std::string_view shortcut, std::string& url) const
+{
+    if(!filterMayContain(shortcut))
+    {
+        filter_rejects++;
+        return std::nullopt;
+    }
+    uint64_t generation;
+    if(isKnownMissing(shortcut, true, generation))
+    {
+        negative_hits++;
+        return std::nullopt;
+    }
+    ASSIGN_OR_RETURN(std::optional<ResolvedLink> link,
+                     backend->resolveShortcut(shortcut, url));
+    if(!link.has_value())
+    {
+        false_positives++;
+        rememberMissing(shortcut, true, generation);
+    }
+    return link;
+}
+
+mw::E<std::optional<ShortLink>> DataSourceFilter::findLinkFromRegexpLinks(
+    const std::string& shortcut) const
+{
+    uint64_t generation;
+    if(isKnownMissing(shortcut, false, generation))
+    {
+        negative_hits++;
+        return std::nullopt;
+    }
+    ASSIGN_OR_RETURN(std::optional<ShortLink> link,
+                     backend->findLinkFromRegexpLinks(shortcut));
+    if(!link.has_value())
+    {
+        rememberMissing(shortcut, false, generation);
+    }
+    return link;
+}
+
+mw::E<std::vector<ShortLink>> DataSourceFilter::getAllLinks(
+    const std::string& user_id) const
+{
+    return backend->getAllLinks(user_id);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceFilter::getLinks(
+    const std::string& user_id, const LinkPageQuery& query) const
+{
+    return backend->getLinks(user_id, query);
+}
+
+mw::E<void> DataSourceFilter::forEachLink(
+    const std::function<mw::E<void>(ShortLink&&)>& f) const
+{
+    return backend->forEachLink(f);
+}
+
+mw::E<std::optional<ShortLink>> DataSourceFilter::getLink(int64_t id) const
+{
+    return backend->getLink(id);
+}
+
+mw::E<void> DataSourceFilter::removeLink(int64_t id) const
+{
+    std::lock_guard<std::mutex> guard(write_lock);
+    // The filter is keyed by shortcut, which has to be looked up
+    // before the link is gone.
+    ASSIGN_OR_RETURN(std::optional<ShortLink> link, backend->getLink(id));
+    DO_OR_RETURN(backend->removeLink(id));
+    if(link.has_value())
+    {
+        std::unique_lock<std::shared_mutex> filter_guard(filter_lock);
+        filter->remove(link->shortcut);
+    }
+    return {};
+}
+
+mw::E<void> DataSourceFilter::addVisits(
+    const std::unordered_map<int64_t, uint64_t>& visits) const
+{
+    return backend->addVisits(visits);
+}
+
+mw::E<std::vector<LinkChange>>
+DataSourceFilter::getChanges(int64_t after_seq, int64_t limit) const
+{
+    return backend->getChanges(after_seq, limit);
+}
+
+mw::E<int64_t> DataSourceFilter::latestChangeSeq() const
+{
+    return backend->latestChangeSeq();
+}
+
+mw::E<int64_t> DataSourceFilter::compactedChangeSeq() const
+{
+    return backend->compactedChangeSeq();
+}
+
+DataSourceFilter::Stats DataSourceFilter::stats() const
+{
+    Stats s;
+    s.filter_rejects = filter_rejects;
+    s.false_positives = false_positives;
+    s.negative_hits = negative_hits;
+    {
+        std::shared_lock<std::shared_mutex> guard(filter_lock);
+        s.links = filter->size();
+        s.estimated_false_positive_rate = filter->falsePositiveRate();
+    }
+    for(NegativeShard& shard: negative_shards)
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        s.negative_entries += shard.entries.size();
+    }
+    return s;
+}
+
+mw::E<void> DataSourceFilter::setSchemaVersion([[maybe_unused]] int64_t v)
+    const
+{
+    return std::unexpected(mw::runtimeError(
+        "Cannot set schema version through the shortcut filter"));
+}
+
+mw::E<std::unique_ptr<BloomFilter>> DataSourceFilter::buildFilter() const
+{
+    std::vector<std::string> shortcuts;
+    DO_OR_RETURN(backend->forEachLink([&](ShortLink&& link) -> mw::E<void>
+    {
+        shortcuts.push_back(std::move(link.shortcut));
+        return {};
+    }));
+    // Leave room to grow, so that the filter is not rebuilt soon.
+    auto result = std::make_unique<BloomFilter>(
+        std::max(shortcuts.size() * 2, FILTER_MIN_CAPACITY));
+    for(const std::string& shortcut: shortcuts)
+    {
+        result->add(shortcut);
+    }
+    return result;
+}
+
+bool DataSourceFilter::filterMayContain(std::string_view shortcut) const
+{
+    std::shared_lock<std::shared_mutex> guard(filter_lock);
+    return filter->mayContain(shortcut);
+}
+
+void DataSourceFilter::addToFilter(
+    const std::vector<std::string_view>& shortcuts) const
+{
+    {
+        std::unique_lock<std::shared_mutex> guard(filter_lock);
+        for(std::string_view shortcut: shortcuts)
+        {
+            filter->add(shortcut);
+        }
+        if(filter->size() <= filter->capacity())
+        {
+            return;
+        }
+    }
+    // The filter is over capacity, and its false positive rate goes
+    // up quickly from here. Make a larger one from the backend, which
+    // already has the new links. Readers keep using the old one in
+    // the mean time, and writers wait on “write_lock”.
+    mw::E<std::unique_ptr<BloomFilter>> larger = buildFilter();
+    if(!larger.has_value())
+    {
+        // The old filter is still correct, only less effective.
+        spdlog::error("Failed to rebuild shortcut filter: {}",
+                      mw::errorMsg(larger.error()));
+        return;
+    }
+    std::unique_lock<std::shared_mutex> guard(filter_lock);
+    filter = *std::move(larger);
+    spdlog::info("Shortcut filter rebuilt with {} links.", filter->size());
+}
+
+DataSourceFilter::NegativeShard& DataSourceFilter::negativeShard(
+    std::string_view shortcut) const
+{
+    return negative_shards[ShortcutHash()(shortcut) % NEGATIVE_SHARDS];
+}
+
+bool DataSourceFilter::isKnownMissing(std::string_view shortcut, bool exact,
+                                      uint64_t& generation) const
+{
+    // Nothing is remembered, so the shard is not even locked.
+    if(negative_shard_size == 0)
+    {
+        generation = 0;
+        return false;
+    }
+    NegativeShard& shard = negativeShard(shortcut);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    generation = shard.generation;
+    auto it = shard.entries.find(shortcut);
+    if(it == shard.entries.end() ||
+       it->second.expiration <= mw::Clock::now())
+    {
+        return false;
+    }
+    return exact ? it->second.no_exact : it->second.no_regexp;
+}
+
+void DataSourceFilter::rememberMissing(std::string_view shortcut, bool exact,
+                                       uint64_t generation) const
+{
+    if(negative_shard_size == 0)
+    {
+        return;
+    }
+    const mw::Time now = mw::Clock::now();
+    NegativeShard& shard = negativeShard(shortcut);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if(generation != shard.generation)
+    {
+        return;
+    }
+
+    auto it = shard.entries.find(shortcut);
+    if(it != shard.entries.end() && it->second.expiration <= now)
+    {
+        shard.order.erase(it->second.order_it);
+        shard.entries.erase(it);
+        it = shard.entries.end();
+    }
+    if(it == shard.entries.end())
+    {
+        // Drop the expired entries, which are the oldest, and the
+        // oldest one if it is still full.
+        while(!shard.order.empty() &&
+              (shard.entries.size() >= negative_shard_size ||
+               shard.entries.find(shard.order.front())->second.expiration
+               <= now))
+        {
+            shard.entries.erase(shard.order.front());
+            shard.order.pop_front();
+        }
+        shard.order.emplace_back(shortcut);
+        NegativeEntry entry;
+        entry.expiration = now + options.negative_ttl;
+        entry.order_it = std::prev(shard.order.end());
+        it = shard.entries.emplace(shard.order.back(), entry).first;
+    }
+    if(exact)
+    {
+        it->second.no_exact = true;
+    }
+    else
+    {
+        it->second.no_regexp = true;
+    }
+}
+
+void DataSourceFilter::forgetMissing(std::optional<std::string_view> shortcut)
+    const
+{
+    if(negative_shard_size == 0)
+    {
+        return;
+    }
+    if(!shortcut.has_value())
+    {
+        for(NegativeShard& shard: negative_shards)
+        {
+            std::lock_guard<std::mutex> guard(shard.lock);
+            shard.generation++;
+            shard.entries.clear();
+            shard.order.clear();
+        }
+        return;
+    }
+    NegativeShard& shard = negativeShard(*shortcut);
+    std::lock_guard<std::mutex> guard(shard.lock);
+    shard.generation++;
+    auto it = shard.entries.find(*shortcut);
+    if(it != shard.entries.end())
+    {
+        shard.order.erase(it->second.order_it);
+        shard.entries.erase(it);
+    }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mw/error.hpp>
+#include <mw/utils.hpp>
+
+#include "bloom_filter.hpp"
+#include "data.hpp"
+#include "metrics.hpp"
+
+// Answers lookups of shortcuts that do not exist without going to
+// the backend, for the scanners that request “/wp-login.php” and
+// the like.
+//
+// A Bloom filter holds the shortcuts of all links. An exact lookup
+// of a shortcut that is not in the filter is a miss straight away.
+// Since the filter cannot rule out regexp links, misses of regexp
+// lookups, and exact lookups that pass the filter but still miss,
+// are remembered in a negative cache for “negative_ttl”. The filter
+// is meant to sit below the link cache, so that lookups that hit the
+// cache never come here.
+//
+// The filter is built from the backend when this is created, and
+// then kept up to date by the writes that go through this class.
+// Links written to the database by anything else are not seen until
+// a restart. This class is thread-safe as long as the backend is.
+class DataSourceFilter : public DataSourceInterface
+{
+public:
+    struct Options
+    {
+        std::chrono::seconds negative_ttl{60};
+        // Maximal number of shortcuts in the negative cache. The
+        // oldest one is dropped when it is full. Set this to 0 to
+        // disable the negative cache.
+        size_t negative_cache_size = 100000;
+        // If not null, the statistics are exported here.
+        Metrics* metrics = nullptr;
+    };
+
+    struct Stats
+    {
+        // Exact lookups answered by the filter alone.
+        uint64_t filter_rejects = 0;
+        // Exact lookups that passed the filter but missed.
+        uint64_t false_positives = 0;
+        // Lookups answered by the negative cache.
+        uint64_t negative_hits = 0;
+        size_t links = 0;
+        size_t negative_entries = 0;
+        // False positive rate of the filter, estimated from how full
+        // it is.
+        double estimated_false_positive_rate = 0.0;
+
+        // Ratio of false positives over all exact lookups of
+        // shortcuts that do not exist, as actually observed. This is
+        // 0 if there has been none.
+        double observedFalsePositiveRate() const;
+    };
+
+    // Build the filter from all links in “source”.
+    static mw::E<std::unique_ptr<DataSourceFilter>>
+    create(std::unique_ptr<DataSourceInterface> source,
+           const Options& options);
+    ~DataSourceFilter() override = default;
+
+    mw::E<int64_t> getSchemaVersion() const override;
+
+    mw::E<void> addLink(ShortLink&& link) const override;
+    mw::E<std::vector<size_t>> addLinks(const std::vector<ShortLink>& links)
+        const override;
+    mw::E<std::optional<ShortLink>>
+    findLinkByShortcut(const std::string& shortcut) const override;
+    mw::E<std::optional<ResolvedLink>>
+    resolveShortcut(std::string_view shortcut, std::string& url) const
+        override;
+    mw::E<std::optional<ShortLink>>
+    findLinkFromRegexpLinks(const std::string& shortcut) const override;
+    mw::E<std::vector<ShortLink>> getAllLinks(const std::string& user_id) const
+        override;
+    mw::E<std::vector<ShortLink>> getLinks(
+        const std::string& user_id, const LinkPageQuery& query) const override;
+    mw::E<void> forEachLink(
+        const std::function<mw::E<void>(ShortLink&&)>& f) const override;
+    mw::E<std::optional<ShortLink>> getLink(int64_t id) const override;
+    mw::E<void> removeLink(int64_t id) const override;
+    mw::E<void> addVisits(const std::unordered_map<int64_t, uint64_t>& visits)
+        const override;
+    mw::E<std::vector<LinkChange>> getChanges(int64_t after_seq,
+                                              int64_t limit) const override;
+    mw::E<int64_t> latestChangeSeq() const override;
+    mw::E<int64_t> compactedChangeSeq() const override;
+
+    Stats stats() const;
+
+protected:
+    // The schema belongs to the backend. This always fails.
+    mw::E<void> setSchemaVersion(int64_t v) const override;
+
+private:
+    // What is known to be missing for a shortcut in the negative
+    // cache.
+    struct NegativeEntry
+    {
+        mw::Time expiration;
+        bool no_exact = false;
+        bool no_regexp = false;
+        // Position in the “order” of its shard.
+        std::list<std::string>::iterator order_it;
+    };
+
+    struct ShortcutHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const
+        {
+            return std::hash<std::string_view>()(s);
+        }
+    };
+
+    // The negative cache is split by the hash of the shortcut, so that
+    // concurrent lookups rarely wait on each other.
+    struct alignas(64) NegativeShard
+    {
+        std::mutex lock;
+        std::unordered_map<std::string, NegativeEntry, ShortcutHash,
+                           std::equal_to<>> entries;
+        // Keys in the order of insertion. Oldest is at the front.
+        std::list<std::string> order;
+        // Increased whenever the shard is invalidated, so that a
+        // lookup that started before a link was added does not put
+        // its stale miss into the cache.
+        uint64_t generation = 0;
+    };
+    static constexpr size_t NEGATIVE_SHARDS = 16;
+
+    DataSourceFilter(std::unique_ptr<DataSourceInterface> source,
+                     const Options& options);
+
+    // Build a filter of all links in the backend.
+    mw::E<std::unique_ptr<BloomFilter>> buildFilter() const;
+    bool filterMayContain(std::string_view shortcut) const;
+    // Add “shortcuts” to the filter, making it larger if it is full.
+    // This requires “write_lock”.
+    void addToFilter(const std::vector<std::string_view>& shortcuts) const;
+
+    // Return whether “shortcut” is in the negative cache, for exact
+    // lookups or regexp lookups. “generation” is set to the
+    // generation to pass to rememberMissing() if the backend misses.
+    bool isKnownMissing(std::string_view shortcut, bool exact,
+                        uint64_t& generation) const;
+    void rememberMissing(std::string_view shortcut, bool exact,
+                         uint64_t generation) const;
+    // Forget the negative result of “shortcut”, or all of them if
+    // it is nullopt.
+    void forgetMissing(std::optional<std::string_view> shortcut) const;
+    // The shard of the negative cache that holds “shortcut”.
+    NegativeShard& negativeShard(std::string_view shortcut) const;
+
+    std::unique_ptr<DataSourceInterface> backend;
+    const Options options;
+
+    // Held by all writes, so that the filter is updated in the same
+    // order as the backend, and while the filter is rebuilt.
+    mutable std::mutex write_lock;
+    mutable std::shared_mutex filter_lock;
+    mutable std::unique_ptr<BloomFilter> filter;
+
+    mutable std::array<NegativeShard, NEGATIVE_SHARDS> negative_shards;
+    // Maximal number of entries in each shard.
+    const size_t negative_shard_size;
+
+    mutable std::atomic<uint64_t> filter_rejects = 0;
+    mutable std::atomic<uint64_t> false_positives = 0;
+    mutable std::atomic<uint64_t> negative_hits = 0;
+
+    std::vector<Metrics::Registration> metric_callbacks;
+};
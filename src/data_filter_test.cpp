@@ -0,0 +1,139 @@
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+
+#include "data.hpp"
+#include "data_filter.hpp"
+#include "data_mock.hpp"
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Return;
+
+namespace
+{
+
+ShortLink makeLink(int64_t id, const std::string& shortcut)
+{
+    ShortLink link;
+    link.id = id;
+    link.shortcut = shortcut;
+    link.original_url = "https://darksair.org/" + shortcut;
+    link.type = ShortLink::NORMAL;
+    link.user_id = "mw";
+    link.visits = 0;
+    return link;
+}
+
+} // namespace
+
+TEST(DataSourceFilter, CanAnswerMissesWithoutBackend)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> backend,
+                   DataSourceSQLite::newFromMemory());
+    ASSERT_TRUE(mw::isExpected(backend->addLink(makeLink(0, "a"))));
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceFilter> data,
+                   DataSourceFilter::create(std::move(backend), {}));
+
+    std::string url;
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> resolved,
+                   data->resolveShortcut("a", url));
+    EXPECT_TRUE(resolved.has_value());
+    EXPECT_EQ(url, "https://darksair.org/a");
+    ASSIGN_OR_FAIL(resolved, data->resolveShortcut("wp-login.php", url));
+    EXPECT_FALSE(resolved.has_value());
+    EXPECT_EQ(data->stats().filter_rejects, 1);
+
+    // Added and removed links are seen at once.
+    ASSERT_TRUE(mw::isExpected(data->addLink(makeLink(0, "b"))));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link,
+                   data->findLinkByShortcut("b"));
+    ASSERT_TRUE(link.has_value());
+    ASSERT_TRUE(mw::isExpected(data->removeLink(link->id)));
+    ASSIGN_OR_FAIL(link, data->findLinkByShortcut("b"));
+    EXPECT_FALSE(link.has_value());
+    EXPECT_EQ(data->stats().links, 1);
+}
+
+TEST(DataSourceFilter, CanCacheRegexpMisses)
+{
+    auto backend = std::make_unique<DataSourceMock>();
+    EXPECT_CALL(*backend, forEachLink(_))
+        .WillOnce(Return(mw::E<void>()));
+    EXPECT_CALL(*backend, findLinkFromRegexpLinks(".env"))
+        .WillOnce(Return(std::nullopt))
+        .WillOnce(Return(makeLink(1, "(.*)")));
+    EXPECT_CALL(*backend, addLink(_)).WillOnce(Return(mw::E<void>()));
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceFilter> data,
+                   DataSourceFilter::create(std::move(backend), {}));
+
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link,
+                   data->findLinkFromRegexpLinks(".env"));
+    EXPECT_FALSE(link.has_value());
+    ASSIGN_OR_FAIL(link, data->findLinkFromRegexpLinks(".env"));
+    EXPECT_FALSE(link.has_value());
+    EXPECT_EQ(data->stats().negative_hits, 1);
+
+    // A new regexp link may match anything, so the misses are
+    // forgotten.
+    ShortLink regexp = makeLink(0, "(.*)");
+    regexp.type = ShortLink::REGEXP;
+    ASSERT_TRUE(mw::isExpected(data->addLink(std::move(regexp))));
+    EXPECT_EQ(data->stats().negative_entries, 0);
+    ASSIGN_OR_FAIL(link, data->findLinkFromRegexpLinks(".env"));
+    EXPECT_TRUE(link.has_value());
+}
+
+TEST(DataSourceFilter, CanDisableNegativeCache)
+{
+    auto backend = std::make_unique<DataSourceMock>();
+    EXPECT_CALL(*backend, forEachLink(_))
+        .WillOnce(Return(mw::E<void>()));
+    EXPECT_CALL(*backend, findLinkFromRegexpLinks(".env"))
+        .Times(2).WillRepeatedly(Return(std::nullopt));
+    DataSourceFilter::Options options;
+    options.negative_cache_size = 0;
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceFilter> data,
+                   DataSourceFilter::create(std::move(backend), options));
+
+    for(int i = 0; i < 2; i++)
+    {
+        ASSIGN_OR_FAIL(std::optional<ShortLink> link,
+                       data->findLinkFromRegexpLinks(".env"));
+        EXPECT_FALSE(link.has_value());
+    }
+    EXPECT_EQ(data->stats().negative_hits, 0);
+    EXPECT_EQ(data->stats().negative_entries, 0);
+}
+
+TEST(DataSourceFilter, CanGrowFilter)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> backend,
+                   DataSourceSQLite::newFromMemory());
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceFilter> data,
+                   DataSourceFilter::create(std::move(backend), {}));
+    std::vector<ShortLink> links;
+    for(int i = 0; i < 3000; i++)
+    {
+        links.push_back(makeLink(0, std::format("link{}", i)));
+    }
+    ASSIGN_OR_FAIL(std::vector<size_t> skipped, data->addLinks(links));
+    EXPECT_TRUE(skipped.empty());
+    std::string url;
+    for(const ShortLink& link: links)
+    {
+        ASSIGN_OR_FAIL(std::optional<ResolvedLink> resolved,
+                       data->resolveShortcut(link.shortcut, url));
+        EXPECT_TRUE(resolved.has_value());
+    }
+    DataSourceFilter::Stats stats = data->stats();
+    EXPECT_EQ(stats.links, 3000);
+    EXPECT_LT(stats.estimated_false_positive_rate, 0.01);
+}
@@ -0,0 +1,450 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <expected>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <mw/error.hpp>
+#include <spdlog/spdlog.h>
+
+#include "data.hpp"
+#include "data_hot_links.hpp"
+#include "frequency_sketch.hpp"
+
+namespace
+{
+
+// A candidate is written to the first free one of this many slots
+// from a rotating start, or dropped.
+constexpr size_t CANDIDATE_PROBES = 4;
+
+std::atomic<uint64_t> next_instance_id = 1;
+
+} // namespace
+
+DataSourceHotLinks::PinnedTable::PinnedTable(std::vector<PinnedLink>&& links)
+        : pinned(std::move(links)),
+          buckets(std::bit_ceil(std::max<size_t>(pinned.size() * 2, 1)), 0)
+{
+    const size_t mask = buckets.size() - 1;
+    for(size_t i = 0; i < pinned.size(); i++)
+    {
+        size_t b = std::hash<std::string_view>()(pinned[i].shortcut) & mask;
+        while(buckets[b] != 0)
+        {
+            b = (b + 1) & mask;
+        }
+        buckets[b] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+const DataSourceHotLinks::PinnedLink*
+DataSourceHotLinks::PinnedTable::find(std::string_view shortcut) const
+{
+    if(pinned.empty())
+    {
+        return nullptr;
+    }
+    const size_t mask = buckets.size() - 1;
+    size_t b = std::hash<std::string_view>()(shortcut) & mask;
+    // There is always an empty bucket, since the table is at most
+    // half full.
+    while(buckets[b] != 0)
+    {
+        const PinnedLink& link = pinned[buckets[b] - 1];
+        if(link.shortcut == shortcut)
+        {
+            return &link;
+        }
+        b = (b + 1) & mask;
+    }
+    return nullptr;
+}
+
+DataSourceHotLinks::DataSourceHotLinks(
+    std::unique_ptr<DataSourceInterface> source, const Options& opts)
+        : backend(std::move(source)), options(opts),
+          instance_id(next_instance_id++), sketch(options.sketch_width),
+          pinned(std::make_shared<const PinnedTable>(
+              std::vector<PinnedLink>()))
+{
+    if(options.metrics != nullptr)
+    {
+        Metrics& m = *options.metrics;
+        metric_callbacks.push_back(m.callback(
+            Metrics::COUNTER, "shrt_hot_links_hits_total",
+            "Exact lookups of shortcuts answered by the table of hot links",
+            "", [this] { return static_cast<double>(hits); }));
+        metric_callbacks.push_back(m.callback(
+            Metrics::GAUGE, "shrt_hot_links_pinned",
+            "Number of links in the table of hot links", "",
+            [this] { return static_cast<double>(stats().pinned); }));
+        metric_callbacks.push_back(m.callback(
+            Metrics::COUNTER, "shrt_hot_links_promotions_total",
+            "Links added to the table of hot links", "",
+            [this] { return static_cast<double>(promotions); }));
+        metric_callbacks.push_back(m.callback(
+            Metrics::COUNTER, "shrt_hot_links_demotions_total",
+            "Links dropped from the table of hot links", "",
+            [this] { return static_cast<double>(demotions); }));
+    }
+    promoter = std::thread([this] { run(); });
+}
+
+DataSourceHotLinks::~DataSourceHotLinks()
+{
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    promoter.join();
+}
+
+mw::E<int64_t> DataSourceHotLinks::getSchemaVersion() const
+{
+    return backend->getSchemaVersion();
+}
+
+mw::E<void> DataSourceHotLinks::addLink(ShortLink&& link) const
+{
+    // A new link is not pinned yet, so there is nothing to update.
+    return backend->addLink(std::move(link));
+}
+
+mw::E<std::vector<size_t>>
+DataSourceHotLinks::addLinks(const std::vector<ShortLink>& links) const
+{
+    return backend->addLinks(links);
+}
+
+mw::E<std::optional<ShortLink>> DataSourceHotLinks::findLinkByShortcut(
+    const std::string& shortcut) const
+{
+    return backend->findLinkByShortcut(shortcut);
+}
+
+mw::E<std::optional<ResolvedLink>> DataSourceHotLinks::resolveShortcut(
+    std::string_view shortcut, std::string& url) const
+{
+    const PinnedLink* link = table().find(shortcut);
+    if(link != nullptr)
+    {
+        hits.fetch_add(1, std::memory_order_relaxed);
+        url.assign(link->url);
+        record(shortcut, true);
+        return link->resolved;
+    }
+    ASSIGN_OR_RETURN(std::optional<ResolvedLink> resolved,
+                     backend->resolveShortcut(shortcut, url));
+    if(resolved.has_value())
+    {
+        record(shortcut, false);
+    }
+    return resolved;
+}
+
+mw::E<std::optional<ShortLink>> DataSourceHotLinks::findLinkFromRegexpLinks(
+    const std::string& shortcut) const
+{
+    return backend->findLinkFromRegexpLinks(shortcut);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceHotLinks::getAllLinks(
+    const std::string& user_id) const
+{
+    return backend->getAllLinks(user_id);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceHotLinks::getLinks(
+    const std::string& user_id, const LinkPageQuery& query) const
+{
+    return backend->getLinks(user_id, query);
+}
+
+mw::E<void> DataSourceHotLinks::forEachLink(
+    const std::function<mw::E<void>(ShortLink&&)>& f) const
+{
+    return backend->forEachLink(f);
+}
+
+mw::E<std::optional<ShortLink>> DataSourceHotLinks::getLink(int64_t id) const
+{
+    return backend->getLink(id);
+}
+
+mw::E<void> DataSourceHotLinks::removeLink(int64_t id) const
+{
+    // Unpin the link first, and keep the promoter from pinning it
+    // again until it is gone from the backend.
+    std::lock_guard<std::mutex> guard(publish_lock);
+    generation++;
+    std::shared_ptr<const PinnedTable> current = pinned.load();
+    std::vector<PinnedLink> links;
+    for(const PinnedLink& link: current->links())
+    {
+        if(link.resolved.id != id)
+        {
+            links.push_back(link);
+        }
+    }
+    if(links.size() != current->links().size())
+    {
+        demotions++;
+        publish(std::make_shared<const PinnedTable>(std::move(links)));
+    }
+    return backend->removeLink(id);
+}
+
+mw::E<void> DataSourceHotLinks::addVisits(
+    const std::unordered_map<int64_t, uint64_t>& visits) const
+{
+    return backend->addVisits(visits);
+}
+
+mw::E<std::vector<LinkChange>>
+DataSourceHotLinks::getChanges(int64_t after_seq, int64_t limit) const
+{
+    return backend->getChanges(after_seq, limit);
+}
+
+mw::E<int64_t> DataSourceHotLinks::latestChangeSeq() const
+{
+    return backend->latestChangeSeq();
+}
+
+mw::E<int64_t> DataSourceHotLinks::compactedChangeSeq() const
+{
+    return backend->compactedChangeSeq();
+}
+
+std::vector<DataSourceHotLinks::HotLink> DataSourceHotLinks::topLinks() const
+{
+    std::lock_guard<std::mutex> guard(top_lock);
+    return top;
+}
+
+DataSourceHotLinks::Stats DataSourceHotLinks::stats() const
+{
+    Stats s;
+    s.hits = hits;
+    s.promotions = promotions;
+    s.demotions = demotions;
+    s.pinned = pinned.load()->links().size();
+    return s;
+}
+
+mw::E<void> DataSourceHotLinks::promote() const
+{
+    uint64_t start_generation;
+    {
+        std::lock_guard<std::mutex> guard(publish_lock);
+        start_generation = generation;
+    }
+    std::shared_ptr<const PinnedTable> current = pinned.load();
+
+    // The links to consider are the new candidates, the links of the
+    // last promotion, and the pinned ones.
+    std::unordered_set<std::string> keys;
+    for(CandidateSlot& slot: candidates)
+    {
+        uint32_t expected = CandidateSlot::READY;
+        if(!slot.state.compare_exchange_strong(
+               expected, CandidateSlot::WRITING, std::memory_order_acquire))
+        {
+            continue;
+        }
+        keys.emplace(slot.shortcut.data(), slot.size);
+        slot.state.store(CandidateSlot::EMPTY, std::memory_order_release);
+    }
+    {
+        std::lock_guard<std::mutex> guard(top_lock);
+        for(const HotLink& link: top)
+        {
+            keys.insert(link.shortcut);
+        }
+    }
+    for(const PinnedLink& link: current->links())
+    {
+        keys.insert(link.shortcut);
+    }
+
+    std::vector<HotLink> hot;
+    for(const std::string& key: keys)
+    {
+        uint32_t estimate = scaledCount(sketch.estimate(key));
+        if(estimate >= options.threshold)
+        {
+            hot.push_back({key, estimate, false});
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [](const HotLink& a, const HotLink& b)
+    {
+        return a.estimate > b.estimate;
+    });
+    // Keep a few more than fit, to show what is close.
+    hot.resize(std::min(hot.size(), options.capacity * 2));
+
+    std::vector<PinnedLink> links;
+    uint64_t promoted = 0;
+    for(size_t i = 0; i < hot.size() && links.size() < options.capacity; i++)
+    {
+        const PinnedLink* link = current->find(hot[i].shortcut);
+        if(link != nullptr)
+        {
+            links.push_back(*link);
+            hot[i].pinned = true;
+            continue;
+        }
+        std::string url;
+        ASSIGN_OR_RETURN(std::optional<ResolvedLink> resolved,
+                         backend->resolveShortcut(hot[i].shortcut, url));
+        if(!resolved.has_value())
+        {
+            continue;
+        }
+        links.push_back({hot[i].shortcut, std::move(url), *resolved});
+        hot[i].pinned = true;
+        promoted++;
+    }
+    uint64_t demoted = current->links().size() + promoted - links.size();
+
+    {
+        std::lock_guard<std::mutex> guard(publish_lock);
+        // A link was removed in the mean time, and may be in “links”.
+        // Try again at the next interval.
+        if(generation != start_generation)
+        {
+            return {};
+        }
+        publish(std::make_shared<const PinnedTable>(std::move(links)));
+    }
+    promotions += promoted;
+    demotions += demoted;
+    {
+        std::lock_guard<std::mutex> guard(top_lock);
+        top = std::move(hot);
+    }
+    sketch.decay();
+    return {};
+}
+
+mw::E<void> DataSourceHotLinks::setSchemaVersion([[maybe_unused]] int64_t v)
+    const
+{
+    return std::unexpected(mw::runtimeError(
+        "Cannot set schema version through the hot links table"));
+}
+
+const DataSourceHotLinks::PinnedTable& DataSourceHotLinks::table() const
+{
+    struct LocalTable
+    {
+        uint64_t instance_id = 0;
+        uint64_t version = 0;
+        std::shared_ptr<const PinnedTable> table;
+    };
+    thread_local LocalTable local;
+    // The version is increased after a table is stored, so a table
+    // loaded after reading a version is at least that new.
+    uint64_t version = pinned_version.load(std::memory_order_acquire);
+    if(local.instance_id != instance_id || local.version != version ||
+       local.table == nullptr)
+    {
+        local.table = pinned.load();
+        local.instance_id = instance_id;
+        local.version = version;
+    }
+    return *local.table;
+}
+
+void DataSourceHotLinks::record(std::string_view shortcut, bool is_pinned)
+    const
+{
+    thread_local uint32_t lookups = 0;
+    if(++lookups % SAMPLE_RATE != 0 || shortcut.size() > MAX_SHORTCUT_SIZE)
+    {
+        return;
+    }
+    uint32_t count = sketch.add(shortcut);
+    if(is_pinned)
+    {
+        return;
+    }
+    // Offer a hot link when it crosses the threshold, and again every
+    // threshold after that, in case the candidate was dropped.
+    const uint32_t step = std::max<uint32_t>(
+        options.threshold * 2 / SAMPLE_RATE, 1);
+    if(count >= step && count % step == 0)
+    {
+        offer(shortcut);
+    }
+}
+
+uint32_t DataSourceHotLinks::scaledCount(uint32_t count)
+{
+    // Only one in “SAMPLE_RATE” lookups is counted. The counts of
+    // earlier intervals add up to about one more interval, since
+    // they are halved after every interval.
+    return static_cast<uint32_t>(std::min<uint64_t>(
+        uint64_t(count) * SAMPLE_RATE / 2,
+        std::numeric_limits<uint32_t>::max()));
+}
+
+void DataSourceHotLinks::offer(std::string_view shortcut) const
+{
+    size_t start = next_candidate.fetch_add(1, std::memory_order_relaxed);
+    for(size_t i = 0; i < CANDIDATE_PROBES; i++)
+    {
+        CandidateSlot& slot = candidates[(start + i) % CANDIDATE_SLOTS];
+        uint32_t expected = CandidateSlot::EMPTY;
+        if(!slot.state.compare_exchange_strong(
+               expected, CandidateSlot::WRITING, std::memory_order_acquire))
+        {
+            continue;
+        }
+        std::memcpy(slot.shortcut.data(), shortcut.data(), shortcut.size());
+        slot.size = static_cast<uint8_t>(shortcut.size());
+        slot.state.store(CandidateSlot::READY, std::memory_order_release);
+        return;
+    }
+}
+
+void DataSourceHotLinks::publish(std::shared_ptr<const PinnedTable> next) const
+{
+    pinned.store(std::move(next));
+    pinned_version.fetch_add(1, std::memory_order_release);
+}
+
+void DataSourceHotLinks::run()
+{
+    std::unique_lock<std::mutex> lock(wake_lock);
+    while(!stopping)
+    {
+        wake.wait_for(lock, options.interval, [this] { return stopping; });
+        if(stopping)
+        {
+            break;
+        }
+        lock.unlock();
+        mw::E<void> result = promote();
+        if(!result.has_value())
+        {
+            spdlog::error("Failed to promote hot links: {}",
+                          mw::errorMsg(result.error()));
+        }
+        lock.lock();
+    }
+}
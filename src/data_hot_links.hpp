@@ -0,0 +1,208 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mw/error.hpp>
+
+#include "data.hpp"
+#include "frequency_sketch.hpp"
+#include "metrics.hpp"
+
+// Keeps the few links that get most of the redirects in a small
+// table in front of everything else.
+//
+// Exact lookups are counted in a FrequencySketch. A shortcut whose
+// estimate reaches “threshold” is offered as a candidate in a fixed
+// ring of slots. A background thread collects the candidates every
+// “interval”, keeps the top “capacity” of them and of the pinned
+// links by their estimates, and publishes a new pinned table. Links
+// that fall below the threshold are dropped from it. The sketch is
+// then decayed, so the estimates follow the traffic of the last few
+// intervals.
+//
+// Lookups read the pinned table without locking: each thread keeps
+// its own reference to the latest table, and only takes a new one
+// when the version number changes. Neither counting nor offering a
+// candidate allocates.
+//
+// Only exact lookups through resolveShortcut() are pinned. Removing
+// a link unpins it before it is removed from the backend, so that it
+// is never served afterwards. This class is thread-safe as long as
+// the backend is.
+class DataSourceHotLinks : public DataSourceInterface
+{
+public:
+    struct Options
+    {
+        // Maximal number of pinned links.
+        size_t capacity = 64;
+        // Estimated lookups per interval for a link to be pinned.
+        uint32_t threshold = 100;
+        std::chrono::milliseconds interval{1000};
+        // Counters in each row of the sketch.
+        size_t sketch_width = 16384;
+        // If not null, the statistics are exported here.
+        Metrics* metrics = nullptr;
+    };
+
+    struct HotLink
+    {
+        std::string shortcut;
+        // Estimated lookups in the last interval or so.
+        uint32_t estimate;
+        bool pinned;
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t promotions = 0;
+        uint64_t demotions = 0;
+        size_t pinned = 0;
+    };
+
+    DataSourceHotLinks(std::unique_ptr<DataSourceInterface> source,
+                       const Options& options);
+    ~DataSourceHotLinks() override;
+
+    mw::E<int64_t> getSchemaVersion() const override;
+
+    mw::E<void> addLink(ShortLink&& link) const override;
+    mw::E<std::vector<size_t>> addLinks(const std::vector<ShortLink>& links)
+        const override;
+    mw::E<std::optional<ShortLink>>
+    findLinkByShortcut(const std::string& shortcut) const override;
+    mw::E<std::optional<ResolvedLink>>
+    resolveShortcut(std::string_view shortcut, std::string& url) const
+        override;
+    mw::E<std::optional<ShortLink>>
+    findLinkFromRegexpLinks(const std::string& shortcut) const override;
+    mw::E<std::vector<ShortLink>> getAllLinks(const std::string& user_id) const
+        override;
+    mw::E<std::vector<ShortLink>> getLinks(
+        const std::string& user_id, const LinkPageQuery& query) const override;
+    mw::E<void> forEachLink(
+        const std::function<mw::E<void>(ShortLink&&)>& f) const override;
+    mw::E<std::optional<ShortLink>> getLink(int64_t id) const override;
+    mw::E<void> removeLink(int64_t id) const override;
+    mw::E<void> addVisits(const std::unordered_map<int64_t, uint64_t>& visits)
+        const override;
+    mw::E<std::vector<LinkChange>> getChanges(int64_t after_seq,
+                                              int64_t limit) const override;
+    mw::E<int64_t> latestChangeSeq() const override;
+    mw::E<int64_t> compactedChangeSeq() const override;
+
+    // The hottest links known, pinned or not, with the highest
+    // estimate first. These are the ones considered in the last
+    // promotion.
+    std::vector<HotLink> topLinks() const;
+    Stats stats() const;
+
+    // Collect the candidates and publish a new pinned table now. This
+    // is called by the background thread. It is public for tests.
+    mw::E<void> promote() const;
+
+protected:
+    // The schema belongs to the backend. This always fails.
+    mw::E<void> setSchemaVersion(int64_t v) const override;
+
+private:
+    // Shortcuts longer than this are never pinned, so that a
+    // candidate fits in a slot.
+    static constexpr size_t MAX_SHORTCUT_SIZE = 64;
+    static constexpr size_t CANDIDATE_SLOTS = 256;
+    // Only every this many lookups of a thread is counted, so that
+    // the threads do not all write to the counters of the same hot
+    // link all the time. See scaledCount().
+    static constexpr uint32_t SAMPLE_RATE = 8;
+
+    struct PinnedLink
+    {
+        std::string shortcut;
+        std::string url;
+        ResolvedLink resolved;
+    };
+
+    // An immutable open-addressing table of the pinned links.
+    class PinnedTable
+    {
+    public:
+        explicit PinnedTable(std::vector<PinnedLink>&& links);
+        const PinnedLink* find(std::string_view shortcut) const;
+        const std::vector<PinnedLink>& links() const { return pinned; }
+
+    private:
+        std::vector<PinnedLink> pinned;
+        // Index into “pinned” plus 1, or 0 for an empty bucket.
+        std::vector<uint32_t> buckets;
+    };
+
+    // A candidate shortcut, handed from a request thread to the
+    // background thread. “state” is EMPTY, WRITING or READY, and
+    // the thread that moves it out of EMPTY or READY owns the slot
+    // until it stores the next state.
+    struct alignas(64) CandidateSlot
+    {
+        enum State : uint32_t { EMPTY, WRITING, READY };
+        std::atomic<uint32_t> state = EMPTY;
+        uint8_t size = 0;
+        std::array<char, MAX_SHORTCUT_SIZE> shortcut;
+    };
+
+    // The current table, as seen by the calling thread.
+    const PinnedTable& table() const;
+    // Count a lookup of “shortcut”, and offer it as a candidate if it
+    // is hot and not pinned yet.
+    void record(std::string_view shortcut, bool is_pinned) const;
+    void offer(std::string_view shortcut) const;
+    // Lookups per interval from a count in the sketch.
+    static uint32_t scaledCount(uint32_t count);
+    // Replace the pinned table. This requires “publish_lock”.
+    void publish(std::shared_ptr<const PinnedTable> next) const;
+    void run();
+
+    std::unique_ptr<DataSourceInterface> backend;
+    const Options options;
+    // Distinguishes this from other instances in the thread-local
+    // references to tables.
+    const uint64_t instance_id;
+
+    mutable FrequencySketch sketch;
+    mutable std::array<CandidateSlot, CANDIDATE_SLOTS> candidates;
+    mutable std::atomic<uint64_t> next_candidate = 0;
+
+    mutable std::atomic<std::shared_ptr<const PinnedTable>> pinned;
+    mutable std::atomic<uint64_t> pinned_version = 0;
+    // Held while publishing a table.
+    mutable std::mutex publish_lock;
+    // Increased by every removal, so that a promotion that read the
+    // backend before it does not pin the removed link again.
+    mutable uint64_t generation = 0;
+    // Shortcuts considered in the last promotion, and their
+    // estimates, for topLinks().
+    mutable std::mutex top_lock;
+    mutable std::vector<HotLink> top;
+
+    mutable std::atomic<uint64_t> hits = 0;
+    mutable std::atomic<uint64_t> promotions = 0;
+    mutable std::atomic<uint64_t> demotions = 0;
+    std::vector<Metrics::Registration> metric_callbacks;
+
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread promoter;
+};
@@ -0,0 +1,124 @@
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+
+#include "data.hpp"
+#include "data_hot_links.hpp"
+
+namespace
+{
+
+ShortLink makeLink(const std::string& shortcut)
+{
+    ShortLink link;
+    link.shortcut = shortcut;
+    link.original_url = "https://darksair.org/" + shortcut;
+    link.type = ShortLink::NORMAL;
+    link.user_id = "mw";
+    link.visits = 0;
+    return link;
+}
+
+mw::E<std::unique_ptr<DataSourceHotLinks>> makeData()
+{
+    ASSIGN_OR_RETURN(std::unique_ptr<DataSourceSQLite> backend,
+                     DataSourceSQLite::newFromMemory());
+    DO_OR_RETURN(backend->addLink(makeLink("a")));
+    DO_OR_RETURN(backend->addLink(makeLink("b")));
+    DataSourceHotLinks::Options options;
+    options.capacity = 1;
+    options.threshold = 100;
+    // Only promote when the test says so.
+    options.interval = std::chrono::hours(1);
+    options.sketch_width = 1024;
+    return std::make_unique<DataSourceHotLinks>(std::move(backend), options);
+}
+
+void lookUp(const DataSourceHotLinks& data, const std::string& shortcut,
+            int times)
+{
+    std::string url;
+    for(int i = 0; i < times; i++)
+    {
+        ASSERT_TRUE(mw::isExpected(data.resolveShortcut(shortcut, url)));
+    }
+}
+
+} // namespace
+
+TEST(DataSourceHotLinks, CanPinHotLinks)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceHotLinks> data, makeData());
+    lookUp(*data, "a", 800);
+    lookUp(*data, "b", 400);
+    lookUp(*data, "c", 800);
+    ASSERT_TRUE(mw::isExpected(data->promote()));
+
+    // Only the hottest one fits.
+    DataSourceHotLinks::Stats stats = data->stats();
+    EXPECT_EQ(stats.pinned, 1);
+    EXPECT_EQ(stats.promotions, 1);
+    std::vector<DataSourceHotLinks::HotLink> top = data->topLinks();
+    ASSERT_EQ(top.size(), 2);
+    EXPECT_EQ(top[0].shortcut, "a");
+    EXPECT_TRUE(top[0].pinned);
+    EXPECT_GE(top[0].estimate, 400);
+    EXPECT_EQ(top[1].shortcut, "b");
+    EXPECT_FALSE(top[1].pinned);
+
+    std::string url;
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> resolved,
+                   data->resolveShortcut("a", url));
+    EXPECT_TRUE(resolved.has_value());
+    EXPECT_EQ(url, "https://darksair.org/a");
+    EXPECT_EQ(data->stats().hits, 1);
+    ASSIGN_OR_FAIL(resolved, data->resolveShortcut("b", url));
+    EXPECT_TRUE(resolved.has_value());
+    EXPECT_EQ(url, "https://darksair.org/b");
+    EXPECT_EQ(data->stats().hits, 1);
+}
+
+TEST(DataSourceHotLinks, CanDemoteLinks)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceHotLinks> data, makeData());
+    lookUp(*data, "a", 800);
+    ASSERT_TRUE(mw::isExpected(data->promote()));
+    ASSERT_EQ(data->stats().pinned, 1);
+
+    // Without more lookups, the estimate decays below the threshold.
+    for(int i = 0; i < 10; i++)
+    {
+        ASSERT_TRUE(mw::isExpected(data->promote()));
+    }
+    EXPECT_EQ(data->stats().pinned, 0);
+    EXPECT_EQ(data->stats().demotions, 1);
+    EXPECT_TRUE(data->topLinks().empty());
+}
+
+TEST(DataSourceHotLinks, CanUnpinRemovedLinks)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceHotLinks> data, makeData());
+    lookUp(*data, "a", 800);
+    ASSERT_TRUE(mw::isExpected(data->promote()));
+    ASSERT_EQ(data->stats().pinned, 1);
+
+    std::string url;
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> resolved,
+                   data->resolveShortcut("a", url));
+    ASSERT_TRUE(resolved.has_value());
+    ASSERT_TRUE(mw::isExpected(data->removeLink(resolved->id)));
+    EXPECT_EQ(data->stats().pinned, 0);
+    ASSIGN_OR_FAIL(resolved, data->resolveShortcut("a", url));
+    EXPECT_FALSE(resolved.has_value());
+
+    ASSERT_TRUE(mw::isExpected(data->promote()));
+    EXPECT_EQ(data->stats().pinned, 0);
+    ASSIGN_OR_FAIL(resolved, data->resolveShortcut("a", url));
+    EXPECT_FALSE(resolved.has_value());
+}
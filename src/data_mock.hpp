@@ -1,8 +1,11 @@
 #pragma once
 
+#include <functional>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <unordered_map>
 
 #include <gmock/gmock.h>
 #include <mw/error.hpp>
@@ -16,15 +19,33 @@ public:
 
     MOCK_METHOD(mw::E<int64_t>, getSchemaVersion, (), (const override));
     MOCK_METHOD(mw::E<void>, addLink, (ShortLink&& link), (const override));
+    MOCK_METHOD(mw::E<std::vector<size_t>>, addLinks,
+                (const std::vector<ShortLink>& links), (const override));
     MOCK_METHOD(mw::E<std::optional<ShortLink>>, findLinkByShortcut,
                 (const std::string& shortcut), (const override));
+    MOCK_METHOD(mw::E<std::optional<ResolvedLink>>, resolveShortcut,
+                (std::string_view shortcut, std::string& url),
+                (const override));
     MOCK_METHOD(mw::E<std::optional<ShortLink>>, findLinkFromRegexpLinks,
                 (const std::string& shortcut), (const override));
     MOCK_METHOD(mw::E<std::vector<ShortLink>>, getAllLinks,
                 (const std::string& user_id), (const override));
+    MOCK_METHOD(mw::E<std::vector<ShortLink>>, getLinks,
+                (const std::string& user_id, const LinkPageQuery& query),
+                (const override));
+    MOCK_METHOD(mw::E<void>, forEachLink,
+                ((const std::function<mw::E<void>(ShortLink&&)>& f)),
+                (const override));
     MOCK_METHOD(mw::E<std::optional<ShortLink>>, getLink, (int64_t id),
                 (const override));
     MOCK_METHOD(mw::E<void>, removeLink, (int64_t id), (const override));
+    MOCK_METHOD(mw::E<void>, addVisits,
+                ((const std::unordered_map<int64_t, uint64_t>& visits)),
+                (const override));
+    MOCK_METHOD(mw::E<std::vector<LinkChange>>, getChanges,
+                (int64_t after_seq, int64_t limit), (const override));
+    MOCK_METHOD(mw::E<int64_t>, latestChangeSeq, (), (const override));
+    MOCK_METHOD(mw::E<int64_t>, compactedChangeSeq, (), (const override));
 
 protected:
     mw::E<void> setSchemaVersion([[maybe_unused]] int64_t v) const override
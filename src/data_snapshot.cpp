@@ -0,0 +1,494 @@
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <spdlog/spdlog.h>
+#include <mw/error.hpp>
+
+#include "data.hpp"
+#include "data_snapshot.hpp"
+
+namespace
+{
+
+constexpr char SNAPSHOT_MAGIC[8] = {'S', 'H', 'R', 'T', 'S', 'N', 'A', 'P'};
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+// The snapshot file is only read by the process that writes it, or
+// one on the same machine, so it uses the native byte order.
+struct SnapshotHeader
+{
+    char magic[8];
+    uint32_t version;
+    // A power of 2.
+    uint32_t bucket_count;
+    uint64_t entry_count;
+    uint64_t entries_offset;
+    uint64_t buckets_offset;
+    uint64_t arena_offset;
+    uint64_t arena_size;
+    uint64_t reserved;
+};
+static_assert(sizeof(SnapshotHeader) == 64);
+
+struct SnapshotEntry
+{
+    uint64_t hash;
+    int64_t id;
+    // Negative if the link has no cache lifetime of its own.
+    int64_t cache_max_age;
+    // Offsets are relative to the start of the arena.
+    uint64_t shortcut_offset;
+    uint64_t url_offset;
+    uint32_t shortcut_size;
+    uint32_t url_size;
+};
+static_assert(sizeof(SnapshotEntry) == 48);
+
+// Buckets hold the index of an entry plus 1, or 0 if empty.
+using SnapshotBucket = uint32_t;
+
+// FNV-1a. Shortcuts are short, and this is cheap.
+uint64_t hashShortcut(std::string_view s)
+{
+    uint64_t h = 14695981039346656037ull;
+    for(char c: s)
+    {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+const SnapshotHeader& header(const char* data)
+{
+    return *reinterpret_cast<const SnapshotHeader*>(data);
+}
+
+} // namespace
+
+LinkSnapshot::~LinkSnapshot()
+{
+    if(data != nullptr)
+    {
+        munmap(const_cast<char*>(data), data_size);
+    }
+}
+
+mw::E<void> LinkSnapshot::write(const std::string& path,
+                                const DataSourceInterface& source)
+{
+    std::vector<SnapshotEntry> entries;
+    std::string arena;
+    DO_OR_RETURN(source.forEachLink([&](ShortLink&& link) -> mw::E<void>
+    {
+        SnapshotEntry entry;
+        entry.hash = hashShortcut(link.shortcut);
+        entry.id = link.id;
+        entry.cache_max_age = link.cache_max_age.value_or(-1);
+        entry.shortcut_offset = arena.size();
+        entry.shortcut_size = static_cast<uint32_t>(link.shortcut.size());
+        arena += link.shortcut;
+        entry.url_offset = arena.size();
+        entry.url_size = static_cast<uint32_t>(link.original_url.size());
+        arena += link.original_url;
+        entries.push_back(entry);
+        return {};
+    }));
+    if(entries.size() >= UINT32_MAX / 2)
+    {
+        return std::unexpected(mw::runtimeError("Too many links to snapshot"));
+    }
+
+    // Keep the load factor at most 1/2, so that probes are short.
+    const uint32_t bucket_count =
+        std::bit_ceil(std::max<uint32_t>(entries.size() * 2, 1));
+    std::vector<SnapshotBucket> buckets(bucket_count, 0);
+    for(uint32_t i = 0; i < entries.size(); i++)
+    {
+        uint32_t b = entries[i].hash & (bucket_count - 1);
+        while(buckets[b] != 0)
+        {
+            b = (b + 1) & (bucket_count - 1);
+        }
+        buckets[b] = i + 1;
+    }
+
+    SnapshotHeader h;
+    std::memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.version = SNAPSHOT_VERSION;
+    h.bucket_count = bucket_count;
+    h.entry_count = entries.size();
+    h.entries_offset = sizeof(SnapshotHeader);
+    h.buckets_offset = h.entries_offset +
+        entries.size() * sizeof(SnapshotEntry);
+    h.arena_offset = h.buckets_offset + buckets.size() * sizeof(SnapshotBucket);
+    h.arena_size = arena.size();
+    h.reserved = 0;
+
+    const std::string temp_path = path + ".tmp";
+    {
+        std::ofstream f(temp_path, std::ios::binary | std::ios::trunc);
+        f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        f.write(reinterpret_cast<const char*>(entries.data()),
+                entries.size() * sizeof(SnapshotEntry));
+        f.write(reinterpret_cast<const char*>(buckets.data()),
+                buckets.size() * sizeof(SnapshotBucket));
+        f.write(arena.data(), arena.size());
+        f.close();
+        if(!f)
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Failed to write snapshot {}", temp_path)));
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if(error)
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Failed to move snapshot to {}: {}", path, error.message())));
+    }
+    return {};
+}
+
+mw::E<std::unique_ptr<LinkSnapshot>> LinkSnapshot::open(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Failed to open snapshot {}: {}", path, std::strerror(errno))));
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 ||
+       static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+    {
+        ::close(fd);
+        return std::unexpected(mw::runtimeError(std::format(
+            "Invalid snapshot {}", path)));
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping stays valid after the file is closed, and after it
+    // is replaced by a newer snapshot.
+    ::close(fd);
+    if(mapped == MAP_FAILED)
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Failed to map snapshot {}: {}", path, std::strerror(errno))));
+    }
+    // Lookups are random, and the whole file is hot.
+    madvise(mapped, size, MADV_WILLNEED);
+
+    auto snapshot = std::unique_ptr<LinkSnapshot>(new LinkSnapshot);
+    snapshot->data = static_cast<const char*>(mapped);
+    snapshot->data_size = size;
+
+    // Check everything once here, so that find() does not have to.
+    const SnapshotHeader& h = header(snapshot->data);
+    auto invalid = [&]
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Invalid snapshot {}", path)));
+    };
+    if(std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+       h.version != SNAPSHOT_VERSION || !std::has_single_bit(h.bucket_count) ||
+       h.entry_count >= h.bucket_count ||
+       h.entries_offset != sizeof(SnapshotHeader) ||
+       h.buckets_offset != h.entries_offset +
+       h.entry_count * sizeof(SnapshotEntry) ||
+       h.arena_offset != h.buckets_offset +
+       uint64_t(h.bucket_count) * sizeof(SnapshotBucket) ||
+       h.arena_offset + h.arena_size != size)
+    {
+        return invalid();
+    }
+    const auto* entries = reinterpret_cast<const SnapshotEntry*>(
+        snapshot->data + h.entries_offset);
+    for(uint64_t i = 0; i < h.entry_count; i++)
+    {
+        if(entries[i].shortcut_offset + entries[i].shortcut_size >
+           h.arena_size ||
+           entries[i].url_offset + entries[i].url_size > h.arena_size)
+        {
+            return invalid();
+        }
+    }
+    const auto* buckets = reinterpret_cast<const SnapshotBucket*>(
+        snapshot->data + h.buckets_offset);
+    for(uint32_t i = 0; i < h.bucket_count; i++)
+    {
+        if(buckets[i] > h.entry_count)
+        {
+            return invalid();
+        }
+    }
+    return snapshot;
+}
+
+std::optional<LinkSnapshot::Link>
+LinkSnapshot::find(std::string_view shortcut) const
+{
+    const SnapshotHeader& h = header(data);
+    const auto* entries = reinterpret_cast<const SnapshotEntry*>(
+        data + h.entries_offset);
+    const auto* buckets = reinterpret_cast<const SnapshotBucket*>(
+        data + h.buckets_offset);
+    const char* arena = data + h.arena_offset;
+
+    const uint64_t hash = hashShortcut(shortcut);
+    // There is always an empty bucket, since the table is at most
+    // half full.
+    for(uint32_t b = hash & (h.bucket_count - 1); buckets[b] != 0;
+        b = (b + 1) & (h.bucket_count - 1))
+    {
+        const SnapshotEntry& entry = entries[buckets[b] - 1];
+        if(entry.hash == hash &&
+           std::string_view(arena + entry.shortcut_offset,
+                            entry.shortcut_size) == shortcut)
+        {
+            Link link;
+            link.resolved.id = entry.id;
+            if(entry.cache_max_age >= 0)
+            {
+                link.resolved.cache_max_age = entry.cache_max_age;
+            }
+            link.url = std::string_view(arena + entry.url_offset,
+                                        entry.url_size);
+            return link;
+        }
+    }
+    return std::nullopt;
+}
+
+uint64_t LinkSnapshot::size() const
+{
+    return header(data).entry_count;
+}
+
+DataSourceSnapshot::DataSourceSnapshot(
+    std::unique_ptr<DataSourceInterface> source, std::string path,
+    std::chrono::seconds interval)
+        : backend(std::move(source)), file_path(std::move(path)),
+          rebuild_interval(interval)
+{
+    builder = std::thread([this] { run(); });
+}
+
+DataSourceSnapshot::~DataSourceSnapshot()
+{
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    builder.join();
+}
+
+mw::E<int64_t> DataSourceSnapshot::getSchemaVersion() const
+{
+    return backend->getSchemaVersion();
+}
+
+mw::E<void> DataSourceSnapshot::addLink(ShortLink&& link) const
+{
+    DO_OR_RETURN(backend->addLink(std::move(link)));
+    invalidate();
+    return {};
+}
+
+mw::E<std::vector<size_t>>
+DataSourceSnapshot::addLinks(const std::vector<ShortLink>& links) const
+{
+    ASSIGN_OR_RETURN(std::vector<size_t> skipped, backend->addLinks(links));
+    if(skipped.size() < links.size())
+    {
+        invalidate();
+    }
+    return skipped;
+}
+
+mw::E<std::optional<ShortLink>> DataSourceSnapshot::findLinkByShortcut(
+    const std::string& shortcut) const
+{
+    // Only what resolveShortcut() needs is in the snapshot. But a
+    // shortcut that is not in a fresh snapshot does not exist.
+    if(std::shared_ptr<const Current> snap = fresh();
+       snap != nullptr && !snap->snapshot->find(shortcut).has_value())
+    {
+        return std::nullopt;
+    }
+    return backend->findLinkByShortcut(shortcut);
+}
+
+mw::E<std::optional<ResolvedLink>> DataSourceSnapshot::resolveShortcut(
+    std::string_view shortcut, std::string& url) const
+{
+    std::shared_ptr<const Current> snap = fresh();
+    if(snap == nullptr)
+    {
+        return backend->resolveShortcut(shortcut, url);
+    }
+    std::optional<LinkSnapshot::Link> link = snap->snapshot->find(shortcut);
+    if(!link.has_value())
+    {
+        return std::nullopt;
+    }
+    url.assign(link->url);
+    return link->resolved;
+}
+
+mw::E<std::optional<ShortLink>> DataSourceSnapshot::findLinkFromRegexpLinks(
+    const std::string& shortcut) const
+{
+    return backend->findLinkFromRegexpLinks(shortcut);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceSnapshot::getAllLinks(
+    const std::string& user_id) const
+{
+    return backend->getAllLinks(user_id);
+}
+
+mw::E<std::vector<ShortLink>> DataSourceSnapshot::getLinks(
+    const std::string& user_id, const LinkPageQuery& query) const
+{
+    return backend->getLinks(user_id, query);
+}
+
+mw::E<void> DataSourceSnapshot::forEachLink(
+    const std::function<mw::E<void>(ShortLink&&)>& f) const
+{
+    return backend->forEachLink(f);
+}
+
+mw::E<std::optional<ShortLink>> DataSourceSnapshot::getLink(int64_t id) const
+{
+    return backend->getLink(id);
+}
+
+mw::E<void> DataSourceSnapshot::removeLink(int64_t id) const
+{
+    // Stop serving the link before it is gone from the backend, and
+    // make sure a snapshot started in between is not used either.
+    invalidate();
+    DO_OR_RETURN(backend->removeLink(id));
+    invalidate();
+    return {};
+}
+
+mw::E<void> DataSourceSnapshot::addVisits(
+    const std::unordered_map<int64_t, uint64_t>& visits) const
+{
+    return backend->addVisits(visits);
+}
+
+mw::E<std::vector<LinkChange>>
+DataSourceSnapshot::getChanges(int64_t after_seq, int64_t limit) const
+{
+    return backend->getChanges(after_seq, limit);
+}
+
+mw::E<int64_t> DataSourceSnapshot::latestChangeSeq() const
+{
+    return backend->latestChangeSeq();
+}
+
+mw::E<int64_t> DataSourceSnapshot::compactedChangeSeq() const
+{
+    return backend->compactedChangeSeq();
+}
+
+mw::E<void> DataSourceSnapshot::rebuild() const
+{
+    std::lock_guard<std::mutex> rebuild_guard(rebuild_lock);
+    auto next = std::make_shared<Current>();
+    next->generation = generation;
+    DO_OR_RETURN(LinkSnapshot::write(file_path, *backend));
+    ASSIGN_OR_RETURN(next->snapshot, LinkSnapshot::open(file_path));
+    spdlog::debug("Loaded snapshot of {} links.", next->snapshot->size());
+
+    std::lock_guard<std::mutex> guard(snapshot_lock);
+    current = std::move(next);
+    return {};
+}
+
+mw::E<void> DataSourceSnapshot::setSchemaVersion(
+    [[maybe_unused]] int64_t v) const
+{
+    return std::unexpected(mw::runtimeError(
+        "Cannot set schema version through the snapshot"));
+}
+
+std::shared_ptr<const DataSourceSnapshot::Current>
+DataSourceSnapshot::fresh() const
+{
+    std::shared_ptr<const Current> snap;
+    {
+        std::lock_guard<std::mutex> guard(snapshot_lock);
+        snap = current;
+    }
+    if(snap == nullptr || snap->generation != generation)
+    {
+        return nullptr;
+    }
+    return snap;
+}
+
+void DataSourceSnapshot::invalidate() const
+{
+    generation++;
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        dirty = true;
+    }
+    wake.notify_one();
+}
+
+void DataSourceSnapshot::run()
+{
+    std::unique_lock<std::mutex> lock(wake_lock);
+    while(!stopping)
+    {
+        // Wait for a change, or for the interval to catch changes
+        // made to the database by someone else.
+        wake.wait_for(lock, rebuild_interval, [this]
+        {
+            return stopping || dirty;
+        });
+        if(stopping)
+        {
+            break;
+        }
+        dirty = false;
+        lock.unlock();
+        if(mw::E<void> result = rebuild(); !result.has_value())
+        {
+            spdlog::error("Failed to build link snapshot: {}",
+                          mw::errorMsg(result.error()));
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mw/error.hpp>
+
+#include "data.hpp"
+
+// An immutable, memory-mapped table from shortcuts to link IDs and
+// URLs.
+//
+// The file has a header, an array of entries, an open-addressing
+// hash table of entry indices, and an arena with the strings. A
+// lookup reads one bucket, one entry and the two strings, so it
+// usually costs a few cache misses.
+class LinkSnapshot
+{
+public:
+    struct Link
+    {
+        ResolvedLink resolved;
+        std::string_view url;
+    };
+
+    ~LinkSnapshot();
+    LinkSnapshot(const LinkSnapshot&) = delete;
+    LinkSnapshot& operator=(const LinkSnapshot&) = delete;
+
+    // Write a snapshot of all links in “source” to “path”. The file
+    // is written to a temporary path first, and then renamed over
+    // “path”, so that a reader never sees a partial file.
+    static mw::E<void> write(const std::string& path,
+                             const DataSourceInterface& source);
+    static mw::E<std::unique_ptr<LinkSnapshot>> open(const std::string& path);
+
+    // The returned URL points into the mapped file, and is valid as
+    // long as this object is.
+    std::optional<Link> find(std::string_view shortcut) const;
+    uint64_t size() const;
+
+private:
+    LinkSnapshot() = default;
+
+    const char* data = nullptr;
+    size_t data_size = 0;
+};
+
+// A read-mostly data source in front of another one. Exact shortcut
+// lookups for redirects are answered from a LinkSnapshot of all the
+// links, without touching the backend. Everything else, including
+// all writes, goes to the backend.
+//
+// A background thread writes a new snapshot to “path” every
+// “interval”, and right after every change to the links, and swaps
+// it in atomically. Until the new snapshot is in, lookups fall back
+// to the backend, so that a removed link is never served.
+class DataSourceSnapshot : public DataSourceInterface
+{
+public:
+    DataSourceSnapshot(std::unique_ptr<DataSourceInterface> source,
+                       std::string path, std::chrono::seconds interval);
+    ~DataSourceSnapshot() override;
+
+    mw::E<int64_t> getSchemaVersion() const override;
+
+    mw::E<void> addLink(ShortLink&& link) const override;
+    mw::E<std::vector<size_t>> addLinks(const std::vector<ShortLink>& links)
+        const override;
+    mw::E<std::optional<ShortLink>>
+    findLinkByShortcut(const std::string& shortcut) const override;
+    mw::E<std::optional<ResolvedLink>>
+    resolveShortcut(std::string_view shortcut, std::string& url) const
+        override;
+    mw::E<std::optional<ShortLink>>
+    findLinkFromRegexpLinks(const std::string& shortcut) const override;
+    mw::E<std::vector<ShortLink>> getAllLinks(const std::string& user_id) const
+        override;
+    mw::E<std::vector<ShortLink>> getLinks(
+        const std::string& user_id, const LinkPageQuery& query) const override;
+    mw::E<void> forEachLink(
+        const std::function<mw::E<void>(ShortLink&&)>& f) const override;
+    mw::E<std::optional<ShortLink>> getLink(int64_t id) const override;
+    mw::E<void> removeLink(int64_t id) const override;
+    mw::E<void> addVisits(const std::unordered_map<int64_t, uint64_t>& visits)
+        const override;
+    mw::E<std::vector<LinkChange>> getChanges(int64_t after_seq,
+                                              int64_t limit) const override;
+    mw::E<int64_t> latestChangeSeq() const override;
+    mw::E<int64_t> compactedChangeSeq() const override;
+
+    // Build a new snapshot now. This is called by the background
+    // thread. It is public so that tests can wait for a snapshot.
+    mw::E<void> rebuild() const;
+
+protected:
+    // The schema belongs to the backend. This always fails.
+    mw::E<void> setSchemaVersion(int64_t v) const override;
+
+private:
+    struct Current
+    {
+        std::unique_ptr<LinkSnapshot> snapshot;
+        // Value of “generation” when the snapshot was started.
+        uint64_t generation;
+    };
+
+    // Return the current snapshot if it is up to date, or null.
+    std::shared_ptr<const Current> fresh() const;
+    // Mark the snapshot as out of date, and wake the builder.
+    void invalidate() const;
+    void run();
+
+    std::unique_ptr<DataSourceInterface> backend;
+    const std::string file_path;
+    const std::chrono::seconds rebuild_interval;
+
+    // Increased on every change to the links.
+    mutable std::atomic<uint64_t> generation = 0;
+    mutable std::mutex snapshot_lock;
+    mutable std::shared_ptr<const Current> current;
+    // Serializes rebuilds from the background thread and from
+    // outside.
+    mutable std::mutex rebuild_lock;
+
+    mutable std::mutex wake_lock;
+    mutable std::condition_variable wake;
+    mutable bool dirty = true;
+    bool stopping = false;
+    std::thread builder;
+};
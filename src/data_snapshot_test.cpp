@@ -0,0 +1,113 @@
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+
+#include "data.hpp"
+#include "data_snapshot.hpp"
+
+namespace
+{
+
+std::string snapshotPath(const std::string& name)
+{
+    std::string path = (std::filesystem::temp_directory_path() / name)
+        .string();
+    std::filesystem::remove(path);
+    return path;
+}
+
+mw::E<void> addNormalLink(const DataSourceInterface& data,
+                          const std::string& shortcut,
+                          std::optional<int64_t> cache_max_age = std::nullopt)
+{
+    ShortLink link;
+    link.shortcut = shortcut;
+    link.original_url = "https://darksair.org/" + shortcut;
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    link.cache_max_age = cache_max_age;
+    return data.addLink(std::move(link));
+}
+
+} // namespace
+
+TEST(LinkSnapshot, CanFindLinks)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    for(int i = 0; i < 1000; i++)
+    {
+        ASSERT_TRUE(mw::isExpected(addNormalLink(
+            *data, std::format("link{}", i),
+            i == 7 ? std::optional<int64_t>(60) : std::nullopt)));
+    }
+    std::string path = snapshotPath("shrt-test-snapshot");
+    ASSERT_TRUE(mw::isExpected(LinkSnapshot::write(path, *data)));
+    ASSIGN_OR_FAIL(std::unique_ptr<LinkSnapshot> snapshot,
+                   LinkSnapshot::open(path));
+    EXPECT_EQ(snapshot->size(), 1000);
+
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link,
+                   data->findLinkByShortcut("link123"));
+    std::optional<LinkSnapshot::Link> found = snapshot->find("link123");
+    ASSERT_TRUE(found.has_value());
+    EXPECT_EQ(found->resolved.id, link->id);
+    EXPECT_FALSE(found->resolved.cache_max_age.has_value());
+    EXPECT_EQ(found->url, "https://darksair.org/link123");
+    found = snapshot->find("link7");
+    ASSERT_TRUE(found.has_value());
+    EXPECT_EQ(found->resolved.cache_max_age, 60);
+    EXPECT_FALSE(snapshot->find("link1000").has_value());
+    EXPECT_FALSE(snapshot->find("").has_value());
+}
+
+TEST(LinkSnapshot, CanRejectInvalidFile)
+{
+    std::string path = snapshotPath("shrt-test-snapshot-invalid");
+    {
+        std::ofstream f(path);
+        f << std::string(100, 'x');
+    }
+    EXPECT_FALSE(LinkSnapshot::open(path).has_value());
+}
+
+TEST(DataSourceSnapshot, CanServeLinksFromSnapshot)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> sqlite,
+                   DataSourceSQLite::newFromMemory());
+    ASSERT_TRUE(mw::isExpected(addNormalLink(*sqlite, "link0")));
+    DataSourceSnapshot data(std::move(sqlite),
+                            snapshotPath("shrt-test-snapshot-source"),
+                            std::chrono::hours(1));
+    ASSERT_TRUE(mw::isExpected(data.rebuild()));
+
+    std::string url;
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> link0,
+                   data.resolveShortcut("link0", url));
+    ASSERT_TRUE(link0.has_value());
+    EXPECT_EQ(url, "https://darksair.org/link0");
+
+    // Changes are visible right away, before the next snapshot.
+    ASSERT_TRUE(mw::isExpected(addNormalLink(data, "link1")));
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> link1,
+                   data.resolveShortcut("link1", url));
+    EXPECT_TRUE(link1.has_value());
+    ASSERT_TRUE(mw::isExpected(data.removeLink(link0->id)));
+    ASSIGN_OR_FAIL(link0, data.resolveShortcut("link0", url));
+    EXPECT_FALSE(link0.has_value());
+
+    ASSERT_TRUE(mw::isExpected(data.rebuild()));
+    ASSIGN_OR_FAIL(link0, data.resolveShortcut("link0", url));
+    EXPECT_FALSE(link0.has_value());
+    ASSIGN_OR_FAIL(link1, data.resolveShortcut("link1", url));
+    EXPECT_TRUE(link1.has_value());
+    EXPECT_EQ(url, "https://darksair.org/link1");
+}
@@ -1,7 +1,15 @@
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <mw/database.hpp>
 #include <mw/error.hpp>
 #include <mw/utils.hpp>
 #include <mw/test_utils.hpp>
@@ -27,3 +35,335 @@ TEST(DataSource, CanAddAndDeleteLink)
     ASSIGN_OR_FAIL(std::vector<ShortLink> links1, data->getAllLinks("aaa"));
     EXPECT_THAT(links1, IsEmpty());
 }
+
+TEST(DataSource, CanResolveShortcut)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ShortLink link;
+    link.shortcut = "link0";
+    link.original_url = "https://darksair.org/";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    EXPECT_TRUE(mw::isExpected(data->addLink(ShortLink(link))));
+    link.shortcut = "link2";
+    link.cache_max_age = 60;
+    EXPECT_TRUE(mw::isExpected(data->addLink(std::move(link))));
+
+    std::string url = "something else";
+    const std::string path = "link0/extra";
+    ASSIGN_OR_FAIL(std::optional<ResolvedLink> resolved, data->resolveShortcut(
+        std::string_view(path).substr(0, 5), url));
+    ASSERT_TRUE(resolved.has_value());
+    EXPECT_EQ(url, "https://darksair.org/");
+    EXPECT_FALSE(resolved->cache_max_age.has_value());
+    ASSIGN_OR_FAIL(resolved, data->resolveShortcut("link1", url));
+    EXPECT_FALSE(resolved.has_value());
+    ASSIGN_OR_FAIL(resolved, data->resolveShortcut("link2", url));
+    ASSERT_TRUE(resolved.has_value());
+    EXPECT_EQ(resolved->cache_max_age, 60);
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link2,
+                   data->findLinkByShortcut("link2"));
+    ASSERT_TRUE(link2.has_value());
+    EXPECT_EQ(link2->id, resolved->id);
+    EXPECT_EQ(link2->cache_max_age, 60);
+}
+
+TEST(DataSource, CanPaginateLinks)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    for(int i = 0; i < 5; i++)
+    {
+        ShortLink link;
+        link.shortcut = std::format("link{}", i);
+        link.original_url = "https://darksair.org/";
+        link.type = ShortLink::NORMAL;
+        link.user_id = i == 2 ? "bbb" : "aaa";
+        ASSERT_TRUE(mw::isExpected(data->addLink(std::move(link))));
+    }
+
+    LinkPageQuery query;
+    query.limit = 2;
+    ASSIGN_OR_FAIL(std::vector<ShortLink> page0, data->getLinks("aaa", query));
+    ASSERT_EQ(page0.size(), 2);
+    EXPECT_EQ(page0[0].shortcut, "link0");
+    EXPECT_EQ(page0[1].shortcut, "link1");
+    query.after_id = page0[1].id;
+    ASSIGN_OR_FAIL(std::vector<ShortLink> page1, data->getLinks("aaa", query));
+    ASSERT_EQ(page1.size(), 2);
+    EXPECT_EQ(page1[0].shortcut, "link3");
+    EXPECT_EQ(page1[1].shortcut, "link4");
+    query.after_id = page1[1].id;
+    ASSIGN_OR_FAIL(std::vector<ShortLink> page2, data->getLinks("aaa", query));
+    EXPECT_THAT(page2, IsEmpty());
+
+    query.order = LinkPageQuery::DESCENDING;
+    query.after_id = std::nullopt;
+    query.limit = 3;
+    ASSIGN_OR_FAIL(page0, data->getLinks("aaa", query));
+    ASSERT_EQ(page0.size(), 3);
+    EXPECT_EQ(page0[0].shortcut, "link4");
+    EXPECT_EQ(page0[2].shortcut, "link1");
+    query.after_id = page0[2].id;
+    ASSIGN_OR_FAIL(page1, data->getLinks("aaa", query));
+    ASSERT_EQ(page1.size(), 1);
+    EXPECT_EQ(page1[0].shortcut, "link0");
+}
+
+TEST(DataSource, CanFindRegexpLinkAfterChange)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ShortLink link0;
+    link0.shortcut = "gh-.+";
+    link0.original_url = "https://github.com/";
+    link0.type = ShortLink::REGEXP;
+    link0.user_id = "aaa";
+    EXPECT_TRUE(mw::isExpected(data->addLink(std::move(link0))));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> found0,
+                   data->findLinkFromRegexpLinks("gh-shrt"));
+    ASSERT_TRUE(found0.has_value());
+    EXPECT_EQ(found0->original_url, "https://github.com/");
+    ASSIGN_OR_FAIL(std::optional<ShortLink> missing,
+                   data->findLinkFromRegexpLinks("gl-shrt"));
+    EXPECT_FALSE(missing.has_value());
+
+    // The compiled regexps should be rebuilt after a removal.
+    EXPECT_TRUE(mw::isExpected(data->removeLink(found0->id)));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> found1,
+                   data->findLinkFromRegexpLinks("gh-shrt"));
+    EXPECT_FALSE(found1.has_value());
+}
+
+TEST(DataSource, CanReadWritesFromFileThroughPool)
+{
+    std::string db_file = (std::filesystem::temp_directory_path() /
+                           "shrt-test-pool.db").string();
+    std::filesystem::remove(db_file);
+    {
+        DataSourceSQLite::Options options;
+        options.read_connections = 2;
+        ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                       DataSourceSQLite::fromFile(db_file, options));
+        ShortLink link0;
+        link0.shortcut = "link0";
+        link0.original_url = "https://darksair.org/";
+        link0.type = ShortLink::NORMAL;
+        link0.user_id = "aaa";
+        EXPECT_TRUE(mw::isExpected(data->addLink(std::move(link0))));
+
+        std::vector<std::thread> threads;
+        for(int i = 0; i < 4; i++)
+        {
+            threads.emplace_back([&]
+            {
+                for(int j = 0; j < 20; j++)
+                {
+                    auto link = data->findLinkByShortcut("link0");
+                    ASSERT_TRUE(link.has_value());
+                    EXPECT_TRUE(link->has_value());
+                }
+            });
+        }
+        for(std::thread& t: threads)
+        {
+            t.join();
+        }
+    }
+    std::filesystem::remove(db_file);
+    std::filesystem::remove(db_file + "-wal");
+    std::filesystem::remove(db_file + "-shm");
+}
+
+TEST(DataSource, CanUpgradeSchema1InPlace)
+{
+    std::string db_file = (std::filesystem::temp_directory_path() /
+                           "shrt-test-upgrade.db").string();
+    std::filesystem::remove(db_file);
+    {
+        ASSIGN_OR_FAIL(std::unique_ptr<mw::SQLite> db,
+                       mw::SQLite::connectFile(db_file));
+        ASSERT_TRUE(mw::isExpected(db->execute(
+            "CREATE TABLE Links "
+            "(id INTEGER PRIMARY KEY, time_creation INTEGER, user_id TEXT,"
+            " shortcut TEXT UNIQUE, original_url TEXT, type INTEGER,"
+            " visits INTEGER);")));
+        ASSERT_TRUE(mw::isExpected(db->execute(
+            "INSERT INTO Links (time_creation, user_id, shortcut,"
+            " original_url, type, visits)"
+            " VALUES (0, 'aaa', 'link0', 'https://darksair.org/', 1, 3);")));
+        ASSERT_TRUE(mw::isExpected(db->execute("PRAGMA user_version = 1;")));
+    }
+    {
+        ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                       DataSourceSQLite::fromFile(db_file));
+        ASSIGN_OR_FAIL(int64_t version, data->getSchemaVersion());
+        EXPECT_EQ(version, 5);
+        ASSIGN_OR_FAIL(std::vector<ShortLink> links, data->getAllLinks("aaa"));
+        ASSERT_EQ(links.size(), 1);
+        EXPECT_EQ(links[0].shortcut, "link0");
+        EXPECT_EQ(links[0].visits, 3);
+        // Existing links are in the replication log.
+        ASSIGN_OR_FAIL(std::vector<LinkChange> changes,
+                       data->getChanges(0, 10));
+        ASSERT_EQ(changes.size(), 1);
+        EXPECT_EQ(changes[0].op, LinkChange::ADD);
+        EXPECT_EQ(changes[0].link.shortcut, "link0");
+    }
+    {
+        ASSIGN_OR_FAIL(std::unique_ptr<mw::SQLite> db,
+                       mw::SQLite::connectFile(db_file));
+        ASSIGN_OR_FAIL(int64_t index_count, db->evalToValue<int64_t>(
+            "SELECT count(*) FROM sqlite_master WHERE type = 'index' AND"
+            " name IN ('LinksByUser', 'LinksByType');"));
+        EXPECT_EQ(index_count, 2);
+    }
+    std::filesystem::remove(db_file);
+    std::filesystem::remove(db_file + "-wal");
+    std::filesystem::remove(db_file + "-shm");
+}
+
+TEST(DataSource, CanCreateLatestSchema)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ASSIGN_OR_FAIL(int64_t version, data->getSchemaVersion());
+    EXPECT_EQ(version, 5);
+}
+
+TEST(DataSource, CanLogChanges)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ASSIGN_OR_FAIL(int64_t latest, data->latestChangeSeq());
+    EXPECT_EQ(latest, 0);
+
+    ShortLink link;
+    link.shortcut = "link0";
+    link.original_url = "https://darksair.org/";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    ASSERT_TRUE(mw::isExpected(data->addLink(ShortLink(link))));
+    link.shortcut = "link1";
+    link.type = ShortLink::REGEXP;
+    link.visits = 5;
+    link.time_creation = mw::secondsToTime(1000);
+    link.cache_max_age = 0;
+    ASSIGN_OR_FAIL(std::vector<size_t> skipped, data->addLinks({link}));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link0,
+                   data->findLinkByShortcut("link0"));
+    ASSERT_TRUE(link0.has_value());
+    ASSERT_TRUE(mw::isExpected(data->removeLink(link0->id)));
+    // Visits are not logged.
+    ASSERT_TRUE(mw::isExpected(data->addVisits({{link0->id + 1, 1}})));
+
+    ASSIGN_OR_FAIL(std::vector<LinkChange> changes, data->getChanges(0, 10));
+    ASSERT_EQ(changes.size(), 3);
+    EXPECT_EQ(changes[0].op, LinkChange::ADD);
+    EXPECT_EQ(changes[0].link.shortcut, "link0");
+    EXPECT_EQ(changes[1].op, LinkChange::ADD);
+    EXPECT_EQ(changes[1].link.type, ShortLink::REGEXP);
+    EXPECT_EQ(changes[1].link.visits, 5);
+    EXPECT_EQ(mw::timeToSeconds(changes[1].link.time_creation), 1000);
+    EXPECT_EQ(changes[1].link.cache_max_age, 0);
+    EXPECT_FALSE(changes[0].link.cache_max_age.has_value());
+    EXPECT_EQ(changes[2].op, LinkChange::REMOVE);
+    EXPECT_EQ(changes[2].link.id, link0->id);
+    EXPECT_EQ(changes[2].link.shortcut, "link0");
+
+    ASSIGN_OR_FAIL(changes, data->getChanges(changes[0].seq, 1));
+    ASSERT_EQ(changes.size(), 1);
+    EXPECT_EQ(changes[0].link.shortcut, "link1");
+    ASSIGN_OR_FAIL(latest, data->latestChangeSeq());
+    EXPECT_EQ(latest, changes[0].seq + 1);
+}
+
+TEST(DataSource, CanCompactChanges)
+{
+    DataSourceSQLite::Options options;
+    options.change_log_retention = 2;
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::fromFile(":memory:", options));
+    ShortLink link;
+    link.original_url = "https://darksair.org/";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    for(int i = 0; i < 3; i++)
+    {
+        link.shortcut = std::format("link{}", i);
+        ASSERT_TRUE(mw::isExpected(data->addLink(ShortLink(link))));
+    }
+    // Changes 1 to 3 add link0 to link2, 4 and 5 remove link0 and
+    // link1, and 6 adds link3.
+    for(const char* shortcut: {"link0", "link1"})
+    {
+        ASSIGN_OR_FAIL(std::optional<ShortLink> removed,
+                       data->findLinkByShortcut(shortcut));
+        ASSERT_TRUE(removed.has_value());
+        ASSERT_TRUE(mw::isExpected(data->removeLink(removed->id)));
+    }
+    link.shortcut = "link3";
+    ASSERT_TRUE(mw::isExpected(data->addLink(ShortLink(link))));
+    ASSIGN_OR_FAIL(int64_t compacted, data->compactedChangeSeq());
+    EXPECT_EQ(compacted, 3);
+
+    // Removing link2 compacts up to 5, which drops the removals of
+    // link0 and link1 with their additions. The addition of link2
+    // stays, since its removal is newer.
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link2,
+                   data->findLinkByShortcut("link2"));
+    ASSERT_TRUE(link2.has_value());
+    ASSERT_TRUE(mw::isExpected(data->removeLink(link2->id)));
+    ASSIGN_OR_FAIL(compacted, data->compactedChangeSeq());
+    EXPECT_EQ(compacted, 5);
+    ASSIGN_OR_FAIL(std::vector<LinkChange> changes, data->getChanges(0, 10));
+    ASSERT_EQ(changes.size(), 3);
+    EXPECT_EQ(changes[0].seq, 3);
+    EXPECT_EQ(changes[0].op, LinkChange::ADD);
+    EXPECT_EQ(changes[0].link.shortcut, "link2");
+    EXPECT_EQ(changes[1].seq, 6);
+    EXPECT_EQ(changes[1].link.shortcut, "link3");
+    EXPECT_EQ(changes[2].seq, 7);
+    EXPECT_EQ(changes[2].op, LinkChange::REMOVE);
+    ASSIGN_OR_FAIL(int64_t latest, data->latestChangeSeq());
+    EXPECT_EQ(latest, 7);
+}
+
+TEST(DataSource, CanAddLinksInBatch)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ShortLink existing;
+    existing.shortcut = "link0";
+    existing.original_url = "https://darksair.org/";
+    existing.type = ShortLink::NORMAL;
+    existing.user_id = "aaa";
+    ASSERT_TRUE(mw::isExpected(data->addLink(std::move(existing))));
+
+    std::vector<ShortLink> links(4);
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        links[i].shortcut = std::format("link{}", i);
+        links[i].original_url = std::format("https://example.com/{}", i);
+        links[i].type = ShortLink::NORMAL;
+        links[i].user_id = "bbb";
+        links[i].visits = i;
+        links[i].time_creation = mw::secondsToTime(1000);
+    }
+    // Duplicate of a shortcut earlier in the batch.
+    links[3].shortcut = "link1";
+    ASSIGN_OR_FAIL(std::vector<size_t> skipped, data->addLinks(links));
+    EXPECT_THAT(skipped, ::testing::ElementsAre(0, 3));
+
+    ASSIGN_OR_FAIL(std::vector<ShortLink> added, data->getAllLinks("bbb"));
+    ASSERT_EQ(added.size(), 2);
+    EXPECT_EQ(added[0].shortcut, "link1");
+    EXPECT_EQ(added[0].visits, 1);
+    EXPECT_EQ(mw::timeToSeconds(added[0].time_creation), 1000);
+    EXPECT_EQ(added[1].shortcut, "link2");
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link0,
+                   data->findLinkByShortcut("link0"));
+    ASSERT_TRUE(link0.has_value());
+    EXPECT_EQ(link0->user_id, "aaa");
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string_view>
+
+#include "frequency_sketch.hpp"
+
+FrequencySketch::FrequencySketch(size_t width)
+        : mask(std::bit_ceil(std::max<size_t>(width, 1)) - 1),
+          counters(std::make_unique<std::atomic<uint32_t>[]>(
+              DEPTH * (mask + 1)))
+{
+}
+
+uint32_t FrequencySketch::add(std::string_view s)
+{
+    uint64_t h = std::hash<std::string_view>()(s);
+    uint32_t result = std::numeric_limits<uint32_t>::max();
+    for(size_t row = 0; row < DEPTH; row++)
+    {
+        std::atomic<uint32_t>& c = counters[slot(h, row)];
+        uint32_t value = c.load(std::memory_order_relaxed);
+        // Saturate instead of wrapping around to 0.
+        if(value < std::numeric_limits<uint32_t>::max())
+        {
+            value = c.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+        result = std::min(result, value);
+    }
+    return result;
+}
+
+uint32_t FrequencySketch::estimate(std::string_view s) const
+{
+    uint64_t h = std::hash<std::string_view>()(s);
+    uint32_t result = std::numeric_limits<uint32_t>::max();
+    for(size_t row = 0; row < DEPTH; row++)
+    {
+        result = std::min(result, counters[slot(h, row)].load(
+                              std::memory_order_relaxed));
+    }
+    return result;
+}
+
+void FrequencySketch::decay()
+{
+    for(size_t i = 0; i < DEPTH * (mask + 1); i++)
+    {
+        uint32_t value = counters[i].load(std::memory_order_relaxed);
+        if(value != 0)
+        {
+            counters[i].store(value / 2, std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t FrequencySketch::slot(uint64_t h, size_t row) const
+{
+    // Each row takes a different hash, h1 + row × h2, as in
+    // BloomFilter.
+    uint64_t h2 = std::rotl(h, 32) | 1;
+    return row * (mask + 1) + ((h + row * h2) & mask);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+// A Count-Min sketch of how often strings are seen. Each string has a
+// counter in each of “DEPTH” rows, and its estimate is the smallest
+// of them, which is never less than the true count, and more only by
+// collisions.
+//
+// The counters are atomic, so that any number of threads can add to
+// the sketch without locking, and nothing allocates after
+// construction. decay() halves all counters, so that the estimates
+// follow recent traffic instead of all traffic since the start.
+class FrequencySketch
+{
+public:
+    static constexpr size_t DEPTH = 4;
+
+    // “width” is the number of counters in each row, rounded up to a
+    // power of 2. The error of an estimate is about 2.7 / width of
+    // the total count, with a probability of about 98%.
+    explicit FrequencySketch(size_t width);
+
+    // Count “s” once, and return its new estimate.
+    uint32_t add(std::string_view s);
+    uint32_t estimate(std::string_view s) const;
+    // Halve all counters. Increments that happen at the same time
+    // may be lost, which does not matter for an estimate.
+    void decay();
+
+private:
+    size_t slot(uint64_t h, size_t row) const;
+
+    size_t mask;
+    std::unique_ptr<std::atomic<uint32_t>[]> counters;
+};
@@ -0,0 +1,47 @@
+#include <format>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "frequency_sketch.hpp"
+
+TEST(FrequencySketch, NeverUnderestimates)
+{
+    FrequencySketch sketch(1024);
+    for(int i = 0; i < 1000; i++)
+    {
+        for(int j = 0; j <= i % 10; j++)
+        {
+            sketch.add(std::format("link{}", i));
+        }
+    }
+    int exact = 0;
+    for(int i = 0; i < 1000; i++)
+    {
+        uint32_t estimate = sketch.estimate(std::format("link{}", i));
+        EXPECT_GE(estimate, static_cast<uint32_t>(i % 10 + 1));
+        if(estimate == static_cast<uint32_t>(i % 10 + 1))
+        {
+            exact++;
+        }
+    }
+    // With 5500 counts over 1024 counters a row, most estimates are
+    // still exact.
+    EXPECT_GT(exact, 500);
+}
+
+TEST(FrequencySketch, CanDecay)
+{
+    FrequencySketch sketch(64);
+    uint32_t estimate = 0;
+    for(int i = 0; i < 100; i++)
+    {
+        estimate = sketch.add("hot");
+    }
+    EXPECT_EQ(estimate, 100);
+    EXPECT_EQ(sketch.estimate("hot"), 100);
+    sketch.decay();
+    EXPECT_EQ(sketch.estimate("hot"), 50);
+    sketch.decay();
+    EXPECT_EQ(sketch.estimate("hot"), 25);
+}
@@ -0,0 +1,181 @@
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <mw/error.hpp>
+#include <mw/utils.hpp>
+
+#include "app.hpp"
+#include "config.hpp"
+#include "data.hpp"
+
+namespace
+{
+
+// A typical “Cookie” header of a logged-in user, with a JWT access
+// token and some cookies of other services on the same domain.
+const std::string COOKIE_HEADER =
+    "_ga=GA1.1.123456789.1700000000; theme=dark; "
+    "shrt-access-token=eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJzdWIiOiJtdyIs"
+    "ImF1ZCI6InNocnQiLCJleHAiOjE3MDAwMDAzMDB9.c2lnbmF0dXJlc2lnbmF0dXJlc2ln; "
+    "shrt-refresh-token=cmVmcmVzaHJlZnJlc2hyZWZyZXNocmVmcmVzaA";
+
+LinkRow sampleRow()
+{
+    return {12345, 1700000000, "mw", "abcdefgh",
+            "https://example.com/some/fairly/long/path?with=query&and=more",
+            ShortLink::NORMAL, 42, std::nullopt};
+}
+
+void BM_ParseCookies(benchmark::State& state)
+{
+    for(auto _: state)
+    {
+        auto cookies = parseCookies(COOKIE_HEADER);
+        benchmark::DoNotOptimize(cookies);
+    }
+}
+BENCHMARK(BM_ParseCookies);
+
+void BM_Link2JSON(benchmark::State& state)
+{
+    LinkRow row = sampleRow();
+    auto link = rowToLink(row);
+    if(!link.has_value())
+    {
+        state.SkipWithError("Failed to make link");
+        return;
+    }
+    for(auto _: state)
+    {
+        nlohmann::json json = link2JSON(*link);
+        benchmark::DoNotOptimize(json);
+    }
+}
+BENCHMARK(BM_Link2JSON);
+
+// rowToLink() moves the strings out of the row, so every iteration
+// needs a fresh row. They are made in batches with the timer
+// stopped.
+void BM_RowToLink(benchmark::State& state)
+{
+    constexpr size_t BATCH = 4096;
+    const LinkRow prototype = sampleRow();
+    std::vector<LinkRow> rows;
+    size_t next = BATCH;
+    for(auto _: state)
+    {
+        if(next == BATCH)
+        {
+            state.PauseTiming();
+            rows.assign(BATCH, prototype);
+            next = 0;
+            state.ResumeTiming();
+        }
+        auto link = rowToLink(rows[next++]);
+        benchmark::DoNotOptimize(link);
+    }
+}
+BENCHMARK(BM_RowToLink);
+
+// The shortcut generated by handleCreateLink() when none is given.
+void BM_ShortcutFromURL(benchmark::State& state)
+{
+    const std::string url =
+        "https://example.com/some/fairly/long/path?with=query&and=more";
+    for(auto _: state)
+    {
+        auto shortcut = shortcutFromURL(url);
+        benchmark::DoNotOptimize(shortcut);
+    }
+}
+BENCHMARK(BM_ShortcutFromURL);
+
+class URLForBench : public benchmark::Fixture
+{
+public:
+    void SetUp([[maybe_unused]] const benchmark::State& state) override
+    {
+        auto data = DataSourceSQLite::newFromMemory();
+        if(!data.has_value())
+        {
+            return;
+        }
+        Configuration config;
+        config.base_url = "https://go.example.com/";
+        // urlFor() does not use authentication.
+        app = std::make_unique<App>(config, *std::move(data), nullptr);
+    }
+
+    void TearDown([[maybe_unused]] const benchmark::State& state) override
+    {
+        app.reset();
+    }
+
+    std::unique_ptr<App> app;
+};
+
+BENCHMARK_F(URLForBench, Links)(benchmark::State& state)
+{
+    if(app == nullptr)
+    {
+        state.SkipWithError("Failed to create app");
+        return;
+    }
+    for(auto _: state)
+    {
+        std::string url = app->urlFor(App::LINKS);
+        benchmark::DoNotOptimize(url);
+    }
+}
+
+BENCHMARK_F(URLForBench, DeleteLinkDialog)(benchmark::State& state)
+{
+    if(app == nullptr)
+    {
+        state.SkipWithError("Failed to create app");
+        return;
+    }
+    for(auto _: state)
+    {
+        std::string url = app->urlFor(App::DELETE_LINK_DIALOG, "12345");
+        benchmark::DoNotOptimize(url);
+    }
+}
+
+// What the url_for() callback of the templates does: look up the
+// route by name first.
+BENCHMARK_F(URLForBench, ByName)(benchmark::State& state)
+{
+    if(app == nullptr)
+    {
+        state.SkipWithError("Failed to create app");
+        return;
+    }
+    for(auto _: state)
+    {
+        std::string url = app->urlFor("delete-link-dialog", "12345");
+        benchmark::DoNotOptimize(url);
+    }
+}
+
+// Appending to a buffer that is reused, as for the next-page link.
+BENCHMARK_F(URLForBench, AppendURL)(benchmark::State& state)
+{
+    if(app == nullptr)
+    {
+        state.SkipWithError("Failed to create app");
+        return;
+    }
+    std::string url;
+    for(auto _: state)
+    {
+        url.clear();
+        app->appendURL(url, App::DELETE_LINK_DIALOG, "12345");
+        benchmark::DoNotOptimize(url);
+    }
+}
+
+} // namespace
@@ -0,0 +1,415 @@
+#include <array>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <nlohmann/json.hpp>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/param_build.h>
+#include <spdlog/spdlog.h>
+#include <mw/auth.hpp>
+#include <mw/error.hpp>
+#include <mw/http_client.hpp>
+#include <mw/url.hpp>
+#include <mw/utils.hpp>
+
+#include "jwt.hpp"
+
+namespace
+{
+
+constexpr char BASE64URL_ALPHABET[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Map from a character to its 6-bit value, or -1 if the character is
+// not in the alphabet.
+constexpr std::array<int8_t, 256> base64URLTable()
+{
+    std::array<int8_t, 256> table{};
+    table.fill(-1);
+    for(int8_t i = 0; i < 64; i++)
+    {
+        table[static_cast<unsigned char>(BASE64URL_ALPHABET[i])] = i;
+    }
+    return table;
+}
+
+template<typename T, void (*Free)(T*)>
+struct OpenSSLDeleter
+{
+    void operator()(T* p) const { Free(p); }
+};
+
+using BigNum = std::unique_ptr<BIGNUM, OpenSSLDeleter<BIGNUM, BN_free>>;
+using ParamBuilder = std::unique_ptr<
+    OSSL_PARAM_BLD, OpenSSLDeleter<OSSL_PARAM_BLD, OSSL_PARAM_BLD_free>>;
+using Params = std::unique_ptr<
+    OSSL_PARAM, OpenSSLDeleter<OSSL_PARAM, OSSL_PARAM_free>>;
+using KeyContext = std::unique_ptr<
+    EVP_PKEY_CTX, OpenSSLDeleter<EVP_PKEY_CTX, EVP_PKEY_CTX_free>>;
+using DigestContext = std::unique_ptr<
+    EVP_MD_CTX, OpenSSLDeleter<EVP_MD_CTX, EVP_MD_CTX_free>>;
+
+BigNum bigNumFromBytes(const std::string& bytes)
+{
+    return BigNum(BN_bin2bn(reinterpret_cast<const unsigned char*>(
+                                bytes.data()),
+                            static_cast<int>(bytes.size()), nullptr));
+}
+
+// Build an RSA public key from the big-endian modulus and exponent.
+// Return null on failure.
+EVP_PKEY* rsaPublicKey(const std::string& modulus,
+                       const std::string& exponent)
+{
+    BigNum n = bigNumFromBytes(modulus);
+    BigNum e = bigNumFromBytes(exponent);
+    ParamBuilder builder(OSSL_PARAM_BLD_new());
+    if(n == nullptr || e == nullptr || builder == nullptr ||
+       OSSL_PARAM_BLD_push_BN(builder.get(), OSSL_PKEY_PARAM_RSA_N, n.get())
+       != 1 ||
+       OSSL_PARAM_BLD_push_BN(builder.get(), OSSL_PKEY_PARAM_RSA_E, e.get())
+       != 1)
+    {
+        return nullptr;
+    }
+    Params params(OSSL_PARAM_BLD_to_param(builder.get()));
+    KeyContext ctx(EVP_PKEY_CTX_new_from_name(nullptr, "RSA", nullptr));
+    if(params == nullptr || ctx == nullptr ||
+       EVP_PKEY_fromdata_init(ctx.get()) != 1)
+    {
+        return nullptr;
+    }
+    EVP_PKEY* key = nullptr;
+    if(EVP_PKEY_fromdata(ctx.get(), &key, EVP_PKEY_PUBLIC_KEY, params.get())
+       != 1)
+    {
+        return nullptr;
+    }
+    return key;
+}
+
+bool verifyRS256(EVP_PKEY* key, std::string_view message,
+                 const std::string& signature)
+{
+    DigestContext ctx(EVP_MD_CTX_new());
+    return ctx != nullptr &&
+        EVP_DigestVerifyInit(ctx.get(), nullptr, EVP_sha256(), nullptr, key)
+        == 1 &&
+        EVP_DigestVerify(
+            ctx.get(),
+            reinterpret_cast<const unsigned char*>(signature.data()),
+            signature.size(),
+            reinterpret_cast<const unsigned char*>(message.data()),
+            message.size()) == 1;
+}
+
+// Decode one part of a JWT as a JSON object. Return nullopt if it is
+// not one.
+std::optional<nlohmann::json> decodeJSONPart(std::string_view part)
+{
+    mw::E<std::string> decoded = base64URLDecode(part);
+    if(!decoded.has_value())
+    {
+        return std::nullopt;
+    }
+    nlohmann::json data = nlohmann::json::parse(*decoded, nullptr, false);
+    if(data.is_discarded() || !data.is_object())
+    {
+        return std::nullopt;
+    }
+    return data;
+}
+
+std::optional<std::string> stringField(const nlohmann::json& data,
+                                       const char* name)
+{
+    auto it = data.find(name);
+    if(it == data.end() || !it->is_string())
+    {
+        return std::nullopt;
+    }
+    return it->get<std::string>();
+}
+
+} // namespace
+
+std::string base64URLEncode(std::string_view data)
+{
+    std::string result;
+    result.reserve((data.size() * 4 + 2) / 3);
+    size_t i = 0;
+    for(; i + 2 < data.size(); i += 3)
+    {
+        uint32_t block = (static_cast<unsigned char>(data[i]) << 16) |
+            (static_cast<unsigned char>(data[i + 1]) << 8) |
+            static_cast<unsigned char>(data[i + 2]);
+        result += BASE64URL_ALPHABET[(block >> 18) & 0x3f];
+        result += BASE64URL_ALPHABET[(block >> 12) & 0x3f];
+        result += BASE64URL_ALPHABET[(block >> 6) & 0x3f];
+        result += BASE64URL_ALPHABET[block & 0x3f];
+    }
+    if(i + 1 == data.size())
+    {
+        uint32_t block = static_cast<unsigned char>(data[i]) << 16;
+        result += BASE64URL_ALPHABET[(block >> 18) & 0x3f];
+        result += BASE64URL_ALPHABET[(block >> 12) & 0x3f];
+    }
+    else if(i + 2 == data.size())
+    {
+        uint32_t block = (static_cast<unsigned char>(data[i]) << 16) |
+            (static_cast<unsigned char>(data[i + 1]) << 8);
+        result += BASE64URL_ALPHABET[(block >> 18) & 0x3f];
+        result += BASE64URL_ALPHABET[(block >> 12) & 0x3f];
+        result += BASE64URL_ALPHABET[(block >> 6) & 0x3f];
+    }
+    return result;
+}
+
+mw::E<std::string> base64URLDecode(std::string_view data)
+{
+    static constexpr std::array<int8_t, 256> TABLE = base64URLTable();
+    // Padding is not used in JWTs, but accept it anyway.
+    while(!data.empty() && data.back() == '=')
+    {
+        data.remove_suffix(1);
+    }
+    if(data.size() % 4 == 1)
+    {
+        return std::unexpected(mw::runtimeError("Invalid base64 length"));
+    }
+
+    std::string result;
+    result.reserve(data.size() * 3 / 4);
+    uint32_t block = 0;
+    int bits = 0;
+    for(char c: data)
+    {
+        int8_t value = TABLE[static_cast<unsigned char>(c)];
+        if(value < 0)
+        {
+            return std::unexpected(mw::runtimeError(
+                "Invalid character in base64"));
+        }
+        block = (block << 6) | static_cast<uint32_t>(value);
+        bits += 6;
+        if(bits >= 8)
+        {
+            bits -= 8;
+            result += static_cast<char>((block >> bits) & 0xff);
+        }
+    }
+    return result;
+}
+
+void JWTVerifier::KeyDeleter::operator()(evp_pkey_st* key) const
+{
+    EVP_PKEY_free(key);
+}
+
+mw::E<std::unique_ptr<JWTVerifier>>
+JWTVerifier::fromOpenIDConnect(const std::string& openid_url_prefix,
+                               const std::string& audience,
+                               mw::HTTPSessionInterface& http)
+{
+    ASSIGN_OR_RETURN(mw::URL url, mw::URL::fromStr(openid_url_prefix));
+    url.appendPath(".well-known/openid-configuration");
+    ASSIGN_OR_RETURN(const mw::HTTPResponse* res,
+                     http.get(mw::HTTPRequest(url.str())));
+    if(res->status != 200)
+    {
+        return std::unexpected(mw::httpError(res->status, std::format(
+            "Failed to get OpenID configuration: {}", res->payloadAsStr())));
+    }
+    nlohmann::json discovery = nlohmann::json::parse(
+        res->payloadAsStr(), nullptr, false);
+    if(discovery.is_discarded() || !discovery.is_object())
+    {
+        return std::unexpected(mw::runtimeError(
+            "Invalid OpenID configuration"));
+    }
+    std::optional<std::string> jwks_uri = stringField(discovery, "jwks_uri");
+    if(!jwks_uri.has_value())
+    {
+        return std::unexpected(mw::runtimeError(
+            "OpenID configuration has no JWKS URI"));
+    }
+    std::string issuer = stringField(discovery, "issuer").value_or("");
+
+    ASSIGN_OR_RETURN(res, http.get(mw::HTTPRequest(*jwks_uri)));
+    if(res->status != 200)
+    {
+        return std::unexpected(mw::httpError(res->status, std::format(
+            "Failed to get JWKS: {}", res->payloadAsStr())));
+    }
+    return fromJWKS(res->payloadAsStr(), issuer, audience);
+}
+
+mw::E<std::unique_ptr<JWTVerifier>>
+JWTVerifier::fromJWKS(const std::string& jwks, const std::string& issuer,
+                      const std::string& audience)
+{
+    nlohmann::json data = nlohmann::json::parse(jwks, nullptr, false);
+    if(data.is_discarded() || !data.is_object() || !data.contains("keys") ||
+       !data["keys"].is_array())
+    {
+        return std::unexpected(mw::runtimeError("Invalid JWKS"));
+    }
+
+    auto verifier = std::unique_ptr<JWTVerifier>(new JWTVerifier);
+    verifier->issuer = issuer;
+    verifier->audience = audience;
+    for(const nlohmann::json& jwk: data["keys"])
+    {
+        if(!jwk.is_object() || stringField(jwk, "kty") != "RSA" ||
+           stringField(jwk, "use").value_or("sig") != "sig" ||
+           stringField(jwk, "alg").value_or("RS256") != "RS256")
+        {
+            continue;
+        }
+        std::optional<std::string> n = stringField(jwk, "n");
+        std::optional<std::string> e = stringField(jwk, "e");
+        if(!n.has_value() || !e.has_value())
+        {
+            continue;
+        }
+        std::string kid = stringField(jwk, "kid").value_or("");
+        mw::E<std::string> modulus = base64URLDecode(*n);
+        mw::E<std::string> exponent = base64URLDecode(*e);
+        Key key;
+        if(modulus.has_value() && exponent.has_value())
+        {
+            key.reset(rsaPublicKey(*modulus, *exponent));
+        }
+        if(key == nullptr)
+        {
+            spdlog::warn("Ignoring invalid RSA key “{}” in JWKS.", kid);
+            continue;
+        }
+        verifier->keys[kid] = std::move(key);
+    }
+    if(verifier->keys.empty())
+    {
+        return std::unexpected(mw::runtimeError("No usable key in JWKS"));
+    }
+    return verifier;
+}
+
+mw::E<std::optional<mw::UserInfo>>
+JWTVerifier::verify(const std::string& token) const
+{
+    const size_t dot1 = token.find('.');
+    const size_t dot2 = dot1 == std::string::npos ? std::string::npos :
+        token.find('.', dot1 + 1);
+    if(dot2 == std::string::npos ||
+       token.find('.', dot2 + 1) != std::string::npos)
+    {
+        // Not a JWT.
+        return std::nullopt;
+    }
+    const std::string_view view = token;
+    std::optional<nlohmann::json> header =
+        decodeJSONPart(view.substr(0, dot1));
+    if(!header.has_value() || stringField(*header, "alg") != "RS256")
+    {
+        return std::nullopt;
+    }
+
+    auto key = keys.end();
+    if(std::optional<std::string> kid = stringField(*header, "kid");
+       kid.has_value())
+    {
+        key = keys.find(*kid);
+    }
+    else if(keys.size() == 1)
+    {
+        key = keys.begin();
+    }
+    if(key == keys.end())
+    {
+        return std::nullopt;
+    }
+
+    mw::E<std::string> signature = base64URLDecode(view.substr(dot2 + 1));
+    if(!signature.has_value() ||
+       !verifyRS256(key->second.get(), view.substr(0, dot2), *signature))
+    {
+        return std::unexpected(mw::runtimeError("Invalid token signature"));
+    }
+
+    std::optional<nlohmann::json> claims =
+        decodeJSONPart(view.substr(dot1 + 1, dot2 - dot1 - 1));
+    if(!claims.has_value())
+    {
+        return std::unexpected(mw::runtimeError("Invalid token claims"));
+    }
+
+    auto exp = claims->find("exp");
+    if(exp == claims->end() || !exp->is_number())
+    {
+        return std::nullopt;
+    }
+    if(mw::secondsToTime(exp->get<int64_t>()) <= mw::Clock::now())
+    {
+        return std::unexpected(mw::runtimeError("Token expired"));
+    }
+
+    if(!issuer.empty())
+    {
+        std::optional<std::string> iss = stringField(*claims, "iss");
+        if(!iss.has_value())
+        {
+            return std::nullopt;
+        }
+        if(*iss != issuer)
+        {
+            return std::unexpected(mw::runtimeError("Wrong token issuer"));
+        }
+    }
+
+    if(!audience.empty())
+    {
+        auto aud = claims->find("aud");
+        if(aud == claims->end())
+        {
+            return std::nullopt;
+        }
+        bool found = false;
+        if(aud->is_string())
+        {
+            found = *aud == audience;
+        }
+        else if(aud->is_array())
+        {
+            for(const nlohmann::json& a: *aud)
+            {
+                if(a.is_string() && a == audience)
+                {
+                    found = true;
+                    break;
+                }
+            }
+        }
+        if(!found)
+        {
+            return std::unexpected(mw::runtimeError("Wrong token audience"));
+        }
+    }
+
+    std::optional<std::string> sub = stringField(*claims, "sub");
+    std::optional<std::string> name =
+        stringField(*claims, "preferred_username");
+    if(!sub.has_value() || !name.has_value())
+    {
+        return std::nullopt;
+    }
+    mw::UserInfo user;
+    user.id = *std::move(sub);
+    user.name = *std::move(name);
+    return user;
+}
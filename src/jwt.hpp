@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <mw/auth.hpp>
+#include <mw/error.hpp>
+#include <mw/http_client.hpp>
+
+struct evp_pkey_st;
+
+// Encode and decode with the URL-safe base64 alphabet and without
+// padding, as used in JWTs.
+std::string base64URLEncode(std::string_view data);
+mw::E<std::string> base64URLDecode(std::string_view data);
+
+class JWTVerifierInterface
+{
+public:
+    virtual ~JWTVerifierInterface() = default;
+
+    // Check the signature and the claims of an access token without
+    // asking the OpenID Connect provider. Return the user if the
+    // token is good. Return nullopt if this cannot be decided
+    // locally, e.g. the token is not a JWT, it is signed by an
+    // unknown key, or some claims are missing; the caller should ask
+    // the provider in this case. Return an error if the token is
+    // definitely not valid.
+    virtual mw::E<std::optional<mw::UserInfo>>
+    verify(const std::string& token) const = 0;
+};
+
+// Verify RS256-signed tokens with the public keys of the provider.
+// The keys are loaded once. A token signed by a key that was added
+// after that is not verified locally.
+class JWTVerifier : public JWTVerifierInterface
+{
+public:
+    // Fetch the discovery document under “openid_url_prefix”, and
+    // then the JWKS it refers to. “audience” is required to be in the
+    // “aud” claim of the tokens.
+    static mw::E<std::unique_ptr<JWTVerifier>>
+    fromOpenIDConnect(const std::string& openid_url_prefix,
+                      const std::string& audience,
+                      mw::HTTPSessionInterface& http);
+    // Use the keys in a JWKS document. If “issuer” is not empty, it
+    // is required to match the “iss” claim of the tokens.
+    static mw::E<std::unique_ptr<JWTVerifier>>
+    fromJWKS(const std::string& jwks, const std::string& issuer,
+             const std::string& audience);
+
+    mw::E<std::optional<mw::UserInfo>>
+    verify(const std::string& token) const override;
+
+private:
+    struct KeyDeleter
+    {
+        void operator()(evp_pkey_st* key) const;
+    };
+    using Key = std::unique_ptr<evp_pkey_st, KeyDeleter>;
+
+    JWTVerifier() = default;
+
+    std::string issuer;
+    std::string audience;
+    // Keyed by “kid”.
+    std::unordered_map<std::string, Key> keys;
+};
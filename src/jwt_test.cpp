@@ -0,0 +1,102 @@
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <nlohmann/json.hpp>
+#include <mw/auth.hpp>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+#include <mw/utils.hpp>
+
+#include "jwt.hpp"
+#include "jwt_test_utils.hpp"
+
+namespace
+{
+
+nlohmann::json claimsExpiringIn(std::chrono::seconds duration)
+{
+    return {
+        {"iss", "https://auth.example.com/"},
+        {"aud", {"account", "shrt"}},
+        {"sub", "user-id"},
+        {"preferred_username", "mw"},
+        {"exp", mw::timeToSeconds(mw::Clock::now() + duration)},
+    };
+}
+
+} // namespace
+
+TEST(JWT, CanEncodeAndDecodeBase64URL)
+{
+    for(const std::string s: {"", "a", "ab", "abc", "abcd", "\xff\xfe?>"})
+    {
+        ASSIGN_OR_FAIL(std::string decoded,
+                       base64URLDecode(base64URLEncode(s)));
+        EXPECT_EQ(decoded, s);
+    }
+    EXPECT_EQ(base64URLEncode("\xff\xfe?>"), "__4_Pg");
+    EXPECT_FALSE(base64URLDecode("a+b").has_value());
+}
+
+TEST(JWT, CanVerifySignedToken)
+{
+    TestJWTSigner signer;
+    ASSIGN_OR_FAIL(auto verifier, JWTVerifier::fromJWKS(
+        signer.jwks(), "https://auth.example.com/", "shrt"));
+
+    ASSIGN_OR_FAIL(std::optional<mw::UserInfo> user, verifier->verify(
+        signer.sign(claimsExpiringIn(std::chrono::minutes(5)))));
+    ASSERT_TRUE(user.has_value());
+    EXPECT_EQ(user->id, "user-id");
+    EXPECT_EQ(user->name, "mw");
+}
+
+TEST(JWT, CanRejectBadTokens)
+{
+    TestJWTSigner signer;
+    TestJWTSigner other_signer;
+    ASSIGN_OR_FAIL(auto verifier, JWTVerifier::fromJWKS(
+        signer.jwks(), "https://auth.example.com/", "shrt"));
+
+    // Expired
+    EXPECT_FALSE(verifier->verify(
+        signer.sign(claimsExpiringIn(std::chrono::seconds(-1))))
+                 .has_value());
+    // Signed by another key with the same ID
+    EXPECT_FALSE(verifier->verify(
+        other_signer.sign(claimsExpiringIn(std::chrono::minutes(5))))
+                 .has_value());
+    // Wrong audience
+    nlohmann::json claims = claimsExpiringIn(std::chrono::minutes(5));
+    claims["aud"] = "someone-else";
+    EXPECT_FALSE(verifier->verify(signer.sign(claims)).has_value());
+    // Tampered claims
+    std::string token = signer.sign(claimsExpiringIn(std::chrono::minutes(5)));
+    token[token.find('.') + 2] ^= 1;
+    EXPECT_FALSE(verifier->verify(token).has_value());
+}
+
+TEST(JWT, CanDeferUndecidableTokens)
+{
+    TestJWTSigner signer;
+    TestJWTSigner unknown_signer("unknown-key");
+    ASSIGN_OR_FAIL(auto verifier, JWTVerifier::fromJWKS(
+        signer.jwks(), "https://auth.example.com/", "shrt"));
+
+    // Opaque token
+    ASSIGN_OR_FAIL(std::optional<mw::UserInfo> user,
+                   verifier->verify("some-opaque-token"));
+    EXPECT_FALSE(user.has_value());
+    // Unknown key
+    ASSIGN_OR_FAIL(user, verifier->verify(unknown_signer.sign(
+        claimsExpiringIn(std::chrono::minutes(5)))));
+    EXPECT_FALSE(user.has_value());
+    // No user name
+    nlohmann::json claims = claimsExpiringIn(std::chrono::minutes(5));
+    claims.erase("preferred_username");
+    ASSIGN_OR_FAIL(user, verifier->verify(signer.sign(claims)));
+    EXPECT_FALSE(user.has_value());
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#include "jwt.hpp"
+
+// A stand-in for the signer of an OpenID Connect provider. It makes
+// an RSA key, publishes it as a JWKS, and signs tokens with it.
+class TestJWTSigner
+{
+public:
+    explicit TestJWTSigner(std::string key_id = "test-key")
+            : kid(std::move(key_id)), key(EVP_RSA_gen(2048))
+    {
+    }
+
+    ~TestJWTSigner()
+    {
+        EVP_PKEY_free(key);
+    }
+
+    TestJWTSigner(const TestJWTSigner&) = delete;
+    TestJWTSigner& operator=(const TestJWTSigner&) = delete;
+
+    std::string jwks() const
+    {
+        nlohmann::json jwk = {
+            {"kty", "RSA"},
+            {"use", "sig"},
+            {"alg", "RS256"},
+            {"kid", kid},
+            {"n", base64URLEncode(param(OSSL_PKEY_PARAM_RSA_N))},
+            {"e", base64URLEncode(param(OSSL_PKEY_PARAM_RSA_E))},
+        };
+        return nlohmann::json{{"keys", {jwk}}}.dump();
+    }
+
+    // Sign “claims” as a JWT with RS256.
+    std::string sign(const nlohmann::json& claims) const
+    {
+        nlohmann::json header = {{"alg", "RS256"}, {"typ", "JWT"},
+                                 {"kid", kid}};
+        std::string message = base64URLEncode(header.dump()) + "." +
+            base64URLEncode(claims.dump());
+        EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+        size_t size = 0;
+        EVP_DigestSignInit(ctx, nullptr, EVP_sha256(), nullptr, key);
+        EVP_DigestSign(ctx, nullptr, &size,
+                       reinterpret_cast<const unsigned char*>(message.data()),
+                       message.size());
+        std::string signature(size, '\0');
+        EVP_DigestSign(ctx, reinterpret_cast<unsigned char*>(signature.data()),
+                       &size,
+                       reinterpret_cast<const unsigned char*>(message.data()),
+                       message.size());
+        EVP_MD_CTX_free(ctx);
+        signature.resize(size);
+        return message + "." + base64URLEncode(signature);
+    }
+
+private:
+    // Return a big number parameter of the key in big-endian bytes.
+    std::string param(const char* name) const
+    {
+        BIGNUM* bn = nullptr;
+        EVP_PKEY_get_bn_param(key, name, &bn);
+        std::string bytes(BN_num_bytes(bn), '\0');
+        BN_bn2bin(bn, reinterpret_cast<unsigned char*>(bytes.data()));
+        BN_free(bn);
+        return bytes;
+    }
+
+    std::string kid;
+    EVP_PKEY* key;
+};
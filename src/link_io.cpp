@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <format>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <mw/error.hpp>
+#include <mw/utils.hpp>
+#include <nlohmann/json.hpp>
+
+#include "data.hpp"
+#include "link_io.hpp"
+
+namespace
+{
+
+enum Column
+{
+    ID, SHORTCUT, ORIGINAL_URL, TYPE, USER_ID, VISITS, TIME_CREATION,
+    CACHE_MAX_AGE, COLUMN_COUNT,
+};
+
+// Names of the fields, indexed by Column.
+constexpr std::array<std::string_view, COLUMN_COUNT> CSV_COLUMNS = {
+    "id", "shortcut", "original_url", "type", "user_id", "visits",
+    "time_creation", "cache_max_age",
+};
+
+void appendJSONString(std::string& out, std::string_view str)
+{
+    out += '"';
+    size_t begin = 0;
+    for(size_t i = 0; i < str.size(); i++)
+    {
+        unsigned char c = str[i];
+        if(c >= 0x20 && c != '"' && c != '\\')
+        {
+            continue;
+        }
+        out.append(str.substr(begin, i - begin));
+        begin = i + 1;
+        switch(c)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            std::format_to(std::back_inserter(out), "\\u{:04x}", c);
+        }
+    }
+    out.append(str.substr(begin));
+    out += '"';
+}
+
+void appendCSVField(std::string& out, std::string_view field)
+{
+    if(field.find_first_of(",\"\r\n") == std::string_view::npos)
+    {
+        out += field;
+        return;
+    }
+    out += '"';
+    for(char c: field)
+    {
+        if(c == '"')
+        {
+            out += '"';
+        }
+        out += c;
+    }
+    out += '"';
+}
+
+// Split a CSV record into its fields, unquoting them. Return nullopt
+// if a quoted field is not closed properly.
+std::optional<std::vector<std::string>> splitCSVRecord(std::string_view record)
+{
+    std::vector<std::string> fields(1);
+    size_t i = 0;
+    while(i < record.size())
+    {
+        char c = record[i];
+        if(c == ',')
+        {
+            fields.emplace_back();
+            i++;
+        }
+        else if(c == '"' && fields.back().empty())
+        {
+            // A quoted field runs to the next lone quote.
+            i++;
+            while(true)
+            {
+                if(i >= record.size())
+                {
+                    return std::nullopt;
+                }
+                if(record[i] == '"')
+                {
+                    if(i + 1 < record.size() && record[i + 1] == '"')
+                    {
+                        fields.back() += '"';
+                        i += 2;
+                        continue;
+                    }
+                    i++;
+                    break;
+                }
+                fields.back() += record[i++];
+            }
+            if(i < record.size() && record[i] != ',')
+            {
+                return std::nullopt;
+            }
+        }
+        else
+        {
+            size_t end = std::min(record.find(',', i), record.size());
+            fields.back() += record.substr(i, end - i);
+            i = end;
+        }
+    }
+    return fields;
+}
+
+mw::E<ShortLink::Type> typeFromNumber(int64_t t)
+{
+    std::optional<ShortLink::Type> type =
+        ShortLink::typeFromInt(static_cast<int>(t));
+    if(!type.has_value() || t != static_cast<int>(t))
+    {
+        return std::unexpected(mw::runtimeError(
+            std::format("Invalid link type: {}", t)));
+    }
+    return *type;
+}
+
+mw::E<int64_t> cacheMaxAgeFromNumber(int64_t seconds)
+{
+    if(seconds < 0)
+    {
+        return std::unexpected(mw::runtimeError(
+            std::format("Invalid cache max age: {}", seconds)));
+    }
+    return seconds;
+}
+
+mw::E<int64_t> numberFromCSV(const std::string& field, std::string_view name)
+{
+    mw::E<int64_t> n = mw::strToNumber<int64_t>(field);
+    if(!n.has_value())
+    {
+        return std::unexpected(mw::runtimeError(
+            std::format("Invalid {}: {}", name, field)));
+    }
+    return n;
+}
+
+// Fill in a link from a JSON object. Fields that are missing are
+// left as they are.
+mw::E<void> linkFromJSON(const nlohmann::json& json, ShortLink& link)
+{
+    if(!json.is_object())
+    {
+        return std::unexpected(mw::runtimeError("Record is not an object"));
+    }
+    auto string_field = [&](Column c, std::string& out) -> mw::E<void>
+    {
+        auto it = json.find(CSV_COLUMNS[c]);
+        if(it == json.end() || it->is_null())
+        {
+            return {};
+        }
+        if(!it->is_string())
+        {
+            return std::unexpected(mw::runtimeError(
+                std::format("“{}” is not a string", CSV_COLUMNS[c])));
+        }
+        out = it->get<std::string>();
+        return {};
+    };
+    auto number_field = [&](Column c) -> mw::E<std::optional<int64_t>>
+    {
+        auto it = json.find(CSV_COLUMNS[c]);
+        if(it == json.end() || it->is_null())
+        {
+            return std::nullopt;
+        }
+        if(!it->is_number_integer())
+        {
+            return std::unexpected(mw::runtimeError(
+                std::format("“{}” is not an integer", CSV_COLUMNS[c])));
+        }
+        return it->get<int64_t>();
+    };
+
+    DO_OR_RETURN(string_field(SHORTCUT, link.shortcut));
+    DO_OR_RETURN(string_field(ORIGINAL_URL, link.original_url));
+    DO_OR_RETURN(string_field(USER_ID, link.user_id));
+    ASSIGN_OR_RETURN(std::optional<int64_t> type, number_field(TYPE));
+    if(type.has_value())
+    {
+        ASSIGN_OR_RETURN(link.type, typeFromNumber(*type));
+    }
+    ASSIGN_OR_RETURN(std::optional<int64_t> visits, number_field(VISITS));
+    if(visits.has_value())
+    {
+        link.visits = static_cast<uint64_t>(std::max<int64_t>(*visits, 0));
+    }
+    ASSIGN_OR_RETURN(std::optional<int64_t> time, number_field(TIME_CREATION));
+    if(time.has_value())
+    {
+        link.time_creation = mw::secondsToTime(*time);
+    }
+    ASSIGN_OR_RETURN(std::optional<int64_t> max_age,
+                     number_field(CACHE_MAX_AGE));
+    if(max_age.has_value())
+    {
+        ASSIGN_OR_RETURN(link.cache_max_age, cacheMaxAgeFromNumber(*max_age));
+    }
+    return {};
+}
+
+} // namespace
+
+std::optional<LinkFormat::Type> LinkFormat::fromStr(std::string_view name)
+{
+    if(name == "ndjson")
+    {
+        return NDJSON;
+    }
+    if(name == "csv")
+    {
+        return CSV;
+    }
+    return std::nullopt;
+}
+
+std::string_view LinkFormat::contentType(Type type)
+{
+    switch(type)
+    {
+    case NDJSON:
+        return "application/x-ndjson";
+    case CSV:
+        return "text/csv";
+    }
+    return "application/octet-stream";
+}
+
+std::string_view LinkFormat::header(Type type)
+{
+    switch(type)
+    {
+    case NDJSON:
+        return "";
+    case CSV:
+        return "id,shortcut,original_url,type,user_id,visits,time_creation,"
+            "cache_max_age\r\n";
+    }
+    return "";
+}
+
+void LinkFormat::appendLink(std::string& out, const ShortLink& link,
+                            Type type)
+{
+    switch(type)
+    {
+    case NDJSON:
+        appendJSON(out, link);
+        out += '\n';
+        break;
+    case CSV:
+        std::format_to(std::back_inserter(out), "{},", link.id);
+        appendCSVField(out, link.shortcut);
+        out += ',';
+        appendCSVField(out, link.original_url);
+        std::format_to(std::back_inserter(out), ",{},",
+                       static_cast<int>(link.type));
+        appendCSVField(out, link.user_id);
+        std::format_to(std::back_inserter(out), ",{},{},", link.visits,
+                       mw::timeToSeconds(link.time_creation));
+        if(link.cache_max_age.has_value())
+        {
+            std::format_to(std::back_inserter(out), "{}", *link.cache_max_age);
+        }
+        out += "\r\n";
+        break;
+    }
+}
+
+void LinkFormat::appendJSON(std::string& out, const ShortLink& link)
+{
+    std::format_to(std::back_inserter(out), "{{\"id\":{},\"shortcut\":",
+                   link.id);
+    appendJSONString(out, link.shortcut);
+    out += ",\"original_url\":";
+    appendJSONString(out, link.original_url);
+    std::format_to(std::back_inserter(out), ",\"type\":{},\"user_id\":",
+                   static_cast<int>(link.type));
+    appendJSONString(out, link.user_id);
+    std::format_to(std::back_inserter(out),
+                   ",\"visits\":{},\"time_creation\":{}", link.visits,
+                   mw::timeToSeconds(link.time_creation));
+    // Only links with their own cache lifetime have it.
+    if(link.cache_max_age.has_value())
+    {
+        std::format_to(std::back_inserter(out), ",\"cache_max_age\":{}",
+                       *link.cache_max_age);
+    }
+    out += '}';
+}
+
+mw::E<ShortLink> LinkFormat::fromJSON(const nlohmann::json& json)
+{
+    ShortLink link;
+    link.id = 0;
+    link.type = ShortLink::NORMAL;
+    link.visits = 0;
+    DO_OR_RETURN(linkFromJSON(json, link));
+    if(auto id = json.find("id"); id != json.end() && id->is_number_integer())
+    {
+        link.id = id->get<int64_t>();
+    }
+    return link;
+}
+
+nlohmann::json LinkImporter::Report::toJSON() const
+{
+    nlohmann::json json = {{"added", added}, {"rejected", rejected},
+                           {"rejections", nlohmann::json::array_t()}};
+    for(const Rejection& r: rejections)
+    {
+        json["rejections"].push_back({{"line", r.line},
+                                      {"shortcut", r.shortcut},
+                                      {"reason", r.reason}});
+    }
+    return json;
+}
+
+LinkImporter::LinkImporter(const DataSourceInterface& data_source,
+                           LinkFormat::Type format, size_t max_batch)
+        : data(data_source), type(format),
+          batch_size(std::max<size_t>(max_batch, 1))
+{
+    batch.reserve(batch_size);
+    batch_lines.reserve(batch_size);
+}
+
+void LinkImporter::setOwner(std::string user_id)
+{
+    owner = std::move(user_id);
+}
+
+mw::E<void> LinkImporter::feed(std::string_view chunk)
+{
+    pending += chunk;
+    return parseRecords();
+}
+
+mw::E<LinkImporter::Report> LinkImporter::finish()
+{
+    DO_OR_RETURN(parseRecords());
+    if(in_quotes)
+    {
+        reject(line, "", "Unterminated quoted field");
+    }
+    else if(!pending.empty())
+    {
+        DO_OR_RETURN(parseRecord(pending, line));
+    }
+    pending.clear();
+    scan_pos = 0;
+    in_quotes = false;
+    DO_OR_RETURN(flush());
+    return std::move(report);
+}
+
+mw::E<void> LinkImporter::parseRecords()
+{
+    size_t begin = 0;
+    for(; scan_pos < pending.size(); scan_pos++)
+    {
+        char c = pending[scan_pos];
+        if(c == '"' && type == LinkFormat::CSV)
+        {
+            in_quotes = !in_quotes;
+        }
+        if(c != '\n')
+        {
+            continue;
+        }
+        scanned_lines++;
+        if(in_quotes)
+        {
+            continue;
+        }
+        std::string_view record(pending.data() + begin, scan_pos - begin);
+        DO_OR_RETURN(parseRecord(record, line));
+        line += scanned_lines;
+        scanned_lines = 0;
+        begin = scan_pos + 1;
+    }
+    pending.erase(0, begin);
+    scan_pos -= begin;
+    return {};
+}
+
+mw::E<void> LinkImporter::parseRecord(std::string_view record, uint64_t at)
+{
+    if(record.ends_with('\r'))
+    {
+        record.remove_suffix(1);
+    }
+    if(record.empty())
+    {
+        return {};
+    }
+    if(type == LinkFormat::CSV && csv_columns.empty())
+    {
+        return parseCSVHeader(record);
+    }
+
+    ShortLink link;
+    link.id = 0;
+    link.type = ShortLink::NORMAL;
+    link.visits = 0;
+    link.time_creation = mw::Clock::now();
+    mw::E<void> parsed;
+    switch(type)
+    {
+    case LinkFormat::NDJSON:
+    {
+        nlohmann::json json = nlohmann::json::parse(record, nullptr, false);
+        if(json.is_discarded())
+        {
+            reject(at, "", "Invalid JSON");
+            return {};
+        }
+        parsed = linkFromJSON(json, link);
+        break;
+    }
+    case LinkFormat::CSV:
+    {
+        std::optional<std::vector<std::string>> fields =
+            splitCSVRecord(record);
+        if(!fields.has_value())
+        {
+            reject(at, "", "Invalid quoted field");
+            return {};
+        }
+        // Columns beyond the end of a short record are missing.
+        auto field = [&](Column c) -> std::string*
+        {
+            const std::optional<size_t>& i = csv_columns[c];
+            if(!i.has_value() || *i >= fields->size())
+            {
+                return nullptr;
+            }
+            return &(*fields)[*i];
+        };
+        parsed = [&]() -> mw::E<void>
+        {
+            if(std::string* f = field(SHORTCUT); f != nullptr)
+            {
+                link.shortcut = std::move(*f);
+            }
+            if(std::string* f = field(ORIGINAL_URL); f != nullptr)
+            {
+                link.original_url = std::move(*f);
+            }
+            if(std::string* f = field(USER_ID); f != nullptr)
+            {
+                link.user_id = std::move(*f);
+            }
+            if(std::string* f = field(TYPE); f != nullptr && !f->empty())
+            {
+                ASSIGN_OR_RETURN(int64_t t, numberFromCSV(*f, "type"));
+                ASSIGN_OR_RETURN(link.type, typeFromNumber(t));
+            }
+            if(std::string* f = field(VISITS); f != nullptr && !f->empty())
+            {
+                ASSIGN_OR_RETURN(int64_t v, numberFromCSV(*f, "visits"));
+                link.visits = static_cast<uint64_t>(std::max<int64_t>(v, 0));
+            }
+            if(std::string* f = field(TIME_CREATION);
+               f != nullptr && !f->empty())
+            {
+                ASSIGN_OR_RETURN(int64_t t,
+                                 numberFromCSV(*f, "creation time"));
+                link.time_creation = mw::secondsToTime(t);
+            }
+            if(std::string* f = field(CACHE_MAX_AGE);
+               f != nullptr && !f->empty())
+            {
+                ASSIGN_OR_RETURN(int64_t t,
+                                 numberFromCSV(*f, "cache max age"));
+                ASSIGN_OR_RETURN(link.cache_max_age, cacheMaxAgeFromNumber(t));
+            }
+            return {};
+        }();
+        break;
+    }
+    }
+    if(!parsed.has_value())
+    {
+        reject(at, link.shortcut, mw::errorMsg(parsed.error()));
+        return {};
+    }
+
+    if(link.shortcut.empty())
+    {
+        reject(at, "", "Empty shortcut");
+        return {};
+    }
+    if(link.original_url.empty())
+    {
+        reject(at, link.shortcut, "Empty original URL");
+        return {};
+    }
+    if(owner.has_value())
+    {
+        link.user_id = *owner;
+    }
+    else if(link.user_id.empty())
+    {
+        reject(at, link.shortcut, "Empty user ID");
+        return {};
+    }
+
+    batch.push_back(std::move(link));
+    batch_lines.push_back(at);
+    if(batch.size() >= batch_size)
+    {
+        return flush();
+    }
+    return {};
+}
+
+mw::E<void> LinkImporter::parseCSVHeader(std::string_view record)
+{
+    std::optional<std::vector<std::string>> names = splitCSVRecord(record);
+    if(!names.has_value())
+    {
+        return std::unexpected(mw::httpError(400, "Invalid CSV header"));
+    }
+    csv_columns.assign(COLUMN_COUNT, std::nullopt);
+    for(size_t i = 0; i < names->size(); i++)
+    {
+        auto it = std::ranges::find(CSV_COLUMNS, (*names)[i]);
+        if(it != CSV_COLUMNS.end())
+        {
+            csv_columns[it - CSV_COLUMNS.begin()] = i;
+        }
+    }
+    for(Column c: {SHORTCUT, ORIGINAL_URL})
+    {
+        if(!csv_columns[c].has_value())
+        {
+            return std::unexpected(mw::httpError(400, std::format(
+                "CSV header has no “{}” column", CSV_COLUMNS[c])));
+        }
+    }
+    return {};
+}
+
+void LinkImporter::reject(uint64_t at, std::string shortcut,
+                          std::string reason)
+{
+    report.rejected++;
+    if(report.rejections.size() < MAX_REJECTIONS)
+    {
+        report.rejections.push_back({at, std::move(shortcut),
+                                     std::move(reason)});
+    }
+}
+
+mw::E<void> LinkImporter::flush()
+{
+    if(batch.empty())
+    {
+        return {};
+    }
+    ASSIGN_OR_RETURN(std::vector<size_t> skipped, data.addLinks(batch));
+    report.added += batch.size() - skipped.size();
+    for(size_t i: skipped)
+    {
+        reject(batch_lines[i], std::move(batch[i].shortcut),
+               "Shortcut already exists");
+    }
+    batch.clear();
+    batch_lines.clear();
+    return {};
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mw/error.hpp>
+#include <nlohmann/json.hpp>
+
+#include "data.hpp"
+
+// Formats of links in bulk, for moving them between databases. Each
+// link is one record with the fields “id”, “shortcut”,
+// “original_url”, “type”, “user_id”, “visits”, “time_creation” and
+// “cache_max_age”. The type is 1 for a normal link and 2 for a regexp
+// link, the creation time is in seconds since the epoch, and the
+// cache max age is in seconds, or empty for the default.
+//
+// In NDJSON, every line is a JSON object of one link. CSV follows
+// RFC 4180, with a header line naming the columns.
+struct LinkFormat
+{
+    enum Type { NDJSON, CSV };
+
+    // “ndjson” or “csv”.
+    static std::optional<Type> fromStr(std::string_view name);
+    static std::string_view contentType(Type type);
+    // What goes before the first link. This is the header line for
+    // CSV, and empty for NDJSON.
+    static std::string_view header(Type type);
+    // Append “link” as one record, including the line break.
+    static void appendLink(std::string& out, const ShortLink& link,
+                           Type type);
+    // Append “link” as a JSON object, as in NDJSON. This writes
+    // directly into “out”, without building a JSON value first.
+    static void appendJSON(std::string& out, const ShortLink& link);
+    // Parse a link written by appendJSON(). Missing fields are left
+    // empty, except that the type defaults to a normal link.
+    static mw::E<ShortLink> fromJSON(const nlohmann::json& json);
+};
+
+// Parses links in one of the formats above from a stream of chunks,
+// and adds them to a data source in batches, each in one
+// transaction. Memory use is bounded by the batch size and the
+// longest record, regardless of the size of the input.
+//
+// A record that cannot be parsed, or whose shortcut already exists,
+// is rejected and reported, and does not stop the import. An error
+// from the data source does, and the batches before it stay added.
+// For CSV, only the “shortcut” and “original_url” columns are
+// required, and the ID is always ignored.
+class LinkImporter
+{
+public:
+    struct Rejection
+    {
+        // Line where the record starts, from 1.
+        uint64_t line;
+        // Empty if the record could not be parsed at all.
+        std::string shortcut;
+        std::string reason;
+    };
+
+    struct Report
+    {
+        uint64_t added = 0;
+        uint64_t rejected = 0;
+        // The first MAX_REJECTIONS rejections. “rejected” counts all
+        // of them.
+        std::vector<Rejection> rejections;
+
+        nlohmann::json toJSON() const;
+    };
+
+    static constexpr size_t MAX_REJECTIONS = 1000;
+
+    LinkImporter(const DataSourceInterface& data, LinkFormat::Type type,
+                 size_t batch_size = 10000);
+
+    // Make every link owned by “user_id”, instead of the user in the
+    // input. Without this, a record without a user is rejected.
+    void setOwner(std::string user_id);
+
+    // Parse the next piece of the input. Records may span chunks.
+    mw::E<void> feed(std::string_view chunk);
+    // Parse whatever is left, which may be a last record without a
+    // line break, and add the remaining links.
+    mw::E<Report> finish();
+
+private:
+    // Parse the complete records in “pending”.
+    mw::E<void> parseRecords();
+    mw::E<void> parseRecord(std::string_view record, uint64_t at);
+    mw::E<void> parseCSVHeader(std::string_view record);
+    void reject(uint64_t at, std::string shortcut, std::string reason);
+    mw::E<void> flush();
+
+    const DataSourceInterface& data;
+    const LinkFormat::Type type;
+    const size_t batch_size;
+    std::optional<std::string> owner;
+
+    // Input that is not parsed yet. It starts at a record.
+    std::string pending;
+    // How far into “pending” the end of the current record has been
+    // looked for, and whether that point is inside a quoted CSV
+    // field. This keeps a long record that arrives in many chunks
+    // from being scanned again with each one.
+    size_t scan_pos = 0;
+    bool in_quotes = false;
+    // Line where “pending” starts, and the lines in it up to
+    // “scan_pos”.
+    uint64_t line = 1;
+    uint64_t scanned_lines = 0;
+
+    // Index of each CSV column in ShortLink order, as in
+    // “CSV_COLUMNS” in link_io.cpp. Empty until the header is parsed.
+    std::vector<std::optional<size_t>> csv_columns;
+
+    std::vector<ShortLink> batch;
+    std::vector<uint64_t> batch_lines;
+    Report report;
+};
@@ -0,0 +1,131 @@
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+#include <mw/utils.hpp>
+#include <nlohmann/json.hpp>
+
+#include "data.hpp"
+#include "link_io.hpp"
+
+using ::testing::SizeIs;
+
+TEST(LinkIO, CanExportAndImportCSV)
+{
+    ShortLink link;
+    link.id = 7;
+    link.shortcut = "a,b";
+    link.original_url = "https://example.com/?q=\"x\"\nnext";
+    link.type = ShortLink::REGEXP;
+    link.user_id = "aaa";
+    link.visits = 3;
+    link.time_creation = mw::secondsToTime(1000);
+    std::string csv(LinkFormat::header(LinkFormat::CSV));
+    LinkFormat::appendLink(csv, link, LinkFormat::CSV);
+    link.shortcut = "c";
+    link.cache_max_age = 60;
+    LinkFormat::appendLink(csv, link, LinkFormat::CSV);
+    EXPECT_EQ(csv, "id,shortcut,original_url,type,user_id,visits,"
+              "time_creation,cache_max_age\r\n7,\"a,b\","
+              "\"https://example.com/?q=\"\"x\"\"\nnext\",2,aaa,3,1000,\r\n"
+              "7,c,\"https://example.com/?q=\"\"x\"\"\nnext\",2,aaa,3,1000,60"
+              "\r\n");
+
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    LinkImporter importer(*data, LinkFormat::CSV);
+    // Feed one byte at a time, so that every record spans chunks.
+    for(char c: csv)
+    {
+        ASSERT_TRUE(mw::isExpected(importer.feed(std::string_view(&c, 1))));
+    }
+    ASSIGN_OR_FAIL(LinkImporter::Report report, importer.finish());
+    EXPECT_EQ(report.added, 2);
+    EXPECT_EQ(report.rejected, 0);
+
+    ASSIGN_OR_FAIL(std::vector<ShortLink> links, data->getAllLinks("aaa"));
+    ASSERT_THAT(links, SizeIs(2));
+    EXPECT_EQ(links[0].shortcut, "a,b");
+    EXPECT_EQ(links[0].original_url, link.original_url);
+    EXPECT_EQ(links[0].type, ShortLink::REGEXP);
+    EXPECT_EQ(links[0].visits, 3);
+    EXPECT_EQ(mw::timeToSeconds(links[0].time_creation), 1000);
+    EXPECT_FALSE(links[0].cache_max_age.has_value());
+    EXPECT_EQ(links[1].cache_max_age, 60);
+}
+
+TEST(LinkIO, CanRejectBadAndDuplicateRecords)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    // A batch size of 2 puts the duplicate in a later batch than the
+    // original.
+    LinkImporter importer(*data, LinkFormat::NDJSON, 2);
+    importer.setOwner("bbb");
+    ASSERT_TRUE(mw::isExpected(importer.feed(
+        "{\"shortcut\": \"a\", \"original_url\": \"https://a/\","
+        " \"user_id\": \"aaa\"}\n"
+        "not json\n"
+        "\n"
+        "{\"shortcut\": \"b\", \"original_url\": \"https://b/\", \"type\": 5}\n"
+        "{\"shortcut\": \"c\", \"original_url\": \"https://c/\"}\n")));
+    ASSERT_TRUE(mw::isExpected(importer.feed(
+        "{\"shortcut\": \"a\", \"original_url\": \"https://a2/\"}")));
+    ASSIGN_OR_FAIL(LinkImporter::Report report, importer.finish());
+    EXPECT_EQ(report.added, 2);
+    EXPECT_EQ(report.rejected, 3);
+    ASSERT_THAT(report.rejections, SizeIs(3));
+    EXPECT_EQ(report.rejections[0].line, 2);
+    EXPECT_EQ(report.rejections[1].line, 4);
+    EXPECT_EQ(report.rejections[1].shortcut, "b");
+    EXPECT_EQ(report.rejections[2].line, 6);
+    EXPECT_EQ(report.rejections[2].reason, "Shortcut already exists");
+
+    ASSIGN_OR_FAIL(std::vector<ShortLink> links, data->getAllLinks("bbb"));
+    ASSERT_THAT(links, SizeIs(2));
+    EXPECT_EQ(links[0].original_url, "https://a/");
+}
+
+TEST(LinkIO, CanNotImportCSVWithoutRequiredColumns)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    LinkImporter importer(*data, LinkFormat::CSV);
+    EXPECT_FALSE(importer.feed("id,shortcut\n1,a\n").has_value());
+}
+
+TEST(LinkIO, CanWriteLinkAsJSON)
+{
+    ShortLink link;
+    link.id = 7;
+    link.shortcut = "q\"\\";
+    link.original_url = "https://example.com/\n\t\x01✅";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    link.visits = 3;
+    link.time_creation = mw::secondsToTime(1000);
+    std::string out;
+    LinkFormat::appendJSON(out, link);
+    EXPECT_EQ(out, "{\"id\":7,\"shortcut\":\"q\\\"\\\\\",\"original_url\":"
+              "\"https://example.com/\\n\\t\\u0001✅\",\"type\":1,"
+              "\"user_id\":\"aaa\",\"visits\":3,\"time_creation\":1000}");
+    nlohmann::json json = nlohmann::json::parse(out);
+    EXPECT_EQ(json["shortcut"], link.shortcut);
+    EXPECT_EQ(json["original_url"], link.original_url);
+
+    link.cache_max_age = 0;
+    out.clear();
+    LinkFormat::appendJSON(out, link);
+    EXPECT_THAT(out, ::testing::EndsWith(",\"cache_max_age\":0}"));
+    ASSIGN_OR_FAIL(ShortLink parsed,
+                   LinkFormat::fromJSON(nlohmann::json::parse(out)));
+    EXPECT_EQ(parsed.cache_max_age, 0);
+    EXPECT_FALSE(LinkFormat::fromJSON(
+        nlohmann::json{{"cache_max_age", -1}}).has_value());
+}
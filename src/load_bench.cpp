@@ -0,0 +1,420 @@
+// A load generator for shrt. It starts the app in-process, with a
+// fixed user instead of an OpenID Connect provider, and sends
+// requests to it over loopback from a number of client threads. The
+// throughput and latency of each scenario are written as JSON.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cxxopts.hpp>
+#include <httplib.h>
+#include <mw/auth.hpp>
+#include <mw/error.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include "app.hpp"
+#include "config.hpp"
+#include "data.hpp"
+#include "data_cache.hpp"
+
+namespace
+{
+
+const std::string ACCESS_TOKEN = "bench";
+
+// Accepts every access token as the same user.
+class FixedUserAuth : public mw::AuthInterface
+{
+public:
+    std::string initialURL() const override
+    {
+        return "http://localhost/";
+    }
+
+    mw::E<mw::Tokens> authenticate(
+        [[maybe_unused]] const std::string& code) const override
+    {
+        mw::Tokens tokens;
+        tokens.access_token = ACCESS_TOKEN;
+        return tokens;
+    }
+
+    mw::E<mw::Tokens> refreshTokens(
+        [[maybe_unused]] const std::string& token) const override
+    {
+        return authenticate("");
+    }
+
+    mw::E<mw::UserInfo> getUser(
+        [[maybe_unused]] const mw::Tokens& tokens) const override
+    {
+        mw::UserInfo user;
+        user.id = "bench";
+        user.name = "bench";
+        return user;
+    }
+};
+
+struct Options
+{
+    std::string host = "127.0.0.1";
+    int port = 18123;
+    int concurrency = 8;
+    std::chrono::seconds duration{5};
+    // Empty means an in-memory database.
+    std::string db_file;
+    int64_t links = 10000;
+    std::vector<std::string> scenarios;
+};
+
+// A kind of request. “send” makes one request with the given client,
+// and returns whether the response was what it should be. “worker”
+// is the index of the client thread, and “i” counts the requests of
+// that thread.
+struct Scenario
+{
+    std::string name;
+    std::function<bool(httplib::Client& client, int worker, uint64_t i)> send;
+};
+
+struct Result
+{
+    std::string name;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    double seconds = 0.0;
+    // Latencies of successful requests in nanoseconds, sorted.
+    std::vector<int64_t> latencies;
+};
+
+int64_t percentile(const std::vector<int64_t>& sorted, double q)
+{
+    if(sorted.empty())
+    {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(q * static_cast<double>(sorted.size()));
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+nlohmann::json resultToJSON(const Result& result)
+{
+    auto micros = [](int64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    int64_t total = 0;
+    for(int64_t ns: result.latencies)
+    {
+        total += ns;
+    }
+    double mean = result.latencies.empty() ? 0.0 :
+        static_cast<double>(total) /
+        static_cast<double>(result.latencies.size());
+    return {
+        {"name", result.name},
+        {"requests", result.requests},
+        {"errors", result.errors},
+        {"seconds", result.seconds},
+        {"throughput", result.seconds > 0.0 ?
+         static_cast<double>(result.requests) / result.seconds : 0.0},
+        {"latency_us", {
+                {"mean", mean / 1000.0},
+                {"p50", micros(percentile(result.latencies, 0.5))},
+                {"p99", micros(percentile(result.latencies, 0.99))},
+                {"p999", micros(percentile(result.latencies, 0.999))},
+                {"max", micros(result.latencies.empty() ? 0 :
+                               result.latencies.back())},
+            }},
+    };
+}
+
+// Send requests of “scenario” from “options.concurrency” threads,
+// each with its own keep-alive connection, for “options.duration”.
+Result run(const Scenario& scenario, const Options& options)
+{
+    std::vector<std::vector<int64_t>> latencies(options.concurrency);
+    std::vector<uint64_t> errors(options.concurrency, 0);
+    std::atomic<bool> go = false;
+    std::atomic<bool> done = false;
+    std::vector<std::thread> workers;
+    for(int w = 0; w < options.concurrency; w++)
+    {
+        workers.emplace_back([&, w]
+        {
+            httplib::Client client(options.host, options.port);
+            client.set_keep_alive(true);
+            std::vector<int64_t>& mine = latencies[w];
+            mine.reserve(1 << 16);
+            while(!go)
+            {
+                std::this_thread::yield();
+            }
+            for(uint64_t i = 0; !done; i++)
+            {
+                auto begin = std::chrono::steady_clock::now();
+                bool ok = scenario.send(client, w, i);
+                auto end = std::chrono::steady_clock::now();
+                if(ok)
+                {
+                    mine.push_back(std::chrono::duration_cast<
+                                   std::chrono::nanoseconds>(end - begin)
+                                   .count());
+                }
+                else
+                {
+                    errors[w]++;
+                }
+            }
+        });
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    go = true;
+    std::this_thread::sleep_for(options.duration);
+    done = true;
+    for(std::thread& t: workers)
+    {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    Result result;
+    result.name = scenario.name;
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+    for(int w = 0; w < options.concurrency; w++)
+    {
+        result.errors += errors[w];
+        result.latencies.insert(result.latencies.end(), latencies[w].begin(),
+                                latencies[w].end());
+    }
+    result.requests = result.latencies.size() + result.errors;
+    std::sort(result.latencies.begin(), result.latencies.end());
+    return result;
+}
+
+// Open the database, and add links until there are at least
+// “options.links” normal ones. Return the shortcuts of the normal
+// links, which are what the redirect scenario requests.
+mw::E<std::unique_ptr<DataSourceSQLite>>
+openDataSource(const Options& options, std::vector<std::string>& shortcuts)
+{
+    std::unique_ptr<DataSourceSQLite> data;
+    if(options.db_file.empty())
+    {
+        ASSIGN_OR_RETURN(data, DataSourceSQLite::newFromMemory());
+    }
+    else
+    {
+        ASSIGN_OR_RETURN(data, DataSourceSQLite::fromFile(options.db_file));
+    }
+
+    DO_OR_RETURN(data->forEachLink([&](ShortLink&& link) -> mw::E<void>
+    {
+        if(link.type == ShortLink::NORMAL)
+        {
+            shortcuts.push_back(std::move(link.shortcut));
+        }
+        return {};
+    }));
+    for(int64_t i = 0; std::ssize(shortcuts) < options.links; i++)
+    {
+        ShortLink link;
+        link.shortcut = std::format("bench-seed-{}", i);
+        link.original_url = std::format("https://example.com/{}", i);
+        link.type = ShortLink::NORMAL;
+        link.user_id = "bench";
+        if(data->findLinkByShortcut(link.shortcut).value_or(std::nullopt)
+           .has_value())
+        {
+            continue;
+        }
+        shortcuts.push_back(link.shortcut);
+        DO_OR_RETURN(data->addLink(std::move(link)));
+    }
+    return data;
+}
+
+std::vector<Scenario> allScenarios(const std::vector<std::string>& shortcuts)
+{
+    const httplib::Headers auth_headers = {
+        {"Cookie", "shrt-access-token=" + ACCESS_TOKEN}};
+    // Links created by this run get shortcuts that are unique
+    // across runs on the same database.
+    const int64_t run_id = std::chrono::system_clock::now()
+        .time_since_epoch().count();
+
+    return {
+        {"redirect", [&shortcuts](httplib::Client& client, int worker,
+                                  uint64_t i)
+        {
+            // Different threads start at different places, so that
+            // they do not all hit the same link.
+            const std::string& shortcut = shortcuts[
+                (i * 7919 + static_cast<uint64_t>(worker) * 104729) %
+                shortcuts.size()];
+            auto res = client.Get("/" + shortcut);
+            return res && res->status == 308;
+        }},
+        {"links", [auth_headers](httplib::Client& client,
+                                 [[maybe_unused]] int worker,
+                                 [[maybe_unused]] uint64_t i)
+        {
+            auto res = client.Get("/_/links", auth_headers);
+            return res && res->status == 200;
+        }},
+        {"create-link", [auth_headers, run_id](httplib::Client& client,
+                                               int worker, uint64_t i)
+        {
+            std::string body = std::format(
+                "shortcut=bench-{}-{}-{}&original_url=https%3A%2F%2F"
+                "example.com%2F{}&regexp=off", run_id, worker, i, i);
+            auto res = client.Post("/_/create-link", auth_headers, body,
+                                   "application/x-www-form-urlencoded");
+            return res && res->status == 302;
+        }},
+    };
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    cxxopts::Options cmd_options(
+        "shrt_bench", "Load generator for shrt");
+    cmd_options.add_options()
+        ("c,config", "Config file. The listen address and port are "
+         "always overridden.", cxxopts::value<std::string>())
+        ("p,port", "Port to listen on",
+         cxxopts::value<int>()->default_value("18123"))
+        ("n,concurrency", "Number of client threads",
+         cxxopts::value<int>()->default_value("8"))
+        ("d,duration", "Seconds to run each scenario",
+         cxxopts::value<int>()->default_value("5"))
+        ("db", "Use this database file instead of an in-memory one",
+         cxxopts::value<std::string>())
+        ("links", "Make sure there are at least this many links",
+         cxxopts::value<int64_t>()->default_value("10000"))
+        ("s,scenarios", "Scenarios to run, from redirect, links, and "
+         "create-link",
+         cxxopts::value<std::vector<std::string>>()->default_value(
+             "redirect,links,create-link"))
+        ("o,output", "Write the JSON result to this file instead of "
+         "stdout", cxxopts::value<std::string>())
+        ("h,help", "Print this message.");
+    auto opts = cmd_options.parse(argc, argv);
+    if(opts.count("help"))
+    {
+        std::cout << cmd_options.help() << std::endl;
+        return 0;
+    }
+
+    Options options;
+    options.port = opts["port"].as<int>();
+    options.concurrency = std::max(1, opts["concurrency"].as<int>());
+    options.duration = std::chrono::seconds(opts["duration"].as<int>());
+    options.links = std::max<int64_t>(1, opts["links"].as<int64_t>());
+    options.scenarios = opts["scenarios"].as<std::vector<std::string>>();
+    if(opts.count("db"))
+    {
+        options.db_file = opts["db"].as<std::string>();
+    }
+
+    Configuration config;
+    if(opts.count("config"))
+    {
+        auto loaded = Configuration::fromYaml(opts["config"].as<std::string>());
+        if(!loaded.has_value())
+        {
+            spdlog::error("Failed to load config: {}",
+                          mw::errorMsg(loaded.error()));
+            return 1;
+        }
+        config = *std::move(loaded);
+    }
+    config.listen_address = options.host;
+    config.listen_port = options.port;
+    config.base_url = std::format("http://{}:{}/", options.host, options.port);
+    // Request logs would dominate the measurement.
+    spdlog::set_level(spdlog::level::warn);
+
+    std::vector<std::string> shortcuts;
+    auto sqlite = openDataSource(options, shortcuts);
+    if(!sqlite.has_value())
+    {
+        spdlog::error("Failed to prepare database: {}",
+                      mw::errorMsg(sqlite.error()));
+        return 1;
+    }
+    std::unique_ptr<DataSourceInterface> data = *std::move(sqlite);
+    if(config.link_cache_size > 0)
+    {
+        data = std::make_unique<DataSourceCache>(std::move(data),
+                                                 config.link_cache_size);
+    }
+
+    App app(config, std::move(data), std::make_unique<FixedUserAuth>());
+    if(auto start = app.start(); !start.has_value())
+    {
+        spdlog::error("Failed to start server: {}",
+                      mw::errorMsg(start.error()));
+        return 1;
+    }
+    // Wait for the server to accept connections.
+    {
+        httplib::Client probe(options.host, options.port);
+        for(int i = 0; i < 100 && !probe.Get("/_/login"); i++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    nlohmann::json results = nlohmann::json::array();
+    for(const Scenario& scenario: allScenarios(shortcuts))
+    {
+        if(std::find(options.scenarios.begin(), options.scenarios.end(),
+                     scenario.name) == options.scenarios.end())
+        {
+            continue;
+        }
+        spdlog::warn("Running {}...", scenario.name);
+        results.push_back(resultToJSON(run(scenario, options)));
+    }
+    app.stop();
+    app.wait();
+
+    nlohmann::json report = {
+        {"timestamp", std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count()},
+        {"concurrency", options.concurrency},
+        {"duration_sec", options.duration.count()},
+        {"database", options.db_file.empty() ? ":memory:" : options.db_file},
+        {"links", shortcuts.size()},
+        {"link_cache_size", config.link_cache_size},
+        {"results", std::move(results)},
+    };
+    if(opts.count("output"))
+    {
+        std::ofstream f(opts["output"].as<std::string>());
+        f << report.dump(2) << std::endl;
+        if(!f)
+        {
+            spdlog::error("Failed to write {}",
+                          opts["output"].as<std::string>());
+            return 1;
+        }
+    }
+    else
+    {
+        std::cout << report.dump(2) << std::endl;
+    }
+    return 0;
+}
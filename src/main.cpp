@@ -1,13 +1,115 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
 #include <memory>
+#include <string>
+#include <thread>
+
+#include <signal.h>
 
 #include <cxxopts.hpp>
 #include <spdlog/spdlog.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <mw/url.hpp>
 #include <mw/error.hpp>
 
 #include "config.hpp"
 #include "data.hpp"
+#include "data_cache.hpp"
+#include "data_filter.hpp"
+#include "data_snapshot.hpp"
+#include "jwt.hpp"
+#include "link_io.hpp"
+#include "metrics.hpp"
 #include "app.hpp"
+#include "cluster.hpp"
+
+namespace
+{
+
+// Size of the chunks in which links are read and written by
+// “--import” and “--export”.
+constexpr size_t LINK_IO_CHUNK_SIZE = 1024 * 1024;
+
+// Write every link of every user in “data” to “path”, or to the
+// standard output if it is “-”.
+mw::E<void> exportLinks(const DataSourceInterface& data,
+                        const std::string& path, LinkFormat::Type format)
+{
+    std::ofstream file;
+    if(path != "-")
+    {
+        file.open(path, std::ios::binary);
+        if(!file)
+        {
+            return std::unexpected(mw::runtimeError(
+                std::format("Failed to open {}", path)));
+        }
+    }
+    std::ostream& out = path == "-" ? std::cout : file;
+    std::string buffer(LinkFormat::header(format));
+    uint64_t count = 0;
+    DO_OR_RETURN(data.forEachLink([&](ShortLink&& link) -> mw::E<void>
+    {
+        LinkFormat::appendLink(buffer, link, format);
+        count++;
+        if(buffer.size() >= LINK_IO_CHUNK_SIZE)
+        {
+            out.write(buffer.data(), std::ssize(buffer));
+            buffer.clear();
+        }
+        return {};
+    }));
+    out.write(buffer.data(), std::ssize(buffer));
+    out.flush();
+    if(!out)
+    {
+        return std::unexpected(mw::runtimeError("Failed to write links"));
+    }
+    spdlog::info("Exported {} links.", count);
+    return {};
+}
+
+// Add the links in “path”, or in the standard input if it is “-”, to
+// “data”, keeping their users.
+mw::E<void> importLinks(const DataSourceInterface& data,
+                        const std::string& path, LinkFormat::Type format)
+{
+    std::ifstream file;
+    if(path != "-")
+    {
+        file.open(path, std::ios::binary);
+        if(!file)
+        {
+            return std::unexpected(mw::runtimeError(
+                std::format("Failed to open {}", path)));
+        }
+    }
+    std::istream& in = path == "-" ? std::cin : file;
+    LinkImporter importer(data, format);
+    std::string buffer(LINK_IO_CHUNK_SIZE, '\0');
+    while(in)
+    {
+        in.read(buffer.data(), std::ssize(buffer));
+        DO_OR_RETURN(importer.feed(std::string_view(buffer.data(),
+                                                    in.gcount())));
+    }
+    if(in.bad())
+    {
+        return std::unexpected(mw::runtimeError("Failed to read links"));
+    }
+    ASSIGN_OR_RETURN(LinkImporter::Report report, importer.finish());
+    for(const LinkImporter::Rejection& r: report.rejections)
+    {
+        spdlog::warn("Line {}: rejected “{}”: {}", r.line, r.shortcut,
+                     r.reason);
+    }
+    spdlog::info("Imported {} links, rejected {}.", report.added,
+                 report.rejected);
+    return {};
+}
+
+} // namespace
 
 int main(int argc, char** argv)
 {
@@ -16,6 +118,12 @@ int main(int argc, char** argv)
     cmd_options.add_options()
         ("c,config", "Config file",
          cxxopts::value<std::string>()->default_value("/etc/shrt.yaml"))
+        ("export", "Export all links to a file (“-” for the standard "
+         "output) and exit.", cxxopts::value<std::string>())
+        ("import", "Import links from a file (“-” for the standard "
+         "input) and exit.", cxxopts::value<std::string>())
+        ("format", "Format of “--export” and “--import”: ndjson or csv.",
+         cxxopts::value<std::string>()->default_value("ndjson"))
         ("h,help", "Print this message.");
     auto opts = cmd_options.parse(argc, argv);
 
@@ -24,6 +132,24 @@ int main(int argc, char** argv)
         std::cout << cmd_options.help() << std::endl;
         return 0;
     }
+    const bool link_io_mode = opts.count("export") || opts.count("import");
+    if(link_io_mode)
+    {
+        // The links may go to the standard output.
+        spdlog::set_default_logger(spdlog::stderr_color_mt("stderr"));
+    }
+
+    // Handle termination signals in a dedicated thread instead of
+    // letting them kill the process, so that the server can shut down
+    // cleanly and flush pending visits. This has to be done before
+    // any other thread is started, so that they inherit the mask.
+    // SIGHUP reloads the templates.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
 
     const std::string config_file = opts["config"].as<std::string>();
     auto config = Configuration::fromYaml(std::move(config_file));
@@ -34,6 +160,14 @@ int main(int argc, char** argv)
         config = mw::E<Configuration>(Configuration());
     }
 
+    if(!config->replication_primary.empty() &&
+       config->replication_state_file.empty())
+    {
+        config->replication_state_file =
+            (std::filesystem::path(config->data_dir) / "replication-state")
+            .string();
+    }
+
     auto url_prefix = mw::URL::fromStr(config->base_url);
     if(!url_prefix.has_value())
     {
@@ -41,6 +175,49 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    // Referred to by the data sources and the app, so this has to
+    // outlive them.
+    Metrics metrics;
+    DataSourceSQLite::Options db_options;
+    db_options.metrics = &metrics;
+    db_options.read_connections = config->db_read_connections;
+    db_options.synchronous = config->db_synchronous;
+    db_options.mmap_size = config->db_mmap_size;
+    db_options.cache_size_kib = config->db_cache_size_kib;
+    db_options.change_log_retention = config->replication_log_retention;
+    auto data_source = DataSourceSQLite::fromFile(
+        (std::filesystem::path(config->data_dir) / "data.db").string(),
+        db_options);
+    if(!data_source.has_value())
+    {
+        spdlog::error("Failed to create data source: {}",
+                      errorMsg(data_source.error()));
+        return 1;
+    }
+
+    if(link_io_mode)
+    {
+        std::optional<LinkFormat::Type> format =
+            LinkFormat::fromStr(opts["format"].as<std::string>());
+        if(!format.has_value())
+        {
+            spdlog::error("Invalid format: {}",
+                          opts["format"].as<std::string>());
+            return 1;
+        }
+        mw::E<void> result = opts.count("export") ?
+            exportLinks(**data_source, opts["export"].as<std::string>(),
+                        *format) :
+            importLinks(**data_source, opts["import"].as<std::string>(),
+                        *format);
+        if(!result.has_value())
+        {
+            spdlog::error("{}", mw::errorMsg(result.error()));
+            return 1;
+        }
+        return 0;
+    }
+
     auto auth = mw::AuthOpenIDConnect::create(
         config->openid_url_prefix, config->client_id, config->client_secret,
         url_prefix->appendPath("_/openid-redirect").str(),
@@ -53,15 +230,93 @@ int main(int argc, char** argv)
         return 1;
     }
 
-    auto data_source = DataSourceSQLite::fromFile(
-        (std::filesystem::path(config->data_dir) / "data.db").string());
-    if(!data_source.has_value())
+    std::unique_ptr<DataSourceInterface> data = *std::move(data_source);
+    if(!config->snapshot_file.empty())
     {
-        spdlog::error("Failed to create data source: {}",
-                      errorMsg(data_source.error()));
-        return 1;
+        data = std::make_unique<DataSourceSnapshot>(
+            std::move(data), config->snapshot_file,
+            std::chrono::seconds(config->snapshot_interval_sec));
+    }
+    // The filter goes below the link cache, so that redirects that
+    // hit the cache do not touch it.
+    const DataSourceFilter* filter = nullptr;
+    if(config->shortcut_filter)
+    {
+        DataSourceFilter::Options filter_options;
+        filter_options.negative_ttl =
+            std::chrono::seconds(config->negative_cache_ttl_sec);
+        filter_options.negative_cache_size = config->negative_cache_size;
+        filter_options.metrics = &metrics;
+        auto filtered = DataSourceFilter::create(std::move(data),
+                                                 filter_options);
+        if(!filtered.has_value())
+        {
+            spdlog::error("Failed to build shortcut filter: {}",
+                          mw::errorMsg(filtered.error()));
+            return 1;
+        }
+        filter = filtered->get();
+        data = *std::move(filtered);
     }
-    App app(*config, *std::move(data_source), *std::move(auth));
+    const DataSourceCache* cache = nullptr;
+    if(config->link_cache_size > 0)
+    {
+        auto cached = std::make_unique<DataSourceCache>(
+            std::move(data), config->link_cache_size, &metrics);
+        cache = cached.get();
+        data = std::move(cached);
+    }
+
+    std::unique_ptr<JWTVerifierInterface> jwt;
+    if(config->jwt_local_verification)
+    {
+        mw::HTTPSession http;
+        auto verifier = JWTVerifier::fromOpenIDConnect(
+            config->openid_url_prefix,
+            config->jwt_audience.empty() ? config->client_id :
+            config->jwt_audience, http);
+        if(verifier.has_value())
+        {
+            jwt = *std::move(verifier);
+        }
+        else
+        {
+            spdlog::warn("Access tokens will not be verified locally: {}",
+                         mw::errorMsg(verifier.error()));
+        }
+    }
+
+    std::unique_ptr<Cluster> cluster;
+    if(!config->cluster_nodes.empty())
+    {
+        std::optional<Cluster::Mode> mode =
+            Cluster::modeFromStr(config->cluster_mode);
+        if(!mode.has_value())
+        {
+            spdlog::error("Invalid cluster mode: {}", config->cluster_mode);
+            return 1;
+        }
+        Cluster::Options cluster_options;
+        cluster_options.nodes = config->cluster_nodes;
+        cluster_options.self = config->cluster_self;
+        cluster_options.mode = *mode;
+        cluster_options.virtual_nodes = config->cluster_virtual_nodes;
+        cluster_options.forward_timeout =
+            std::chrono::milliseconds(config->cluster_forward_timeout_ms);
+        auto nodes = Cluster::create(cluster_options);
+        if(!nodes.has_value())
+        {
+            spdlog::error("Failed to set up cluster: {}",
+                          mw::errorMsg(nodes.error()));
+            return 1;
+        }
+        cluster = *std::move(nodes);
+        spdlog::info("This is node {} of a cluster of {}.",
+                     config->cluster_self, config->cluster_nodes.size());
+    }
+
+    App app(*config, std::move(data), *std::move(auth), std::move(jwt),
+            &metrics, std::move(cluster));
     auto start = app.start();
     if(!start.has_value())
     {
@@ -72,6 +327,44 @@ int main(int argc, char** argv)
 
     spdlog::info("Listening at {}:{}...", config->listen_address,
                  config->listen_port);
+    std::thread([&app, &signals]
+    {
+        int sig;
+        while(sigwait(&signals, &sig) == 0 && sig == SIGHUP)
+        {
+            if(mw::E<void> result = app.reloadTemplates(); result.has_value())
+            {
+                spdlog::info("Templates reloaded.");
+            }
+            else
+            {
+                spdlog::error("Failed to reload templates: {}",
+                              mw::errorMsg(result.error()));
+            }
+        }
+        spdlog::info("Received signal {}, shutting down...", sig);
+        app.stop();
+    }).detach();
     app.wait();
+    App::RenderStats render = app.renderStats();
+    if(render.count > 0)
+    {
+        spdlog::info("Rendered {} pages, {} µs on average, {} µs at most.",
+                     render.count, render.total.count() / render.count / 1000,
+                     render.max.count() / 1000);
+    }
+    if(cache != nullptr)
+    {
+        DataSourceCache::Stats stats = cache->stats();
+        spdlog::info("Link cache: {} hits, {} misses, hit ratio {:.3f}.",
+                     stats.hits, stats.misses, stats.hitRatio());
+    }
+    if(filter != nullptr)
+    {
+        DataSourceFilter::Stats stats = filter->stats();
+        spdlog::info("Shortcut filter: {} rejects, {} false positives, {} "
+                     "negative cache hits.", stats.filter_rejects,
+                     stats.false_positives, stats.negative_hits);
+    }
     return 0;
 }
@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "metrics.hpp"
+
+namespace
+{
+
+std::atomic<uint64_t> next_serial = 1;
+
+const char* typeName(Metrics::Type type)
+{
+    switch(type)
+    {
+    case Metrics::COUNTER:
+        return "counter";
+    case Metrics::GAUGE:
+        return "gauge";
+    case Metrics::HISTOGRAM:
+        return "histogram";
+    }
+    return "untyped";
+}
+
+// Join the labels of a series with one more label.
+std::string withLabel(const std::string& labels, const std::string& label)
+{
+    if(labels.empty())
+    {
+        return std::format("{{{}}}", label);
+    }
+    return std::format("{{{},{}}}", labels, label);
+}
+
+std::string bracedLabels(const std::string& labels)
+{
+    if(labels.empty())
+    {
+        return "";
+    }
+    return std::format("{{{}}}", labels);
+}
+
+} // namespace
+
+Metrics::Registration::Registration(Registration&& r)
+        : metrics(r.metrics), index(r.index)
+{
+    r.metrics = nullptr;
+}
+
+Metrics::Registration& Metrics::Registration::operator=(Registration&& r)
+{
+    std::swap(metrics, r.metrics);
+    std::swap(index, r.index);
+    return *this;
+}
+
+Metrics::Registration::~Registration()
+{
+    if(metrics != nullptr)
+    {
+        metrics->unregister(index);
+    }
+}
+
+Metrics::Timer::Timer(Metrics* m, Histogram h)
+        : metrics(m), histogram(h)
+{
+    if(metrics != nullptr)
+    {
+        begin = std::chrono::steady_clock::now();
+    }
+}
+
+Metrics::Timer::~Timer()
+{
+    if(metrics != nullptr)
+    {
+        metrics->observe(histogram, std::chrono::steady_clock::now() - begin);
+    }
+}
+
+Metrics::Shard::Shard(size_t n)
+        : size(n), values(std::make_unique<std::atomic<uint64_t>[]>(n))
+{
+}
+
+Metrics::Metrics() : serial(next_serial++) {}
+
+Metrics::~Metrics() = default;
+
+Metrics::Counter Metrics::counter(const std::string& name,
+                                  const std::string& help,
+                                  const std::string& labels)
+{
+    size_t index = registerSeries(name, help, COUNTER, labels, 1, nullptr);
+    std::lock_guard<std::mutex> guard(lock);
+    return {series[index].slot};
+}
+
+Metrics::Histogram Metrics::histogram(const std::string& name,
+                                      const std::string& help,
+                                      const std::string& labels)
+{
+    // One slot per bucket, and one for the sum.
+    size_t index = registerSeries(name, help, HISTOGRAM, labels,
+                                  HISTOGRAM_BUCKETS + 1, nullptr);
+    std::lock_guard<std::mutex> guard(lock);
+    return {series[index].slot};
+}
+
+Metrics::Registration Metrics::callback(
+    Type type, const std::string& name, const std::string& help,
+    const std::string& labels, std::function<double()> value)
+{
+    return {this, registerSeries(name, help, type, labels, 0,
+                                 std::move(value))};
+}
+
+void Metrics::increment(Counter c, uint64_t n)
+{
+    std::atomic<uint64_t>& v = values(c.slot + 1)[c.slot];
+    // Only this thread writes to “v”, so this does not need to be an
+    // atomic add. It is atomic so that render() can read it.
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Metrics::observe(Histogram h, std::chrono::nanoseconds duration)
+{
+    uint64_t ns = duration.count() < 0 ? 0 : duration.count();
+    // Bucket i holds durations of at most 2^i µs.
+    size_t bucket = std::min<size_t>(std::bit_width(ns / 1000),
+                                     HISTOGRAM_BUCKETS - 1);
+    std::atomic<uint64_t>* v = values(h.slot + HISTOGRAM_BUCKETS + 1);
+    std::atomic<uint64_t>& count = v[h.slot + bucket];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    std::atomic<uint64_t>& sum = v[h.slot + HISTOGRAM_BUCKETS];
+    sum.store(sum.load(std::memory_order_relaxed) + ns,
+              std::memory_order_relaxed);
+}
+
+std::string Metrics::render() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<uint64_t> totals(slot_count, 0);
+    for(const std::unique_ptr<Shard>& shard: shards)
+    {
+        for(size_t i = 0; i < shard->size; i++)
+        {
+            totals[i] += shard->values[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::string result;
+    for(size_t f = 0; f < families.size(); f++)
+    {
+        const Family& family = families[f];
+        std::string lines;
+        for(const Series& s: series)
+        {
+            if(s.family != f)
+            {
+                continue;
+            }
+            if(s.is_callback)
+            {
+                // The callback may have been unregistered, and only the
+                // latest of those with the same labels is shown.
+                if(s.value && isLatestCallback(s))
+                {
+                    lines += std::format("{}{} {}\n", family.name,
+                                         bracedLabels(s.labels), s.value());
+                }
+                continue;
+            }
+            switch(family.type)
+            {
+            case COUNTER:
+                lines += std::format("{}{} {}\n", family.name,
+                                     bracedLabels(s.labels), totals[s.slot]);
+                break;
+            case GAUGE:
+                // Gauges are always callbacks.
+                break;
+            case HISTOGRAM:
+            {
+                uint64_t cumulative = 0;
+                for(size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+                {
+                    cumulative += totals[s.slot + i];
+                    std::string le = i + 1 == HISTOGRAM_BUCKETS ? "+Inf" :
+                        std::format("{}", static_cast<double>(
+                                        uint64_t(1) << i) / 1e6);
+                    lines += std::format(
+                        "{}_bucket{} {}\n", family.name,
+                        withLabel(s.labels, std::format("le=\"{}\"", le)),
+                        cumulative);
+                }
+                lines += std::format(
+                    "{}_sum{} {}\n", family.name, bracedLabels(s.labels),
+                    static_cast<double>(totals[s.slot + HISTOGRAM_BUCKETS])
+                    / 1e9);
+                lines += std::format("{}_count{} {}\n", family.name,
+                                     bracedLabels(s.labels), cumulative);
+                break;
+            }
+            }
+        }
+        if(lines.empty())
+        {
+            continue;
+        }
+        result += std::format("# HELP {} {}\n# TYPE {} {}\n", family.name,
+                              family.help, family.name,
+                              typeName(family.type));
+        result += lines;
+    }
+    return result;
+}
+
+size_t Metrics::registerSeries(
+    const std::string& name, const std::string& help, Type type,
+    const std::string& labels, size_t slots, std::function<double()> value)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    size_t family = 0;
+    while(family < families.size() && families[family].name != name)
+    {
+        family++;
+    }
+    if(family == families.size())
+    {
+        families.push_back({name, help, type});
+    }
+
+    const bool is_callback = static_cast<bool>(value);
+    for(size_t i = 0; i < series.size(); i++)
+    {
+        if(series[i].family != family || series[i].labels != labels)
+        {
+            continue;
+        }
+        if(!is_callback)
+        {
+            return i;
+        }
+        // Each registration of a callback has its own series, so that
+        // unregistering it does not remove the callback of another
+        // owner. A series whose callback is gone is reused.
+        if(series[i].is_callback && !series[i].value)
+        {
+            series[i].value = std::move(value);
+            series[i].serial = next_callback++;
+            return i;
+        }
+    }
+    series.push_back({family, labels, slot_count, is_callback,
+                      std::move(value), is_callback ? next_callback++ : 0});
+    slot_count += slots;
+    return series.size() - 1;
+}
+
+bool Metrics::isLatestCallback(const Series& s) const
+{
+    for(const Series& other: series)
+    {
+        if(other.is_callback && other.value && other.family == s.family &&
+           other.labels == s.labels && other.serial > s.serial)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Metrics::unregister(size_t index)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    series[index].value = nullptr;
+}
+
+std::atomic<uint64_t>* Metrics::values(size_t slot_end)
+{
+    // Shards of this thread, keyed by the serial of their registry.
+    // There is usually only one registry.
+    thread_local std::vector<std::pair<uint64_t, Shard*>> local_shards;
+    auto it = local_shards.begin();
+    while(it != local_shards.end() && it->first != serial)
+    {
+        it++;
+    }
+    if(it != local_shards.end() && it->second->size >= slot_end)
+    {
+        return it->second->values.get();
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    shards.push_back(std::make_unique<Shard>(slot_count));
+    Shard* shard = shards.back().get();
+    if(it == local_shards.end())
+    {
+        local_shards.emplace_back(serial, shard);
+    }
+    else
+    {
+        it->second = shard;
+    }
+    return shard->values.get();
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A registry of metrics, which are exported in the text format of
+// Prometheus.
+//
+// Counters and histograms are meant for hot paths. Each thread
+// records into its own array of values, without any lock or
+// read-modify-write across threads, and the arrays are only summed
+// when the metrics are rendered. Metrics whose values already exist
+// elsewhere, such as the size of a cache, are registered as
+// callbacks instead, and read when the metrics are rendered.
+//
+// Registering a metric takes a lock, so it should be done once, up
+// front, and the returned handle kept.
+class Metrics
+{
+public:
+    // The upper bounds of the buckets of a histogram are 1 µs × 2^i,
+    // for i from 0 to HISTOGRAM_BUCKETS - 2. The last bucket is +Inf.
+    static constexpr size_t HISTOGRAM_BUCKETS = 24;
+
+    struct Counter
+    {
+        size_t slot = 0;
+    };
+
+    struct Histogram
+    {
+        size_t slot = 0;
+    };
+
+    enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+    // Keeps a callback metric registered. The metric is removed when
+    // this is destroyed, so that it can refer to an object that is
+    // destroyed before the registry.
+    class Registration
+    {
+    public:
+        Registration() = default;
+        Registration(Registration&& r);
+        Registration& operator=(Registration&& r);
+        ~Registration();
+
+    private:
+        friend class Metrics;
+        Registration(Metrics* m, size_t i) : metrics(m), index(i) {}
+
+        Metrics* metrics = nullptr;
+        size_t index = 0;
+    };
+
+    // Measures the time from its construction to its destruction into
+    // a histogram. This does nothing if “metrics” is null.
+    class Timer
+    {
+    public:
+        Timer(Metrics* m, Histogram h);
+        ~Timer();
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+
+    private:
+        Metrics* metrics;
+        Histogram histogram;
+        std::chrono::steady_clock::time_point begin;
+    };
+
+    Metrics();
+    ~Metrics();
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // Register a metric. “labels” is in the syntax of Prometheus,
+    // e.g. “route="links",code="2xx"”, or empty. All metrics with the
+    // same name should have the same type and help. Registering the
+    // same name and labels again returns the metric already there.
+    // For callbacks, the latest one registered is shown, and the
+    // others come back when it is unregistered.
+    Counter counter(const std::string& name, const std::string& help,
+                    const std::string& labels = "");
+    // A histogram of durations, exported in seconds.
+    Histogram histogram(const std::string& name, const std::string& help,
+                        const std::string& labels = "");
+    // A metric whose value is read from “value” when rendering.
+    // “type” is COUNTER or GAUGE.
+    [[nodiscard]] Registration callback(
+        Type type, const std::string& name, const std::string& help,
+        const std::string& labels, std::function<double()> value);
+
+    void increment(Counter c, uint64_t n = 1);
+    void observe(Histogram h, std::chrono::nanoseconds duration);
+
+    // All metrics in the text format of Prometheus.
+    std::string render() const;
+
+private:
+    struct Family
+    {
+        std::string name;
+        std::string help;
+        Type type;
+    };
+
+    struct Series
+    {
+        size_t family;
+        std::string labels;
+        // First slot of the values. Not used by callbacks.
+        size_t slot;
+        bool is_callback;
+        // Empty if the callback has been removed.
+        std::function<double()> value;
+        // Order of registration of callbacks.
+        uint64_t serial;
+    };
+
+    // The values recorded by one thread. Only that thread writes to
+    // them.
+    struct Shard
+    {
+        explicit Shard(size_t n);
+
+        const size_t size;
+        std::unique_ptr<std::atomic<uint64_t>[]> values;
+    };
+
+    size_t registerSeries(const std::string& name, const std::string& help,
+                          Type type, const std::string& labels,
+                          size_t slot_count, std::function<double()> value);
+    void unregister(size_t index);
+    // Whether no callback with the labels of “s” was registered after
+    // it. This requires “lock”.
+    bool isLatestCallback(const Series& s) const;
+    // Return the values of the calling thread, which have room for at
+    // least “slot_end” slots.
+    std::atomic<uint64_t>* values(size_t slot_end);
+
+    // Distinguishes this registry from others in the thread-local
+    // lists of shards. It is never reused.
+    const uint64_t serial;
+
+    mutable std::mutex lock;
+    std::vector<Family> families;
+    std::vector<Series> series;
+    size_t slot_count = 0;
+    uint64_t next_callback = 1;
+    // Shards of all threads. A thread gets a new, larger shard when
+    // metrics are added after its shard is made. The old one is kept,
+    // and still counts.
+    std::vector<std::unique_ptr<Shard>> shards;
+};
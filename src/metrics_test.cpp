@@ -0,0 +1,93 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "metrics.hpp"
+
+using ::testing::HasSubstr;
+using ::testing::Not;
+
+TEST(Metrics, CanSumCountersOfAllThreads)
+{
+    Metrics metrics;
+    Metrics::Counter a = metrics.counter("test_total", "Test counter",
+                                         "kind=\"a\"");
+    Metrics::Counter b = metrics.counter("test_total", "Test counter",
+                                         "kind=\"b\"");
+    std::vector<std::thread> threads;
+    for(int i = 0; i < 4; i++)
+    {
+        threads.emplace_back([&]
+        {
+            for(int j = 0; j < 1000; j++)
+            {
+                metrics.increment(a);
+            }
+            metrics.increment(b, 2);
+        });
+    }
+    for(std::thread& t: threads)
+    {
+        t.join();
+    }
+    // Registering again gives the same counter.
+    metrics.increment(metrics.counter("test_total", "Test counter",
+                                      "kind=\"b\""));
+
+    std::string text = metrics.render();
+    EXPECT_THAT(text, HasSubstr("# TYPE test_total counter\n"));
+    EXPECT_THAT(text, HasSubstr("test_total{kind=\"a\"} 4000\n"));
+    EXPECT_THAT(text, HasSubstr("test_total{kind=\"b\"} 9\n"));
+}
+
+TEST(Metrics, CanObserveHistogram)
+{
+    Metrics metrics;
+    Metrics::Histogram h = metrics.histogram("test_seconds", "Test histogram");
+    metrics.observe(h, std::chrono::nanoseconds(500));
+    metrics.observe(h, std::chrono::microseconds(3));
+    metrics.observe(h, std::chrono::hours(1));
+    // A metric added after this thread has recorded something.
+    Metrics::Counter c = metrics.counter("test_late_total", "Late counter");
+    metrics.increment(c);
+
+    std::string text = metrics.render();
+    EXPECT_THAT(text, HasSubstr("# TYPE test_seconds histogram\n"));
+    EXPECT_THAT(text, HasSubstr("test_seconds_bucket{le=\"1e-06\"} 1\n"));
+    EXPECT_THAT(text, HasSubstr("test_seconds_bucket{le=\"2e-06\"} 1\n"));
+    EXPECT_THAT(text, HasSubstr("test_seconds_bucket{le=\"4e-06\"} 2\n"));
+    EXPECT_THAT(text, HasSubstr("test_seconds_bucket{le=\"+Inf\"} 3\n"));
+    EXPECT_THAT(text, HasSubstr("test_seconds_count 3\n"));
+    EXPECT_THAT(text, HasSubstr("test_late_total 1\n"));
+}
+
+TEST(Metrics, CanUnregisterCallback)
+{
+    Metrics metrics;
+    {
+        Metrics::Registration r = metrics.callback(
+            Metrics::GAUGE, "test_ratio", "Test gauge", "", [] { return 0.5; });
+        EXPECT_THAT(metrics.render(), HasSubstr("test_ratio 0.5\n"));
+    }
+    EXPECT_THAT(metrics.render(), Not(HasSubstr("test_ratio")));
+}
+
+TEST(Metrics, CanKeepCallbacksOfOtherOwners)
+{
+    Metrics metrics;
+    Metrics::Registration first = metrics.callback(
+        Metrics::GAUGE, "test_ratio", "Test gauge", "", [] { return 0.5; });
+    {
+        Metrics::Registration second = metrics.callback(
+            Metrics::GAUGE, "test_ratio", "Test gauge", "", [] { return 1; });
+        EXPECT_THAT(metrics.render(), HasSubstr("test_ratio 1\n"));
+        EXPECT_THAT(metrics.render(), Not(HasSubstr("test_ratio 0.5\n")));
+    }
+    EXPECT_THAT(metrics.render(), HasSubstr("test_ratio 0.5\n"));
+    first = Metrics::Registration();
+    EXPECT_THAT(metrics.render(), Not(HasSubstr("test_ratio")));
+}
@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <memory>
+#include <new>
+#include <optional>
+#include <string>
+
+#include <benchmark/benchmark.h>
+#include <httplib.h>
+#include <mw/error.hpp>
+
+#include "app.hpp"
+#include "config.hpp"
+#include "data.hpp"
+#include "data_cache.hpp"
+
+namespace
+{
+
+// Number of calls to operator new on this thread. Replacing operator
+// new affects the whole benchmark binary, but it only adds a
+// thread-local increment.
+thread_local uint64_t allocation_count = 0;
+
+} // namespace
+
+void* operator new(size_t size)
+{
+    allocation_count++;
+    if(void* p = std::malloc(size == 0 ? 1 : size); p != nullptr)
+    {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+// GCC cannot tell that this pairs with the operator new above.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, [[maybe_unused]] size_t size) noexcept
+{
+    std::free(p);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+namespace
+{
+
+constexpr int64_t LINK_COUNT = 1000;
+
+// Create an in-memory data source with “LINK_COUNT” normal links,
+// with shortcuts “link0”, “link1”, etc.
+std::unique_ptr<DataSourceSQLite> seededLinks()
+{
+    auto data = DataSourceSQLite::newFromMemory();
+    if(!data.has_value())
+    {
+        return nullptr;
+    }
+    for(int64_t i = 0; i < LINK_COUNT; i++)
+    {
+        ShortLink link;
+        link.shortcut = std::format("link{}", i);
+        link.original_url = std::format("https://example.com/{}", i);
+        link.type = ShortLink::NORMAL;
+        link.user_id = "bench";
+        if(!(*data)->addLink(std::move(link)).has_value())
+        {
+            return nullptr;
+        }
+    }
+    return *std::move(data);
+}
+
+// Run “lookup” in the timed loop, and report the number of
+// allocations it makes per iteration.
+template<typename F>
+void runCountingAllocations(benchmark::State& state, F lookup)
+{
+    // Warm up caches and buffers outside of the count.
+    lookup();
+    uint64_t allocations = 0;
+    for(auto _: state)
+    {
+        uint64_t before = allocation_count;
+        lookup();
+        allocations += allocation_count - before;
+    }
+    state.counters["allocs_per_op"] = benchmark::Counter(
+        static_cast<double>(allocations), benchmark::Counter::kAvgIterations);
+}
+
+void BM_ResolveShortcutSQLite(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = seededLinks();
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    std::string url;
+    runCountingAllocations(state, [&]
+    {
+        auto id = data->resolveShortcut("link500", url);
+        benchmark::DoNotOptimize(id);
+    });
+}
+BENCHMARK(BM_ResolveShortcutSQLite);
+
+void BM_ResolveShortcutCache(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = seededLinks();
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    DataSourceCache cache(std::move(data), LINK_COUNT);
+    std::string url;
+    runCountingAllocations(state, [&]
+    {
+        auto id = cache.resolveShortcut("link500", url);
+        benchmark::DoNotOptimize(id);
+    });
+}
+BENCHMARK(BM_ResolveShortcutCache);
+
+// What the redirect handler used to do: materialize a whole
+// ShortLink. This is here for comparison.
+void BM_FindLinkByShortcutCache(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = seededLinks();
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    DataSourceCache cache(std::move(data), LINK_COUNT);
+    runCountingAllocations(state, [&]
+    {
+        auto link = cache.findLinkByShortcut("link500");
+        benchmark::DoNotOptimize(link);
+    });
+}
+BENCHMARK(BM_FindLinkByShortcutCache);
+
+// Only the response of a redirect, without the lookup. The
+// difference between this and BM_HandleShortcut is what the handler
+// allocates on its own.
+void BM_RedirectResponse(benchmark::State& state)
+{
+    const std::string url = "https://example.com/500";
+    runCountingAllocations(state, [&]
+    {
+        httplib::Response res;
+        res.set_redirect(url, 308);
+        benchmark::DoNotOptimize(res);
+    });
+}
+BENCHMARK(BM_RedirectResponse);
+
+// The whole redirect handler, through the link cache as configured
+// by default, not counting the HTTP server.
+void BM_HandleShortcut(benchmark::State& state)
+{
+    std::unique_ptr<DataSourceSQLite> data = seededLinks();
+    if(data == nullptr)
+    {
+        state.SkipWithError("Failed to populate database");
+        return;
+    }
+    Configuration config;
+    // The handler does not use authentication.
+    App app(config, std::make_unique<DataSourceCache>(std::move(data),
+                                                      LINK_COUNT),
+            nullptr);
+    httplib::Request req;
+    req.path_params["shortcut"] = "link500";
+    runCountingAllocations(state, [&]
+    {
+        httplib::Response res;
+        app.handleShortcut(req, res);
+        benchmark::DoNotOptimize(res);
+    });
+}
+BENCHMARK(BM_HandleShortcut);
+
+} // namespace
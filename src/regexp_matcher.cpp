@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "data.hpp"
+#include "regexp_matcher.hpp"
+
+RegexpLinkMatcher::RegexpLinkMatcher(std::vector<ShortLink>&& links)
+{
+    patterns.reserve(links.size());
+    for(ShortLink& link: links)
+    {
+        std::regex re;
+        try
+        {
+            re.assign(link.shortcut, std::regex::ECMAScript |
+                      std::regex::optimize);
+        }
+        catch(const std::regex_error& e)
+        {
+            spdlog::warn("Ignoring link {} with invalid regexp {}: {}",
+                         link.id, link.shortcut, e.what());
+            continue;
+        }
+
+        std::string prefix = literalPrefix(link.shortcut);
+        uint32_t node = 0;
+        for(char c: prefix)
+        {
+            auto it = trie[node].children.find(c);
+            if(it == trie[node].children.end())
+            {
+                trie.emplace_back();
+                it = trie[node].children.emplace(
+                    c, static_cast<uint32_t>(trie.size() - 1)).first;
+            }
+            node = it->second;
+        }
+        trie[node].patterns.push_back(static_cast<uint32_t>(patterns.size()));
+        patterns.push_back({std::move(link), std::move(re)});
+    }
+}
+
+const ShortLink* RegexpLinkMatcher::match(const std::string& path) const
+{
+    std::smatch captures;
+    return match(path, captures);
+}
+
+const ShortLink* RegexpLinkMatcher::match(const std::string& path,
+                                          std::smatch& captures) const
+{
+    // Patterns whose literal prefix is a non-empty prefix of the
+    // path.
+    std::vector<uint32_t> prefixed;
+    uint32_t node = 0;
+    for(char c: path)
+    {
+        auto it = trie[node].children.find(c);
+        if(it == trie[node].children.end())
+        {
+            break;
+        }
+        node = it->second;
+        prefixed.insert(prefixed.end(), trie[node].patterns.begin(),
+                        trie[node].patterns.end());
+    }
+    std::sort(prefixed.begin(), prefixed.end());
+
+    // Try them together with the patterns without a prefix, in the
+    // order in which the links were given.
+    const std::vector<uint32_t>& unprefixed = trie[0].patterns;
+    auto a = prefixed.begin();
+    auto b = unprefixed.begin();
+    while(a != prefixed.end() || b != unprefixed.end())
+    {
+        uint32_t i;
+        if(b == unprefixed.end() || (a != prefixed.end() && *a < *b))
+        {
+            i = *a++;
+        }
+        else
+        {
+            i = *b++;
+        }
+        // Ensure it’s a full match
+        if(std::regex_match(path, captures, patterns[i].re))
+        {
+            return &patterns[i].link;
+        }
+    }
+    return nullptr;
+}
+
+std::string RegexpLinkMatcher::expandCaptures(const std::string& url,
+                                              const std::smatch& captures)
+{
+    if(url.find('$') == std::string::npos)
+    {
+        return url;
+    }
+    return captures.format(url);
+}
+
+std::string RegexpLinkMatcher::literalPrefix(std::string_view pattern)
+{
+    // Top-level alternatives each have their own prefix. Don’t
+    // bother.
+    if(pattern.find('|') != std::string_view::npos)
+    {
+        return "";
+    }
+
+    size_t i = 0;
+    if(pattern.starts_with('^'))
+    {
+        i = 1;
+    }
+    std::string prefix;
+    for(; i < pattern.size(); i++)
+    {
+        char c = pattern[i];
+        if(std::string_view("\\^$.|?*+()[]{}").find(c) !=
+           std::string_view::npos)
+        {
+            // The last literal character may be optional.
+            if((c == '?' || c == '*' || c == '{') && !prefix.empty())
+            {
+                prefix.pop_back();
+            }
+            break;
+        }
+        prefix.push_back(c);
+    }
+    return prefix;
+}
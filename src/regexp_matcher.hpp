@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "data.hpp"
+
+// A compiled set of regexp links. The regexps are compiled once when
+// the matcher is built, and the matcher is immutable afterwards, so
+// it can be shared between threads.
+//
+// To avoid trying every pattern on every lookup, the literal prefix
+// of each pattern (e.g. “gh/” in “gh/(.+)”) is put into a trie. A
+// lookup walks the trie along the path, which only yields patterns
+// whose prefix matches, plus those without a usable prefix. Only
+// these candidates are run through std::regex.
+class RegexpLinkMatcher
+{
+public:
+    RegexpLinkMatcher() = default;
+    // The links should be in the order in which they are to be
+    // tried. Links whose shortcut is not a valid regexp are dropped.
+    explicit RegexpLinkMatcher(std::vector<ShortLink>&& links);
+
+    // Return the first link whose shortcut fully matches “path”, or
+    // nullptr if there is none. The pointer is valid as long as the
+    // matcher is alive. The capture groups of the match are put in
+    // “captures”, which refers to “path”.
+    const ShortLink* match(const std::string& path, std::smatch& captures)
+        const;
+    const ShortLink* match(const std::string& path) const;
+
+    // Replace “$n” in “url” by the n-th capture group, “$&” by the
+    // whole match, and “$$” by a literal “$”.
+    static std::string expandCaptures(const std::string& url,
+                                      const std::smatch& captures);
+
+    // Number of usable patterns.
+    size_t size() const { return patterns.size(); }
+
+    // The literal text that every string matching “pattern” starts
+    // with. This is conservative: it may be shorter than the real
+    // prefix, and it is empty if unsure.
+    static std::string literalPrefix(std::string_view pattern);
+
+private:
+    struct Pattern
+    {
+        ShortLink link;
+        std::regex re;
+    };
+
+    struct TrieNode
+    {
+        std::map<char, uint32_t> children;
+        // Indices into “patterns” whose literal prefix ends here.
+        std::vector<uint32_t> patterns;
+    };
+
+    std::vector<Pattern> patterns;
+    // Root is at index 0. Patterns without a literal prefix are
+    // attached to the root, so they are always candidates.
+    std::vector<TrieNode> trie{1};
+};
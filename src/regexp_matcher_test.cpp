@@ -0,0 +1,76 @@
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "data.hpp"
+#include "regexp_matcher.hpp"
+
+namespace
+{
+
+ShortLink makeRegexpLink(int64_t id, const std::string& pattern)
+{
+    ShortLink link;
+    link.id = id;
+    link.shortcut = pattern;
+    link.original_url = "https://darksair.org/";
+    link.type = ShortLink::REGEXP;
+    return link;
+}
+
+} // namespace
+
+TEST(RegexpLinkMatcher, CanFindLiteralPrefix)
+{
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("gh-(.+)"), "gh-");
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("^abc$"), "abc");
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("abc?"), "ab");
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("abc*d"), "ab");
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("ab+"), "ab");
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("a|b"), "");
+    EXPECT_EQ(RegexpLinkMatcher::literalPrefix("[a-z]+"), "");
+}
+
+TEST(RegexpLinkMatcher, CanMatchInOrder)
+{
+    std::vector<ShortLink> links;
+    links.push_back(makeRegexpLink(1, "gh-(.+)"));
+    links.push_back(makeRegexpLink(2, ".*"));
+    links.push_back(makeRegexpLink(3, "gh-abc"));
+    links.push_back(makeRegexpLink(4, "(invalid"));
+    RegexpLinkMatcher matcher(std::move(links));
+    EXPECT_EQ(matcher.size(), 3);
+
+    const ShortLink* link = matcher.match("gh-abc");
+    ASSERT_NE(link, nullptr);
+    EXPECT_EQ(link->id, 1);
+    link = matcher.match("g");
+    ASSERT_NE(link, nullptr);
+    EXPECT_EQ(link->id, 2);
+}
+
+TEST(RegexpLinkMatcher, CanRequireFullMatch)
+{
+    std::vector<ShortLink> links;
+    links.push_back(makeRegexpLink(1, "abc"));
+    RegexpLinkMatcher matcher(std::move(links));
+    EXPECT_EQ(matcher.match("abcd"), nullptr);
+    EXPECT_EQ(matcher.match("ab"), nullptr);
+    EXPECT_NE(matcher.match("abc"), nullptr);
+}
+
+TEST(RegexpLinkMatcher, CanExpandCaptures)
+{
+    std::vector<ShortLink> links;
+    links.push_back(makeRegexpLink(1, "gh-([^-]+)-(.+)"));
+    links[0].original_url = "https://github.com/$1/$2?a=$$";
+    RegexpLinkMatcher matcher(std::move(links));
+
+    std::string path = "gh-MetroWind-shrt";
+    std::smatch captures;
+    const ShortLink* link = matcher.match(path, captures);
+    ASSERT_NE(link, nullptr);
+    EXPECT_EQ(RegexpLinkMatcher::expandCaptures(link->original_url, captures),
+              "https://github.com/MetroWind/shrt?a=$");
+}
@@ -0,0 +1,299 @@
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+#include <mw/error.hpp>
+#include <mw/http_client.hpp>
+#include <nlohmann/json.hpp>
+
+#include "data.hpp"
+#include "link_io.hpp"
+#include "metrics.hpp"
+#include "replication.hpp"
+
+std::string ReplicationFormat::changesToJSON(
+    const std::vector<LinkChange>& changes, const LogState& state)
+{
+    std::string out;
+    // Most of a change is its URL.
+    out.reserve(64 + changes.size() * 256);
+    std::format_to(std::back_inserter(out),
+                   "{{\"latest\":{},\"compacted\":{},\"changes\":[",
+                   state.latest, state.compacted);
+    for(size_t i = 0; i < changes.size(); i++)
+    {
+        if(i > 0)
+        {
+            out += ',';
+        }
+        std::format_to(std::back_inserter(out), "{{\"seq\":{},\"op\":{},"
+                       "\"link\":", changes[i].seq,
+                       static_cast<int>(changes[i].op));
+        LinkFormat::appendJSON(out, changes[i].link);
+        out += '}';
+    }
+    out += "]}";
+    return out;
+}
+
+mw::E<ReplicationFormat::LogState> ReplicationFormat::changesFromJSON(
+    std::string_view body, std::vector<LinkChange>& changes)
+{
+    nlohmann::json json = nlohmann::json::parse(body, nullptr, false);
+    if(json.is_discarded() || !json.is_object() ||
+       !json.contains("latest") || !json["latest"].is_number_integer() ||
+       !json.contains("changes") || !json["changes"].is_array() ||
+       (json.contains("compacted") &&
+        !json["compacted"].is_number_integer()))
+    {
+        return std::unexpected(mw::runtimeError("Invalid replication log"));
+    }
+    for(const nlohmann::json& item: json["changes"])
+    {
+        if(!item.is_object() || !item.contains("seq") ||
+           !item["seq"].is_number_integer() || !item.contains("op") ||
+           !item["op"].is_number_integer() || !item.contains("link"))
+        {
+            return std::unexpected(mw::runtimeError(
+                "Invalid change in replication log"));
+        }
+        LinkChange& change = changes.emplace_back();
+        change.seq = item["seq"].get<int64_t>();
+        int op = item["op"].get<int>();
+        if(op != LinkChange::ADD && op != LinkChange::REMOVE)
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Invalid operation in change {}", change.seq)));
+        }
+        change.op = static_cast<LinkChange::Op>(op);
+        ASSIGN_OR_RETURN(change.link, LinkFormat::fromJSON(item["link"]));
+    }
+    LogState state;
+    state.latest = json["latest"].get<int64_t>();
+    state.compacted = json.value("compacted", int64_t(0));
+    return state;
+}
+
+ReplicationFollower::ReplicationFollower(
+    const DataSourceInterface& data_source, const Options& opts,
+    std::unique_ptr<mw::HTTPSessionInterface> http_session)
+        : data(data_source), options(opts), http(std::move(http_session))
+{
+    if(!options.state_file.empty())
+    {
+        std::ifstream f(options.state_file);
+        int64_t seq = 0;
+        if(f >> seq)
+        {
+            applied_seq = seq;
+        }
+        // Absent in state files from before compaction.
+        int64_t compacted = 0;
+        if(f >> compacted)
+        {
+            bootstrap_compacted = compacted;
+        }
+    }
+    if(options.metrics != nullptr)
+    {
+        metric_callbacks.push_back(options.metrics->callback(
+            Metrics::GAUGE, "shrt_replication_applied_seq",
+            "Sequence number of the last change applied from the primary",
+            "", [this] { return static_cast<double>(stats().applied_seq); }));
+        metric_callbacks.push_back(options.metrics->callback(
+            Metrics::GAUGE, "shrt_replication_primary_seq",
+            "Sequence number of the latest change on the primary", "",
+            [this] { return static_cast<double>(stats().primary_seq); }));
+        metric_callbacks.push_back(options.metrics->callback(
+            Metrics::GAUGE, "shrt_replication_lag",
+            "Number of changes on the primary not applied yet", "",
+            [this] { return static_cast<double>(stats().lag()); }));
+        metric_callbacks.push_back(options.metrics->callback(
+            Metrics::COUNTER, "shrt_replication_errors_total",
+            "Failures to fetch or apply changes from the primary", "",
+            [this] { return static_cast<double>(stats().errors); }));
+    }
+    poller = std::thread([this] { run(); });
+}
+
+ReplicationFollower::~ReplicationFollower()
+{
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    poller.join();
+}
+
+mw::E<bool> ReplicationFollower::poll()
+{
+    std::lock_guard<std::mutex> guard(poll_lock);
+    std::string url = options.primary_url;
+    if(!url.ends_with('/'))
+    {
+        url += '/';
+    }
+    std::format_to(std::back_inserter(url),
+                   "_/replication/changes?after={}&limit={}",
+                   applied_seq.load(), options.batch_size);
+    ASSIGN_OR_RETURN(const mw::HTTPResponse* res, http->get(
+        mw::HTTPRequest(url).addHeader("Authorization",
+                                       "Bearer " + options.token)));
+    if(res->status != 200)
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Primary responded with {}: {}", res->status,
+            res->payloadAsStr())));
+    }
+    std::vector<LinkChange> changes;
+    ASSIGN_OR_RETURN(ReplicationFormat::LogState state,
+                     ReplicationFormat::changesFromJSON(res->payloadAsStr(),
+                                                        changes));
+    primary_seq = state.latest;
+    if(applied_seq == 0)
+    {
+        bootstrap_compacted = state.compacted;
+    }
+    // A removal after “applied_seq” may be gone from the log with its
+    // addition, which is applied already. Applying the rest would
+    // hide that.
+    if(state.compacted > applied_seq &&
+       state.compacted > bootstrap_compacted)
+    {
+        fell_behind = true;
+        return std::unexpected(mw::runtimeError(std::format(
+            "Fell behind the log of the primary, which is compacted up "
+            "to {}, while {} is applied. Bootstrap this follower again "
+            "from an empty data directory.", state.compacted,
+            applied_seq.load())));
+    }
+    if(changes.empty())
+    {
+        return false;
+    }
+    DO_OR_RETURN(apply(changes));
+    applied_seq = changes.back().seq;
+    DO_OR_RETURN(saveState());
+    return applied_seq < state.latest;
+}
+
+ReplicationFollower::Stats ReplicationFollower::stats() const
+{
+    Stats s;
+    s.applied_seq = applied_seq;
+    s.primary_seq = primary_seq;
+    s.errors = errors;
+    s.fell_behind = fell_behind;
+    return s;
+}
+
+void ReplicationFollower::run()
+{
+    while(true)
+    {
+        mw::E<bool> more = poll();
+        if(!more.has_value())
+        {
+            errors++;
+            // Polling again would not help.
+            if(fell_behind)
+            {
+                spdlog::error("Stopped replicating from {}: {}",
+                              options.primary_url,
+                              mw::errorMsg(more.error()));
+                return;
+            }
+            spdlog::warn("Failed to replicate from {}: {}",
+                         options.primary_url, mw::errorMsg(more.error()));
+        }
+        std::unique_lock<std::mutex> guard(wake_lock);
+        if(more.has_value() && *more)
+        {
+            if(stopping)
+            {
+                return;
+            }
+            continue;
+        }
+        if(wake.wait_for(guard, options.poll_interval,
+                         [this] { return stopping; }))
+        {
+            return;
+        }
+    }
+}
+
+mw::E<void> ReplicationFollower::apply(const std::vector<LinkChange>& changes)
+{
+    // Consecutive additions go in one transaction.
+    std::vector<ShortLink> added;
+    auto add_pending = [&]() -> mw::E<void>
+    {
+        if(added.empty())
+        {
+            return {};
+        }
+        // Skipped links are already here, from an earlier attempt.
+        DO_OR_RETURN(data.addLinks(added));
+        added.clear();
+        return {};
+    };
+    for(const LinkChange& change: changes)
+    {
+        if(change.op == LinkChange::ADD)
+        {
+            added.push_back(change.link);
+            continue;
+        }
+        DO_OR_RETURN(add_pending());
+        ASSIGN_OR_RETURN(std::optional<ShortLink> link,
+                         data.findLinkByShortcut(change.link.shortcut));
+        if(link.has_value())
+        {
+            DO_OR_RETURN(data.removeLink(link->id));
+        }
+    }
+    return add_pending();
+}
+
+mw::E<void> ReplicationFollower::saveState() const
+{
+    if(options.state_file.empty())
+    {
+        return {};
+    }
+    std::filesystem::path temp_path = options.state_file;
+    temp_path += ".tmp";
+    {
+        std::ofstream f(temp_path, std::ios::trunc);
+        f << applied_seq.load() << "\n" << bootstrap_compacted.load() << "\n";
+        f.close();
+        if(!f)
+        {
+            return std::unexpected(mw::runtimeError(std::format(
+                "Failed to write {}", temp_path.string())));
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temp_path, options.state_file, error);
+    if(error)
+    {
+        return std::unexpected(mw::runtimeError(std::format(
+            "Failed to move replication state to {}: {}",
+            options.state_file.string(), error.message())));
+    }
+    return {};
+}
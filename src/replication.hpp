@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <mw/error.hpp>
+#include <mw/http_client.hpp>
+
+#include "data.hpp"
+#include "metrics.hpp"
+
+// The wire format of the replication log, as served by the primary at
+// “/_/replication/changes”. The body is a JSON object with “latest”,
+// the sequence number of the latest change on the primary,
+// “compacted”, the sequence number up to which its log is compacted
+// (see DataSourceInterface::compactedChangeSeq()), and “changes”, an
+// array of objects with “seq”, “op” (1 for add, 2 for remove) and
+// “link” in the format of LinkFormat::appendJSON().
+struct ReplicationFormat
+{
+    struct LogState
+    {
+        int64_t latest = 0;
+        int64_t compacted = 0;
+    };
+
+    static std::string changesToJSON(const std::vector<LinkChange>& changes,
+                                     const LogState& state);
+    // Parse the body written by changesToJSON() into “changes”, and
+    // return the state of the log. A missing “compacted” is 0.
+    static mw::E<LogState> changesFromJSON(std::string_view body,
+                                           std::vector<LinkChange>& changes);
+};
+
+// Tails the replication log of a primary, and applies the changes to
+// a local data source, which then serves redirects by itself.
+//
+// A background thread asks the primary for the changes after the last
+// one applied, applies them, and asks again right away if there may
+// be more, or after “poll_interval” otherwise. Applying a change
+// twice does no harm: adding a link whose shortcut exists is skipped,
+// and removing a link that is not there does nothing. So the
+// sequence number of the last applied change only has to be saved
+// after the changes, and the follower can restart from it.
+//
+// Links are matched by shortcut, since the local IDs are not the ones
+// of the primary.
+//
+// Compaction drops a removal together with the addition it undoes, so
+// a follower that starts from the beginning never misses one, however
+// far the log is compacted at that point. It has missed one only if
+// the log gets compacted past both that point and the last change it
+// has applied. It then logs an error and stops polling, and has to be
+// bootstrapped again from an empty data directory.
+class ReplicationFollower
+{
+public:
+    struct Options
+    {
+        // Base URL of the primary.
+        std::string primary_url;
+        // Sent as a bearer token to the primary.
+        std::string token;
+        std::chrono::milliseconds poll_interval{1000};
+        int64_t batch_size = 1000;
+        // Where the sequence number of the last applied change, and
+        // how far the log was compacted when the follower started from
+        // the beginning, are kept across restarts. If empty, they are
+        // not kept, and a new follower starts from the beginning of
+        // the log.
+        std::filesystem::path state_file;
+        // If not null, the progress is exported here.
+        Metrics* metrics = nullptr;
+    };
+
+    struct Stats
+    {
+        int64_t applied_seq = 0;
+        // As of the last answer from the primary.
+        int64_t primary_seq = 0;
+        uint64_t errors = 0;
+        // Whether the follower has missed changes, and stopped.
+        bool fell_behind = false;
+
+        int64_t lag() const
+        {
+            return std::max<int64_t>(primary_seq - applied_seq, 0);
+        }
+    };
+
+    // Start following. “data” has to outlive this.
+    ReplicationFollower(const DataSourceInterface& data, const Options& options,
+                        std::unique_ptr<mw::HTTPSessionInterface> http);
+    ~ReplicationFollower();
+    ReplicationFollower(const ReplicationFollower&) = delete;
+    ReplicationFollower& operator=(const ReplicationFollower&) = delete;
+
+    // Fetch and apply one batch of changes. Return whether there may
+    // be more. This is called by the background thread, and is public
+    // for tests.
+    mw::E<bool> poll();
+
+    Stats stats() const;
+
+private:
+    void run();
+    mw::E<void> apply(const std::vector<LinkChange>& changes);
+    mw::E<void> saveState() const;
+
+    const DataSourceInterface& data;
+    const Options options;
+    std::unique_ptr<mw::HTTPSessionInterface> http;
+
+    // Serializes polls from the background thread and from outside.
+    std::mutex poll_lock;
+    std::atomic<int64_t> applied_seq = 0;
+    // How far the log of the primary was compacted when this started
+    // from the beginning. Changes up to here were never missed.
+    std::atomic<int64_t> bootstrap_compacted = 0;
+    std::atomic<bool> fell_behind = false;
+    std::atomic<int64_t> primary_seq = 0;
+    std::atomic<uint64_t> errors = 0;
+    std::vector<Metrics::Registration> metric_callbacks;
+
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread poller;
+};
@@ -0,0 +1,262 @@
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <httplib.h>
+#include <gtest/gtest.h>
+#include <mw/error.hpp>
+#include <mw/http_client.hpp>
+#include <mw/test_utils.hpp>
+#include <mw/utils.hpp>
+
+#include "data.hpp"
+#include "replication.hpp"
+
+namespace
+{
+
+// Serves the replication log of “data” on “port”, like App does.
+class PrimaryServer
+{
+public:
+    PrimaryServer(const DataSourceInterface& data, int port)
+    {
+        server.Get("/_/replication/changes",
+                   [&data](const httplib::Request& req, httplib::Response& res)
+        {
+            mw::E<std::vector<LinkChange>> changes = data.getChanges(
+                std::stoll(req.get_param_value("after")),
+                std::stoll(req.get_param_value("limit")));
+            mw::E<int64_t> latest = data.latestChangeSeq();
+            mw::E<int64_t> compacted = data.compactedChangeSeq();
+            if(!changes.has_value() || !latest.has_value() ||
+               !compacted.has_value())
+            {
+                res.status = 500;
+                return;
+            }
+            res.set_content(ReplicationFormat::changesToJSON(
+                *changes, {.latest = *latest, .compacted = *compacted}),
+                            "application/json");
+        });
+        listener = std::thread([this, port]
+        {
+            server.listen("localhost", port);
+        });
+        server.wait_until_ready();
+    }
+
+    ~PrimaryServer()
+    {
+        server.stop();
+        listener.join();
+    }
+
+private:
+    httplib::Server server;
+    std::thread listener;
+};
+
+mw::E<void> addLink(const DataSourceInterface& data,
+                    const std::string& shortcut)
+{
+    ShortLink link;
+    link.shortcut = shortcut;
+    link.original_url = "https://darksair.org/";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    return data.addLink(std::move(link));
+}
+
+mw::E<void> removeLink(const DataSourceInterface& data,
+                       const std::string& shortcut)
+{
+    ASSIGN_OR_RETURN(std::optional<ShortLink> link,
+                     data.findLinkByShortcut(shortcut));
+    if(!link.has_value())
+    {
+        return std::unexpected(mw::runtimeError("No link " + shortcut));
+    }
+    return data.removeLink(link->id);
+}
+
+// A primary whose log is compacted like in DataSource.CanCompactChanges:
+// 3 adds link2, 6 adds link3 and 7 removes link2, and changes up to 5
+// are compacted.
+mw::E<std::unique_ptr<DataSourceSQLite>> compactedPrimary()
+{
+    DataSourceSQLite::Options options;
+    options.change_log_retention = 2;
+    ASSIGN_OR_RETURN(std::unique_ptr<DataSourceSQLite> data,
+                     DataSourceSQLite::fromFile(":memory:", options));
+    for(const char* shortcut: {"link0", "link1", "link2"})
+    {
+        DO_OR_RETURN(addLink(*data, shortcut));
+    }
+    DO_OR_RETURN(removeLink(*data, "link0"));
+    DO_OR_RETURN(removeLink(*data, "link1"));
+    DO_OR_RETURN(addLink(*data, "link3"));
+    DO_OR_RETURN(removeLink(*data, "link2"));
+    return data;
+}
+
+// Wait until “done” of the stats of “follower” is true.
+template<typename Predicate>
+ReplicationFollower::Stats waitFor(const ReplicationFollower& follower,
+                                   Predicate done)
+{
+    ReplicationFollower::Stats stats = follower.stats();
+    for(int i = 0; i < 500 && !done(stats); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        stats = follower.stats();
+    }
+    return stats;
+}
+
+} // namespace
+
+TEST(ReplicationFormat, CanWriteAndParseChanges)
+{
+    std::vector<LinkChange> changes(2);
+    changes[0].seq = 3;
+    changes[0].op = LinkChange::ADD;
+    changes[0].link.id = 7;
+    changes[0].link.shortcut = "a\"b";
+    changes[0].link.original_url = "https://example.com/";
+    changes[0].link.type = ShortLink::REGEXP;
+    changes[0].link.user_id = "aaa";
+    changes[0].link.visits = 2;
+    changes[0].link.time_creation = mw::secondsToTime(1000);
+    changes[1] = changes[0];
+    changes[1].seq = 5;
+    changes[1].op = LinkChange::REMOVE;
+
+    std::string json = ReplicationFormat::changesToJSON(
+        changes, {.latest = 9, .compacted = 2});
+    std::vector<LinkChange> parsed;
+    ASSIGN_OR_FAIL(ReplicationFormat::LogState state,
+                   ReplicationFormat::changesFromJSON(json, parsed));
+    EXPECT_EQ(state.latest, 9);
+    EXPECT_EQ(state.compacted, 2);
+    ASSERT_EQ(parsed.size(), 2);
+    EXPECT_EQ(parsed[0].seq, 3);
+    EXPECT_EQ(parsed[0].op, LinkChange::ADD);
+    EXPECT_EQ(parsed[0].link.id, 7);
+    EXPECT_EQ(parsed[0].link.shortcut, "a\"b");
+    EXPECT_EQ(parsed[0].link.type, ShortLink::REGEXP);
+    EXPECT_EQ(parsed[0].link.visits, 2);
+    EXPECT_EQ(mw::timeToSeconds(parsed[0].link.time_creation), 1000);
+    EXPECT_EQ(parsed[1].seq, 5);
+    EXPECT_EQ(parsed[1].op, LinkChange::REMOVE);
+
+    parsed.clear();
+    ASSIGN_OR_FAIL(state, ReplicationFormat::changesFromJSON(
+        ReplicationFormat::changesToJSON({}, {}), parsed));
+    EXPECT_EQ(state.latest, 0);
+    EXPECT_TRUE(parsed.empty());
+
+    // Logs without compaction leave out “compacted”.
+    ASSIGN_OR_FAIL(state, ReplicationFormat::changesFromJSON(
+        R"({"latest": 4, "changes": []})", parsed));
+    EXPECT_EQ(state.latest, 4);
+    EXPECT_EQ(state.compacted, 0);
+}
+
+TEST(ReplicationFormat, CanRejectInvalidChanges)
+{
+    std::vector<LinkChange> changes;
+    EXPECT_FALSE(ReplicationFormat::changesFromJSON("[]", changes)
+                 .has_value());
+    EXPECT_FALSE(ReplicationFormat::changesFromJSON(
+        R"({"latest": 1, "changes": [{"seq": 1, "op": 3, "link": {}}]})",
+        changes).has_value());
+    EXPECT_FALSE(ReplicationFormat::changesFromJSON(
+        R"({"latest": 1, "compacted": "1", "changes": []})", changes)
+                 .has_value());
+}
+
+TEST(ReplicationFollower, CanBootstrapFromCompactedLog)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> primary,
+                   compactedPrimary());
+    ASSIGN_OR_FAIL(int64_t compacted, primary->compactedChangeSeq());
+    ASSERT_EQ(compacted, 5);
+    PrimaryServer server(*primary, 8099);
+
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ReplicationFollower::Options options;
+    options.primary_url = "http://localhost:8099/";
+    options.poll_interval = std::chrono::milliseconds(10);
+    // Smaller than the log, so that the follower is below the
+    // compacted point after its first batch.
+    options.batch_size = 1;
+    {
+        ReplicationFollower follower(*data, options,
+                                     std::make_unique<mw::HTTPSession>());
+        ReplicationFollower::Stats stats = waitFor(
+            follower, [](const ReplicationFollower::Stats& s)
+            {
+                return s.applied_seq == 7 || s.errors > 0;
+            });
+        EXPECT_EQ(stats.applied_seq, 7);
+        EXPECT_EQ(stats.errors, 0);
+        EXPECT_FALSE(stats.fell_behind);
+    }
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link,
+                   data->findLinkByShortcut("link3"));
+    EXPECT_TRUE(link.has_value());
+    ASSIGN_OR_FAIL(link, data->findLinkByShortcut("link2"));
+    EXPECT_FALSE(link.has_value());
+}
+
+TEST(ReplicationFollower, CanStopWhenFallenBehind)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> primary,
+                   compactedPrimary());
+    // This compacts up to 7, dropping the removal of link2.
+    ASSERT_TRUE(mw::isExpected(addLink(*primary, "link4")));
+    ASSERT_TRUE(mw::isExpected(removeLink(*primary, "link3")));
+    ASSIGN_OR_FAIL(int64_t compacted, primary->compactedChangeSeq());
+    ASSERT_EQ(compacted, 7);
+    PrimaryServer server(*primary, 8100);
+
+    // A follower that started when the log was compacted up to 5, and
+    // has added link2 since.
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ASSERT_TRUE(mw::isExpected(addLink(*data, "link2")));
+    std::filesystem::path state_file =
+        std::filesystem::temp_directory_path() / "shrt-test-replication";
+    {
+        std::ofstream f(state_file, std::ios::trunc);
+        f << "3\n5\n";
+    }
+    ReplicationFollower::Options options;
+    options.primary_url = "http://localhost:8100/";
+    options.poll_interval = std::chrono::milliseconds(10);
+    options.state_file = state_file;
+    {
+        ReplicationFollower follower(*data, options,
+                                     std::make_unique<mw::HTTPSession>());
+        ReplicationFollower::Stats stats = waitFor(
+            follower, [](const ReplicationFollower::Stats& s)
+            {
+                return s.fell_behind;
+            });
+        EXPECT_TRUE(stats.fell_behind);
+        // It stops instead of failing on every poll.
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        stats = follower.stats();
+        EXPECT_EQ(stats.errors, 1);
+        EXPECT_EQ(stats.applied_seq, 3);
+    }
+    std::filesystem::remove(state_file);
+}
@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <mw/auth.hpp>
+#include <mw/crypto.hpp>
+#include <mw/utils.hpp>
+
+#include "session_cache.hpp"
+
+SessionCache::SessionCache(size_t max_size, std::chrono::seconds time_to_live)
+        : capacity(max_size), ttl(time_to_live)
+{
+}
+
+std::optional<mw::UserInfo> SessionCache::find(const std::string& access_token)
+{
+    if(capacity == 0)
+    {
+        return std::nullopt;
+    }
+    std::optional<std::string> k = key(access_token);
+    if(!k.has_value())
+    {
+        return std::nullopt;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = entries.find(*k);
+    if(it == entries.end())
+    {
+        misses++;
+        return std::nullopt;
+    }
+    if(it->second.expiration <= mw::Clock::now())
+    {
+        order.erase(it->second.order_it);
+        entries.erase(it);
+        misses++;
+        return std::nullopt;
+    }
+    hits++;
+    return it->second.user;
+}
+
+void SessionCache::insert(const std::string& access_token,
+                          const mw::UserInfo& user,
+                          std::optional<mw::Time> expiration)
+{
+    if(capacity == 0)
+    {
+        return;
+    }
+    std::optional<std::string> k = key(access_token);
+    if(!k.has_value())
+    {
+        return;
+    }
+    mw::Time expire = mw::Clock::now() + ttl;
+    if(expiration.has_value())
+    {
+        expire = std::min(expire, *expiration);
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if(auto it = entries.find(*k); it != entries.end())
+    {
+        it->second.user = user;
+        it->second.expiration = expire;
+        return;
+    }
+    if(entries.size() >= capacity)
+    {
+        entries.erase(order.front());
+        order.pop_front();
+    }
+    order.push_back(*k);
+    entries.emplace(*std::move(k), Entry{user, expire, std::prev(order.end())});
+}
+
+size_t SessionCache::size() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return entries.size();
+}
+
+SessionCache::Stats SessionCache::stats() const
+{
+    return {hits, misses, size()};
+}
+
+std::optional<std::string> SessionCache::key(const std::string& access_token)
+{
+    auto hash = mw::SHA256Hasher().hashToBytes(access_token);
+    if(!hash.has_value())
+    {
+        return std::nullopt;
+    }
+    return std::string(hash->begin(), hash->end());
+}
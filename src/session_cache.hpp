@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+#include <mw/auth.hpp>
+#include <mw/utils.hpp>
+
+// Remember which user an access token belongs to, so that a
+// repeated request with the same token does not need to ask the
+// OpenID Connect provider again.
+//
+// Tokens are keyed by their SHA256 hash, so the cache does not keep
+// usable tokens in memory. An entry expires after “ttl”, or when the
+// token itself expires if that is earlier. A token revoked at the
+// provider therefore stays valid here for at most “ttl”. When the
+// cache is full, the oldest entry is dropped.
+class SessionCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        size_t size = 0;
+    };
+
+    SessionCache(size_t capacity, std::chrono::seconds ttl);
+
+    std::optional<mw::UserInfo> find(const std::string& access_token);
+    void insert(const std::string& access_token, const mw::UserInfo& user,
+                std::optional<mw::Time> expiration = std::nullopt);
+    size_t size() const;
+    Stats stats() const;
+
+private:
+    struct Entry
+    {
+        mw::UserInfo user;
+        mw::Time expiration;
+        // Position in “order”.
+        std::list<std::string>::iterator order_it;
+    };
+
+    // Return the hash of the token, or nullopt if hashing failed.
+    static std::optional<std::string> key(const std::string& access_token);
+
+    const size_t capacity;
+    const std::chrono::seconds ttl;
+
+    mutable std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+    // Keys in the order of insertion. Oldest is at the front.
+    std::list<std::string> order;
+
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+};
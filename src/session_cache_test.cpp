@@ -0,0 +1,57 @@
+#include <chrono>
+#include <optional>
+
+#include <gtest/gtest.h>
+#include <mw/auth.hpp>
+#include <mw/utils.hpp>
+
+#include "session_cache.hpp"
+
+namespace
+{
+
+mw::UserInfo makeUser(const std::string& id)
+{
+    mw::UserInfo user;
+    user.id = id;
+    user.name = id;
+    return user;
+}
+
+} // namespace
+
+TEST(SessionCache, CanFindInsertedToken)
+{
+    SessionCache cache(10, std::chrono::seconds(60));
+    EXPECT_FALSE(cache.find("aaa").has_value());
+    cache.insert("aaa", makeUser("mw"));
+    std::optional<mw::UserInfo> user = cache.find("aaa");
+    ASSERT_TRUE(user.has_value());
+    EXPECT_EQ(user->id, "mw");
+    EXPECT_FALSE(cache.find("bbb").has_value());
+}
+
+TEST(SessionCache, CanExpireEntries)
+{
+    SessionCache cache(10, std::chrono::seconds(60));
+    cache.insert("aaa", makeUser("mw"),
+                 mw::Clock::now() - std::chrono::seconds(1));
+    EXPECT_FALSE(cache.find("aaa").has_value());
+    EXPECT_EQ(cache.size(), 0);
+
+    SessionCache no_ttl(10, std::chrono::seconds(0));
+    no_ttl.insert("aaa", makeUser("mw"));
+    EXPECT_FALSE(no_ttl.find("aaa").has_value());
+}
+
+TEST(SessionCache, CanDropOldestWhenFull)
+{
+    SessionCache cache(2, std::chrono::seconds(60));
+    cache.insert("aaa", makeUser("a"));
+    cache.insert("bbb", makeUser("b"));
+    cache.insert("ccc", makeUser("c"));
+    EXPECT_EQ(cache.size(), 2);
+    EXPECT_FALSE(cache.find("aaa").has_value());
+    EXPECT_TRUE(cache.find("bbb").has_value());
+    EXPECT_TRUE(cache.find("ccc").has_value());
+}
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+#include <mw/error.hpp>
+
+#include "data.hpp"
+#include "visit_counter.hpp"
+
+namespace
+{
+
+// Each thread gets a fixed index, which picks its shard.
+size_t threadIndex()
+{
+    static std::atomic<size_t> next_index = 0;
+    thread_local size_t index = next_index++;
+    return index;
+}
+
+} // namespace
+
+VisitCounter::VisitCounter(const DataSourceInterface& data_source,
+                           std::chrono::milliseconds interval,
+                           uint64_t threshold, size_t shard_count)
+        : data(data_source), flush_interval(interval),
+          flush_threshold(std::max<uint64_t>(threshold, 1)),
+          shards(std::max<size_t>(shard_count, 1))
+{
+    flusher = std::thread([this] { run(); });
+}
+
+VisitCounter::~VisitCounter()
+{
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_one();
+    flusher.join();
+    flush();
+}
+
+void VisitCounter::record(int64_t link_id)
+{
+    Shard& shard = shards[threadIndex() % shards.size()];
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.counts[link_id]++;
+    }
+    if(++pending == flush_threshold)
+    {
+        wake.notify_one();
+    }
+}
+
+void VisitCounter::flush()
+{
+    std::lock_guard<std::mutex> flush_guard(flush_lock);
+    std::unordered_map<int64_t, uint64_t> counts;
+    for(Shard& shard: shards)
+    {
+        // Zero the counts instead of clearing the map, so that
+        // recording another visit to the same link does not allocate.
+        // Links without visits since the last flush are dropped, so
+        // that the map does not grow forever.
+        std::lock_guard<std::mutex> guard(shard.lock);
+        for(auto it = shard.counts.begin(); it != shard.counts.end();)
+        {
+            if(it->second == 0)
+            {
+                it = shard.counts.erase(it);
+                continue;
+            }
+            counts[it->first] += it->second;
+            it->second = 0;
+            ++it;
+        }
+    }
+    pending = 0;
+    if(counts.empty())
+    {
+        return;
+    }
+
+    mw::E<void> result = data.addVisits(counts);
+    if(!result.has_value())
+    {
+        // The counts are dropped. Visits are statistics; retrying
+        // forever against a broken database is worse.
+        spdlog::error("Failed to write visits of {} links: {}",
+                      counts.size(), mw::errorMsg(result.error()));
+    }
+}
+
+void VisitCounter::run()
+{
+    std::unique_lock<std::mutex> lock(wake_lock);
+    while(!stopping)
+    {
+        wake.wait_for(lock, flush_interval, [this]
+        {
+            return stopping || pending >= flush_threshold;
+        });
+        if(stopping)
+        {
+            break;
+        }
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
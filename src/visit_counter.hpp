@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "data.hpp"
+
+// Count link visits in memory, and periodically write them to the
+// data source in one batch.
+//
+// The counts are sharded, and each thread records into its own shard,
+// so recording a visit never waits on the database or on other
+// request threads. A background thread collects the shards and calls
+// DataSourceInterface::addVisits() every “interval”, or earlier once
+// “threshold” visits are pending. Whatever is left is flushed when
+// the counter is destroyed.
+class VisitCounter
+{
+public:
+    VisitCounter(const DataSourceInterface& data_source,
+                 std::chrono::milliseconds interval, uint64_t threshold,
+                 size_t shard_count = std::thread::hardware_concurrency());
+    ~VisitCounter();
+    VisitCounter(const VisitCounter&) = delete;
+    VisitCounter& operator=(const VisitCounter&) = delete;
+
+    void record(int64_t link_id);
+    // Write all pending counts to the data source now. This is
+    // called by the background thread. It is public so that the
+    // counts can be forced out, e.g. in tests.
+    void flush();
+
+private:
+    struct alignas(64) Shard
+    {
+        std::mutex lock;
+        std::unordered_map<int64_t, uint64_t> counts;
+    };
+
+    void run();
+
+    const DataSourceInterface& data;
+    const std::chrono::milliseconds flush_interval;
+    const uint64_t flush_threshold;
+    std::vector<Shard> shards;
+    std::atomic<uint64_t> pending = 0;
+
+    // Serializes flushes from the background thread and from
+    // outside.
+    std::mutex flush_lock;
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread flusher;
+};
@@ -0,0 +1,56 @@
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <mw/error.hpp>
+#include <mw/test_utils.hpp>
+
+#include "data.hpp"
+#include "data_mock.hpp"
+#include "visit_counter.hpp"
+
+using ::testing::Return;
+using ::testing::UnorderedElementsAre;
+using ::testing::Pair;
+
+TEST(VisitCounter, CanFlushOnDestruction)
+{
+    DataSourceMock data;
+    EXPECT_CALL(data, addVisits(UnorderedElementsAre(Pair(1, 3), Pair(2, 1))))
+        .WillOnce(Return(mw::E<void>()));
+    {
+        VisitCounter counter(data, std::chrono::hours(1), 1000, 4);
+        counter.record(1);
+        counter.record(2);
+        std::thread t([&] { counter.record(1); counter.record(1); });
+        t.join();
+    }
+}
+
+TEST(VisitCounter, CanWriteVisitsToDatabase)
+{
+    ASSIGN_OR_FAIL(std::unique_ptr<DataSourceSQLite> data,
+                   DataSourceSQLite::newFromMemory());
+    ShortLink link;
+    link.shortcut = "link0";
+    link.original_url = "https://darksair.org/";
+    link.type = ShortLink::NORMAL;
+    link.user_id = "aaa";
+    EXPECT_TRUE(mw::isExpected(data->addLink(std::move(link))));
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link0,
+                   data->findLinkByShortcut("link0"));
+    ASSERT_TRUE(link0.has_value());
+
+    VisitCounter counter(*data, std::chrono::hours(1), 1000);
+    counter.record(link0->id);
+    counter.record(link0->id);
+    counter.flush();
+    ASSIGN_OR_FAIL(std::optional<ShortLink> link1, data->getLink(link0->id));
+    ASSERT_TRUE(link1.has_value());
+    EXPECT_EQ(link1->visits, 2);
+}
@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+#include "worker_pool.hpp"
+
+namespace
+{
+
+// The CPUs this process is allowed to run on.
+std::vector<int> allowedCPUs()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return cpus;
+    }
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if(CPU_ISSET(cpu, &set))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+} // namespace
+
+WorkerPool::WorkerPool(const Options& options)
+        : max_queued(options.max_queued)
+{
+    size_t count = options.threads;
+    if(count == 0)
+    {
+        count = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+    std::vector<int> cpus;
+    if(options.pin_cpus)
+    {
+        cpus = allowedCPUs();
+        if(cpus.empty())
+        {
+            spdlog::warn("Failed to get the CPUs to pin workers to.");
+        }
+    }
+    workers.reserve(count);
+    for(size_t i = 0; i < count; i++)
+    {
+        int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+        workers.emplace_back([this, cpu] { run(cpu); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    shutdown();
+}
+
+bool WorkerPool::enqueue(std::function<void()> fn)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(stopping || (max_queued > 0 && tasks.size() >= max_queued))
+        {
+            return false;
+        }
+        tasks.push_back(std::move(fn));
+    }
+    wake.notify_one();
+    return true;
+}
+
+void WorkerPool::shutdown()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if(stopping)
+        {
+            return;
+        }
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread& worker: workers)
+    {
+        worker.join();
+    }
+}
+
+void WorkerPool::run(int cpu)
+{
+    // Pin before taking any task, so that all of them run there.
+    if(cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(int err = pthread_setaffinity_np(pthread_self(), sizeof(set),
+                                            &set);
+           err != 0)
+        {
+            spdlog::warn("Failed to pin a worker to CPU {}: error {}", cpu,
+                         err);
+        }
+    }
+    while(true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            wake.wait(guard, [this] { return stopping || !tasks.empty(); });
+            if(tasks.empty())
+            {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
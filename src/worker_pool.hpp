@@ -0,0 +1,59 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <httplib.h>
+
+// The threads that handle the connections of the HTTP server. This
+// replaces the thread pool of httplib, so that the number of threads
+// and of waiting connections are configurable, and so that the
+// threads can be pinned to CPUs. This needs httplib 0.15.0 or later,
+// where TaskQueue::enqueue() returns whether the task is taken.
+//
+// With “pin_cpus”, worker i is pinned to the i-th CPU this process is
+// allowed to run on, wrapping around, so that a worker keeps its
+// caches warm and the workers spread over the CPUs evenly. This only
+// helps if the threads are about as many as the CPUs, and nothing
+// else busy runs on them.
+class WorkerPool : public httplib::TaskQueue
+{
+public:
+    struct Options
+    {
+        // Number of threads. 0 means one per CPU.
+        size_t threads = 0;
+        // Connections waiting for a thread beyond this are refused,
+        // and closed right away. 0 means no limit.
+        size_t max_queued = 0;
+        bool pin_cpus = false;
+    };
+
+    explicit WorkerPool(const Options& options);
+    ~WorkerPool() override;
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    bool enqueue(std::function<void()> fn) override;
+    // Run the tasks that are queued already, and stop the threads.
+    void shutdown() override;
+
+    size_t threadCount() const { return workers.size(); }
+
+private:
+    // Run tasks until shutdown(). If “cpu” is not negative, pin the
+    // calling thread to it first.
+    void run(int cpu);
+
+    const size_t max_queued;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::deque<std::function<void()>> tasks;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
@@ -0,0 +1,98 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "worker_pool.hpp"
+
+TEST(WorkerPool, CanRunTasks)
+{
+    std::atomic<int> done = 0;
+    {
+        WorkerPool pool({.threads = 3});
+        EXPECT_EQ(pool.threadCount(), 3);
+        for(int i = 0; i < 100; i++)
+        {
+            EXPECT_TRUE(pool.enqueue([&] { done++; }));
+        }
+        pool.shutdown();
+        EXPECT_FALSE(pool.enqueue([&] { done++; }));
+    }
+    EXPECT_EQ(done, 100);
+}
+
+TEST(WorkerPool, CanStartOneThreadPerCPU)
+{
+    WorkerPool pool({});
+    EXPECT_EQ(pool.threadCount(),
+              std::max<size_t>(std::thread::hardware_concurrency(), 1));
+    WorkerPool one({.threads = 1});
+    EXPECT_EQ(one.threadCount(), 1);
+}
+
+TEST(WorkerPool, CanRefuseTasksWhenFull)
+{
+    std::mutex lock;
+    std::condition_variable cv;
+    bool started = false;
+    bool release = false;
+    WorkerPool pool({.threads = 1, .max_queued = 1});
+    // Keep the only worker busy.
+    EXPECT_TRUE(pool.enqueue([&]
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        started = true;
+        cv.notify_all();
+        cv.wait(guard, [&] { return release; });
+    }));
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        cv.wait(guard, [&] { return started; });
+    }
+    std::atomic<int> done = 0;
+    EXPECT_TRUE(pool.enqueue([&] { done++; }));
+    EXPECT_FALSE(pool.enqueue([&] { done++; }));
+    EXPECT_FALSE(pool.enqueue([&] { done++; }));
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        release = true;
+    }
+    cv.notify_all();
+    // Once the queue drains, there is room again.
+    for(int i = 0; i < 500 && done == 0; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_TRUE(pool.enqueue([&] { done++; }));
+    pool.shutdown();
+    EXPECT_EQ(done, 2);
+}
+
+TEST(WorkerPool, CanPinWorkers)
+{
+    std::atomic<int> pinned = 0;
+    {
+        WorkerPool pool({.threads = 2, .pin_cpus = true});
+        for(int i = 0; i < 2; i++)
+        {
+            pool.enqueue([&]
+            {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+                if(CPU_COUNT(&set) == 1)
+                {
+                    pinned++;
+                }
+            });
+        }
+    }
+    EXPECT_EQ(pinned, 2);
+}